@@ -18,7 +18,7 @@ inline float maxf() {
 
 // _____________________________________________________________________________
 inline float minf() {
-  float min = static_cast<float>(std::numeric_limits<float>::min());
+  float min = static_cast<float>(std::numeric_limits<float>::lowest());
   return min;
 }
 
@@ -40,12 +40,71 @@ class AABB {
   Vec3 min() const { return _min; }
   Vec3 max() const { return _max; }
 
+  inline bool is_empty() const {
+    return _min.x() > _max.x() || _min.y() > _max.y() || _min.z() > _max.z();
+  }
+  inline Vec3 centroid() const { return 0.5f * (_min + _max); }
+  inline float surface_area() const;
+  inline int largest_axis() const;
+
+  // Grow the box, so that it also encloses the provided box / point
+  inline void extend(const AABB &b);
+  inline void extend(const Vec3 &p);
+
   bool hit(const Ray &r, float &t_min, float &t_max) const;
+  // Same test with the inverse of the ray's direction, which is computed
+  // once per ray instead of once per box
+  inline bool hit(const Vec3 &origin, const Vec3 &inv_dir,
+                  float &t_min, float &t_max) const;
  private:
   Vec3 _min{maxf(), maxf(), maxf()};
   Vec3 _max{minf(), minf(), minf()};
 };
 
+// _____________________________________________________________________________
+float AABB::surface_area() const {
+  if (is_empty()) return 0.f;
+  Vec3 d = _max - _min;
+  return 2.f * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+}
+
+// _____________________________________________________________________________
+int AABB::largest_axis() const {
+  Vec3 d = _max - _min;
+  if (d.x() >= d.y() && d.x() >= d.z()) return 0;
+  return d.y() >= d.z() ? 1 : 2;
+}
+
+// _____________________________________________________________________________
+void AABB::extend(const AABB &b) {
+  for (int a = 0; a < 3; a++) {
+    _min[a] = minf(_min[a], b._min[a]);
+    _max[a] = maxf(_max[a], b._max[a]);
+  }
+}
+
+// _____________________________________________________________________________
+void AABB::extend(const Vec3 &p) {
+  for (int a = 0; a < 3; a++) {
+    _min[a] = minf(_min[a], p[a]);
+    _max[a] = maxf(_max[a], p[a]);
+  }
+}
+
+// _____________________________________________________________________________
+bool AABB::hit(const Vec3 &origin, const Vec3 &inv_dir,
+               float &t_min, float &t_max) const {
+  for (int a = 0; a < 3; a++) {
+    float t0 = (_min[a] - origin[a]) * inv_dir[a];
+    float t1 = (_max[a] - origin[a]) * inv_dir[a];
+    if (inv_dir[a] < 0.f) std::swap(t0, t1);
+    t_min = maxf(t0, t_min);
+    t_max = minf(t1, t_max);
+    if (t_max <= t_min) return false;
+  }
+  return true;
+}
+
 // _____________________________________________________________________________
 bool AABB::hit(const Ray &r, float &t_min, float &t_max) const {
   float t0, t1;
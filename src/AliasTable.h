@@ -0,0 +1,93 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_ALIASTABLE_H_
+#define SRC_ALIASTABLE_H_
+
+#include <algorithm>  // min
+#include <vector>
+
+/**
+ * Discrete distribution over the indices of a list of non-negative weights,
+ * from which an index is drawn in constant time with Vose's alias method:
+ * every bin holds the chance q of keeping its own index and the index
+ * (alias), which it's replaced by otherwise. A list without any weight is
+ * sampled uniformly.
+ */
+class AliasTable {
+ public:
+  AliasTable() = default;
+  explicit AliasTable(const std::vector<float> &weights);
+
+  inline int size() const { return static_cast<int>(_bins.size()); }
+  // Sum of the weights
+  inline float total() const { return _total; }
+  // Probability of the index i
+  inline float pmf(int i) const { return _bins[i].p; }
+
+  // Index drawn with the random number u in [0, 1), and its probability
+  int sample(float u, float &pmf) const;
+
+ private:
+  struct Bin {
+    float q;
+    int alias;
+    float p;
+  };
+
+  std::vector<Bin> _bins;
+  float _total{0.f};
+};
+
+// _____________________________________________________________________________
+AliasTable::AliasTable(const std::vector<float> &weights)
+    : _bins(weights.size()) {
+  int n = size();
+  if (n == 0) return;
+  // Sum in double, so that many small weights aren't lost
+  double total = 0.0;
+  for (float w : weights) total += w;
+  _total = static_cast<float>(total);
+  for (int i = 0; i < n; i++) {
+    _bins[i].p = total > 0.0 ? static_cast<float>(weights[i] / total)
+                             : 1.f / n;
+    _bins[i].alias = i;
+  }
+
+  // Weights scaled to an average of 1, split into the bins below and above
+  std::vector<double> scaled(n);
+  std::vector<int> small;
+  std::vector<int> large;
+  for (int i = 0; i < n; i++) {
+    scaled[i] = total > 0.0 ? weights[i] * n / total : 1.0;
+    if (scaled[i] < 1.0) small.push_back(i);
+    else large.push_back(i);
+  }
+  // Fill every small bin up to 1 with a large one
+  while (!small.empty() && !large.empty()) {
+    int s = small.back();
+    small.pop_back();
+    int l = large.back();
+    _bins[s].q = static_cast<float>(scaled[s]);
+    _bins[s].alias = l;
+    scaled[l] -= 1.0 - scaled[s];
+    if (scaled[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // What's left is 1 up to rounding errors
+  for (int i : small) _bins[i].q = 1.f;
+  for (int i : large) _bins[i].q = 1.f;
+}
+
+// _____________________________________________________________________________
+int AliasTable::sample(float u, float &pmf) const {
+  float x = u * size();
+  int i = std::min(static_cast<int>(x), size() - 1);
+  if (x - i >= _bins[i].q) i = _bins[i].alias;
+  pmf = _bins[i].p;
+  return i;
+}
+
+#endif  // SRC_ALIASTABLE_H_
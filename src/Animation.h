@@ -0,0 +1,232 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_ANIMATION_H_
+#define SRC_ANIMATION_H_
+
+#include <chrono>
+#include <cstdio>   // snprintf
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Camera.h"
+#include "Renderer.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "Transform.h"
+#include "TwoLevelBVH.h"
+#include "Vec3.h"
+
+/**
+ * Placement of an instance, which is interpolated component-wise between
+ * keyframes: scale first, then rotation around axis by angle degrees, then
+ * translation.
+ */
+struct TransformKey {
+  Vec3 translation{0.f, 0.f, 0.f};
+  Vec3 axis{0.f, 1.f, 0.f};
+  float angle{0.f};
+  Vec3 scale{1.f, 1.f, 1.f};
+
+  inline Transform matrix() const {
+    return Transform::translate(translation)
+           * Transform::rotate(axis, angle)
+           * Transform::scale(scale);
+  }
+};
+
+// Position and orientation of the camera
+struct CameraKey {
+  Vec3 lookfrom{0.f, 0.f, 0.f};
+  Vec3 lookat{0.f, 0.f, -1.f};
+  float vertical_fov{20.f};
+};
+
+// _____________________________________________________________________________
+inline TransformKey lerp(const TransformKey &a, const TransformKey &b,
+                         float s) {
+  TransformKey k;
+  k.translation = (1.f - s) * a.translation + s * b.translation;
+  k.axis = (1.f - s) * a.axis + s * b.axis;
+  k.angle = (1.f - s) * a.angle + s * b.angle;
+  k.scale = (1.f - s) * a.scale + s * b.scale;
+  return k;
+}
+
+// _____________________________________________________________________________
+inline CameraKey lerp(const CameraKey &a, const CameraKey &b, float s) {
+  CameraKey k;
+  k.lookfrom = (1.f - s) * a.lookfrom + s * b.lookfrom;
+  k.lookat = (1.f - s) * a.lookat + s * b.lookat;
+  k.vertical_fov = (1.f - s) * a.vertical_fov + s * b.vertical_fov;
+  return k;
+}
+
+/**
+ * Values of type T at points in time, linearly interpolated in between and
+ * held constant before the first and after the last key.
+ */
+template <typename T>
+class Keyframes {
+ public:
+  // Keys may be added in any order
+  void add(float time, const T &value) {
+    size_t k = _times.size();
+    while (k > 0 && _times[k - 1] > time) k--;
+    _times.insert(_times.begin() + k, time);
+    _values.insert(_values.begin() + k, value);
+  }
+
+  inline bool empty() const { return _times.empty(); }
+
+  T at(float time) const {
+    if (time <= _times.front()) return _values.front();
+    if (time >= _times.back()) return _values.back();
+    size_t k = 1;
+    while (_times[k] < time) k++;
+    float s = (time - _times[k - 1]) / (_times[k] - _times[k - 1]);
+    return lerp(_values[k - 1], _values[k], s);
+  }
+
+ private:
+  std::vector<float> _times;
+  std::vector<T> _values;
+};
+
+/**
+ * Keyframes of the camera and of the instances of a TwoLevelBVH.
+ * Instances without keys keep their transform.
+ */
+class Animation {
+ public:
+  inline Keyframes<CameraKey>& camera() { return _camera; }
+  inline const Keyframes<CameraKey>& camera() const { return _camera; }
+
+  // Keyframes of the instance with the provided id
+  Keyframes<TransformKey>& instance(int id) {
+    for (InstanceKeys &k : _instances) {
+      if (k.id == id) return k.keys;
+    }
+    _instances.push_back({id, Keyframes<TransformKey>()});
+    return _instances.back().keys;
+  }
+
+  // Move the animated instances of scene to the provided time. Call
+  // scene->update() afterwards to bring the BVHs up to date
+  void apply(float time, TwoLevelBVH *scene) const {
+    for (const InstanceKeys &k : _instances) {
+      if (k.keys.empty()) continue;
+      scene->set_transform(k.id, k.keys.at(time).matrix());
+    }
+  }
+
+ private:
+  struct InstanceKeys {
+    int id;
+    Keyframes<TransformKey> keys;
+  };
+
+  Keyframes<CameraKey> _camera;
+  std::vector<InstanceKeys> _instances;
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Render frames frames of the animation at fps frames per second into the
+ * files named by the printf pattern (e.g. "frame_%04d.ppm").
+ * The two scenes have to contain the same instances: while frame n is
+ * traced in one of them on the pool, the other one is moved to frame n+1
+ * and its BVHs are refit on a separate thread, and frame n-1 is written to
+ * disk on a third one. So between two frames, the renderer only waits for
+ * whatever of the two took longer than tracing.
+ */
+void render_sequence(const Animation &animation,
+                     TwoLevelBVH *scenes[2],
+                     int frames, float fps,
+                     int nx, int ny, int ns,
+                     const char *pattern,
+                     ThreadPool *pool);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+void render_sequence(const Animation &animation,
+                     TwoLevelBVH *scenes[2],
+                     int frames, float fps,
+                     int nx, int ny, int ns,
+                     const char *pattern,
+                     ThreadPool *pool) {
+  using Clock = std::chrono::steady_clock;
+  auto seconds = [](Clock::time_point a, Clock::time_point b) {
+    return std::chrono::duration<double>(b - a).count();
+  };
+  float ar = static_cast<float>(nx) / static_cast<float>(ny);
+  Vec3 up(0.f, 1.f, 0.f);
+  Image images[2] = {Image(nx, ny), Image(nx, ny)};
+  std::future<void> prepared;
+  std::future<bool> written;
+
+  auto start = Clock::now();
+  animation.apply(0.f, scenes[0]);
+  scenes[0]->update();
+  double trace_seconds = 0.0;
+
+  for (int f = 0; f < frames; f++) {
+    TwoLevelBVH *scene = scenes[f % 2];
+    Image &image = images[f % 2];
+
+    // Prepare the next frame in the other scene
+    if (f + 1 < frames) {
+      TwoLevelBVH *next = scenes[(f + 1) % 2];
+      float next_time = (f + 1) / fps;
+      prepared = std::async(std::launch::async, [&animation, next,
+                                                 next_time, f]() {
+        trace_thread_name("prepare");
+        TRACE_SCOPE("prepare_frame", "frame", f + 1);
+        animation.apply(next_time, next);
+        next->update();
+      });
+    }
+
+    TRACE_SCOPE("frame", "frame", f);
+    auto trace_start = Clock::now();
+    CameraKey key = animation.camera().empty()
+                    ? CameraKey() : animation.camera().at(f / fps);
+    Camera cam(key.lookfrom, key.lookat, up, key.vertical_fov, ar, 0.f,
+               (key.lookat - key.lookfrom).length());
+    render_image(cam, scene, ns, image, pool, f);
+    trace_seconds += seconds(trace_start, Clock::now());
+
+    // Wait for the next scene and for the output of the previous frame,
+    // which used the other image
+    if (prepared.valid()) prepared.get();
+    if (written.valid() && !written.get()) {
+      std::cout << "Could not write frame " << f - 1 << std::endl;
+    }
+    char path[256];
+    snprintf(path, sizeof(path), pattern, f);
+    std::string out_file(path);
+    written = std::async(std::launch::async, [&image, out_file]() {
+      trace_thread_name("output");
+      return write_ppm(out_file.c_str(), image);
+    });
+  }
+  if (written.valid() && !written.get()) {
+    std::cout << "Could not write frame " << frames - 1 << std::endl;
+  }
+
+  double total = seconds(start, Clock::now());
+  std::cout << "Rendered " << frames << " frames in " << total
+            << " seconds (" << trace_seconds << " seconds tracing, "
+            << total - trace_seconds << " seconds outside of tracing)."
+            << std::endl;
+}
+
+#endif  // SRC_ANIMATION_H_
@@ -8,6 +8,7 @@
 #include "HitableList.h"
 #include "Utils.h"
 #include "Sphere.h"
+#include "Stats.h"
 
 class BVH: public Hitable {
  public:
@@ -21,6 +22,7 @@ class BVH: public Hitable {
                    HitRecord &rec) const;
 
   virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const;
 
  private:
   Hitable *_left{nullptr};
@@ -93,7 +95,9 @@ bool BVH::hit(const Ray &r,
               float t_max,
               HitRecord &rec) const {
   // Check if the surrounding box is hit
+  STATS_INC(box_tests);
   if (!_box.hit(r, t_min, t_max)) return false;
+  STATS_INC(bvh_nodes_visited);
 
   // Get possible hits from children nodes recursively
   HitRecord left_rec, right_rec;
@@ -130,4 +134,9 @@ bool BVH::bounding_box(AABB &box) const {
   return true;
 }
 
+// _____________________________________________________________________________
+unsigned BVH::material_types() const {
+  return _left->material_types() | _right->material_types();
+}
+
 #endif  // SRC_BVH_H_
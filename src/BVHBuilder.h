@@ -0,0 +1,390 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_BVHBUILDER_H_
+#define SRC_BVHBUILDER_H_
+
+#include <algorithm>  // sort, nth_element
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "AABB.h"
+#include "HitableList.h"
+#include "LinearBVHNode.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+// Identifiers of the builders, part of the BVH cache key
+#define BVH_BUILDER_MEDIAN_SPLIT 0
+#define BVH_BUILDER_BINNED_SAH 1
+#define BVH_BUILDER_LBVH 2
+#define BVH_BUILDER_LBVH_OPTIMIZED 3
+
+// Number of bins used to evaluate split candidates of the binned builder
+#define BVH_BINS 16
+// Maximum number of primitives in a leaf of the binned builder
+#define BVH_MAX_LEAF_SIZE 4
+// Ranges with more primitives are built as separate tasks
+#define BVH_TASK_THRESHOLD 4096
+// Ranges with more primitives are binned in parallel chunks
+#define BVH_PARALLEL_BINNING_THRESHOLD 262144
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Collect the bounding boxes of all elements of the list l in list order.
+ * Elements without a bounding box get an empty one.
+ */
+std::vector<AABB> primitive_boxes(HitableList *l);
+
+/**
+ * Build a flattened BVH over the provided primitive bounding boxes, using
+ * the same strategy as BVH::BVH: at every node a random axis is chosen, the
+ * primitives are sorted by the minimum of their boxes along that axis and the
+ * range is split in two halves. Ranges of one or two primitives become leaves.
+ */
+BVHBuildResult build_median_split(const std::vector<AABB> &boxes);
+
+/**
+ * Build a flattened BVH over the provided primitive bounding boxes with
+ * binned SAH partitioning: the centroids of a range are distributed into
+ * BVH_BINS bins along the axis of largest extent and the range is partitioned
+ * in place at the bin boundary with the lowest surface area heuristic cost.
+ * When a thread pool is provided, large subtrees are built concurrently on it.
+ * The result doesn't depend on the pool or the number of its threads.
+ * Degenerate inputs (e.g. exponentially spaced primitives, which SAH peels
+ * off one per level) would make arbitrarily deep trees, so subtrees, which
+ * could otherwise exceed max_depth, are split at the object median instead.
+ */
+BVHBuildResult build_binned_sah(const std::vector<AABB> &boxes,
+                                ThreadPool *pool,
+                                int max_depth = BVH_MAX_DEPTH);
+
+/**
+ * SAH cost of a flattened BVH, normalized by the surface area of its root:
+ * each interior node costs one traversal step and each leaf one intersection
+ * per primitive, weighted by the probability of a ray hitting the node.
+ * Lower is better; use it to compare the quality of different builders.
+ */
+float bvh_sah_cost(const std::vector<LinearBVHNode> &nodes);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+std::vector<AABB> primitive_boxes(HitableList *l) {
+  std::vector<AABB> boxes(l->size());
+  for (int i = 0; i < l->size(); i++) {
+    if (!(*l)[i]->bounding_box(boxes[i])) {
+      std::cout << "No bounding box" << std::endl;
+    }
+  }
+  return boxes;
+}
+
+// _____________________________________________________________________________
+int build_median_split_recursive(const std::vector<AABB> &boxes,
+                                 int min_idx, int max_idx,
+                                 BVHBuildResult &out) {
+  int node_idx = static_cast<int>(out.nodes.size());
+  out.nodes.emplace_back();
+
+  // Choose axis for split and sort by it
+  int axis = static_cast<int>(get_random_in_range(0.f, 3.f));
+  std::sort(out.indices.begin() + min_idx,
+            out.indices.begin() + max_idx,
+            [&boxes, axis](int32_t a, int32_t b) {
+              return boxes[a].min()[axis] < boxes[b].min()[axis];
+            });
+
+  // Compute the bounding box of the range
+  AABB box;
+  for (int i = min_idx; i < max_idx; i++) {
+    AABB prim_box = boxes[out.indices[i]];
+    box = surrounding_box(prim_box, box);
+  }
+
+  LinearBVHNode node{};
+  node.box(box);
+  node.axis = static_cast<uint16_t>(axis);
+  int num_elements = max_idx - min_idx;
+  if (num_elements <= 2) {
+    // 1 or 2 primitives make a leaf
+    node.offset = min_idx;
+    node.count = static_cast<uint16_t>(num_elements);
+  } else {
+    // The first child directly follows the node, the second child's index is
+    // known after the first subtree is complete
+    int half_els = num_elements / 2;
+    build_median_split_recursive(boxes, min_idx, min_idx + half_els, out);
+    node.offset = build_median_split_recursive(boxes, min_idx + half_els,
+                                               max_idx, out);
+    node.count = 0;
+  }
+  out.nodes[node_idx] = node;
+  return node_idx;
+}
+
+// _____________________________________________________________________________
+BVHBuildResult build_median_split(const std::vector<AABB> &boxes) {
+  BVHBuildResult out;
+  int n = static_cast<int>(boxes.size());
+  if (n == 0) return out;
+
+  out.indices.resize(n);
+  for (int i = 0; i < n; i++) out.indices[i] = i;
+  // A binary tree with leaves of 1-2 primitives has less than 2n nodes
+  out.nodes.reserve(2 * n);
+  build_median_split_recursive(boxes, 0, n, out);
+  return out;
+}
+
+// State shared by all nodes of a binned SAH build
+struct BinnedBuildContext {
+  const std::vector<AABB> *boxes;
+  std::vector<Vec3> centroids;
+  std::vector<int32_t> *indices;
+  ThreadPool *pool;
+  int max_depth;
+};
+
+// Primitive count and bounds of a bin
+struct BVHBin {
+  AABB box;
+  int count{0};
+};
+
+// _____________________________________________________________________________
+void compute_range_bounds(BinnedBuildContext &ctx, int begin, int end,
+                          AABB &box, AABB &centroid_box) {
+  const std::vector<AABB> &boxes = *ctx.boxes;
+  const std::vector<int32_t> &indices = *ctx.indices;
+  for (int i = begin; i < end; i++) {
+    box.extend(boxes[indices[i]]);
+    centroid_box.extend(ctx.centroids[indices[i]]);
+  }
+}
+
+// _____________________________________________________________________________
+void compute_bins(BinnedBuildContext &ctx, int begin, int end,
+                  int axis, float c_min, float scale, BVHBin *bins) {
+  const std::vector<int32_t> &indices = *ctx.indices;
+  for (int i = begin; i < end; i++) {
+    int32_t idx = indices[i];
+    int b = static_cast<int>((ctx.centroids[idx][axis] - c_min) * scale);
+    if (b > BVH_BINS - 1) b = BVH_BINS - 1;
+    bins[b].count++;
+    bins[b].box.extend((*ctx.boxes)[idx]);
+  }
+}
+
+// _____________________________________________________________________________
+void append_subtree(std::vector<LinearBVHNode> &out,
+                    const std::vector<LinearBVHNode> &subtree) {
+  // Child indices of the subtree are relative to its root
+  int32_t base = static_cast<int32_t>(out.size());
+  for (LinearBVHNode node : subtree) {
+    if (!node.is_leaf()) node.offset += base;
+    out.push_back(node);
+  }
+}
+
+// _____________________________________________________________________________
+// Depth of the tree over n primitives, which median splits build
+inline int median_split_depth(int n) {
+  int depth = 0;
+  for (; n > BVH_MAX_LEAF_SIZE; n -= n / 2) depth++;
+  return depth;
+}
+
+// _____________________________________________________________________________
+void build_binned_recursive(BinnedBuildContext &ctx, int begin, int end,
+                            int depth, std::vector<LinearBVHNode> &out) {
+  int n = end - begin;
+  bool parallel = ctx.pool != nullptr && n > BVH_PARALLEL_BINNING_THRESHOLD;
+  int num_chunks = parallel ? ctx.pool->size() : 1;
+  int chunk_size = (n + num_chunks - 1) / num_chunks;
+
+  // Bounds of the primitives and their centroids. Min/max are exact, so the
+  // order, in which the chunks are merged, doesn't matter
+  AABB box, centroid_box;
+  if (parallel) {
+    std::vector<AABB> chunk_boxes(num_chunks), chunk_centroids(num_chunks);
+    ctx.pool->parallel_for(num_chunks, [&](int c) {
+      int b = begin + c * chunk_size;
+      int e = b + chunk_size < end ? b + chunk_size : end;
+      compute_range_bounds(ctx, b, e, chunk_boxes[c], chunk_centroids[c]);
+    });
+    for (int c = 0; c < num_chunks; c++) {
+      box.extend(chunk_boxes[c]);
+      centroid_box.extend(chunk_centroids[c]);
+    }
+  } else {
+    compute_range_bounds(ctx, begin, end, box, centroid_box);
+  }
+
+  int node_idx = static_cast<int>(out.size());
+  out.emplace_back();
+  LinearBVHNode node{};
+  node.box(box);
+
+  int axis = centroid_box.largest_axis();
+  float c_min = centroid_box.min()[axis];
+  float extent = centroid_box.max()[axis] - c_min;
+  int mid = begin + n / 2;
+  bool make_leaf = n <= 1;
+  // Median splits from here on just stay within the maximum depth; at the
+  // maximum depth itself (only reached with a small max_depth), the rest
+  // goes into one leaf
+  bool median = depth + median_split_depth(n) >= ctx.max_depth;
+
+  if (median) {
+    make_leaf = n <= BVH_MAX_LEAF_SIZE || depth >= ctx.max_depth;
+    if (!make_leaf) {
+      const std::vector<Vec3> &centroids = ctx.centroids;
+      std::nth_element(ctx.indices->begin() + begin,
+                       ctx.indices->begin() + mid,
+                       ctx.indices->begin() + end,
+                       [&](int32_t a, int32_t b) {
+                         return centroids[a][axis] < centroids[b][axis];
+                       });
+    }
+  } else if (!make_leaf && extent > 0.f) {
+    // Distribute the centroids into the bins
+    float scale = BVH_BINS / extent;
+    BVHBin bins[BVH_BINS];
+    if (parallel) {
+      std::vector<BVHBin> chunk_bins(num_chunks * BVH_BINS);
+      ctx.pool->parallel_for(num_chunks, [&](int c) {
+        int b = begin + c * chunk_size;
+        int e = b + chunk_size < end ? b + chunk_size : end;
+        compute_bins(ctx, b, e, axis, c_min, scale, &chunk_bins[c*BVH_BINS]);
+      });
+      for (int c = 0; c < num_chunks; c++) {
+        for (int b = 0; b < BVH_BINS; b++) {
+          bins[b].count += chunk_bins[c*BVH_BINS + b].count;
+          bins[b].box.extend(chunk_bins[c*BVH_BINS + b].box);
+        }
+      }
+    } else {
+      compute_bins(ctx, begin, end, axis, c_min, scale, bins);
+    }
+
+    // Sweep from the right to get the cost of the right side of each split
+    float right_cost[BVH_BINS];
+    AABB right_box;
+    int right_count = 0;
+    for (int b = BVH_BINS - 1; b > 0; b--) {
+      right_box.extend(bins[b].box);
+      right_count += bins[b].count;
+      right_cost[b] = right_box.surface_area() * right_count;
+    }
+
+    // Sweep from the left and find the cheapest split
+    // cost = traversal + (A_left*N_left + A_right*N_right) / A_node
+    float best_cost = maxf();
+    int best_split = -1;
+    AABB left_box;
+    int left_count = 0;
+    for (int b = 0; b < BVH_BINS - 1; b++) {
+      left_box.extend(bins[b].box);
+      left_count += bins[b].count;
+      if (left_count == 0 || left_count == n) continue;
+      float cost = left_box.surface_area() * left_count + right_cost[b + 1];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_split = b;
+      }
+    }
+    float area = box.surface_area();
+    best_cost = 1.f + (area > 0.f ? best_cost / area : 0.f);
+
+    // Intersecting all primitives is the cost of a leaf
+    if (n <= BVH_MAX_LEAF_SIZE && static_cast<float>(n) <= best_cost) {
+      make_leaf = true;
+    } else if (best_split >= 0) {
+      const std::vector<Vec3> &centroids = ctx.centroids;
+      int32_t *first = ctx.indices->data() + begin;
+      int32_t *last = ctx.indices->data() + end;
+      mid = begin + static_cast<int>(std::partition(first, last,
+          [&](int32_t idx) {
+            int b = static_cast<int>((centroids[idx][axis] - c_min) * scale);
+            return (b > BVH_BINS - 1 ? BVH_BINS - 1 : b) <= best_split;
+          }) - first);
+    }
+  } else if (n <= BVH_MAX_LEAF_SIZE) {
+    // All centroids coincide, splitting doesn't help
+    make_leaf = true;
+  }
+
+  if (make_leaf) {
+    node.offset = begin;
+    node.count = static_cast<uint16_t>(n);
+    out[node_idx] = node;
+    return;
+  }
+
+  // Build the children; the first one directly follows the node
+  node.axis = static_cast<uint16_t>(axis);
+  if (ctx.pool != nullptr && n > BVH_TASK_THRESHOLD) {
+    // Left subtree as a separate task, right subtree on this thread. Both
+    // are appended in the same order, as in the serial build
+    std::vector<LinearBVHNode> left_nodes, right_nodes;
+    std::future<void> left = ctx.pool->submit(
+        [&ctx, &left_nodes, begin, mid, depth]() {
+          build_binned_recursive(ctx, begin, mid, depth + 1, left_nodes);
+        });
+    build_binned_recursive(ctx, mid, end, depth + 1, right_nodes);
+    ctx.pool->wait(left);
+    append_subtree(out, left_nodes);
+    node.offset = static_cast<int32_t>(out.size());
+    append_subtree(out, right_nodes);
+  } else {
+    build_binned_recursive(ctx, begin, mid, depth + 1, out);
+    node.offset = static_cast<int32_t>(out.size());
+    build_binned_recursive(ctx, mid, end, depth + 1, out);
+  }
+  out[node_idx] = node;
+}
+
+// _____________________________________________________________________________
+BVHBuildResult build_binned_sah(const std::vector<AABB> &boxes,
+                                ThreadPool *pool,
+                                int max_depth) {
+  BVHBuildResult out;
+  int n = static_cast<int>(boxes.size());
+  if (n == 0) return out;
+
+  out.indices.resize(n);
+  BinnedBuildContext ctx;
+  ctx.boxes = &boxes;
+  ctx.centroids.resize(n);
+  ctx.indices = &out.indices;
+  ctx.pool = pool;
+  ctx.max_depth = max_depth;
+  for (int i = 0; i < n; i++) {
+    out.indices[i] = i;
+    ctx.centroids[i] = boxes[i].centroid();
+  }
+  out.nodes.reserve(2 * n);
+  build_binned_recursive(ctx, 0, n, 0, out.nodes);
+  return out;
+}
+
+// _____________________________________________________________________________
+float bvh_sah_cost(const std::vector<LinearBVHNode> &nodes) {
+  if (nodes.empty()) return 0.f;
+  double cost = 0.0;
+  for (const LinearBVHNode &node : nodes) {
+    double area = node.box().surface_area();
+    cost += node.is_leaf() ? area * node.count : area;
+  }
+  float root_area = nodes[0].box().surface_area();
+  return root_area > 0.f ? static_cast<float>(cost / root_area) : 0.f;
+}
+
+#endif  // SRC_BVHBUILDER_H_
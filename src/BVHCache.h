@@ -0,0 +1,187 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_BVHCACHE_H_
+#define SRC_BVHCACHE_H_
+
+#include <cstdint>
+#include <cstdio>   // rename, remove, snprintf
+#include <cstring>  // memcpy, memcmp
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "AABB.h"
+#include "HitableList.h"
+#include "LinearBVH.h"
+#include "LinearBVHNode.h"
+#include "MappedFile.h"
+
+// Version of the cache file layout; bump it, when LinearBVHNode changes
+#define BVH_CACHE_VERSION 1
+
+/**
+ * Layout of a BVH cache file:
+ *   BVHCacheHeader
+ *   node_count x LinearBVHNode
+ *   primitive_count x int32_t primitive indices
+ * All references inside the file are indices, so the file can be mapped at
+ * any address and used in place.
+ */
+struct BVHCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t node_size;
+  uint64_t scene_hash;
+  int32_t node_count;
+  int32_t primitive_count;
+};
+
+static_assert(sizeof(BVHCacheHeader) % alignof(LinearBVHNode) == 0,
+              "Nodes following the header must stay aligned");
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Compute a 64-bit FNV-1a hash of the scene content relevant to the BVH:
+ * the number of primitives and their bounding boxes in list order.
+ * tag allows to distinguish between different BVH builders.
+ */
+uint64_t scene_hash(const std::vector<AABB> &boxes, uint64_t tag);
+
+/**
+ * Path of the cache file inside the directory dir for a scene with the
+ * provided hash.
+ */
+std::string bvh_cache_path(const std::string &dir, uint64_t hash);
+
+/**
+ * Write the BVH to the file with the provided path. The file is first
+ * written to a temporary file and afterwards renamed, so that concurrent
+ * renders never map a partially written file.
+ */
+bool save_bvh_cache(const std::string &path,
+                    uint64_t hash,
+                    const BVHBuildResult &bvh);
+
+/**
+ * Memory-map the cache file with the provided path and create a BVH over the
+ * list l from it. Returns nullptr, if the file doesn't exist, doesn't
+ * match the hash or the list, or doesn't hold a valid tree.
+ */
+LinearBVH* load_bvh_cache(const std::string &path,
+                          uint64_t hash,
+                          HitableList *l);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+inline void fnv1a(uint64_t &hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+}
+
+// _____________________________________________________________________________
+uint64_t scene_hash(const std::vector<AABB> &boxes, uint64_t tag) {
+  uint64_t hash = 14695981039346656037ull;
+  uint64_t n = boxes.size();
+  fnv1a(hash, &tag, sizeof(tag));
+  fnv1a(hash, &n, sizeof(n));
+  for (const AABB &box : boxes) {
+    float b[6] = {box.min().x(), box.min().y(), box.min().z(),
+                  box.max().x(), box.max().y(), box.max().z()};
+    fnv1a(hash, b, sizeof(b));
+  }
+  return hash;
+}
+
+// _____________________________________________________________________________
+std::string bvh_cache_path(const std::string &dir, uint64_t hash) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bvh",
+           static_cast<unsigned long long>(hash));
+  if (dir.empty() || dir.back() == '/') return dir + name;
+  return dir + "/" + name;
+}
+
+// _____________________________________________________________________________
+bool save_bvh_cache(const std::string &path,
+                    uint64_t hash,
+                    const BVHBuildResult &bvh) {
+  BVHCacheHeader header{};
+  memcpy(header.magic, "MWRBVH", 6);
+  header.version = BVH_CACHE_VERSION;
+  header.node_size = sizeof(LinearBVHNode);
+  header.scene_hash = hash;
+  header.node_count = static_cast<int32_t>(bvh.nodes.size());
+  header.primitive_count = static_cast<int32_t>(bvh.indices.size());
+
+  std::string tmp_path = path + ".tmp";
+  std::ofstream file(tmp_path, std::ios::binary);
+  if (!file) return false;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(bvh.nodes.data()),
+             bvh.nodes.size() * sizeof(LinearBVHNode));
+  file.write(reinterpret_cast<const char*>(bvh.indices.data()),
+             bvh.indices.size() * sizeof(int32_t));
+  file.close();
+  if (!file) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+// _____________________________________________________________________________
+LinearBVH* load_bvh_cache(const std::string &path,
+                          uint64_t hash,
+                          HitableList *l) {
+  MappedFile *mapping = new MappedFile(path.c_str());
+  if (!mapping->is_open() || mapping->size() < sizeof(BVHCacheHeader)) {
+    delete mapping;
+    return nullptr;
+  }
+
+  // Validate the header against the scene
+  const BVHCacheHeader *header =
+      reinterpret_cast<const BVHCacheHeader*>(mapping->data());
+  size_t expected_size = sizeof(BVHCacheHeader)
+      + static_cast<size_t>(header->node_count) * sizeof(LinearBVHNode)
+      + static_cast<size_t>(header->primitive_count) * sizeof(int32_t);
+  if (memcmp(header->magic, "MWRBVH", 6) != 0 ||
+      header->version != BVH_CACHE_VERSION ||
+      header->node_size != sizeof(LinearBVHNode) ||
+      header->scene_hash != hash ||
+      header->node_count <= 0 ||
+      header->primitive_count != l->size() ||
+      mapping->size() != expected_size) {
+    delete mapping;
+    return nullptr;
+  }
+
+  // Use the node and index arrays in place
+  const char *base = mapping->data() + sizeof(BVHCacheHeader);
+  const LinearBVHNode *nodes = reinterpret_cast<const LinearBVHNode*>(base);
+  const int32_t *indices = reinterpret_cast<const int32_t*>(
+      base + header->node_count * sizeof(LinearBVHNode));
+  for (int i = 0; i < header->primitive_count; i++) {
+    if (indices[i] < 0 || indices[i] >= l->size()) {
+      delete mapping;
+      return nullptr;
+    }
+  }
+  if (!bvh_valid(nodes, header->node_count, header->primitive_count)) {
+    delete mapping;
+    return nullptr;
+  }
+  return new LinearBVH(l, nodes, header->node_count, indices, mapping);
+}
+
+#endif  // SRC_BVHCACHE_H_
@@ -0,0 +1,730 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+// Micro- and macro-benchmarks of the renderer. Every benchmark reports the
+// time per operation in nanoseconds, and the tracing throughput in rays per
+// second, if it traces rays.
+//
+// Command line options:
+//   --filter=<text>   only run the benchmarks, whose name contains text
+//   --min-time=<s>    minimum duration of a measurement, default 0.2
+//   --json=<file>     also write the results as JSON to file
+//   --accuracy        instead of benchmarking, compare the approximations of
+//                     FastMath.h with libm and fail, if one exceeds its
+//                     documented error bound
+
+#include <algorithm>  // max
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "AABB.h"
+#include "BVHBuilder.h"
+#include "Camera.h"
+#include "FastMath.h"
+#include "HitableList.h"
+#include "LinearBVH.h"
+#include "QuantizedBVH.h"
+#include "Ray.h"
+#include "Renderer.h"
+#include "Scenes.h"
+#include "Sphere.h"
+#include "ThreadPool.h"
+#include "UniformGrid.h"
+#include "Utils.h"
+#include "Vec3.h"
+#include "Vec3A.h"
+#include "Vec3x8.h"
+
+// Number of measurements of a benchmark, the fastest one is reported
+#define BENCHMARK_REPETITIONS 3
+// Number of precomputed inputs, which the micro-benchmarks cycle through
+#define BENCHMARK_INPUTS 1024
+
+// Results of the benchmarks are written here, so that the compiler cannot
+// remove the benchmarked code
+static volatile float benchmark_sink;
+
+// Measurement of a single benchmark
+struct BenchmarkResult {
+  std::string name;
+  uint64_t operations{0};
+  double seconds{0.0};
+  // Number of traced rays, 0 for benchmarks, which don't trace rays
+  uint64_t rays{0};
+
+  inline double ns_per_op() const { return seconds * 1e9 / operations; }
+  inline double rays_per_second() const { return rays / seconds; }
+};
+
+/**
+ * Runs the benchmarks and collects their results.
+ * A benchmark is a function op(n), which executes the benchmarked operation
+ * n times and returns the number of rays, which it traced. The suite grows n
+ * until a call takes at least the minimum time and reports the fastest of
+ * BENCHMARK_REPETITIONS calls.
+ */
+class BenchmarkSuite {
+ public:
+  BenchmarkSuite(const std::string &filter, double min_seconds)
+      : _filter(filter), _min_seconds(min_seconds) {}
+
+  inline bool enabled(const std::string &name) const {
+    return name.find(_filter) != std::string::npos;
+  }
+
+  void run(const std::string &name,
+           const std::function<uint64_t(uint64_t)> &op);
+
+  void print_header() const;
+  bool write_json(const std::string &path) const;
+
+ private:
+  std::string _filter;
+  double _min_seconds;
+  std::vector<BenchmarkResult> _results;
+};
+
+// _____________________________________________________________________________
+void BenchmarkSuite::run(const std::string &name,
+                         const std::function<uint64_t(uint64_t)> &op) {
+  if (!enabled(name)) return;
+  auto measure = [&op](uint64_t n, BenchmarkResult &r) {
+    auto start = std::chrono::steady_clock::now();
+    r.rays = op(n);
+    auto end = std::chrono::steady_clock::now();
+    r.operations = n;
+    r.seconds = std::chrono::duration<double>(end - start).count();
+  };
+
+  // Find the number of operations, which take long enough to be measured
+  BenchmarkResult best;
+  best.name = name;
+  uint64_t n = 1;
+  measure(n, best);
+  while (best.seconds < _min_seconds) {
+    double factor = best.seconds > 0.0 ? 1.5 * _min_seconds / best.seconds
+                                       : 100.0;
+    n = static_cast<uint64_t>(n * std::min(std::max(factor, 2.0), 100.0));
+    measure(n, best);
+  }
+  for (int k = 1; k < BENCHMARK_REPETITIONS; k++) {
+    BenchmarkResult r;
+    r.name = name;
+    measure(n, r);
+    if (r.seconds < best.seconds) best = r;
+  }
+  _results.push_back(best);
+
+  std::cout << std::left << std::setw(36) << name << std::right
+            << std::setw(14) << std::fixed << std::setprecision(1)
+            << best.ns_per_op() << " ns/op";
+  if (best.rays > 0) {
+    std::cout << std::setw(14) << std::setprecision(0)
+              << best.rays_per_second() << " rays/s";
+  }
+  std::cout << std::endl;
+}
+
+// _____________________________________________________________________________
+void BenchmarkSuite::print_header() const {
+  std::cout << std::left << std::setw(36) << "benchmark" << std::right
+            << std::setw(20) << "time" << std::setw(21) << "throughput"
+            << std::endl;
+}
+
+// _____________________________________________________________________________
+bool BenchmarkSuite::write_json(const std::string &path) const {
+  std::ofstream file(path);
+  if (!file) return false;
+  file << "{\n  \"threads\": " << global_thread_pool().size()
+       << ",\n  \"min_time\": " << _min_seconds
+       << ",\n  \"benchmarks\": [";
+  for (size_t i = 0; i < _results.size(); i++) {
+    const BenchmarkResult &r = _results[i];
+    file << (i == 0 ? "\n" : ",\n")
+         << "    {\"name\": \"" << r.name << "\""
+         << ", \"iterations\": " << r.operations
+         << ", \"seconds\": " << std::setprecision(9) << r.seconds
+         << ", \"ns_per_op\": " << r.ns_per_op();
+    if (r.rays > 0) {
+      file << ", \"rays\": " << r.rays
+           << ", \"rays_per_second\": " << r.rays_per_second();
+    }
+    file << "}";
+  }
+  file << "\n  ]\n}\n";
+  return static_cast<bool>(file);
+}
+
+/**
+ * Wrapper counting the rays, which are traced against the world. The render
+ * kernels trace every ray of a path against the world, so these are all
+ * rays of a render.
+ */
+class RayCounter: public Hitable {
+ public:
+  explicit RayCounter(Hitable *world) : _world(world) {}
+
+  inline uint64_t rays() const { return _rays.load(); }
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const {
+    _rays.fetch_add(1, std::memory_order_relaxed);
+    return _world->hit(r, t_min, t_max, rec);
+  }
+
+  virtual bool bounding_box(AABB &box) const {
+    return _world->bounding_box(box);
+  }
+
+  virtual unsigned material_types() const {
+    return _world->material_types();
+  }
+
+ private:
+  Hitable *_world;
+  mutable std::atomic<uint64_t> _rays{0};
+};
+
+// _____________________________________________________________________________
+// Random rays from points around the origin towards the unit sphere
+std::vector<Ray> random_rays(float distance) {
+  seed_random(0);
+  std::vector<Ray> rays;
+  rays.reserve(BENCHMARK_INPUTS);
+  for (int i = 0; i < BENCHMARK_INPUTS; i++) {
+    Vec3 origin = distance * make_unit_vector(random_in_unit_sphere());
+    Vec3 target = 1.2f * random_in_unit_sphere();
+    rays.push_back(Ray(origin, target - origin));
+  }
+  return rays;
+}
+
+// _____________________________________________________________________________
+void primitive_benchmarks(BenchmarkSuite &suite) {
+  std::vector<Ray> rays = random_rays(5.f);
+  Sphere sphere(Vec3(0.f, 0.f, 0.f), 1.f, nullptr);
+  suite.run("sphere_hit", [&](uint64_t n) {
+    HitRecord rec;
+    int hits = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      hits += sphere.hit(rays[i % BENCHMARK_INPUTS], SHADOW_BIAS, MAXFLOAT,
+                         rec);
+    }
+    benchmark_sink = static_cast<float>(hits);
+    return n;
+  });
+
+  // Packets of eight consecutive rays
+  std::vector<Vec3x8> origins, directions;
+  for (int i = 0; i < BENCHMARK_INPUTS; i += 8) {
+    Vec3 o[8], d[8];
+    for (int k = 0; k < 8; k++) {
+      o[k] = rays[i + k].origin();
+      d[k] = rays[i + k].direction();
+    }
+    origins.push_back(Vec3x8::load(o));
+    directions.push_back(Vec3x8::load(d));
+  }
+  suite.run("sphere_hit_x8", [&](uint64_t n) {
+    int hits = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      Float8 t_max = float8(MAXFLOAT);
+      size_t p = i % origins.size();
+      hits += sphere.hit8(origins[p], directions[p], SHADOW_BIAS, t_max);
+    }
+    benchmark_sink = static_cast<float>(hits);
+    return 8 * n;
+  });
+
+  AABB box(Vec3(-1.f, -1.f, -1.f), Vec3(1.f, 1.f, 1.f));
+  suite.run("aabb_hit", [&](uint64_t n) {
+    int hits = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      float t_min = SHADOW_BIAS;
+      float t_max = MAXFLOAT;
+      hits += box.hit(rays[i % BENCHMARK_INPUTS], t_min, t_max);
+    }
+    benchmark_sink = static_cast<float>(hits);
+    return n;
+  });
+}
+
+// _____________________________________________________________________________
+void vector_benchmarks(BenchmarkSuite &suite) {
+  // Normalize eight vectors and sum up their cross products with a fixed
+  // axis, with each of the vector types
+  seed_random(2);
+  std::vector<Vec3> vectors;
+  for (int i = 0; i < BENCHMARK_INPUTS; i++) {
+    vectors.push_back(random_in_unit_sphere() + Vec3(0.f, 0.f, 2.f));
+  }
+  std::vector<Vec3A> aligned;
+  for (const Vec3 &v : vectors) aligned.push_back(Vec3A(v));
+  std::vector<Vec3x8> lanes;
+  for (int i = 0; i < BENCHMARK_INPUTS; i += 8) {
+    lanes.push_back(Vec3x8::load(&vectors[i]));
+  }
+  Vec3 axis(0.f, 1.f, 0.f);
+
+  suite.run("vector/vec3", [&](uint64_t n) {
+    Vec3 sum(0.f, 0.f, 0.f);
+    for (uint64_t i = 0; i < n; i++) {
+      size_t p = (8 * i) % BENCHMARK_INPUTS;
+      for (int k = 0; k < 8; k++) {
+        Vec3 u = make_unit_vector(vectors[p + k]);
+        sum += dot(u, axis) * cross(u, axis);
+      }
+    }
+    benchmark_sink = sum.x();
+    return uint64_t(0);
+  });
+  suite.run("vector/vec3a", [&](uint64_t n) {
+    Vec3A sum;
+    Vec3A axis_a(axis);
+    for (uint64_t i = 0; i < n; i++) {
+      size_t p = (8 * i) % BENCHMARK_INPUTS;
+      for (int k = 0; k < 8; k++) {
+        Vec3A u = make_unit_vector(aligned[p + k]);
+        sum = fmadd(Vec3A(float4(dot(u, axis_a))), cross(u, axis_a), sum);
+      }
+    }
+    benchmark_sink = sum.x();
+    return uint64_t(0);
+  });
+  suite.run("vector/vec3x8", [&](uint64_t n) {
+    Vec3x8 sum;
+    Vec3x8 axis8(axis);
+    for (uint64_t i = 0; i < n; i++) {
+      const Vec3x8 &v = lanes[i % lanes.size()];
+      Vec3x8 u = make_unit_vector(v);
+      sum = fmadd(cross(u, axis8), dot(u, axis8), sum);
+    }
+    Vec3 out[8];
+    sum.store(out);
+    benchmark_sink = out[0].x();
+    return uint64_t(0);
+  });
+}
+
+// _____________________________________________________________________________
+void math_benchmarks(BenchmarkSuite &suite) {
+  // Arguments in the ranges, in which the renderer calls the functions
+  seed_random(4);
+  std::vector<float> angles, unit, positive;
+  for (int i = 0; i < BENCHMARK_INPUTS; i++) {
+    angles.push_back(get_random_in_range(-100.f, 100.f));
+    unit.push_back(get_random_in_range(-1.f, 1.f));
+    positive.push_back(get_random_in_range(0.01f, 100.f));
+  }
+  // An operation evaluates f on the whole array, like a batch kernel
+  // would, so that the compiler can vectorize the loop; f is a template
+  // parameter, so it is inlined into it
+  auto run = [&suite](const std::string &name, const std::vector<float> &in,
+                      auto f) {
+    suite.run(name, [&in, f](uint64_t n) {
+      static float out[BENCHMARK_INPUTS];
+      const float *x = in.data();
+      for (uint64_t i = 0; i < n; i++) {
+        for (int k = 0; k < BENCHMARK_INPUTS; k++) {
+          out[k] = f(x[k], x[BENCHMARK_INPUTS - 1 - k]);
+        }
+      }
+      benchmark_sink = out[0];
+      return uint64_t(0);
+    });
+  };
+  run("math/sin/libm", angles, [](float x, float) { return sinf(x); });
+  run("math/sin/fast", angles, [](float x, float) { return fast_sin(x); });
+  run("math/atan2/libm", unit, [](float y, float x) { return atan2f(y, x); });
+  run("math/atan2/fast", unit, [](float y, float x) {
+    return fast_atan2(y, x);
+  });
+  run("math/asin/libm", unit, [](float x, float) { return asinf(x); });
+  run("math/asin/fast", unit, [](float x, float) { return fast_asin(x); });
+  run("math/rsqrt/libm", positive, [](float x, float) {
+    return 1.f / sqrtf(x);
+  });
+  run("math/rsqrt/fast", positive, [](float x, float) {
+    return fast_rsqrt(x);
+  });
+  run("math/pow5/libm", unit, [](float x, float) {
+    return static_cast<float>(pow(x, 5));
+  });
+  run("math/pow5/ipow", unit, [](float x, float) { return ipow<5>(x); });
+}
+
+// _____________________________________________________________________________
+// Print the maximum error of an approximation and whether it is in bound
+bool report_accuracy(const char *name, double error, float bound) {
+  bool ok = error <= bound;
+  std::cout << std::left << std::setw(12) << name << std::right
+            << std::setw(14) << error << std::setw(14) << bound
+            << (ok ? "  ok" : "  EXCEEDED") << std::endl;
+  return ok;
+}
+
+// _____________________________________________________________________________
+bool check_math_accuracy() {
+  // Dense samples of the domains, compared with libm in double precision
+  const int samples = 4000000;
+  double sin_error = 0.0;
+  double asin_error = 0.0;
+  double rsqrt_error = 0.0;
+  for (int i = 0; i <= samples; i++) {
+    float s = static_cast<float>(i) / samples;
+    float x = (2.f * s - 1.f) * FAST_SIN_MAX_ARGUMENT;
+    sin_error = std::max(sin_error, fabs(fast_sin(x) - sin(double(x))));
+    float u = 2.f * s - 1.f;
+    asin_error = std::max(asin_error, fabs(fast_asin(u) - asin(double(u))));
+    // Mantissas in [1, 2) with exponents from -64 to 63
+    float r = ldexpf(1.f + s, i % 128 - 64);
+    rsqrt_error = std::max(rsqrt_error,
+                           fabs(fast_rsqrt(r) * sqrt(double(r)) - 1.0));
+  }
+  double atan2_error = 0.0;
+  const int grid = 2000;
+  for (int i = 0; i <= grid; i++) {
+    for (int j = 0; j <= grid; j++) {
+      float y = 4.f * i / grid - 2.f;
+      float x = 4.f * j / grid - 2.f;
+      atan2_error = std::max(atan2_error,
+                             fabs(fast_atan2(y, x) - atan2(double(y),
+                                                           double(x))));
+    }
+  }
+  double pow_error = 0.0;
+  for (int i = 0; i <= samples; i++) {
+    float x = 2.f * i / samples - 1.f;
+    pow_error = std::max(pow_error, fabs(ipow<5>(x) - pow(double(x), 5)));
+  }
+
+  std::cout << std::left << std::setw(12) << "function" << std::right
+            << std::setw(14) << "max error" << std::setw(14) << "bound"
+            << std::endl;
+  bool ok = report_accuracy("sin", sin_error, FAST_SIN_MAX_ERROR);
+  ok &= report_accuracy("atan2", atan2_error, FAST_ATAN2_MAX_ERROR);
+  ok &= report_accuracy("asin", asin_error, FAST_ASIN_MAX_ERROR);
+  ok &= report_accuracy("rsqrt", rsqrt_error, FAST_RSQRT_MAX_ERROR);
+  // Only the rounding of the float multiplications
+  ok &= report_accuracy("ipow<5>", pow_error, 2.5e-7f);
+  return ok;
+}
+
+// _____________________________________________________________________________
+void sampling_benchmarks(BenchmarkSuite &suite) {
+  suite.run("get_random_in_range", [](uint64_t n) {
+    float sum = 0.f;
+    for (uint64_t i = 0; i < n; i++) sum += get_random_in_range(0.f, 1.f);
+    benchmark_sink = sum;
+    return uint64_t(0);
+  });
+  suite.run("random_in_unit_sphere", [](uint64_t n) {
+    float sum = 0.f;
+    for (uint64_t i = 0; i < n; i++) sum += random_in_unit_sphere().x();
+    benchmark_sink = sum;
+    return uint64_t(0);
+  });
+  suite.run("random_in_unit_disc", [](uint64_t n) {
+    float sum = 0.f;
+    for (uint64_t i = 0; i < n; i++) {
+      float x, y;
+      random_in_unit_disc(x, y);
+      sum += x;
+    }
+    benchmark_sink = sum;
+    return uint64_t(0);
+  });
+
+  // Directions and normals for the scattering functions
+  std::vector<Vec3> directions, normals;
+  seed_random(1);
+  for (int i = 0; i < BENCHMARK_INPUTS; i++) {
+    Vec3 n = make_unit_vector(random_in_unit_sphere());
+    Vec3 d = random_in_unit_sphere();
+    // Incoming directions point against the normal
+    if (dot(d, n) > 0.f) d = -1.f * d;
+    normals.push_back(n);
+    directions.push_back(d);
+  }
+  suite.run("reflect", [&](uint64_t n) {
+    float sum = 0.f;
+    for (uint64_t i = 0; i < n; i++) {
+      sum += reflect(directions[i % BENCHMARK_INPUTS],
+                     normals[i % BENCHMARK_INPUTS]).x();
+    }
+    benchmark_sink = sum;
+    return uint64_t(0);
+  });
+  suite.run("refract", [&](uint64_t n) {
+    float sum = 0.f;
+    Vec3 t;
+    for (uint64_t i = 0; i < n; i++) {
+      if (refract(directions[i % BENCHMARK_INPUTS],
+                  normals[i % BENCHMARK_INPUTS], 1.f / 1.52f, t)) {
+        sum += t.x();
+      }
+    }
+    benchmark_sink = sum;
+    return uint64_t(0);
+  });
+  suite.run("schlick", [&](uint64_t n) {
+    float sum = 0.f;
+    for (uint64_t i = 0; i < n; i++) {
+      sum += schlick(directions[i % BENCHMARK_INPUTS],
+                     normals[i % BENCHMARK_INPUTS], 1.52f, false);
+    }
+    benchmark_sink = sum;
+    return uint64_t(0);
+  });
+}
+
+// _____________________________________________________________________________
+// Traversal of the BVH with quantized nodes. The list of primitives isn't
+// owned by either BVH afterwards
+template <typename Q>
+void quantized_traverse_benchmark(BenchmarkSuite &suite,
+                                  const std::string &name,
+                                  LinearBVH &bvh,
+                                  const std::vector<Ray> &rays) {
+  if (!suite.enabled(name)) return;
+  QuantizedBVH<Q> quantized(&bvh);
+  suite.run(name, [&](uint64_t ops) {
+    HitRecord rec;
+    int hits = 0;
+    for (uint64_t i = 0; i < ops; i++) {
+      hits += quantized.hit(rays[i % BENCHMARK_INPUTS], SHADOW_BIAS, MAXFLOAT,
+                            rec);
+    }
+    benchmark_sink = static_cast<float>(hits);
+    return ops;
+  });
+  quantized.release();
+}
+
+// _____________________________________________________________________________
+void bvh_benchmarks(BenchmarkSuite &suite) {
+  ThreadPool &pool = global_thread_pool();
+  for (int n : {1000, 10000, 100000}) {
+    std::string size = std::to_string(n);
+    HitableList *world = nullptr;
+    std::vector<AABB> boxes;
+    for (int builder : {BVH_BUILDER_MEDIAN_SPLIT, BVH_BUILDER_BINNED_SAH,
+                        BVH_BUILDER_LBVH, BVH_BUILDER_LBVH_OPTIMIZED}) {
+      std::string name = std::string("bvh_build/") + bvh_builder_name(builder)
+                         + "/" + size;
+      std::string traverse_name = std::string("bvh_traverse/")
+                                  + bvh_builder_name(builder) + "/" + size;
+      std::string quantized_names[2] = {"bvh_traverse/sah-q8/" + size,
+                                        "bvh_traverse/sah-q16/" + size};
+      bool quantized = builder == BVH_BUILDER_BINNED_SAH &&
+                       (suite.enabled(quantized_names[0]) ||
+                        suite.enabled(quantized_names[1]));
+      if (!suite.enabled(name) && !suite.enabled(traverse_name) &&
+          !quantized) {
+        continue;
+      }
+      // Create the scene only, if one of its benchmarks runs
+      if (world == nullptr) {
+        seed_random(2);
+        world = random_spheres_objects(n);
+        boxes = primitive_boxes(world);
+      }
+      suite.run(name, [&](uint64_t ops) {
+        for (uint64_t i = 0; i < ops; i++) {
+          BVHBuildResult bvh = build_bvh_with(builder, boxes, &pool);
+          benchmark_sink = static_cast<float>(bvh.nodes.size());
+        }
+        return uint64_t(0);
+      });
+
+      // Rays from the outside through the cube of spheres
+      LinearBVH bvh(world, build_bvh_with(builder, boxes, &pool));
+      AABB bounds;
+      bvh.bounding_box(bounds);
+      float radius = (bounds.max() - bounds.min()).length();
+      std::vector<Ray> rays = random_rays(1.f);
+      for (Ray &r : rays) {
+        Vec3 origin = bounds.centroid() + radius * r.origin();
+        Vec3 target = bounds.centroid()
+                      + 0.5f * radius * (r.origin() + r.direction());
+        r = Ray(origin, target - origin);
+      }
+      suite.run(traverse_name, [&](uint64_t ops) {
+        HitRecord rec;
+        int hits = 0;
+        for (uint64_t i = 0; i < ops; i++) {
+          hits += bvh.hit(rays[i % BENCHMARK_INPUTS], SHADOW_BIAS, MAXFLOAT,
+                          rec);
+        }
+        benchmark_sink = static_cast<float>(hits);
+        return ops;
+      });
+      if (quantized) {
+        quantized_traverse_benchmark<uint8_t>(suite, quantized_names[0], bvh,
+                                              rays);
+        quantized_traverse_benchmark<uint16_t>(suite, quantized_names[1], bvh,
+                                               rays);
+      }
+      bvh.release();
+    }
+    delete world;
+  }
+}
+
+// _____________________________________________________________________________
+void accel_benchmarks(BenchmarkSuite &suite) {
+  // The BVH against the uniform grid on a scene with primitives of similar
+  // size (the cover scene without its ground sphere is a lattice) and on
+  // random spheres
+  ThreadPool &pool = global_thread_pool();
+  for (std::string scene : {"cover", "spheres"}) {
+    std::string names[4] = {"accel_build/bvh/" + scene,
+                            "accel_build/grid/" + scene,
+                            "accel_trace/bvh/" + scene,
+                            "accel_trace/grid/" + scene};
+    bool enabled = false;
+    for (const std::string &name : names) enabled |= suite.enabled(name);
+    if (!enabled) continue;
+    seed_random(3);
+    HitableList *world = scene == "cover" ? cover_scene_objects()
+                                          : random_spheres_objects(10000);
+    std::vector<AABB> boxes = primitive_boxes(world);
+
+    suite.run(names[0], [&](uint64_t ops) {
+      for (uint64_t i = 0; i < ops; i++) {
+        BVHBuildResult bvh = build_bvh_with(BVH_BUILDER_BINNED_SAH, boxes,
+                                            &pool);
+        benchmark_sink = static_cast<float>(bvh.nodes.size());
+      }
+      return uint64_t(0);
+    });
+    suite.run(names[1], [&](uint64_t ops) {
+      for (uint64_t i = 0; i < ops; i++) {
+        UniformGrid grid(world);
+        benchmark_sink = static_cast<float>(grid.reference_count());
+        grid.release();
+      }
+      return uint64_t(0);
+    });
+
+    LinearBVH bvh(world, build_bvh_with(BVH_BUILDER_BINNED_SAH, boxes, &pool));
+    UniformGrid grid(world);
+    // Rays between random points of the objects' bounds, like the
+    // secondary rays of the paths
+    AABB bounds;
+    grid.bounding_box(bounds);
+    Vec3 extent = bounds.max() - bounds.min();
+    std::vector<Ray> rays = random_rays(1.f);
+    for (Ray &r : rays) {
+      Vec3 a = 0.5f * (r.origin() + Vec3(1.f, 1.f, 1.f));
+      Vec3 b = 0.5f * (make_unit_vector(r.direction()) + Vec3(1.f, 1.f, 1.f));
+      Vec3 origin = bounds.min() + a * extent;
+      r = Ray(origin, bounds.min() + b * extent - origin);
+    }
+    const Hitable *structures[2] = {&bvh, &grid};
+    for (int k = 0; k < 2; k++) {
+      const Hitable *as = structures[k];
+      suite.run(names[2 + k], [&](uint64_t ops) {
+        HitRecord rec;
+        int hits = 0;
+        for (uint64_t i = 0; i < ops; i++) {
+          hits += as->hit(rays[i % BENCHMARK_INPUTS], SHADOW_BIAS, MAXFLOAT,
+                          rec);
+        }
+        benchmark_sink = static_cast<float>(hits);
+        return ops;
+      });
+    }
+    bvh.release();
+    grid.release();
+    delete world;
+  }
+}
+
+// _____________________________________________________________________________
+void render_benchmarks(BenchmarkSuite &suite) {
+  // Small images of the built-in scenes, seen by the renderer's camera
+  int nx = 160;
+  int ny = 120;
+  int ns = 4;
+  Camera cam(Vec3(13.f, 2.f, 3.f), Vec3(0.f, 0.f, 0.f), Vec3(0.f, 1.f, 0.f),
+             20.f, static_cast<float>(nx) / ny, 0.f, 10.f, 0.f, 1.f);
+  std::vector<std::pair<std::string, std::function<Hitable*()>>> scenes = {
+      {"checker", two_spheres_checker},
+      {"cover", cover_scene},
+      {"some", some_spheres},
+      {"forest", []() { return forest_scene(5000); }},
+      {"motion", motion_scene}};
+  for (auto &scene : scenes) {
+    std::string name = "render/" + scene.first;
+    bool specialized = suite.enabled(name);
+    bool general = suite.enabled(name + "/general");
+    if (!specialized && !general) continue;
+    seed_random(3);
+    Hitable *world = scene.second();
+    RayCounter counter(world);
+    Image image(nx, ny);
+    // The kernel specialized on the scene's materials, and for comparison
+    // the one handling all materials
+    const RenderKernel *kernels[2] = {
+        &select_render_kernel(world->material_types()),
+        &general_render_kernel()};
+    for (int k = 0; k < 2; k++) {
+      if (!(k == 0 ? specialized : general)) continue;
+      suite.run(k == 0 ? name : name + "/general", [&](uint64_t ops) {
+        uint64_t rays = counter.rays();
+        for (uint64_t i = 0; i < ops; i++) {
+          render_image(cam, &counter, ns, image, &global_thread_pool(), i,
+                       nullptr, kernels[k]);
+        }
+        return counter.rays() - rays;
+      });
+    }
+    delete world;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  std::string filter;
+  std::string json_file;
+  double min_seconds = 0.2;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg.rfind("--filter=", 0) == 0) {
+      filter = arg.substr(9);
+    } else if (arg.rfind("--min-time=", 0) == 0) {
+      min_seconds = std::stod(arg.substr(11));
+    } else if (arg.rfind("--json=", 0) == 0) {
+      json_file = arg.substr(7);
+    } else if (arg == "--accuracy") {
+      return check_math_accuracy() ? 0 : 1;
+    }
+  }
+
+  BenchmarkSuite suite(filter, min_seconds);
+  suite.print_header();
+  primitive_benchmarks(suite);
+  vector_benchmarks(suite);
+  math_benchmarks(suite);
+  sampling_benchmarks(suite);
+  bvh_benchmarks(suite);
+  accel_benchmarks(suite);
+  render_benchmarks(suite);
+
+  if (!json_file.empty() && !suite.write_json(json_file)) {
+    std::cout << "Could not write " << json_file << std::endl;
+    return 1;
+  }
+  return 0;
+}
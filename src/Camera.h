@@ -20,12 +20,15 @@ class Camera {
    * vertical_fov is the vertical field of view in degrees.
    * aspect_ratio is just the aspect ratio between the image plane's
    * width and height.
+   * time0 and time1 define the shutter interval; rays get a random time
+   * inside it.
    */
   Camera(const Vec3 &lookfrom,
          const Vec3 &lookat,
          const Vec3 &up_vector,
          float vertical_fov, float aspect_ratio,
-         float lens_radius, float focus_distance);
+         float lens_radius, float focus_distance,
+         float time0 = 0.f, float time1 = 0.f);
 
   inline Ray get_ray(float u, float v) const;
 
@@ -37,6 +40,8 @@ class Camera {
   Vec3 _u, _v, _w;
   float _lens_radius;  // lens radius
   float _focus_distance;
+  float _time0;  // shutter open
+  float _time1;  // shutter close
 };
 
 // _____________________________________________________________________________
@@ -44,7 +49,8 @@ Camera::Camera(const Vec3 &lookfrom,
                const Vec3 &lookat,
                const Vec3 &up_vector,
                float vertical_fov, float aspect_ratio,
-               float lens_radius, float focus_distance) {
+               float lens_radius, float focus_distance,
+               float time0, float time1) {
   // Convert the field of view to radians
   float theta = vertical_fov * (M_PI / 180.f);
 
@@ -55,6 +61,8 @@ Camera::Camera(const Vec3 &lookfrom,
   // Set lens radius and focus distance
   _lens_radius = lens_radius;
   _focus_distance = focus_distance;
+  _time0 = time0;
+  _time1 = time1;
 
   // Compute camera's orthonormal basis
   _w = make_unit_vector(lookfrom - lookat);
@@ -81,9 +89,17 @@ Ray Camera::get_ray(float s, float t) const {
   // Compute offset vector
   Vec3 offset = lens_x*_lens_radius*_u + lens_y*_lens_radius*_v;
 
+  // Get point in time inside the shutter interval; a closed shutter doesn't
+  // use up a random number
+  float time = _time0;
+  if (_time1 > _time0) {
+    time += get_random_in_range(0.f, 1.f) * (_time1 - _time0);
+  }
+
   return Ray(_origin + offset,
              _lower_left_corner + s*_horizontal + t*_vertical
-             - _origin - offset);
+             - _origin - offset,
+             time);
 }
 
 #endif  // SRC_CAMERA_H_
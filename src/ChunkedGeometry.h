@@ -0,0 +1,721 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_CHUNKEDGEOMETRY_H_
+#define SRC_CHUNKEDGEOMETRY_H_
+
+#include <fcntl.h>   // open, posix_fadvise
+#include <unistd.h>  // pread, close
+
+#include <algorithm>  // min, max, sort
+#include <cstdint>
+#include <cstdio>     // FILE, remove
+#include <cstdlib>    // mkstemp
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "AABB.h"
+#include "Hitable.h"
+#include "LinearBVHNode.h"
+#include "BVHBuilder.h"
+#include "Material.h"
+#include "ParticleSet.h"
+#include "Ray.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "Utils.h"
+#include "Vec3.h"
+
+// Definitions
+// "MWRC" in little endian
+#define CHUNK_FILE_MAGIC 0x4352574du
+#define CHUNK_FILE_VERSION 1u
+// Default number of particles per chunk, about 1 MB of particles and BVH
+#define CHUNK_PARTICLES (1 << 16)
+// Buckets per axis, into which the conversion distributes the particles
+#define CHUNK_BUCKETS 4
+// Rays intersected by one task
+#define CHUNK_RAY_BLOCK 256
+
+/**
+ * Header of a chunk file. It is followed by the data of the chunks and the
+ * table of the chunks at table_offset, one ChunkRecord per chunk.
+ */
+struct ChunkFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t count;
+  uint64_t table_offset;
+};
+
+/**
+ * Entry of the chunk table: the box of the chunk, and where its data is.
+ * The data are the BVH nodes followed by the clusters of particles (see
+ * build_particle_clusters), in the byte order of the machine.
+ */
+struct ChunkRecord {
+  float min[3];
+  float max[3];
+  uint64_t offset;
+  // Particles without the padding of the clusters
+  uint32_t count;
+  // Particles with the padding
+  uint32_t clusters;
+  uint32_t nodes;
+  uint32_t reserved;
+
+  inline AABB box() const {
+    return AABB(Vec3(min[0], min[1], min[2]), Vec3(max[0], max[1], max[2]));
+  }
+  inline size_t bytes() const {
+    return nodes * sizeof(LinearBVHNode) + clusters * sizeof(Particle);
+  }
+};
+
+static_assert(sizeof(ChunkRecord) == 48, "ChunkRecord should be 48 bytes");
+
+/**
+ * Chunks of a chunk file in memory, at most up to a budget of bytes. A chunk
+ * is loaded, when it is acquired, and the least recently acquired chunks are
+ * dropped, until the rest fits into the budget; the chunk, which was just
+ * acquired, always stays.
+ * The cache isn't thread-safe: it is only used by the thread scheduling the
+ * chunks (see ChunkedScene::intersect), while the rays are intersected with
+ * a chunk on the other threads.
+ */
+class ChunkCache {
+ public:
+  ChunkCache() = delete;
+  // The palette stays owned by the caller and has to outlive the cache
+  ChunkCache(int fd, const std::vector<ChunkRecord> &chunks,
+             size_t budget, const std::vector<Material*> &palette);
+  ChunkCache(const ChunkCache &c) = delete;
+  ChunkCache& operator=(const ChunkCache &c) = delete;
+  ~ChunkCache();
+
+  // The chunk, if it is in memory, nullptr otherwise
+  inline const ParticleSet* resident(int chunk) const { return _sets[chunk]; }
+  // The chunk, loaded from the file, if it isn't in memory
+  const ParticleSet* acquire(int chunk);
+  // Ask the kernel to read the chunk in the background
+  void prefetch(int chunk) const;
+
+  inline size_t budget() const { return _budget; }
+  inline size_t resident_bytes() const { return _resident_bytes; }
+  inline int resident_count() const { return static_cast<int>(_lru.size()); }
+  // Loads and bytes read since the cache was created
+  inline int64_t loads() const { return _loads; }
+  inline int64_t loaded_bytes() const { return _loaded_bytes; }
+
+ private:
+  ParticleSet* load(int chunk) const;
+  void evict();
+
+  int _fd;
+  const std::vector<ChunkRecord> &_chunks;
+  size_t _budget;
+  const std::vector<Material*> &_palette;
+  std::vector<ParticleSet*> _sets;
+  // Resident chunks, the least recently acquired first
+  std::list<int> _lru;
+  std::vector<std::list<int>::iterator> _where;
+  size_t _resident_bytes{0};
+  int64_t _loads{0};
+  int64_t _loaded_bytes{0};
+};
+
+/**
+ * Particles of a chunk file, which may be much larger than the memory. The
+ * chunks are spatially compact pieces of the particles with a BVH of their
+ * own; a top-level BVH over their boxes stays in memory, while the chunks
+ * are paged in by a ChunkCache with a fixed budget.
+ * A ray, which reaches a chunk not in memory, can't wait for it, so rays
+ * aren't intersected one by one: they are submitted and queued at the first
+ * chunk, whose box they enter. The queues of the chunks in memory are worked
+ * off first, and a chunk is only read, when none of the rays can go on
+ * without; then the chunk with the most rays waiting is read. Meanwhile the
+ * caller shades the finished rays and submits new ones, so that the rays of
+ * many bounces pile up in front of a chunk, and a read is shared by as many
+ * rays as the caller keeps in flight.
+ */
+class ChunkedScene {
+ public:
+  // Closest hit of a submitted ray
+  struct Result {
+    int id;
+    bool hit;
+    HitRecord rec;
+  };
+
+  ChunkedScene() = delete;
+  /**
+   * Chunks from the chunk file at path, with at most about cache_bytes of
+   * them in memory. The palette stays owned by the caller and has to
+   * outlive the scene. The scene isn't open, if the file can't be read or
+   * its table doesn't fit the file.
+   */
+  ChunkedScene(const char *path, size_t cache_bytes,
+               const std::vector<Material*> &palette);
+  ChunkedScene(const ChunkedScene &s) = delete;
+  ChunkedScene& operator=(const ChunkedScene &s) = delete;
+  ~ChunkedScene();
+
+  inline bool is_open() const { return _cache != nullptr; }
+  inline int chunk_count() const { return static_cast<int>(_chunks.size()); }
+  inline const AABB& bounds() const { return _bounds; }
+  inline int64_t particle_count() const { return _particle_count; }
+  // Bytes of all the chunks in the file
+  inline int64_t data_bytes() const { return _data_bytes; }
+  inline const ChunkCache& cache() const { return *_cache; }
+  // Queues of rays worked off so far
+  inline int64_t chunk_batches() const { return _batches; }
+  // Submitted rays, which aren't finished yet
+  inline int pending() const { return _pending; }
+  // The last ray submitted with the id
+  inline const Ray& ray(int id) const { return _rays[id].ray; }
+
+  /**
+   * Submit the rays rays[k] with the ids ids[k] (small integers, which
+   * aren't pending) to be intersected with the particles in [t_min,
+   * t_max[k]]. The closest hit so far of other geometry is passed in with
+   * t_max[k], rec[k] and hit[k], and is the result, unless a particle is
+   * hit in front of it. The boxes of the chunks are tested on the pool.
+   */
+  void submit(const std::vector<int> &ids,
+              const std::vector<Ray> &rays,
+              float t_min,
+              const std::vector<float> &t_max,
+              const std::vector<HitRecord> &rec,
+              const std::vector<uint8_t> &hit,
+              ThreadPool *pool);
+
+  /**
+   * Work off the queues of the chunks in memory, then, if no ray is
+   * finished, read the chunk with the most rays waiting, until rays are
+   * finished or none is pending. The finished rays are appended to
+   * finished. The rays are intersected on the pool (serially without a
+   * pool).
+   */
+  void resolve(std::vector<Result> &finished, ThreadPool *pool);
+
+ private:
+  // Chunk, whose box a ray enters at t
+  struct Candidate {
+    float t;
+    int chunk;
+  };
+
+  struct PendingRay {
+    Ray ray;
+    float t_min;
+    float t_max;
+    bool hit;
+    HitRecord rec;
+    // Front to back
+    std::vector<Candidate> candidates;
+    int cursor;
+  };
+
+  // Chunk with the most rays waiting, only among the ones in memory, if
+  // resident is set; -1, if there is none
+  int largest_queue(bool resident) const;
+  // Intersect the queue of the chunk with it, and move the rays on
+  void work_off(int chunk, std::vector<Result> &finished, ThreadPool *pool);
+  // Queue the ray at its next candidate before its closest hit, or finish it
+  void advance(int id, std::vector<Result> &finished);
+
+  int _fd{-1};
+  std::vector<ChunkRecord> _chunks;
+  // Top-level BVH over the boxes of the chunks
+  std::vector<LinearBVHNode> _nodes;
+  std::vector<int32_t> _indices;
+  AABB _bounds;
+  int64_t _particle_count{0};
+  int64_t _data_bytes{0};
+  ChunkCache *_cache{nullptr};
+  // Submitted rays by their id, and the ids waiting at every chunk
+  std::vector<PendingRay> _rays;
+  std::vector<std::vector<int>> _queues;
+  // Rays finished, when they were submitted
+  std::vector<Result> _finished;
+  int _pending{0};
+  int64_t _batches{0};
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Convert the particle file at particle_path into the chunk file at
+ * chunk_path with chunks of up to chunk_particles particles. The particles
+ * are fitted into [-1, 1] x [0, 2] x [-1, 1] like in the particle scene (see
+ * fit_particle).
+ * The particles are streamed twice from the file: once for their bounds,
+ * and once to distribute them by their centers into CHUNK_BUCKETS^3
+ * buckets in temporary files next to the chunk file, which has to have room
+ * for the particles anyway ($TMPDIR is often a small in-memory file
+ * system). Each bucket is then
+ * sorted along a Morton curve and cut into chunks, so only a bucket has to
+ * fit into the memory, not the whole file.
+ * Returns false, if a file can't be read or written; a partially written
+ * chunk file is removed.
+ */
+bool convert_particles_to_chunks(const char *particle_path,
+                                 const char *chunk_path,
+                                 int chunk_particles,
+                                 ThreadPool *pool);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+// Temporary file in the directory dir, which is removed, when it's closed
+inline FILE* temporary_file(const std::string &dir) {
+  std::string path = dir + "/chunks-XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) return nullptr;
+  unlink(path.c_str());
+  FILE *f = fdopen(fd, "w+b");
+  if (f == nullptr) close(fd);
+  return f;
+}
+
+// _____________________________________________________________________________
+bool convert_particles_to_chunks(const char *particle_path,
+                                 const char *chunk_path,
+                                 int chunk_particles,
+                                 ThreadPool *pool) {
+  TRACE_SCOPE("convert_particles_to_chunks");
+  std::ifstream in(particle_path, std::ios::binary);
+  ParticleFileHeader header;
+  if (!in || !in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      header.magic != PARTICLE_FILE_MAGIC ||
+      header.version != PARTICLE_FILE_VERSION) {
+    return false;
+  }
+  std::streamoff begin = in.tellg();
+  chunk_particles = std::max(chunk_particles, PARTICLE_CLUSTER_SIZE);
+
+  // Call visit with every particle of the file, a block at a time
+  std::vector<Particle> block(1 << 16);
+  auto stream = [&](auto visit) {
+    in.clear();
+    in.seekg(begin);
+    for (uint64_t done = 0; done < header.count;) {
+      size_t n = static_cast<size_t>(
+          std::min<uint64_t>(block.size(), header.count - done));
+      if (!in.read(reinterpret_cast<char*>(block.data()),
+                   n * sizeof(Particle))) {
+        return false;
+      }
+      for (size_t i = 0; i < n; i++) visit(block[i]);
+      done += n;
+    }
+    return true;
+  };
+
+  // Bounds of the particles, and of their centers for the buckets
+  AABB bounds;
+  AABB centers;
+  bool ok = stream([&](const Particle &p) {
+    bounds.extend(particle_box(p));
+    centers.extend(Vec3(p.center[0], p.center[1], p.center[2]));
+  });
+  if (!ok) return false;
+
+  std::vector<FILE*> buckets(CHUNK_BUCKETS * CHUNK_BUCKETS * CHUNK_BUCKETS);
+  std::string bucket_dir = parent_directory(chunk_path);
+  for (FILE *&f : buckets) {
+    ok = ok && (f = temporary_file(bucket_dir)) != nullptr;
+  }
+  if (!ok) {
+    std::cout << "Could not create the temporary bucket files in "
+              << bucket_dir << std::endl;
+  }
+  Vec3 extent = centers.max() - centers.min();
+  if (ok) {
+    bool written = true;
+    ok = stream([&](Particle p) {
+      int b = 0;
+      for (int a = 2; a >= 0; a--) {
+        float x = extent[a] > 0.f
+            ? (p.center[a] - centers.min()[a]) / extent[a] : 0.f;
+        int cell = std::min(static_cast<int>(x * CHUNK_BUCKETS),
+                            CHUNK_BUCKETS - 1);
+        b = b * CHUNK_BUCKETS + cell;
+      }
+      fit_particle(p, bounds);
+      written = written && fwrite(&p, sizeof(Particle), 1, buckets[b]) == 1;
+    });
+    // Write errors may only show up, when the buffers are flushed
+    for (FILE *f : buckets) written = written && fflush(f) == 0;
+    if (!written) {
+      std::cout << "Could not write the temporary bucket files" << std::endl;
+      ok = false;
+    }
+  }
+
+  // Cut the buckets into chunks and write them out, followed by the table
+  std::ofstream out(chunk_path, std::ios::binary);
+  bool created = out.is_open();
+  ChunkFileHeader chunk_header{CHUNK_FILE_MAGIC, CHUNK_FILE_VERSION, 0, 0};
+  out.write(reinterpret_cast<const char*>(&chunk_header),
+            sizeof(chunk_header));
+  std::vector<ChunkRecord> table;
+  uint64_t offset = sizeof(chunk_header);
+  for (FILE *f : buckets) {
+    if (!ok || !out) break;
+    std::vector<Particle> particles(static_cast<size_t>(ftell(f))
+                                    / sizeof(Particle));
+    rewind(f);
+    if (fread(particles.data(), sizeof(Particle), particles.size(), f)
+        != particles.size()) {
+      ok = false;
+      break;
+    }
+    std::vector<int32_t> order = morton_order(particles, pool);
+    for (size_t first = 0; first < particles.size();
+         first += chunk_particles) {
+      size_t n = std::min(particles.size() - first,
+                          static_cast<size_t>(chunk_particles));
+      std::vector<Particle> chunk(n);
+      for (size_t i = 0; i < n; i++) chunk[i] = particles[order[first + i]];
+      std::vector<Particle> clusters;
+      std::vector<LinearBVHNode> nodes;
+      build_particle_clusters(std::move(chunk), pool, clusters, nodes);
+
+      ChunkRecord record;
+      for (int a = 0; a < 3; a++) {
+        record.min[a] = nodes[0].min[a];
+        record.max[a] = nodes[0].max[a];
+      }
+      record.offset = offset;
+      record.count = static_cast<uint32_t>(n);
+      record.clusters = static_cast<uint32_t>(clusters.size());
+      record.nodes = static_cast<uint32_t>(nodes.size());
+      record.reserved = 0;
+      out.write(reinterpret_cast<const char*>(nodes.data()),
+                nodes.size() * sizeof(LinearBVHNode));
+      out.write(reinterpret_cast<const char*>(clusters.data()),
+                clusters.size() * sizeof(Particle));
+      offset += record.bytes();
+      table.push_back(record);
+    }
+  }
+  for (FILE *f : buckets) {
+    if (f != nullptr) fclose(f);
+  }
+
+  if (ok) {
+    out.write(reinterpret_cast<const char*>(table.data()),
+              table.size() * sizeof(ChunkRecord));
+    chunk_header.count = table.size();
+    chunk_header.table_offset = offset;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&chunk_header),
+              sizeof(chunk_header));
+    out.close();
+    if (!out) {
+      std::cout << "Could not write " << chunk_path << std::endl;
+      ok = false;
+    }
+  }
+  // Don't leave a truncated chunk file behind
+  if (!ok && created) {
+    out.close();
+    remove(chunk_path);
+  }
+  return ok;
+}
+
+// _____________________________________________________________________________
+ChunkCache::ChunkCache(int fd, const std::vector<ChunkRecord> &chunks,
+                       size_t budget, const std::vector<Material*> &palette)
+    : _fd(fd), _chunks(chunks), _budget(budget), _palette(palette),
+      _sets(chunks.size(), nullptr), _where(chunks.size(), _lru.end()) {}
+
+// _____________________________________________________________________________
+ChunkCache::~ChunkCache() {
+  for (ParticleSet *s : _sets) delete s;
+}
+
+// _____________________________________________________________________________
+ParticleSet* ChunkCache::load(int chunk) const {
+  TRACE_SCOPE("load_chunk", "chunk", chunk);
+  const ChunkRecord &record = _chunks[chunk];
+  std::vector<LinearBVHNode> nodes(record.nodes);
+  std::vector<Particle> clusters(record.clusters);
+  // Read in pieces, pread may return less than asked for
+  auto read = [this](void *data, size_t bytes, uint64_t offset) {
+    char *p = static_cast<char*>(data);
+    while (bytes > 0) {
+      ssize_t n = pread(_fd, p, bytes, static_cast<off_t>(offset));
+      if (n <= 0) return false;
+      p += n;
+      bytes -= static_cast<size_t>(n);
+      offset += static_cast<uint64_t>(n);
+    }
+    return true;
+  };
+  size_t node_bytes = nodes.size() * sizeof(LinearBVHNode);
+  if (!read(nodes.data(), node_bytes, record.offset) ||
+      !read(clusters.data(), clusters.size() * sizeof(Particle),
+            record.offset + node_bytes)) {
+    // An empty set, so that a broken chunk is only missing in the image
+    nodes.clear();
+    clusters.clear();
+  } else if (!bvh_valid(nodes.data(), static_cast<int>(nodes.size()),
+                        static_cast<int>(record.clusters
+                                         / PARTICLE_CLUSTER_SIZE))) {
+    // The traversal would leave the arrays or overflow its stack, so build
+    // the BVH again; the padding particles only repeat others
+    std::cout << "Rebuilding the broken BVH of chunk " << chunk << std::endl;
+    std::vector<Particle> particles = std::move(clusters);
+    build_particle_clusters(std::move(particles), nullptr, clusters, nodes);
+  }
+  return new ParticleSet(std::move(clusters), std::move(nodes),
+                         static_cast<int>(record.count), _palette);
+}
+
+// _____________________________________________________________________________
+void ChunkCache::evict() {
+  // Keep the most recently acquired chunk, even if it alone is too large
+  while (_lru.size() > 1 && _resident_bytes > _budget) {
+    int chunk = _lru.front();
+    _lru.pop_front();
+    _where[chunk] = _lru.end();
+    _resident_bytes -= _chunks[chunk].bytes();
+    delete _sets[chunk];
+    _sets[chunk] = nullptr;
+  }
+}
+
+// _____________________________________________________________________________
+const ParticleSet* ChunkCache::acquire(int chunk) {
+  if (_sets[chunk] != nullptr) {
+    // Most recently used now
+    _lru.splice(_lru.end(), _lru, _where[chunk]);
+    return _sets[chunk];
+  }
+  _sets[chunk] = load(chunk);
+  _where[chunk] = _lru.insert(_lru.end(), chunk);
+  _resident_bytes += _chunks[chunk].bytes();
+  _loads++;
+  _loaded_bytes += static_cast<int64_t>(_chunks[chunk].bytes());
+  evict();
+  return _sets[chunk];
+}
+
+// _____________________________________________________________________________
+void ChunkCache::prefetch(int chunk) const {
+  const ChunkRecord &record = _chunks[chunk];
+  posix_fadvise(_fd, static_cast<off_t>(record.offset),
+                static_cast<off_t>(record.bytes()), POSIX_FADV_WILLNEED);
+}
+
+// _____________________________________________________________________________
+ChunkedScene::ChunkedScene(const char *path, size_t cache_bytes,
+                           const std::vector<Material*> &palette) {
+  _fd = open(path, O_RDONLY);
+  if (_fd < 0) return;
+  ChunkFileHeader header;
+  if (pread(_fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic != CHUNK_FILE_MAGIC ||
+      header.version != CHUNK_FILE_VERSION) {
+    return;
+  }
+  // Check the size first, so that a broken header can't allocate too much
+  off_t size = lseek(_fd, 0, SEEK_END);
+  if (size < 0 || header.table_offset > static_cast<uint64_t>(size) ||
+      (static_cast<uint64_t>(size) - header.table_offset) / sizeof(ChunkRecord)
+          < header.count) {
+    return;
+  }
+  _chunks.resize(header.count);
+  size_t table_bytes = _chunks.size() * sizeof(ChunkRecord);
+  if (pread(_fd, _chunks.data(), table_bytes,
+            static_cast<off_t>(header.table_offset))
+      != static_cast<ssize_t>(table_bytes)) {
+    return;
+  }
+  // The records must describe whole clusters with a tree over them, which
+  // lie between the header and the table
+  for (const ChunkRecord &c : _chunks) {
+    uint64_t cluster_count = c.clusters / PARTICLE_CLUSTER_SIZE;
+    if (c.count == 0 || c.clusters % PARTICLE_CLUSTER_SIZE != 0 ||
+        cluster_count != (c.count + PARTICLE_CLUSTER_SIZE - 1)
+                         / PARTICLE_CLUSTER_SIZE ||
+        c.nodes == 0 || c.nodes >= 2 * cluster_count ||
+        c.offset < sizeof(header) || c.offset > header.table_offset ||
+        c.bytes() > header.table_offset - c.offset) {
+      _chunks.clear();
+      return;
+    }
+  }
+
+  std::vector<AABB> boxes;
+  for (const ChunkRecord &c : _chunks) {
+    boxes.push_back(c.box());
+    _bounds.extend(c.box());
+    _particle_count += c.count;
+    _data_bytes += static_cast<int64_t>(c.bytes());
+  }
+  if (!boxes.empty()) {
+    BVHBuildResult bvh = build_binned_sah(boxes, nullptr);
+    _nodes = std::move(bvh.nodes);
+    _indices = std::move(bvh.indices);
+  }
+  _queues.resize(_chunks.size());
+  _cache = new ChunkCache(_fd, _chunks, cache_bytes, palette);
+}
+
+// _____________________________________________________________________________
+ChunkedScene::~ChunkedScene() {
+  delete _cache;
+  if (_fd >= 0) close(_fd);
+}
+
+// _____________________________________________________________________________
+int ChunkedScene::largest_queue(bool resident) const {
+  int best = -1;
+  for (int c = 0; c < chunk_count(); c++) {
+    if (_queues[c].empty() ||
+        (resident && _cache->resident(c) == nullptr)) {
+      continue;
+    }
+    if (best < 0 || _queues[c].size() > _queues[best].size()) best = c;
+  }
+  return best;
+}
+
+// _____________________________________________________________________________
+void ChunkedScene::advance(int id, std::vector<Result> &finished) {
+  PendingRay &r = _rays[id];
+  // The candidates are sorted, so there's no closer one after a candidate
+  // behind the hit
+  if (r.cursor < static_cast<int>(r.candidates.size()) &&
+      r.candidates[r.cursor].t < r.t_max) {
+    _queues[r.candidates[r.cursor].chunk].push_back(id);
+    return;
+  }
+  finished.push_back({id, r.hit, r.rec});
+  _pending--;
+}
+
+// _____________________________________________________________________________
+void ChunkedScene::submit(const std::vector<int> &ids,
+                          const std::vector<Ray> &rays,
+                          float t_min,
+                          const std::vector<float> &t_max,
+                          const std::vector<HitRecord> &rec,
+                          const std::vector<uint8_t> &hit,
+                          ThreadPool *pool) {
+  int n = static_cast<int>(ids.size());
+  for (int id : ids) {
+    if (id >= static_cast<int>(_rays.size())) _rays.resize(id + 1);
+  }
+  // Find the chunks, whose boxes each ray enters before its closest hit so
+  // far, front to back
+  auto find_candidates = [&](int block) {
+    int end = std::min(n, (block + 1) * CHUNK_RAY_BLOCK);
+    for (int k = block * CHUNK_RAY_BLOCK; k < end; k++) {
+      PendingRay &r = _rays[ids[k]];
+      r.ray = rays[k];
+      r.t_min = t_min;
+      r.t_max = t_max[k];
+      r.hit = hit[k] != 0;
+      r.rec = rec[k];
+      r.candidates.clear();
+      r.cursor = 0;
+      if (_nodes.empty()) continue;
+      float closest = r.t_max;
+      traverse_bvh(_nodes.data(), r.ray, t_min, closest,
+          [&](int offset, int count, float&) {
+            for (int i = offset; i < offset + count; i++) {
+              float t0 = t_min;
+              float t1 = closest;
+              if (_chunks[_indices[i]].box().hit(r.ray, t0, t1)) {
+                r.candidates.push_back({t0, _indices[i]});
+              }
+            }
+            return false;
+          });
+      std::sort(r.candidates.begin(), r.candidates.end(),
+                [](const Candidate &a, const Candidate &b) {
+                  return a.t < b.t;
+                });
+    }
+  };
+  int blocks = (n + CHUNK_RAY_BLOCK - 1) / CHUNK_RAY_BLOCK;
+  if (pool != nullptr) {
+    pool->parallel_for(blocks, find_candidates);
+  } else {
+    for (int block = 0; block < blocks; block++) find_candidates(block);
+  }
+  _pending += n;
+  for (int id : ids) advance(id, _finished);
+}
+
+// _____________________________________________________________________________
+void ChunkedScene::work_off(int chunk, std::vector<Result> &finished,
+                            ThreadPool *pool) {
+  std::vector<int> batch;
+  batch.swap(_queues[chunk]);
+  _batches++;
+  const ParticleSet *set = _cache->acquire(chunk);
+  // Start reading the chunk, which will probably be read next, while this
+  // one is traced
+  int next = -1;
+  for (int c = 0; c < chunk_count(); c++) {
+    if (!_queues[c].empty() && _cache->resident(c) == nullptr &&
+        (next < 0 || _queues[c].size() > _queues[next].size())) {
+      next = c;
+    }
+  }
+  if (next >= 0) _cache->prefetch(next);
+
+  int n = static_cast<int>(batch.size());
+  TRACE_SCOPE("chunk_batch", "chunk", chunk, "rays", n);
+  auto intersect = [&](int block) {
+    int end = std::min(n, (block + 1) * CHUNK_RAY_BLOCK);
+    for (int k = block * CHUNK_RAY_BLOCK; k < end; k++) {
+      PendingRay &r = _rays[batch[k]];
+      HitRecord temp_rec;
+      if (set->hit(r.ray, r.t_min, r.t_max, temp_rec)) {
+        r.t_max = temp_rec.t;
+        r.rec = temp_rec;
+        r.hit = true;
+      }
+      r.cursor++;
+    }
+  };
+  int blocks = (n + CHUNK_RAY_BLOCK - 1) / CHUNK_RAY_BLOCK;
+  if (pool != nullptr) {
+    pool->parallel_for(blocks, intersect);
+  } else {
+    for (int block = 0; block < blocks; block++) intersect(block);
+  }
+  for (int id : batch) advance(id, finished);
+}
+
+// _____________________________________________________________________________
+void ChunkedScene::resolve(std::vector<Result> &finished, ThreadPool *pool) {
+  finished.insert(finished.end(), _finished.begin(), _finished.end());
+  _finished.clear();
+  while (_pending > 0) {
+    // The rays, which can go on without a read, first
+    int chunk = largest_queue(true);
+    if (chunk < 0) {
+      if (!finished.empty()) return;
+      chunk = largest_queue(false);
+    }
+    work_off(chunk, finished, pool);
+  }
+}
+
+#endif  // SRC_CHUNKEDGEOMETRY_H_
@@ -10,9 +10,11 @@
 class Dialectic: public Material {
  public:
   Dialectic() = delete;
-  explicit Dialectic(float ri) : _refraction_index(ri) {}
+  explicit Dialectic(float ri)
+      : Material(MATERIAL_DIALECTIC), _refraction_index(ri) {}
 
   inline float reflective_index() const { return _refraction_index; }
+
   virtual bool scatter(const Ray &r,
                        const HitRecord &rec,
                        Vec3 &attenuation,
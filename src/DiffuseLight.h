@@ -9,10 +9,12 @@
 
 class DiffuseLight: public Material {
  public:
-  DiffuseLight() = default;
-  explicit DiffuseLight(Texture *t) : _emit(t) {}
+  DiffuseLight() : Material(MATERIAL_DIFFUSE_LIGHT) {}
+  explicit DiffuseLight(Texture *t)
+      : Material(MATERIAL_DIFFUSE_LIGHT), _emit(t) {}
   ~DiffuseLight() { delete _emit; }
 
+
   virtual bool scatter(const Ray &r,
                        const HitRecord &rec,
                        Vec3 &attenuation,
@@ -0,0 +1,588 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_DISTRIBUTED_H_
+#define SRC_DISTRIBUTED_H_
+
+#include <netdb.h>       // getaddrinfo
+#include <netinet/in.h>  // sockaddr_in
+#include <poll.h>
+#include <signal.h>      // kill
+#include <sys/socket.h>
+#include <sys/wait.h>    // waitpid
+#include <unistd.h>      // fork, close
+
+#include <algorithm>  // min
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>    // memset, memcpy
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "BVHCache.h"
+#include "Camera.h"
+#include "Hitable.h"
+#include "Ray.h"
+#include "Renderer.h"
+#include "RenderKernel.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "Utils.h"
+#include "Vec3.h"
+
+// Definitions
+// Side length of the square tiles, which are sent to the workers
+#define DISTRIBUTED_TILE_SIZE 64
+#define DISTRIBUTED_MAGIC 0x3152574du  // "MWR1"
+
+/**
+ * Rendering of one image by several worker processes: local ones, which
+ * are forked from the coordinator and talk to it over a socket pair, and
+ * remote ones (e.g. another machine or another process on localhost),
+ * which build the same scene from the same command line and connect to it
+ * over TCP.
+ * The image is split into chunks: a tile of the image and a block of
+ * consecutive samples. A worker returns the per-pixel sums of the samples
+ * of a chunk, and the coordinator adds the blocks of a tile in the order of
+ * the samples. Every pixel seeds the random number generator per block,
+ * so a chunk doesn't depend on the process, which rendered it, and the
+ * image is the same for any number of workers (it only depends on the
+ * number of samples per block). With a single block it is the image of
+ * render_image.
+ * The chunks of a worker, which closes its connection or doesn't answer
+ * in time, are given to the other workers. Without workers, the
+ * coordinator renders the chunks itself.
+ * The messages are raw structs in the byte order of the machine, so all
+ * the processes have to run on the same architecture.
+ */
+
+// Sent by the coordinator to every new worker
+struct RenderJob {
+  uint32_t magic;
+  int32_t width;
+  int32_t height;
+  int32_t ns;
+  uint64_t seed;
+  // scene_fingerprint of the coordinator's world and camera
+  uint64_t scene;
+};
+
+// Request of the coordinator; the answer repeats it, followed by
+// 3 * (x1 - x0) * (y1 - y0) floats, the sums of the rows of the tile
+struct RenderChunk {
+  uint32_t id;
+  // Tile in image coordinates (row 0 is the top row), x1 and y1 exclusive
+  int32_t x0;
+  int32_t y0;
+  int32_t x1;
+  int32_t y1;
+  // Block of samples [s0, s1) with index block
+  int32_t block;
+  int32_t s0;
+  int32_t s1;
+};
+
+struct DistributedOptions {
+  // Number of worker processes to fork
+  int local_workers{0};
+  // TCP port, on which remote workers are accepted; < 0 for none
+  int listen_port{-1};
+  // Samples per block; <= 0 puts all samples in one block
+  int block_samples{0};
+  // A worker, which doesn't answer a chunk in time, is dropped
+  int timeout_seconds{120};
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Render the world with the camera c into image, which defines the size,
+ * with ns samples per pixel on the workers given by the options (see
+ * above). The paths are traced with kernel, by default with the kernel
+ * specialized on the material types of the world.
+ * Returns false, if a socket cannot be set up.
+ */
+bool render_distributed(const Camera &c,
+                        Hitable *world,
+                        int ns,
+                        Image &image,
+                        const DistributedOptions &options,
+                        uint64_t seed = 0,
+                        const RenderKernel *kernel = nullptr);
+
+/**
+ * Render the chunks requested over the connected socket fd, until the
+ * coordinator closes it. The tiles are split across the pool (serially
+ * without a pool).
+ * Returns false, if the connection failed or the job is invalid, e.g. the
+ * coordinator renders an image of another size than width x height, or
+ * another scene or view.
+ */
+bool serve_render_worker(int fd,
+                         const Camera &c,
+                         Hitable *world,
+                         int width,
+                         int height,
+                         ThreadPool *pool,
+                         const RenderKernel *kernel = nullptr);
+
+/**
+ * Hash of the world's bounding box and of a few rays of the camera c. The
+ * workers of a render build the scene from the same command line, so their
+ * fingerprints match the one of the coordinator.
+ */
+uint64_t scene_fingerprint(const Camera &c, const Hitable *world);
+
+/**
+ * Connect to the coordinator at host and port.
+ * Returns the socket or -1 on failure.
+ */
+int connect_to_coordinator(const char *host, int port);
+
+/**
+ * Sum the samples of the block of the chunk for every pixel of its tile
+ * into sums (3 floats per pixel, row by row).
+ */
+void render_chunk(const Camera &c,
+                  Hitable *world,
+                  PathKernel trace,
+                  const RenderJob &job,
+                  const RenderChunk &chunk,
+                  float *sums,
+                  ThreadPool *pool);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+// Send or receive all the bytes, retrying partial transfers
+inline bool send_all(int fd, const void *data, size_t size) {
+  const char *p = static_cast<const char*>(data);
+  while (size > 0) {
+    // A closed peer shouldn't kill the process with SIGPIPE
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// _____________________________________________________________________________
+inline bool receive_all(int fd, void *data, size_t size) {
+  char *p = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// _____________________________________________________________________________
+inline size_t chunk_floats(const RenderChunk &chunk) {
+  return 3 * static_cast<size_t>(chunk.x1 - chunk.x0)
+           * static_cast<size_t>(chunk.y1 - chunk.y0);
+}
+
+// _____________________________________________________________________________
+void render_chunk(const Camera &c,
+                  Hitable *world,
+                  PathKernel trace,
+                  const RenderJob &job,
+                  const RenderChunk &chunk,
+                  float *sums,
+                  ThreadPool *pool) {
+  TRACE_SCOPE("chunk", "x", chunk.x0, "y", chunk.y0);
+  int nx = job.width;
+  int ny = job.height;
+  int width = chunk.x1 - chunk.x0;
+  auto render_row = [&](int row) {
+    int y = chunk.y0 + row;
+    // The camera's v axis points up
+    int j = ny - 1 - y;
+    for (int i = chunk.x0; i < chunk.x1; i++) {
+      // The seed of render_image for the first block
+      uint64_t pixel_seed = job.seed * static_cast<uint64_t>(nx) * ny
+                            + j * nx + i;
+      seed_random(pixel_seed
+                  + static_cast<uint64_t>(chunk.block) * 0x9e3779b97f4a7c15ull);
+      Vec3 col{0.f, 0.f, 0.f};
+      for (int s = chunk.s0; s < chunk.s1; s++) {
+        float u = static_cast<float>((i + get_random_in_range(0.f, 1.f))
+                                     / nx);
+        float v = static_cast<float>((j + get_random_in_range(0.f, 1.f))
+                                     / ny);
+        col += trace(c.get_ray(u, v), world);
+      }
+      float *out = sums + 3 * (static_cast<size_t>(row) * width
+                               + (i - chunk.x0));
+      out[0] = col[0];
+      out[1] = col[1];
+      out[2] = col[2];
+    }
+  };
+
+  int rows = chunk.y1 - chunk.y0;
+  if (pool != nullptr) {
+    pool->parallel_for(rows, render_row);
+  } else {
+    for (int row = 0; row < rows; row++) render_row(row);
+  }
+}
+
+// _____________________________________________________________________________
+bool serve_render_worker(int fd,
+                         const Camera &c,
+                         Hitable *world,
+                         int width,
+                         int height,
+                         ThreadPool *pool,
+                         const RenderKernel *kernel) {
+  RenderJob job;
+  if (!receive_all(fd, &job, sizeof(job)) || job.magic != DISTRIBUTED_MAGIC ||
+      job.ns <= 0) {
+    return false;
+  }
+  if (job.width != width || job.height != height) {
+    std::cout << "The coordinator renders a " << job.width << "x"
+              << job.height << " image, not " << width << "x" << height
+              << std::endl;
+    return false;
+  }
+  if (job.scene != scene_fingerprint(c, world)) {
+    std::cout << "The coordinator renders another scene or view"
+              << std::endl;
+    return false;
+  }
+  if (kernel == nullptr) {
+    kernel = &select_render_kernel(world->material_types());
+  }
+  std::vector<float> sums;
+  RenderChunk chunk;
+  // The coordinator closes the connection after the last chunk
+  while (receive_all(fd, &chunk, sizeof(chunk))) {
+    if (chunk.x0 < 0 || chunk.x1 > job.width || chunk.x0 >= chunk.x1 ||
+        chunk.y0 < 0 || chunk.y1 > job.height || chunk.y0 >= chunk.y1 ||
+        chunk.s0 < 0 || chunk.s1 > job.ns || chunk.s0 >= chunk.s1) {
+      return false;
+    }
+    sums.resize(chunk_floats(chunk));
+    render_chunk(c, world, kernel->trace, job, chunk, sums.data(), pool);
+    if (!send_all(fd, &chunk, sizeof(chunk)) ||
+        !send_all(fd, sums.data(), sums.size() * sizeof(float))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// _____________________________________________________________________________
+uint64_t scene_fingerprint(const Camera &c, const Hitable *world) {
+  uint64_t hash = 14695981039346656037ull;
+  AABB box;
+  if (world->bounding_box(box)) {
+    float b[6] = {box.min().x(), box.min().y(), box.min().z(),
+                  box.max().x(), box.max().y(), box.max().z()};
+    fnv1a(hash, b, sizeof(b));
+  }
+  // The lens and the shutter take random numbers, so draw the rays from a
+  // fixed seed and leave the generator of the thread as it was
+  unsigned short state[3];
+  memcpy(state, random_state(), sizeof(state));
+  seed_random(DISTRIBUTED_MAGIC);
+  for (float s : {0.f, 0.5f, 1.f}) {
+    Ray r = c.get_ray(s, 1.f - s);
+    float v[7] = {r.origin().x(), r.origin().y(), r.origin().z(),
+                  r.direction().x(), r.direction().y(), r.direction().z(),
+                  r.time()};
+    fnv1a(hash, v, sizeof(v));
+  }
+  memcpy(random_state(), state, sizeof(state));
+  return hash;
+}
+
+// _____________________________________________________________________________
+int connect_to_coordinator(const char *host, int port) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses;
+  std::string service = std::to_string(port);
+  if (getaddrinfo(host, service.c_str(), &hints, &addresses) != 0) return -1;
+  int fd = -1;
+  for (addrinfo *a = addresses; a != nullptr; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+  return fd;
+}
+
+// _____________________________________________________________________________
+// Socket listening for remote workers on all interfaces, or -1 on failure
+inline int listen_for_workers(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(fd, 16) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// _____________________________________________________________________________
+// A connection to a worker, as seen by the coordinator
+struct WorkerConnection {
+  int fd{-1};
+  // Process id of a local worker, -1 for remote ones
+  pid_t pid{-1};
+  // Index of the chunk in flight, -1 if idle
+  int chunk{-1};
+  std::chrono::steady_clock::time_point sent;
+};
+
+// _____________________________________________________________________________
+bool render_distributed(const Camera &c,
+                        Hitable *world,
+                        int ns,
+                        Image &image,
+                        const DistributedOptions &options,
+                        uint64_t seed,
+                        const RenderKernel *kernel) {
+  TRACE_SCOPE("render", "width", image.width, "height", image.height);
+  if (kernel == nullptr) {
+    kernel = &select_render_kernel(world->material_types());
+  }
+  RenderJob job{DISTRIBUTED_MAGIC, image.width, image.height, ns, seed,
+                scene_fingerprint(c, world)};
+  int block_samples = options.block_samples > 0
+      ? std::min(options.block_samples, ns) : ns;
+  int blocks = (ns + block_samples - 1) / block_samples;
+
+  // The chunks of a tile are consecutive, in the order of their blocks
+  std::vector<RenderChunk> chunks;
+  for (int y = 0; y < image.height; y += DISTRIBUTED_TILE_SIZE) {
+    for (int x = 0; x < image.width; x += DISTRIBUTED_TILE_SIZE) {
+      for (int b = 0; b < blocks; b++) {
+        RenderChunk chunk;
+        chunk.id = static_cast<uint32_t>(chunks.size());
+        chunk.x0 = x;
+        chunk.y0 = y;
+        chunk.x1 = std::min(x + DISTRIBUTED_TILE_SIZE, image.width);
+        chunk.y1 = std::min(y + DISTRIBUTED_TILE_SIZE, image.height);
+        chunk.block = b;
+        chunk.s0 = b * block_samples;
+        chunk.s1 = std::min(ns, (b + 1) * block_samples);
+        chunks.push_back(chunk);
+      }
+    }
+  }
+  std::deque<int> queue;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    queue.push_back(static_cast<int>(i));
+  }
+
+  // Sums of the chunks, which arrived before the preceding blocks of their
+  // tile; the blocks are added in order, so the floating point sums don't
+  // depend on the order, in which the chunks arrive
+  std::vector<std::vector<float>> pending(chunks.size());
+  std::vector<bool> done(chunks.size(), false);
+  std::vector<int> next_block(chunks.size() / blocks, 0);
+  size_t merged = 0;
+  std::fill(image.pixels.begin(), image.pixels.end(), Vec3(0.f, 0.f, 0.f));
+  auto merge = [&](int index, std::vector<float> sums) {
+    if (done[index]) return;
+    done[index] = true;
+    int tile = index / blocks;
+    pending[index] = std::move(sums);
+    while (next_block[tile] < blocks &&
+           done[tile * blocks + next_block[tile]]) {
+      int ready = tile * blocks + next_block[tile];
+      const RenderChunk &chunk = chunks[ready];
+      const float *s = pending[ready].data();
+      for (int y = chunk.y0; y < chunk.y1; y++) {
+        for (int x = chunk.x0; x < chunk.x1; x++, s += 3) {
+          image.at(x, y) += Vec3(s[0], s[1], s[2]);
+        }
+      }
+      std::vector<float>().swap(pending[ready]);
+      next_block[tile]++;
+      merged++;
+    }
+  };
+
+  int listener = -1;
+  if (options.listen_port >= 0) {
+    listener = listen_for_workers(options.listen_port);
+    if (listener < 0) {
+      std::cout << "Cannot listen on port " << options.listen_port
+                << std::endl;
+      return false;
+    }
+  }
+
+  std::vector<WorkerConnection> workers;
+  for (int w = 0; w < options.local_workers; w++) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) break;
+    pid_t pid = fork();
+    if (pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      break;
+    }
+    if (pid == 0) {
+      // The threads of the coordinator don't exist in the child, so the
+      // worker renders serially and leaves without running the destructors
+      // of the coordinator's objects (e.g. its thread pool)
+      close(fds[0]);
+      if (listener >= 0) close(listener);
+      for (const WorkerConnection &other : workers) close(other.fd);
+      bool ok = serve_render_worker(fds[1], c, world, image.width,
+                                    image.height, nullptr, kernel);
+      _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    WorkerConnection worker;
+    worker.fd = fds[0];
+    worker.pid = pid;
+    workers.push_back(worker);
+  }
+  for (WorkerConnection &worker : workers) {
+    if (!send_all(worker.fd, &job, sizeof(job))) {
+      close(worker.fd);
+      worker.fd = -1;
+    }
+  }
+
+  auto drop = [&](WorkerConnection &worker) {
+    if (worker.chunk >= 0) {
+      // Somebody else renders the chunk next
+      queue.push_front(worker.chunk);
+      worker.chunk = -1;
+    }
+    if (worker.pid > 0) kill(worker.pid, SIGKILL);
+    close(worker.fd);
+    worker.fd = -1;
+  };
+
+  std::vector<float> sums;
+  while (merged < chunks.size()) {
+    // Hand out the queued chunks, one per idle worker
+    int live = 0;
+    for (WorkerConnection &worker : workers) {
+      if (worker.fd < 0) continue;
+      if (worker.chunk < 0 && !queue.empty()) {
+        worker.chunk = queue.front();
+        queue.pop_front();
+        worker.sent = std::chrono::steady_clock::now();
+        if (!send_all(worker.fd, &chunks[worker.chunk], sizeof(RenderChunk))) {
+          drop(worker);
+          continue;
+        }
+      }
+      live++;
+    }
+
+    // Without workers all the unfinished chunks are in the queue
+    if (live == 0 && !queue.empty()) {
+      int index = queue.front();
+      queue.pop_front();
+      sums.resize(chunk_floats(chunks[index]));
+      render_chunk(c, world, kernel->trace, job, chunks[index], sums.data(),
+                   &global_thread_pool());
+      merge(index, std::move(sums));
+      sums = std::vector<float>();
+      if (listener < 0) continue;
+    }
+
+    std::vector<pollfd> fds;
+    std::vector<int> owners;
+    for (size_t w = 0; w < workers.size(); w++) {
+      if (workers[w].fd >= 0 && workers[w].chunk >= 0) {
+        fds.push_back(pollfd{workers[w].fd, POLLIN, 0});
+        owners.push_back(static_cast<int>(w));
+      }
+    }
+    if (listener >= 0) {
+      fds.push_back(pollfd{listener, POLLIN, 0});
+      owners.push_back(-1);
+    }
+    // Wake up regularly for the timeouts; don't wait, when the coordinator
+    // has chunks to render itself
+    int wait_ms = live == 0 ? 0 : 1000;
+    int ready = poll(fds.data(), fds.size(), wait_ms);
+    if (ready < 0 && errno != EINTR) break;
+
+    for (size_t i = 0; ready > 0 && i < fds.size(); i++) {
+      if (fds[i].revents == 0) continue;
+      if (owners[i] < 0) {
+        WorkerConnection worker;
+        worker.fd = accept(listener, nullptr, nullptr);
+        if (worker.fd < 0) continue;
+        if (send_all(worker.fd, &job, sizeof(job))) {
+          workers.push_back(worker);
+        } else {
+          close(worker.fd);
+        }
+        continue;
+      }
+      WorkerConnection &worker = workers[owners[i]];
+      const RenderChunk &expected = chunks[worker.chunk];
+      RenderChunk answer;
+      sums.resize(chunk_floats(expected));
+      if (!receive_all(worker.fd, &answer, sizeof(answer)) ||
+          answer.id != expected.id ||
+          !receive_all(worker.fd, sums.data(), sums.size() * sizeof(float))) {
+        drop(worker);
+        continue;
+      }
+      merge(worker.chunk, std::move(sums));
+      sums = std::vector<float>();
+      worker.chunk = -1;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (WorkerConnection &worker : workers) {
+      if (worker.fd >= 0 && worker.chunk >= 0 &&
+          now - worker.sent > std::chrono::seconds(options.timeout_seconds)) {
+        drop(worker);
+      }
+    }
+  }
+
+  // Closing the connections ends the workers
+  for (WorkerConnection &worker : workers) {
+    if (worker.fd >= 0) close(worker.fd);
+    if (worker.pid > 0) waitpid(worker.pid, nullptr, 0);
+  }
+  if (listener >= 0) close(listener);
+  if (merged < chunks.size()) return false;
+
+  for (Vec3 &pixel : image.pixels) pixel /= static_cast<float>(ns);
+  return true;
+}
+
+#endif  // SRC_DISTRIBUTED_H_
@@ -0,0 +1,252 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_ENVIRONMENTLIGHT_H_
+#define SRC_ENVIRONMENTLIGHT_H_
+
+#include <algorithm>  // min, max
+#include <cmath>
+#include <cstdint>
+#include <cstring>    // memcpy
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "AABB.h"
+#include "AliasTable.h"
+#include "Utils.h"
+#include "Vec3.h"
+
+/**
+ * Light arriving from infinitely far away, given by a high dynamic range
+ * image in the equirectangular (latitude-longitude) layout: the columns
+ * go around the y axis, the rows from +y (top row) to -y. Every texel is
+ * constant over its rectangle of the image.
+ * For sampling, the texels are weighted by their luminance times the
+ * sine of their latitude, which makes them proportional to the light they
+ * send, and stored in alias tables: one over the rows, and one over the
+ * texels of every row. Drawing a direction takes constant time.
+ */
+class EnvironmentLight {
+ public:
+  EnvironmentLight() = delete;
+  // Texels of a width x height image, row by row from the top row
+  EnvironmentLight(int width, int height, std::vector<Vec3> texels);
+  EnvironmentLight(const EnvironmentLight &e) = delete;
+  EnvironmentLight& operator=(const EnvironmentLight &e) = delete;
+
+  inline int width() const { return _width; }
+  inline int height() const { return _height; }
+  // False, if the environment is black everywhere
+  inline bool emits() const { return _rows.total() > 0.f; }
+
+  // Radiance arriving from the direction (which needn't be normalized)
+  Vec3 radiance(const Vec3 &direction) const;
+  /**
+   * Random unit direction, drawn in proportion to the weights of the
+   * texels, and its density (per solid angle). Returns false, if the
+   * environment doesn't emit.
+   */
+  bool sample(Vec3 &direction, float &pdf) const;
+  // Density of sample for the direction
+  float pdf(const Vec3 &direction) const;
+
+ private:
+  // Texel, in which the direction lies, and the sine of its latitude
+  int texel_of(const Vec3 &direction, float &sin_theta) const;
+
+  int _width;
+  int _height;
+  std::vector<Vec3> _texels;
+  AliasTable _rows;
+  std::vector<AliasTable> _columns;
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Read the environment from a Portable Float Map (color or grayscale), as
+ * written by HDR tools. Returns nullptr, if the file can't be read.
+ */
+EnvironmentLight* read_environment(const char *in_file);
+
+/**
+ * Procedural sky: the gradient from white at the horizon to light blue at
+ * the zenith, a dim ground below the horizon, and a small, bright sun,
+ * which is found by few random directions.
+ */
+EnvironmentLight* sky_environment(int width = 512, int height = 256);
+
+// Environment of the scene, nullptr for a black background
+inline const EnvironmentLight*& scene_environment();
+
+// Radiance of scene_environment() from the direction, black without
+inline Vec3 environment_radiance(const Vec3 &direction);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+EnvironmentLight::EnvironmentLight(int width, int height,
+                                   std::vector<Vec3> texels)
+    : _width(width), _height(height), _texels(std::move(texels)) {
+  std::vector<float> row_weights(_height);
+  std::vector<float> weights(_width);
+  _columns.reserve(_height);
+  for (int y = 0; y < _height; y++) {
+    float sin_theta = sinf(M_PI * (y + 0.5f) / _height);
+    for (int x = 0; x < _width; x++) {
+      const Vec3 &c = _texels[y * _width + x];
+      weights[x] = maxf((c.x() + c.y() + c.z()) / 3.f, 0.f) * sin_theta;
+    }
+    _columns.emplace_back(weights);
+    row_weights[y] = _columns.back().total();
+  }
+  _rows = AliasTable(row_weights);
+}
+
+// _____________________________________________________________________________
+int EnvironmentLight::texel_of(const Vec3 &direction,
+                               float &sin_theta) const {
+  float length = direction.length();
+  float cos_theta = length > 0.f ? direction.y() / length : 1.f;
+  cos_theta = maxf(-1.f, minf(cos_theta, 1.f));
+  sin_theta = sqrtf(maxf(1.f - cos_theta * cos_theta, 0.f));
+  float theta = acosf(cos_theta);
+  float phi = atan2f(direction.z(), direction.x());
+  int x = static_cast<int>((phi + M_PI) / (2.f * M_PI) * _width);
+  int y = static_cast<int>(theta / M_PI * _height);
+  x = std::min(std::max(x, 0), _width - 1);
+  y = std::min(std::max(y, 0), _height - 1);
+  return y * _width + x;
+}
+
+// _____________________________________________________________________________
+Vec3 EnvironmentLight::radiance(const Vec3 &direction) const {
+  float sin_theta;
+  return _texels[texel_of(direction, sin_theta)];
+}
+
+// _____________________________________________________________________________
+float EnvironmentLight::pdf(const Vec3 &direction) const {
+  if (!emits()) return 0.f;
+  float sin_theta;
+  int texel = texel_of(direction, sin_theta);
+  if (sin_theta <= 0.f) return 0.f;
+  int y = texel / _width;
+  int x = texel % _width;
+  // Uniform within the texel, which covers 2 pi^2 sin(theta) / (w h) of
+  // the solid angle
+  return _rows.pmf(y) * _columns[y].pmf(x) * _width * _height
+         / (2.f * M_PI * M_PI * sin_theta);
+}
+
+// _____________________________________________________________________________
+bool EnvironmentLight::sample(Vec3 &direction, float &pdf) const {
+  if (!emits()) return false;
+  float row_pmf;
+  float column_pmf;
+  int y = _rows.sample(get_random_in_range(0.f, 1.f), row_pmf);
+  int x = _columns[y].sample(get_random_in_range(0.f, 1.f), column_pmf);
+  float u = (x + get_random_in_range(0.f, 1.f)) / _width;
+  float v = (y + get_random_in_range(0.f, 1.f)) / _height;
+  float theta = v * M_PI;
+  float phi = u * 2.f * M_PI - M_PI;
+  float sin_theta = sinf(theta);
+  if (sin_theta <= 0.f) return false;
+  direction = Vec3(sin_theta * cosf(phi), cosf(theta), sin_theta * sinf(phi));
+  pdf = row_pmf * column_pmf * _width * _height
+        / (2.f * M_PI * M_PI * sin_theta);
+  return true;
+}
+
+// _____________________________________________________________________________
+EnvironmentLight* read_environment(const char *in_file) {
+  std::ifstream file(in_file, std::ios::binary);
+  std::string magic;
+  int width, height;
+  float scale;
+  if (!(file >> magic >> width >> height >> scale) ||
+      (magic != "PF" && magic != "Pf") || width <= 0 || height <= 0) {
+    return nullptr;
+  }
+  // A single whitespace separates the header from the data
+  file.get();
+  int channels = magic == "PF" ? 3 : 1;
+  std::vector<float> values(static_cast<size_t>(channels) * width * height);
+  file.read(reinterpret_cast<char*>(values.data()),
+            values.size() * sizeof(float));
+  if (!file) return nullptr;
+  // The sign of the scale gives the byte order, negative for little endian
+  const uint16_t probe = 1;
+  bool little_endian = *reinterpret_cast<const char*>(&probe) == 1;
+  if ((scale < 0.f) != little_endian) {
+    for (float &f : values) {
+      uint32_t bits;
+      memcpy(&bits, &f, sizeof(bits));
+      bits = (bits >> 24) | ((bits >> 8) & 0xff00u) | ((bits << 8) & 0xff0000u)
+             | (bits << 24);
+      memcpy(&f, &bits, sizeof(bits));
+    }
+  }
+
+  // The rows of the file go from the bottom to the top
+  std::vector<Vec3> texels(static_cast<size_t>(width) * height);
+  for (int y = 0; y < height; y++) {
+    const float *row = &values[static_cast<size_t>(height - 1 - y)
+                               * width * channels];
+    for (int x = 0; x < width; x++) {
+      const float *v = row + x * channels;
+      Vec3 c = channels == 3 ? Vec3(v[0], v[1], v[2]) : Vec3(v[0], v[0], v[0]);
+      // Negative and invalid values can't be light
+      for (int a = 0; a < 3; a++) {
+        c[a] = std::isfinite(c[a]) ? maxf(c[a], 0.f) : 0.f;
+      }
+      texels[static_cast<size_t>(y) * width + x] = c;
+    }
+  }
+  return new EnvironmentLight(width, height, std::move(texels));
+}
+
+// _____________________________________________________________________________
+EnvironmentLight* sky_environment(int width, int height) {
+  Vec3 sun = make_unit_vector(Vec3(-1.f, 0.8f, 0.6f));
+  // Cosine of the angular radius of the sun (2 degrees)
+  float cos_sun = cosf(2.f * M_PI / 180.f);
+  std::vector<Vec3> texels(static_cast<size_t>(width) * height);
+  for (int y = 0; y < height; y++) {
+    float theta = M_PI * (y + 0.5f) / height;
+    for (int x = 0; x < width; x++) {
+      float phi = 2.f * M_PI * (x + 0.5f) / width - M_PI;
+      Vec3 d(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+      Vec3 c;
+      if (d.y() >= 0.f) {
+        float t = d.y();
+        c = (1.f - t) * Vec3(1.f, 1.f, 1.f) + t * Vec3(0.5f, 0.7f, 1.f);
+      } else {
+        c = Vec3(0.2f, 0.18f, 0.15f);
+      }
+      if (dot(d, sun) >= cos_sun) c = Vec3(500.f, 475.f, 425.f);
+      texels[static_cast<size_t>(y) * width + x] = c;
+    }
+  }
+  return new EnvironmentLight(width, height, std::move(texels));
+}
+
+// _____________________________________________________________________________
+const EnvironmentLight*& scene_environment() {
+  static const EnvironmentLight *environment = nullptr;
+  return environment;
+}
+
+// _____________________________________________________________________________
+Vec3 environment_radiance(const Vec3 &direction) {
+  const EnvironmentLight *environment = scene_environment();
+  if (environment == nullptr) return Vec3(0.f, 0.f, 0.f);
+  return environment->radiance(direction);
+}
+
+#endif  // SRC_ENVIRONMENTLIGHT_H_
@@ -0,0 +1,175 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_FASTMATH_H_
+#define SRC_FASTMATH_H_
+
+#include <math.h>
+#include <cstdint>
+#include <cstring>  // memcpy
+
+#include "Simd.h"
+
+/**
+ * Fast approximations of the transcendental functions on the hot paths of
+ * the renderer. They are polynomials without branches (the case
+ * distinctions are selects), so loops over them can be vectorized.
+ * The documented bounds are the maximum absolute errors against libm over
+ * the given domain; `Benchmark --accuracy` checks them.
+ *
+ * The render code calls the math_* functions, which are the exact libm
+ * functions in double precision (so the default build renders the same
+ * images as before), unless the renderer is built with FAST_MATH defined
+ * (cmake -DFAST_MATH=ON), in which case they are the float approximations.
+ * That build also drops errno from sqrt (-fno-math-errno), without which
+ * fast_asin isn't vectorized.
+ */
+
+// Maximum absolute errors of the approximations
+// fast_sin for |x| <= FAST_SIN_MAX_ARGUMENT
+#define FAST_SIN_MAX_ERROR 2e-7f
+#define FAST_SIN_MAX_ARGUMENT 8192.f
+#define FAST_ATAN2_MAX_ERROR 4e-7f
+#define FAST_ASIN_MAX_ERROR 4e-7f
+// Relative error of fast_rsqrt for normal, positive floats
+#define FAST_RSQRT_MAX_ERROR 4e-7f
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+// sin(x); the error grows with |x| through the range reduction
+inline float fast_sin(float x);
+
+// atan2(y, x) in [-pi, pi]; 0 for y = x = 0
+inline float fast_atan2(float y, float x);
+
+// asin(x) for x in [-1, 1]
+inline float fast_asin(float x);
+
+// 1 / sqrt(x) for x > 0
+inline float fast_rsqrt(float x);
+
+// x^N for a non-negative integer N with O(log N) multiplications
+template <int N>
+constexpr float ipow(float x);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+float fast_sin(float x) {
+  // Reduce to r in [-pi/2, pi/2] with x = r + k*pi; pi is split in two
+  // parts, so that k*pi is subtracted without losing the low bits. The
+  // conversion to int rounds (instead of floorf, which is a call without
+  // SSE4.1)
+  int32_t ki = static_cast<int32_t>(x * 0.318309886f + copysignf(0.5f, x));
+  float k = static_cast<float>(ki);
+  float r = (x - k * 3.140625f) - k * 9.67653589793e-4f;
+  // sin(x) = (-1)^k sin(r)
+  float sign = 1.f - 2.f * static_cast<float>(ki & 1);
+  // Minimax polynomial for sin on [-pi/2, pi/2]
+  float r2 = r * r;
+  float p = 2.6083159809786593541503e-6f;
+  p = p * r2 - 1.981069071916863322258e-4f;
+  p = p * r2 + 8.33307858556509017944336e-3f;
+  p = p * r2 - 1.66666597127914428710938e-1f;
+  return sign * (r + r * r2 * p);
+}
+
+// _____________________________________________________________________________
+float fast_atan2(float y, float x) {
+  float ax = fabsf(x);
+  float ay = fabsf(y);
+  float mx = ax > ay ? ax : ay;
+  float mn = ax > ay ? ay : ax;
+  // a in [0, 1], so the polynomial only has to cover atan on [0, 1]
+  float a = mx > 0.f ? mn / mx : 0.f;
+  // Abramowitz and Stegun 4.4.49
+  float s = a * a;
+  float p = 0.0028662257f;
+  p = p * s - 0.0161657367f;
+  p = p * s + 0.0429096138f;
+  p = p * s - 0.0752896400f;
+  p = p * s + 0.1065626393f;
+  p = p * s - 0.1420889944f;
+  p = p * s + 0.1999355085f;
+  p = p * s - 0.3333314528f;
+  float r = a + a * s * p;
+  // Undo the reductions to the first octant
+  r = ay > ax ? 1.57079632679f - r : r;
+  r = x < 0.f ? 3.14159265359f - r : r;
+  return y < 0.f ? -r : r;
+}
+
+// _____________________________________________________________________________
+float fast_asin(float x) {
+  float a = fabsf(x);
+  // Abramowitz and Stegun 4.4.46: asin(a) = pi/2 - sqrt(1 - a) * p(a)
+  float p = -0.0012624911f;
+  p = p * a + 0.0066700901f;
+  p = p * a - 0.0170881256f;
+  p = p * a + 0.0308918810f;
+  p = p * a - 0.0501743046f;
+  p = p * a + 0.0889789874f;
+  p = p * a - 0.2145988016f;
+  p = p * a + 1.5707963050f;
+  float r = 1.57079632679f - sqrtf(1.f - a) * p;
+  return x < 0.f ? -r : r;
+}
+
+// _____________________________________________________________________________
+float fast_rsqrt(float x) {
+#if defined(SIMD_SSE)
+  // 12-bit estimate of the instruction
+  float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+  // Initial guess from the bits of the float
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits = 0x5f375a86u - (bits >> 1);
+  float y;
+  memcpy(&y, &bits, sizeof(y));
+  y = y * (1.5f - 0.5f * x * y * y);
+  y = y * (1.5f - 0.5f * x * y * y);
+#endif
+  // Newton-Raphson steps double the number of correct bits
+  return y * (1.5f - 0.5f * x * y * y);
+}
+
+// _____________________________________________________________________________
+template <int N>
+constexpr float ipow(float x) {
+  static_assert(N >= 0, "ipow needs a non-negative exponent");
+  if constexpr (N == 0) {
+    return 1.f;
+  } else if constexpr (N % 2 == 0) {
+    return ipow<N / 2>(x * x);
+  } else {
+    return x * ipow<N / 2>(x * x);
+  }
+}
+
+// _____________________________________________________________________________
+// Functions used by the render code, exact or fast depending on the build.
+// There is no math_sin: fast_sin is only accurate up to
+// FAST_SIN_MAX_ARGUMENT, and the checker texture, its only user, passes
+// unbounded arguments, so it keeps calling libm sin
+// _____________________________________________________________________________
+
+#ifdef FAST_MATH
+#define FAST_MATH_ENABLED true
+inline float math_atan2(float y, float x) { return fast_atan2(y, x); }
+inline float math_asin(float x) { return fast_asin(x); }
+inline float math_rsqrt(float x) { return fast_rsqrt(x); }
+inline float math_pow5(float x) { return ipow<5>(x); }
+#else
+#define FAST_MATH_ENABLED false
+inline double math_atan2(double y, double x) { return atan2(y, x); }
+inline double math_asin(double x) { return asin(x); }
+inline float math_rsqrt(float x) { return 1.f / sqrtf(x); }
+inline double math_pow5(double x) { return pow(x, 5.0); }
+#endif
+
+#endif  // SRC_FASTMATH_H_
@@ -0,0 +1,116 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_HALF_H_
+#define SRC_HALF_H_
+
+#include <cstdint>
+#include <cstring>  // memcpy
+
+#include "Simd.h"
+
+// Conversions between floats and 16-bit floats (IEEE half precision) for
+// compact storage; the arithmetic is always done in floats
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+// IEEE half precision with rounding to the nearest even value
+inline uint16_t float_to_half(float f);
+inline float half_to_float(uint16_t h);
+
+// Convert n floats from and to halves, eight at a time, where the CPU can
+void floats_to_halves(const float *in, int n, uint16_t *out);
+void halves_to_floats(const uint16_t *in, int n, float *out);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+uint16_t float_to_half(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint16_t sign = static_cast<uint16_t>((x >> 16) & 0x8000u);
+  uint32_t exponent = (x >> 23) & 0xffu;
+  uint32_t mantissa = x & 0x7fffffu;
+  // Infinity and NaN, which stays a (quiet) NaN
+  if (exponent == 0xffu) {
+    return sign | 0x7c00u | (mantissa != 0u ? 0x200u : 0u);
+  }
+  int e = static_cast<int>(exponent) - 127 + 15;
+  // Overflows to infinity
+  if (e >= 31) return sign | 0x7c00u;
+  uint32_t bits;
+  int shift;
+  if (e <= 0) {
+    // Subnormal half (or zero): shift the mantissa with its implicit bit
+    if (e < -10) return sign;
+    bits = mantissa | 0x800000u;
+    shift = 14 - e;
+  } else {
+    bits = (static_cast<uint32_t>(e) << 23) | mantissa;
+    shift = 13;
+  }
+  uint32_t h = bits >> shift;
+  // Round to nearest even; a carry into the exponent is the right result
+  uint32_t rest = bits & ((1u << shift) - 1u);
+  uint32_t half_way = 1u << (shift - 1);
+  if (rest > half_way || (rest == half_way && (h & 1u))) h++;
+  return sign | static_cast<uint16_t>(h);
+}
+
+// _____________________________________________________________________________
+float half_to_float(uint16_t h) {
+  uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+  uint32_t exponent = (h >> 10) & 0x1fu;
+  uint32_t mantissa = h & 0x3ffu;
+  uint32_t x;
+  if (exponent == 0x1fu) {
+    x = sign | 0x7f800000u | (mantissa << 13);
+  } else if (exponent != 0u) {
+    x = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  } else if (mantissa == 0u) {
+    x = sign;
+  } else {
+    // Subnormal half: normalize the mantissa
+    int e = -1;
+    do {
+      mantissa <<= 1;
+      e++;
+    } while ((mantissa & 0x400u) == 0u);
+    x = sign | (static_cast<uint32_t>(127 - 15 - e) << 23)
+        | ((mantissa & 0x3ffu) << 13);
+  }
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// _____________________________________________________________________________
+void floats_to_halves(const float *in, int n, uint16_t *out) {
+  int k = 0;
+#if defined(SIMD_AVX) && defined(__F16C__)
+  for (; k + 8 <= n; k += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + k),
+                                _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), h);
+  }
+#endif
+  for (; k < n; k++) out[k] = float_to_half(in[k]);
+}
+
+// _____________________________________________________________________________
+void halves_to_floats(const uint16_t *in, int n, float *out) {
+  int k = 0;
+#if defined(SIMD_AVX) && defined(__F16C__)
+  for (; k + 8 <= n; k += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + k));
+    _mm256_storeu_ps(out + k, _mm256_cvtph_ps(h));
+  }
+#endif
+  for (; k < n; k++) out[k] = half_to_float(in[k]);
+}
+
+#endif  // SRC_HALF_H_
@@ -0,0 +1,145 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_HEATMAP_H_
+#define SRC_HEATMAP_H_
+
+#include <algorithm>  // nth_element
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "Stats.h"
+#include "Vec3.h"
+
+// What a Heatmap records per pixel
+enum HeatmapMetric {
+  // Wall-clock nanoseconds spent rendering the pixel
+  HEATMAP_TIME,
+  // Box and primitive tests of the pixel's rays; needs RENDER_STATS
+  HEATMAP_STEPS
+};
+
+/**
+ * Cost of every pixel of a render, to find out, where in the image the
+ * render time is spent. Row 0 is the top row of the image.
+ */
+struct Heatmap {
+  Heatmap(int w, int h, HeatmapMetric m)
+      : width(w), height(h), metric(m), values(w * h, 0.f) {}
+
+  inline float& at(int x, int y) { return values[y * width + x]; }
+
+  int width;
+  int height;
+  HeatmapMetric metric;
+  std::vector<float> values;
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Cost counter of the calling thread for the metric. The cost of a pixel is
+ * the difference of the counter before and after rendering it.
+ */
+uint64_t heatmap_counter(HeatmapMetric metric);
+
+/**
+ * Map t in [0, 1] to a color from black over blue, magenta, red and yellow
+ * to white, so that cheap pixels are dark and expensive ones bright.
+ */
+Vec3 false_color(float t);
+
+/**
+ * Write the heatmap as a false-color PPM image. The colors are scaled to
+ * the 99th percentile of the costs, so a few extreme pixels don't hide the
+ * differences between the others.
+ * Returns false, if the file cannot be written.
+ */
+bool write_heatmap_ppm(const char *out_file, const Heatmap &heatmap);
+
+/**
+ * Write the raw costs as a Portable Float Map (PFM): a short text header
+ * followed by the floats in the host's byte order, bottom row first.
+ * Returns false, if the file cannot be written.
+ */
+bool write_pfm(const char *out_file, const Heatmap &heatmap);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+uint64_t heatmap_counter(HeatmapMetric metric) {
+  if (metric == HEATMAP_STEPS) {
+    const RenderStats &s = thread_render_stats();
+    return s.box_tests + s.primitive_tests;
+  }
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// _____________________________________________________________________________
+Vec3 false_color(float t) {
+  t = t < 0.f ? 0.f : (t > 1.f ? 1.f : t);
+  // Piecewise linear between the key colors
+  static const float keys[6][3] = {{0.f, 0.f, 0.f}, {0.f, 0.f, 1.f},
+                                   {1.f, 0.f, 1.f}, {1.f, 0.f, 0.f},
+                                   {1.f, 1.f, 0.f}, {1.f, 1.f, 1.f}};
+  float x = t * 5.f;
+  int k = static_cast<int>(x);
+  if (k >= 5) k = 4;
+  float s = x - k;
+  return Vec3(keys[k][0] + s * (keys[k + 1][0] - keys[k][0]),
+              keys[k][1] + s * (keys[k + 1][1] - keys[k][1]),
+              keys[k][2] + s * (keys[k + 1][2] - keys[k][2]));
+}
+
+// _____________________________________________________________________________
+bool write_heatmap_ppm(const char *out_file, const Heatmap &heatmap) {
+  std::ofstream image_file(out_file);
+  if (!image_file) return false;
+
+  std::vector<float> sorted = heatmap.values;
+  float scale = 0.f;
+  if (!sorted.empty()) {
+    size_t p99 = sorted.size() * 99 / 100;
+    std::nth_element(sorted.begin(), sorted.begin() + p99, sorted.end());
+    scale = sorted[p99];
+  }
+  if (scale <= 0.f) scale = 1.f;
+
+  image_file << "P3" << std::endl
+             << heatmap.width << " " << heatmap.height << std::endl
+             << "255" << std::endl;
+  for (float value : heatmap.values) {
+    Vec3 col = false_color(value / scale);
+    image_file << static_cast<int>(255.99f * col.r()) << " "
+               << static_cast<int>(255.99f * col.g()) << " "
+               << static_cast<int>(255.99f * col.b()) << "\n";
+  }
+  return static_cast<bool>(image_file);
+}
+
+// _____________________________________________________________________________
+bool write_pfm(const char *out_file, const Heatmap &heatmap) {
+  std::ofstream file(out_file, std::ios::binary);
+  if (!file) return false;
+  // Grayscale PFM; the sign of the scale gives the byte order
+  const uint16_t probe = 1;
+  bool little_endian = *reinterpret_cast<const char*>(&probe) == 1;
+  file << "Pf\n" << heatmap.width << " " << heatmap.height << "\n"
+       << (little_endian ? "-1.0" : "1.0") << "\n";
+  for (int y = heatmap.height - 1; y >= 0; y--) {
+    const float *row = &heatmap.values[y * heatmap.width];
+    file.write(reinterpret_cast<const char*>(row),
+               heatmap.width * sizeof(float));
+  }
+  return static_cast<bool>(file);
+}
+
+#endif  // SRC_HEATMAP_H_
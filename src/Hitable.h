@@ -29,6 +29,17 @@ class Hitable {
                    HitRecord &rec) const = 0;
 
   virtual bool bounding_box(AABB &box) const = 0;
+
+  // Bounding box at the provided point in time. The default is the box of
+  // a static object; moving objects have to override it.
+  virtual bool bounding_box_at(float /*time*/, AABB &box) const {
+    return bounding_box(box);
+  }
+
+  // Set of the types of the materials, which hits on the object can report,
+  // as a bit mask (see material_bit), from which the renderer chooses its
+  // kernel. Objects, which don't know their materials, report all types.
+  virtual unsigned material_types() const { return ~0u; }
 };
 
 #endif  // SRC_HITABLE_H_
@@ -29,6 +29,7 @@ class HitableList: public Hitable {
 
   bool hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const;
   bool bounding_box(AABB &box) const;
+  unsigned material_types() const;
 
  private:
   int _size{0};
@@ -217,4 +218,11 @@ bool HitableList::bounding_box(AABB &box) const {
   return true;
 }
 
+// _____________________________________________________________________________
+unsigned HitableList::material_types() const {
+  unsigned types = 0u;
+  for (int i = 0; i < _size; i++) types |= _data[i]->material_types();
+  return types;
+}
+
 #endif  // SRC_HITABLELIST_H_
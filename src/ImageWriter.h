@@ -0,0 +1,413 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_IMAGEWRITER_H_
+#define SRC_IMAGEWRITER_H_
+
+#include <cmath>      // sqrtf
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>    // memcpy
+#include <fstream>    // output to a file
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#include "Simd.h"
+#include "Trace.h"
+#include "Vec3.h"
+
+// Definitions
+// Rows, which are complete but not yet written, before push blocks
+#define IMAGE_WRITER_MAX_ROWS 256
+
+enum ImageFormat {
+  // Plain text PPM (P3)
+  IMAGE_PPM,
+  // 8-bit RGB PNG, only with zlib (cmake finds it and defines WITH_ZLIB)
+  IMAGE_PNG
+};
+
+enum ToneMap {
+  // Clamp to [0, 1]
+  TONEMAP_CLAMP,
+  // x / (1 + x), which compresses the highlights instead of clipping them
+  TONEMAP_REINHARD
+};
+
+/**
+ * Writer streaming an image to disk on its own thread, while it is being
+ * rendered. The render threads push finished tiles (or rows), which are
+ * copied into row buffers; the writer thread tonemaps, gamma corrects and
+ * quantizes every row, as soon as it and the rows above it are complete,
+ * writes it and releases its buffer. So the renderer never waits for the
+ * disk, unless IMAGE_WRITER_MAX_ROWS complete rows are waiting for it, and
+ * only the rows in flight are in memory, not the whole image.
+ */
+class ImageWriter {
+ public:
+  ImageWriter() = delete;
+  ImageWriter(const char *path, int width, int height, ImageFormat format,
+              ToneMap tonemap = TONEMAP_CLAMP);
+  ImageWriter(const ImageWriter &w) = delete;
+  ImageWriter& operator=(const ImageWriter &w) = delete;
+  ~ImageWriter();
+
+  inline int width() const { return _width; }
+  inline int height() const { return _height; }
+
+  /**
+   * Copy the pixels of the rectangle at (x0, y0) with the provided width
+   * and height (row 0 is the top row of the image); pixels holds them row
+   * by row. Every pixel of the image has to be pushed exactly once.
+   * Thread-safe.
+   */
+  void push(int x0, int y0, int width, int height, const Vec3 *pixels);
+
+  /**
+   * Wait, until all the rows are written, and close the file. Rows with
+   * pixels, which were never pushed, are written black.
+   * Returns false, if the file cannot be written or the image is
+   * incomplete.
+   */
+  bool finish();
+
+ private:
+  struct Row {
+    std::vector<Vec3> pixels;
+    int missing;
+  };
+
+  void writer_loop();
+  bool write_header();
+  bool write_row(const std::vector<Vec3> &pixels);
+  bool write_end();
+
+  int _width;
+  int _height;
+  ImageFormat _format;
+  ToneMap _tonemap;
+  std::ofstream _file;
+  std::thread _thread;
+
+  // Rows in flight by index, guarded by _mutex
+  std::map<int, Row> _rows;
+  int _complete_rows{0};
+  // Row, which the writer thread writes next
+  int _next_row{0};
+  bool _closed{false};
+  bool _incomplete{false};
+  bool _failed{false};
+  std::mutex _mutex;
+  std::condition_variable _row_complete;
+  std::condition_variable _row_written;
+
+  // Owned by the writer thread
+  std::vector<uint8_t> _bytes;
+  std::string _text;
+#ifdef WITH_ZLIB
+  z_stream _zlib;
+  std::vector<uint8_t> _previous;
+  std::vector<uint8_t> _deflated;
+#endif
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+// Format of the file by its extension: PNG for .png, otherwise PPM
+ImageFormat image_format(const std::string &path);
+
+/**
+ * Tonemap, gamma correct (gamma 2) and quantize n pixels into 3 * n bytes.
+ */
+void quantize_pixels(const Vec3 *pixels, int n, ToneMap tonemap,
+                     uint8_t *out);
+
+/**
+ * Linear value of a quantized channel, which quantizes to the same byte
+ * again, so images read back are written unchanged.
+ */
+float dequantize_channel(uint8_t q, ToneMap tonemap);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+ImageFormat image_format(const std::string &path) {
+  size_t dot = path.rfind('.');
+  if (dot != std::string::npos && path.substr(dot) == ".png") {
+    return IMAGE_PNG;
+  }
+  return IMAGE_PPM;
+}
+
+// _____________________________________________________________________________
+inline float quantize_channel(float x, ToneMap tonemap) {
+  x = x > 0.f ? x : 0.f;
+  if (tonemap == TONEMAP_REINHARD) x = x / (1.f + x);
+  x = 255.99f * sqrtf(x);
+  return x < 255.f ? x : 255.f;
+}
+
+// _____________________________________________________________________________
+void quantize_pixels(const Vec3 *pixels, int n, ToneMap tonemap,
+                     uint8_t *out) {
+  static_assert(sizeof(Vec3) == 3 * sizeof(float),
+                "the pixels are read as an array of floats");
+  const float *in = reinterpret_cast<const float*>(pixels);
+  int count = 3 * n;
+  int k = 0;
+  // Eight channels at a time; sqrt and the division are exact in both
+  // paths, so the tail gives the same bytes
+  Float8 zero = float8(0.f);
+  Float8 one = float8(1.f);
+  Float8 scale = float8(255.99f);
+  Float8 top = float8(255.f);
+  alignas(32) float q[8];
+  for (; k + 8 <= count; k += 8) {
+    Float8 x = float8_max(float8_load(in + k), zero);
+    if (tonemap == TONEMAP_REINHARD) x = float8_div(x, float8_add(one, x));
+    x = float8_min(float8_mul(scale, float8_sqrt(x)), top);
+    float8_store(q, x);
+    for (int l = 0; l < 8; l++) out[k + l] = static_cast<uint8_t>(q[l]);
+  }
+  for (; k < count; k++) {
+    out[k] = static_cast<uint8_t>(quantize_channel(in[k], tonemap));
+  }
+}
+
+// _____________________________________________________________________________
+float dequantize_channel(uint8_t q, ToneMap tonemap) {
+  // The middle of the interval, which quantizes to q
+  float x = (q + 0.5f) / 255.99f;
+  x = x * x;
+  if (tonemap == TONEMAP_REINHARD) x = x / (1.f - x);
+  return x;
+}
+
+// _____________________________________________________________________________
+ImageWriter::ImageWriter(const char *path, int width, int height,
+                         ImageFormat format, ToneMap tonemap)
+    : _width(width), _height(height), _format(format), _tonemap(tonemap),
+      _file(path, std::ios::binary) {
+  _bytes.resize(3 * static_cast<size_t>(width));
+#ifdef WITH_ZLIB
+  memset(&_zlib, 0, sizeof(_zlib));
+#endif
+  _failed = !_file || !write_header();
+  _thread = std::thread(&ImageWriter::writer_loop, this);
+}
+
+// _____________________________________________________________________________
+ImageWriter::~ImageWriter() {
+  finish();
+}
+
+// _____________________________________________________________________________
+void ImageWriter::push(int x0, int y0, int width, int height,
+                       const Vec3 *pixels) {
+  for (int r = 0; r < height; r++) {
+    int y = y0 + r;
+    std::unique_lock<std::mutex> lock(_mutex);
+    // Back pressure; the row, which the writer thread waits for, is never
+    // held back, so the writer makes progress
+    _row_written.wait(lock, [this, y]() {
+      return _complete_rows < IMAGE_WRITER_MAX_ROWS || y <= _next_row ||
+             _closed;
+    });
+    if (_closed) return;
+    Row &row = _rows[y];
+    if (row.pixels.empty()) {
+      row.pixels.assign(_width, Vec3(0.f, 0.f, 0.f));
+      row.missing = _width;
+    }
+    memcpy(&row.pixels[x0], pixels + static_cast<size_t>(r) * width,
+           width * sizeof(Vec3));
+    row.missing -= width;
+    if (row.missing == 0) {
+      _complete_rows++;
+      _row_complete.notify_one();
+    }
+  }
+}
+
+// _____________________________________________________________________________
+bool ImageWriter::finish() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_closed && !_thread.joinable()) return !_failed && !_incomplete;
+    _closed = true;
+  }
+  _row_complete.notify_all();
+  _row_written.notify_all();
+  if (_thread.joinable()) _thread.join();
+  if (!_failed) _failed = !write_end();
+#ifdef WITH_ZLIB
+  // Also releases the stream after a failure
+  if (_format == IMAGE_PNG) deflateEnd(&_zlib);
+#endif
+  _file.close();
+  return !_failed && !_incomplete;
+}
+
+// _____________________________________________________________________________
+void ImageWriter::writer_loop() {
+  trace_thread_name("output");
+  std::vector<Vec3> black(_width, Vec3(0.f, 0.f, 0.f));
+  for (int y = 0; y < _height; y++) {
+    std::vector<Vec3> pixels;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _row_complete.wait(lock, [this, y]() {
+        auto it = _rows.find(y);
+        return _closed || (it != _rows.end() && it->second.missing == 0);
+      });
+      auto it = _rows.find(y);
+      if (it == _rows.end() || it->second.missing > 0) _incomplete = true;
+      if (it != _rows.end()) {
+        if (it->second.missing == 0) _complete_rows--;
+        pixels = std::move(it->second.pixels);
+        _rows.erase(it);
+      }
+      _next_row = y + 1;
+    }
+    _row_written.notify_all();
+    if (_failed) continue;
+    TRACE_SCOPE("write_row", "y", y);
+    _failed = !write_row(pixels.empty() ? black : pixels);
+  }
+}
+
+// _____________________________________________________________________________
+// PNG and its chunks store integers big endian
+inline void append_be32(std::string &s, uint32_t x) {
+  char b[4] = {static_cast<char>(x >> 24), static_cast<char>(x >> 16),
+               static_cast<char>(x >> 8), static_cast<char>(x)};
+  s.append(b, 4);
+}
+
+#ifdef WITH_ZLIB
+// _____________________________________________________________________________
+inline bool write_png_chunk(std::ofstream &file, const char *type,
+                            const uint8_t *data, size_t size) {
+  std::string header;
+  append_be32(header, static_cast<uint32_t>(size));
+  header.append(type, 4);
+  uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(type), 4);
+  // crc32 returns its initial value for a null pointer
+  if (size > 0) crc = crc32(crc, data, static_cast<uInt>(size));
+  std::string trailer;
+  append_be32(trailer, static_cast<uint32_t>(crc));
+  file.write(header.data(), header.size());
+  file.write(reinterpret_cast<const char*>(data), size);
+  file.write(trailer.data(), trailer.size());
+  return static_cast<bool>(file);
+}
+#endif
+
+// _____________________________________________________________________________
+bool ImageWriter::write_header() {
+  if (_format == IMAGE_PPM) {
+    _file << "P3" << std::endl
+          << _width << " " << _height << std::endl
+          << "255" << std::endl;
+    return static_cast<bool>(_file);
+  }
+#ifdef WITH_ZLIB
+  static const char signature[8] = {'\x89', 'P', 'N', 'G',
+                                    '\r', '\n', '\x1a', '\n'};
+  _file.write(signature, sizeof(signature));
+  std::string ihdr;
+  append_be32(ihdr, static_cast<uint32_t>(_width));
+  append_be32(ihdr, static_cast<uint32_t>(_height));
+  // 8 bits per channel, RGB, deflate, adaptive filters, no interlacing
+  ihdr.append("\x08\x02\x00\x00\x00", 5);
+  if (!write_png_chunk(_file, "IHDR",
+                       reinterpret_cast<const uint8_t*>(ihdr.data()),
+                       ihdr.size())) {
+    return false;
+  }
+  if (deflateInit(&_zlib, Z_DEFAULT_COMPRESSION) != Z_OK) return false;
+  _previous.assign(_bytes.size(), 0);
+  _deflated.resize(1 << 16);
+  return true;
+#else
+  return false;
+#endif
+}
+
+// _____________________________________________________________________________
+bool ImageWriter::write_row(const std::vector<Vec3> &pixels) {
+  quantize_pixels(pixels.data(), _width, _tonemap, _bytes.data());
+  if (_format == IMAGE_PPM) {
+    _text.clear();
+    char number[4];
+    for (size_t k = 0; k < _bytes.size(); k++) {
+      int v = _bytes[k];
+      int n = 0;
+      if (v >= 100) number[n++] = static_cast<char>('0' + v / 100);
+      if (v >= 10) number[n++] = static_cast<char>('0' + v / 10 % 10);
+      number[n++] = static_cast<char>('0' + v % 10);
+      number[n++] = k % 3 == 2 ? '\n' : ' ';
+      _text.append(number, n);
+    }
+    _file.write(_text.data(), _text.size());
+    return static_cast<bool>(_file);
+  }
+#ifdef WITH_ZLIB
+  // The Up filter (difference to the row above) compresses the smooth
+  // gradients of renders well
+  std::vector<uint8_t> filtered(_bytes.size() + 1);
+  filtered[0] = 2;
+  for (size_t k = 0; k < _bytes.size(); k++) {
+    filtered[k + 1] = static_cast<uint8_t>(_bytes[k] - _previous[k]);
+  }
+  _previous.swap(_bytes);
+  _zlib.next_in = filtered.data();
+  _zlib.avail_in = static_cast<uInt>(filtered.size());
+  while (_zlib.avail_in > 0) {
+    _zlib.next_out = _deflated.data();
+    _zlib.avail_out = static_cast<uInt>(_deflated.size());
+    if (deflate(&_zlib, Z_NO_FLUSH) != Z_OK) return false;
+    size_t size = _deflated.size() - _zlib.avail_out;
+    if (size > 0 && !write_png_chunk(_file, "IDAT", _deflated.data(), size)) {
+      return false;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+// _____________________________________________________________________________
+bool ImageWriter::write_end() {
+  if (_format == IMAGE_PPM) return static_cast<bool>(_file.flush());
+#ifdef WITH_ZLIB
+  int status = Z_OK;
+  while (status == Z_OK) {
+    _zlib.next_out = _deflated.data();
+    _zlib.avail_out = static_cast<uInt>(_deflated.size());
+    status = deflate(&_zlib, Z_FINISH);
+    size_t size = _deflated.size() - _zlib.avail_out;
+    if (size > 0 && !write_png_chunk(_file, "IDAT", _deflated.data(), size)) {
+      status = Z_ERRNO;
+    }
+  }
+  return status == Z_STREAM_END &&
+         write_png_chunk(_file, "IEND", nullptr, 0);
+#else
+  return false;
+#endif
+}
+
+#endif  // SRC_IMAGEWRITER_H_
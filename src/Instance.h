@@ -0,0 +1,104 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_INSTANCE_H_
+#define SRC_INSTANCE_H_
+
+#include "AABB.h"
+#include "Hitable.h"
+#include "Material.h"
+#include "Transform.h"
+
+/**
+ * Copy of a shared object placed into the scene with an affine transform.
+ * Rays are transformed into the object's space for the intersection, so
+ * many instances of the same object (e.g. a mesh, or a BVH over a group of
+ * spheres) only cost the memory of the transforms.
+ * Neither the object, nor the optional override material are owned by the
+ * instance; they are shared between instances and have to outlive them.
+ */
+class Instance: public Hitable {
+ public:
+  Instance() = delete;
+  Instance(const Hitable *object,
+           const Transform &to_world,
+           Material *material = nullptr);
+
+  inline const Hitable* object() const { return _object; }
+  inline const Transform& to_world() const { return _to_world; }
+  void to_world(const Transform &t);
+  // Update the bounding box after the object has changed
+  void refit();
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const;
+
+  virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const;
+
+ private:
+  const Hitable *_object;
+  Transform _to_world;
+  Transform _to_object;
+  // Replaces the material of the object's hits, when not nullptr
+  Material *_material;
+  AABB _box;
+};
+
+// _____________________________________________________________________________
+Instance::Instance(const Hitable *object,
+                   const Transform &to_world,
+                   Material *material) {
+  _object = object;
+  _material = material;
+  this->to_world(to_world);
+}
+
+// _____________________________________________________________________________
+void Instance::to_world(const Transform &t) {
+  _to_world = t;
+  _to_object = t.inverse();
+  refit();
+}
+
+// _____________________________________________________________________________
+void Instance::refit() {
+  AABB object_box;
+  if (_object->bounding_box(object_box)) _box = _to_world.box(object_box);
+}
+
+// _____________________________________________________________________________
+bool Instance::hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const {
+  // The direction isn't normalized, so the ray parameter t is the same in
+  // both spaces
+  Ray object_ray(_to_object.point(r.origin()),
+                 _to_object.vector(r.direction()),
+                 r.time());
+  if (!_object->hit(object_ray, t_min, t_max, rec)) return false;
+
+  rec.p = _to_world.point(rec.p);
+  rec.normal = make_unit_vector(_to_object.transposed(rec.normal));
+  if (_material != nullptr) rec.mat_ptr = _material;
+  return true;
+}
+
+// _____________________________________________________________________________
+bool Instance::bounding_box(AABB &box) const {
+  if (_box.is_empty()) return false;
+  box = _box;
+  return true;
+}
+
+// _____________________________________________________________________________
+unsigned Instance::material_types() const {
+  // The instance's material replaces the ones of the object
+  if (_material != nullptr) return material_bit(_material->type());
+  return _object->material_types();
+}
+
+#endif  // SRC_INSTANCE_H_
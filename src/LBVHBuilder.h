@@ -0,0 +1,487 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_LBVHBUILDER_H_
+#define SRC_LBVHBUILDER_H_
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <utility>  // pair
+#include <vector>
+
+#include "AABB.h"
+#include "BVHBuilder.h"
+#include "LinearBVHNode.h"
+#include "ThreadPool.h"
+
+// Number of bits per radix sort pass
+#define LBVH_RADIX_BITS 8
+// Maximum number of leaves of a treelet restructured by the optimization pass
+#define LBVH_TREELET_SIZE 7
+// Subtrees above this depth are optimized as separate tasks
+#define LBVH_TASK_DEPTH 6
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Build a linear BVH (LBVH) over the provided primitive bounding boxes:
+ * 1. The centroids are quantized inside the scene's centroid bounds and
+ *    interleaved into Morton codes with 30 (10 bits per axis) or 63 (21 bits
+ *    per axis) bits.
+ * 2. The codes are sorted with a parallel LSD radix sort.
+ * 3. The hierarchy is emitted by splitting each range at the highest bit, in
+ *    which the codes of its first and last primitive differ. Every leaf holds
+ *    one primitive, so the position of every subtree in the depth-first node
+ *    array is known upfront, and subtrees are emitted concurrently.
+ * When optimize is set, a treelet restructuring pass (Karras and Aila, 2013)
+ * replaces the topology of each treelet of up to LBVH_TREELET_SIZE leaves
+ * with the one of lowest SAH cost, unless that makes the tree deeper than
+ * BVH_MAX_DEPTH.
+ */
+BVHBuildResult build_lbvh(const std::vector<AABB> &boxes,
+                          ThreadPool *pool,
+                          int morton_bits,
+                          bool optimize);
+
+/**
+ * Sort keys with their values in ascending order of the lowest bits of the
+ * keys with a parallel LSD radix sort. The sort is stable.
+ */
+void radix_sort(std::vector<uint64_t> &keys,
+                std::vector<int32_t> &values,
+                int bits,
+                ThreadPool *pool);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+// Insert two 0 bits after each of the lowest 10 bits of v
+inline uint64_t expand_bits_10(uint64_t v) {
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+// _____________________________________________________________________________
+// Insert two 0 bits after each of the lowest 21 bits of v
+inline uint64_t expand_bits_21(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | (v << 32)) & 0x001f00000000ffffull;
+  v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+  v = (v | (v << 8)) & 0x100f00f00f00f00full;
+  v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+  v = (v | (v << 2)) & 0x1249249249249249ull;
+  return v;
+}
+
+// _____________________________________________________________________________
+void radix_sort(std::vector<uint64_t> &keys,
+                std::vector<int32_t> &values,
+                int bits,
+                ThreadPool *pool) {
+  const int num_buckets = 1 << LBVH_RADIX_BITS;
+  int n = static_cast<int>(keys.size());
+  int num_chunks = pool != nullptr && n > BVH_TASK_THRESHOLD ? pool->size() : 1;
+  int chunk_size = (n + num_chunks - 1) / num_chunks;
+
+  std::vector<uint64_t> keys_tmp(n);
+  std::vector<int32_t> values_tmp(n);
+  std::vector<int> offsets(num_chunks * num_buckets);
+  auto for_each_chunk = [&](const std::function<void(int, int, int)> &f) {
+    auto body = [&](int c) {
+      int b = c * chunk_size;
+      int e = b + chunk_size < n ? b + chunk_size : n;
+      f(c, b, e);
+    };
+    if (num_chunks > 1) {
+      pool->parallel_for(num_chunks, body);
+    } else {
+      body(0);
+    }
+  };
+
+  for (int shift = 0; shift < bits; shift += LBVH_RADIX_BITS) {
+    // Count the digits of each chunk
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for_each_chunk([&](int c, int b, int e) {
+      int *hist = &offsets[c * num_buckets];
+      for (int i = b; i < e; i++) {
+        hist[(keys[i] >> shift) & (num_buckets - 1)]++;
+      }
+    });
+
+    // Exclusive prefix sum over digits first and chunks second, which
+    // keeps the sort stable
+    int sum = 0;
+    for (int d = 0; d < num_buckets; d++) {
+      for (int c = 0; c < num_chunks; c++) {
+        int count = offsets[c * num_buckets + d];
+        offsets[c * num_buckets + d] = sum;
+        sum += count;
+      }
+    }
+
+    // Scatter each chunk to its offsets
+    for_each_chunk([&](int c, int b, int e) {
+      int *offset = &offsets[c * num_buckets];
+      for (int i = b; i < e; i++) {
+        int dst = offset[(keys[i] >> shift) & (num_buckets - 1)]++;
+        keys_tmp[dst] = keys[i];
+        values_tmp[dst] = values[i];
+      }
+    });
+    keys.swap(keys_tmp);
+    values.swap(values_tmp);
+  }
+}
+
+// State shared by all nodes of a LBVH build
+struct LBVHBuildContext {
+  const std::vector<AABB> *boxes;
+  std::vector<uint64_t> codes;
+  std::vector<int32_t> *indices;
+  std::vector<LinearBVHNode> *nodes;
+  ThreadPool *pool;
+};
+
+// _____________________________________________________________________________
+// Emit the subtree over the sorted primitives [begin, end) starting at the
+// node with index node_idx. Returns the bounding box of the subtree.
+AABB emit_lbvh_recursive(LBVHBuildContext &ctx, int begin, int end,
+                         int node_idx) {
+  LinearBVHNode node{};
+  if (end - begin == 1) {
+    AABB box = (*ctx.boxes)[(*ctx.indices)[begin]];
+    node.box(box);
+    node.offset = begin;
+    node.count = 1;
+    (*ctx.nodes)[node_idx] = node;
+    return box;
+  }
+
+  // Find the first code, which has the highest differing bit set
+  uint64_t first = ctx.codes[begin];
+  uint64_t last = ctx.codes[end - 1];
+  int mid;
+  if (first == last) {
+    // Identical codes, split in the middle
+    mid = begin + (end - begin) / 2;
+    node.axis = 0;
+  } else {
+    int bit = 63 - __builtin_clzll(first ^ last);
+    int lo = begin;
+    int hi = end - 1;
+    while (lo + 1 < hi) {
+      int m = (lo + hi) / 2;
+      if ((ctx.codes[m] >> bit) & 1) {
+        hi = m;
+      } else {
+        lo = m;
+      }
+    }
+    mid = hi;
+    // Bits are interleaved as ...xyz
+    node.axis = static_cast<uint16_t>(2 - bit % 3);
+  }
+
+  // A subtree over k primitives has 2k - 1 nodes
+  int left_idx = node_idx + 1;
+  int right_idx = node_idx + 2 * (mid - begin);
+  AABB left_box, right_box;
+  if (ctx.pool != nullptr && end - begin > BVH_TASK_THRESHOLD) {
+    std::future<void> left = ctx.pool->submit([&]() {
+      left_box = emit_lbvh_recursive(ctx, begin, mid, left_idx);
+    });
+    right_box = emit_lbvh_recursive(ctx, mid, end, right_idx);
+    ctx.pool->wait(left);
+  } else {
+    left_box = emit_lbvh_recursive(ctx, begin, mid, left_idx);
+    right_box = emit_lbvh_recursive(ctx, mid, end, right_idx);
+  }
+
+  AABB box = surrounding_box(left_box, right_box);
+  node.box(box);
+  node.offset = right_idx;
+  node.count = 0;
+  (*ctx.nodes)[node_idx] = node;
+  return box;
+}
+
+// Node of the explicit binary tree used by the treelet optimization
+struct TreeletNode {
+  AABB box;
+  int left;
+  int right;
+  int offset;
+  int count;
+  // SAH cost of the subtree, not normalized by the root's area
+  float cost;
+};
+
+// _____________________________________________________________________________
+void optimize_treelet(std::vector<TreeletNode> &tree, int root) {
+  // Grow the treelet by repeatedly expanding the leaf with the largest area
+  int leaves[LBVH_TREELET_SIZE];
+  int internal[LBVH_TREELET_SIZE];
+  int num_leaves = 2;
+  int num_internal = 1;
+  leaves[0] = tree[root].left;
+  leaves[1] = tree[root].right;
+  internal[0] = root;
+  while (num_leaves < LBVH_TREELET_SIZE) {
+    int best = -1;
+    float best_area = -1.f;
+    for (int i = 0; i < num_leaves; i++) {
+      const TreeletNode &n = tree[leaves[i]];
+      if (n.count == 0 && n.box.surface_area() > best_area) {
+        best_area = n.box.surface_area();
+        best = i;
+      }
+    }
+    if (best < 0) break;
+    int expanded = leaves[best];
+    internal[num_internal++] = expanded;
+    leaves[best] = tree[expanded].left;
+    leaves[num_leaves++] = tree[expanded].right;
+  }
+  if (num_leaves < 3) return;
+
+  // Optimal cost of every subset of the treelet's leaves
+  const int num_subsets = 1 << num_leaves;
+  float area[1 << LBVH_TREELET_SIZE];
+  float cost[1 << LBVH_TREELET_SIZE];
+  int split[1 << LBVH_TREELET_SIZE];
+  AABB subset_box[1 << LBVH_TREELET_SIZE];
+  for (int s = 1; s < num_subsets; s++) {
+    int lowest = __builtin_ctz(s);
+    if (s == (1 << lowest)) {
+      subset_box[s] = tree[leaves[lowest]].box;
+    } else {
+      subset_box[s] = subset_box[s & (s - 1)];
+      subset_box[s].extend(tree[leaves[lowest]].box);
+    }
+    area[s] = subset_box[s].surface_area();
+  }
+  // Process subsets in order of increasing size
+  for (int size = 1; size <= num_leaves; size++) {
+    for (int s = 1; s < num_subsets; s++) {
+      if (__builtin_popcount(s) != size) continue;
+      if (size == 1) {
+        cost[s] = tree[leaves[__builtin_ctz(s)]].cost;
+        continue;
+      }
+      // Enumerate the partitions of s, each one only once, by requiring the
+      // first part to contain the lowest element of s
+      float best_cost = maxf();
+      int best_split = 0;
+      int lowest = s & (-s);
+      for (int p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+        if ((p & lowest) == 0) continue;
+        float c = cost[p] + cost[s ^ p];
+        if (c < best_cost) {
+          best_cost = c;
+          best_split = p;
+        }
+      }
+      cost[s] = area[s] + best_cost;
+      split[s] = best_split;
+    }
+  }
+
+  // Keep the old topology, unless the optimal one is cheaper
+  int all = num_subsets - 1;
+  if (cost[all] >= tree[root].cost) return;
+
+  // Rebuild the treelet reusing its internal nodes
+  int next_internal = 0;
+  std::function<int(int)> rebuild = [&](int s) -> int {
+    if ((s & (s - 1)) == 0) return leaves[__builtin_ctz(s)];
+    int idx = internal[next_internal++];
+    int left = rebuild(split[s]);
+    int right = rebuild(s ^ split[s]);
+    TreeletNode &n = tree[idx];
+    n.left = left;
+    n.right = right;
+    n.box = subset_box[s];
+    n.cost = cost[s];
+    return idx;
+  };
+  rebuild(all);
+}
+
+// _____________________________________________________________________________
+void optimize_treelets_recursive(std::vector<TreeletNode> &tree, int node,
+                                 int depth, ThreadPool *pool) {
+  if (tree[node].count > 0) return;
+  int left = tree[node].left;
+  int right = tree[node].right;
+  // Subtrees are disjoint, so they are optimized independently, bottom-up
+  if (pool != nullptr && depth < LBVH_TASK_DEPTH) {
+    std::future<void> f = pool->submit([&tree, left, depth, pool]() {
+      optimize_treelets_recursive(tree, left, depth + 1, pool);
+    });
+    optimize_treelets_recursive(tree, right, depth + 1, pool);
+    pool->wait(f);
+  } else {
+    optimize_treelets_recursive(tree, left, depth + 1, nullptr);
+    optimize_treelets_recursive(tree, right, depth + 1, nullptr);
+  }
+  optimize_treelet(tree, node);
+}
+
+// _____________________________________________________________________________
+void flatten_treelets(const std::vector<TreeletNode> &tree, int node,
+                      std::vector<LinearBVHNode> &out) {
+  const TreeletNode &n = tree[node];
+  int node_idx = static_cast<int>(out.size());
+  out.emplace_back();
+  LinearBVHNode flat{};
+  flat.box(n.box);
+  if (n.count > 0) {
+    flat.offset = n.offset;
+    flat.count = static_cast<uint16_t>(n.count);
+    out[node_idx] = flat;
+    return;
+  }
+
+  // The children keep their order, so that the leaves stay in the order of
+  // the Morton split. The traversal visits the left child first along the
+  // axis, on which it lies furthest before the right one
+  Vec3 d = tree[n.right].box.centroid() - tree[n.left].box.centroid();
+  int axis = 0;
+  for (int a = 1; a < 3; a++) {
+    if (d[a] > d[axis]) axis = a;
+  }
+  flat.axis = static_cast<uint16_t>(axis);
+  flatten_treelets(tree, n.left, out);
+  flat.offset = static_cast<int32_t>(out.size());
+  flatten_treelets(tree, n.right, out);
+  out[node_idx] = flat;
+}
+
+// _____________________________________________________________________________
+void optimize_lbvh(BVHBuildResult &bvh, ThreadPool *pool) {
+  // Convert to an explicit tree, in which the topology can be changed
+  int num_nodes = static_cast<int>(bvh.nodes.size());
+  std::vector<TreeletNode> tree(num_nodes);
+  for (int i = num_nodes - 1; i >= 0; i--) {
+    const LinearBVHNode &flat = bvh.nodes[i];
+    TreeletNode &n = tree[i];
+    n.box = flat.box();
+    n.offset = flat.offset;
+    n.count = flat.count;
+    if (flat.is_leaf()) {
+      n.left = n.right = -1;
+      n.cost = n.box.surface_area() * n.count;
+    } else {
+      n.left = i + 1;
+      n.right = flat.offset;
+      n.cost = n.box.surface_area() + tree[n.left].cost + tree[n.right].cost;
+    }
+  }
+
+  optimize_treelets_recursive(tree, 0, 0, pool);
+
+  // The restructuring may deepen the tree; keep the Morton tree, which is at
+  // most 63 + log2(n) levels deep, if it becomes too deep for the traversal
+  std::vector<std::pair<int, int>> stack = {{0, 0}};
+  while (!stack.empty()) {
+    std::pair<int, int> entry = stack.back();
+    stack.pop_back();
+    const TreeletNode &n = tree[entry.first];
+    if (n.count > 0) continue;
+    if (entry.second + 1 > BVH_MAX_DEPTH) return;
+    stack.push_back({n.left, entry.second + 1});
+    stack.push_back({n.right, entry.second + 1});
+  }
+
+  bvh.nodes.clear();
+  flatten_treelets(tree, 0, bvh.nodes);
+
+  // The restructured treelets combine leaves from anywhere in the treelet,
+  // so renumber the primitives in the depth-first order of the leaves. Like
+  // in the trees of the other builders, every subtree then covers one
+  // contiguous range of them
+  std::vector<int32_t> indices;
+  indices.reserve(bvh.indices.size());
+  for (LinearBVHNode &node : bvh.nodes) {
+    if (!node.is_leaf()) continue;
+    int32_t offset = static_cast<int32_t>(indices.size());
+    indices.insert(indices.end(), bvh.indices.begin() + node.offset,
+                   bvh.indices.begin() + node.offset + node.count);
+    node.offset = offset;
+  }
+  bvh.indices.swap(indices);
+}
+
+// _____________________________________________________________________________
+BVHBuildResult build_lbvh(const std::vector<AABB> &boxes,
+                          ThreadPool *pool,
+                          int morton_bits,
+                          bool optimize) {
+  BVHBuildResult out;
+  int n = static_cast<int>(boxes.size());
+  if (n == 0) return out;
+
+  // Quantize the centroids inside their bounds
+  AABB centroid_box;
+  for (const AABB &box : boxes) centroid_box.extend(box.centroid());
+  int bits_per_axis = morton_bits > 30 ? 21 : 10;
+  float cells = static_cast<float>((1 << bits_per_axis) - 1);
+  Vec3 extent = centroid_box.max() - centroid_box.min();
+  Vec3 scale(extent.x() > 0.f ? cells / extent.x() : 0.f,
+             extent.y() > 0.f ? cells / extent.y() : 0.f,
+             extent.z() > 0.f ? cells / extent.z() : 0.f);
+
+  LBVHBuildContext ctx;
+  ctx.boxes = &boxes;
+  ctx.codes.resize(n);
+  ctx.indices = &out.indices;
+  ctx.nodes = &out.nodes;
+  ctx.pool = pool;
+  out.indices.resize(n);
+  auto compute_codes = [&](int b, int e) {
+    for (int i = b; i < e; i++) {
+      Vec3 q = (boxes[i].centroid() - centroid_box.min()) * scale;
+      uint64_t x = static_cast<uint64_t>(q.x());
+      uint64_t y = static_cast<uint64_t>(q.y());
+      uint64_t z = static_cast<uint64_t>(q.z());
+      if (bits_per_axis == 21) {
+        ctx.codes[i] = (expand_bits_21(x) << 2) | (expand_bits_21(y) << 1)
+                       | expand_bits_21(z);
+      } else {
+        ctx.codes[i] = (expand_bits_10(x) << 2) | (expand_bits_10(y) << 1)
+                       | expand_bits_10(z);
+      }
+      out.indices[i] = i;
+    }
+  };
+  if (pool != nullptr && n > BVH_TASK_THRESHOLD) {
+    int chunk_size = (n + pool->size() - 1) / pool->size();
+    pool->parallel_for(pool->size(), [&](int c) {
+      int b = c * chunk_size;
+      compute_codes(b, b + chunk_size < n ? b + chunk_size : n);
+    });
+  } else {
+    compute_codes(0, n);
+  }
+
+  radix_sort(ctx.codes, out.indices, 3 * bits_per_axis, pool);
+
+  out.nodes.resize(2 * n - 1);
+  emit_lbvh_recursive(ctx, 0, n, 0);
+
+  if (optimize) optimize_lbvh(out, pool);
+  return out;
+}
+
+#endif  // SRC_LBVHBUILDER_H_
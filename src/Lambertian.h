@@ -11,13 +11,20 @@
 
 class Lambertian: public Material {
  public:
-  Lambertian() = default;
-  explicit Lambertian(Texture *albedo) : _albedo(albedo) {}
+  Lambertian() : Material(MATERIAL_LAMBERTIAN) {}
+  explicit Lambertian(Texture *albedo)
+      : Material(MATERIAL_LAMBERTIAN), _albedo(albedo) {}
 
   virtual bool scatter(const Ray &r,
                        const HitRecord &rec,
                        Vec3 &attenuation,
                        Ray &scattered) const;
+
+  // Reflected fraction of the light at the hit
+  inline Vec3 albedo(const HitRecord &rec) const {
+    return _albedo->value(0.f, 0.f, rec.p);
+  }
+
  private:
   Texture *_albedo{nullptr};
 };
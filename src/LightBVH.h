@@ -0,0 +1,507 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_LIGHTBVH_H_
+#define SRC_LIGHTBVH_H_
+
+#include <algorithm>  // min, max, partition
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "AABB.h"
+#include "HitableList.h"
+#include "Material.h"
+#include "Sphere.h"
+#include "Utils.h"
+#include "Vec3.h"
+
+// Definitions
+// Buckets per axis of the binned light BVH build
+#define LIGHT_BVH_BUCKETS 12
+// Maximum depth of the light BVH, limited by the bits of the trails
+#define LIGHT_BVH_MAX_DEPTH 64
+
+enum LightSampling {
+  // Lights are only found by the paths, which hit them
+  LIGHT_SAMPLING_NONE,
+  // One light is sampled at every diffuse hit, all with the same chance
+  LIGHT_SAMPLING_UNIFORM,
+  // One light is sampled at every diffuse hit by its estimated contribution
+  LIGHT_SAMPLING_BVH
+};
+
+/**
+ * Bounds of the emitters below a node of the light BVH: the box around
+ * them, their total power phi, and a cone of their emission directions,
+ * which are within theta_o around w, each spreading light up to theta_e
+ * further (pi / 2 for diffuse emitters). Only the cosines of the angles are
+ * stored.
+ */
+struct LightBounds {
+  AABB box;
+  float phi{0.f};
+  Vec3 w{0.f, 0.f, 1.f};
+  float cos_theta_o{1.f};
+  float cos_theta_e{1.f};
+
+  /**
+   * Upper bound of the light, which the emitters send to a point p with
+   * the normal n, up to a constant factor. It's 0 only, if no emitter can
+   * reach p.
+   */
+  float importance(const Vec3 &p, const Vec3 &n) const;
+};
+
+/**
+ * Emitting sphere, which can be sampled by the cone of directions, in which
+ * it is seen from a point outside of it. The light of the sphere is its
+ * material's emission at the center.
+ */
+struct SphereLight {
+  const Sphere *sphere;
+  Vec3 radiance;
+
+  // Bounds of the sphere, which emits in every direction
+  LightBounds bounds() const;
+  /**
+   * Random direction from p towards the sphere, uniform within the cone,
+   * in which it is seen, and its density (per solid angle). Returns false,
+   * if p is inside.
+   */
+  bool sample(const Vec3 &p, Vec3 &direction, float &pdf) const;
+  // Density of sample at p, for every direction towards the sphere
+  float pdf(const Vec3 &p) const;
+};
+
+/**
+ * BVH over the lights of a scene for picking one light at a shading point
+ * in proportion to its estimated contribution there (Conty Estevez and
+ * Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting",
+ * 2018). Each node bounds the position, power and emission directions of
+ * its lights (see LightBounds). A light is picked by descending from the
+ * root, and choosing each child randomly by its importance at the point, so
+ * the cost is logarithmic in the number of lights. Close and bright lights
+ * are picked far more often than the others, which a uniform pick would
+ * treat the same, so the noise stays low with many lights.
+ * The chance of a light, which was hit by a path instead, is found again by
+ * following the light's trail, the sides taken from the root to its leaf.
+ * With uniform, the lights are picked with the same chance, for comparison.
+ */
+class LightBVH {
+ public:
+  LightBVH() = delete;
+  explicit LightBVH(std::vector<SphereLight> lights, bool uniform = false);
+  LightBVH(const LightBVH &b) = delete;
+  LightBVH& operator=(const LightBVH &b) = delete;
+
+  inline int light_count() const { return static_cast<int>(_lights.size()); }
+  inline const SphereLight& light(int i) const { return _lights[i]; }
+  inline int node_count() const { return static_cast<int>(_nodes.size()); }
+  inline bool uniform() const { return _uniform; }
+
+  // Index of the light with the material, or -1, if it isn't a light
+  inline int light_of(const Material *m) const {
+    auto it = _by_material.find(m);
+    return it == _by_material.end() ? -1 : it->second;
+  }
+
+  /**
+   * Pick a light for the point p with the normal n with the random number u
+   * in [0, 1). Returns false, if no light can reach p; otherwise light and
+   * the probability pmf, with which it was picked.
+   */
+  bool sample(const Vec3 &p, const Vec3 &n, float u,
+              int &light, float &pmf) const;
+  // Probability, with which sample picks the light for p and n
+  float pmf(const Vec3 &p, const Vec3 &n, int light) const;
+
+ private:
+  struct Node {
+    LightBounds bounds;
+    // Interior node: index of the second child; the first child is the
+    // next node. Leaf: index of the light
+    int32_t offset;
+    bool leaf;
+  };
+
+  // Build the subtree over the lights [begin, end) of order at depth, with
+  // the trail of the sides taken so far; returns the index of its root
+  int build(std::vector<int> &order, int begin, int end, int depth,
+            uint64_t trail);
+
+  std::vector<SphereLight> _lights;
+  std::vector<Node> _nodes;
+  // Sides (bit d for depth d, 1 for the second child) from the root to the
+  // leaf of every light
+  std::vector<uint64_t> _trails;
+  std::unordered_map<const Material*, int> _by_material;
+  bool _uniform;
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Lights of the list, the spheres with an emitting material. Other emitters
+ * can't be sampled and are only found by the paths, which hit them.
+ */
+std::vector<SphereLight> sphere_lights(HitableList *list);
+
+// Bounds of the emitters of both bounds
+LightBounds union_bounds(const LightBounds &a, const LightBounds &b);
+
+// Lights sampled by the direct lighting kernel, nullptr without
+inline const LightBVH*& scene_lights();
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+// Square root, which is 0 for the negative results of rounding errors
+inline float safe_sqrt(float x) {
+  return sqrtf(maxf(x, 0.f));
+}
+
+// _____________________________________________________________________________
+// cos(max(0, a - b)) from the sines and cosines of a and b in [0, pi]
+inline float cos_sub_clamped(float sin_a, float cos_a,
+                             float sin_b, float cos_b) {
+  if (cos_a > cos_b) return 1.f;
+  return cos_a * cos_b + sin_a * sin_b;
+}
+
+// _____________________________________________________________________________
+// sin(max(0, a - b)) from the sines and cosines of a and b in [0, pi]
+inline float sin_sub_clamped(float sin_a, float cos_a,
+                             float sin_b, float cos_b) {
+  if (cos_a > cos_b) return 0.f;
+  return sin_a * cos_b - cos_a * sin_b;
+}
+
+// _____________________________________________________________________________
+// Average of the color channels, as a measure of power
+inline float average(const Vec3 &c) {
+  return (c.x() + c.y() + c.z()) / 3.f;
+}
+
+// _____________________________________________________________________________
+float LightBounds::importance(const Vec3 &p, const Vec3 &n) const {
+  // Distance to the center, limited, so that points close to or inside the
+  // box don't get an infinite importance
+  Vec3 center = box.centroid();
+  Vec3 diagonal = box.max() - box.min();
+  float d2 = maxf((p - center).squared_length(), 0.5f * diagonal.length());
+  Vec3 wi = p - center;
+  float length = wi.length();
+  wi = length > 0.f ? wi / length : Vec3(0.f, 0.f, 1.f);
+
+  // Angle between the emission cone and p, less the angle, in which the
+  // bounding sphere of the box is seen from p
+  float cos_theta_w = dot(w, wi);
+  float sin_theta_w = safe_sqrt(1.f - cos_theta_w * cos_theta_w);
+  float radius2 = 0.25f * diagonal.squared_length();
+  float cos_theta_b = d2 < radius2 ? -1.f : safe_sqrt(1.f - radius2 / d2);
+  float sin_theta_b = safe_sqrt(1.f - cos_theta_b * cos_theta_b);
+  float sin_theta_o = safe_sqrt(1.f - cos_theta_o * cos_theta_o);
+  float cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w,
+                                      sin_theta_o, cos_theta_o);
+  float sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w,
+                                      sin_theta_o, cos_theta_o);
+  float cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x,
+                                      sin_theta_b, cos_theta_b);
+  if (cos_theta_p <= cos_theta_e) return 0.f;
+  float importance = phi * cos_theta_p / d2;
+
+  // Cosine at the receiver, with the same allowance for the box
+  float cos_theta_i = fabsf(dot(wi, n));
+  float sin_theta_i = safe_sqrt(1.f - cos_theta_i * cos_theta_i);
+  importance *= cos_sub_clamped(sin_theta_i, cos_theta_i,
+                                sin_theta_b, cos_theta_b);
+  return maxf(importance, 0.f);
+}
+
+// _____________________________________________________________________________
+LightBounds SphereLight::bounds() const {
+  float r = sphere->radius();
+  Vec3 c = sphere->center();
+  LightBounds b;
+  b.box = AABB(c - Vec3(r, r, r), c + Vec3(r, r, r));
+  // Radiance times the area times pi
+  b.phi = average(radiance) * 4.f * M_PI * r * r * M_PI;
+  // Every direction, spread by the cosine of a diffuse emitter
+  b.cos_theta_o = -1.f;
+  b.cos_theta_e = 0.f;
+  return b;
+}
+
+// _____________________________________________________________________________
+float SphereLight::pdf(const Vec3 &p) const {
+  float r2 = sphere->radius() * sphere->radius();
+  float d2 = (sphere->center() - p).squared_length();
+  if (d2 <= r2) return 0.f;
+  // 1 - cos(theta_max) as sin^2 / (1 + cos), which doesn't cancel for
+  // distant spheres
+  float sin2 = r2 / d2;
+  float cos_max = safe_sqrt(1.f - sin2);
+  return 1.f / (2.f * M_PI * sin2 / (1.f + cos_max));
+}
+
+// _____________________________________________________________________________
+bool SphereLight::sample(const Vec3 &p, Vec3 &direction, float &pdf) const {
+  Vec3 to_center = sphere->center() - p;
+  float r2 = sphere->radius() * sphere->radius();
+  float d2 = to_center.squared_length();
+  if (d2 <= r2) return false;
+  float sin2 = r2 / d2;
+  float cos_max = safe_sqrt(1.f - sin2);
+  float one_minus_cos_max = sin2 / (1.f + cos_max);
+
+  // Uniform within the cone around the direction to the center
+  float u1 = get_random_in_range(0.f, 1.f);
+  float u2 = get_random_in_range(0.f, 1.f);
+  float cos_theta = 1.f - u1 * one_minus_cos_max;
+  float sin_theta = safe_sqrt(1.f - cos_theta * cos_theta);
+  float phi = 2.f * M_PI * u2;
+  Vec3 w = to_center / sqrtf(d2);
+  Vec3 a = fabsf(w.x()) > 0.9f ? Vec3(0.f, 1.f, 0.f) : Vec3(1.f, 0.f, 0.f);
+  Vec3 v = make_unit_vector(cross(w, a));
+  Vec3 u = cross(w, v);
+  direction = sin_theta * cosf(phi) * u + sin_theta * sinf(phi) * v
+              + cos_theta * w;
+  pdf = 1.f / (2.f * M_PI * one_minus_cos_max);
+  return true;
+}
+
+// _____________________________________________________________________________
+LightBounds union_bounds(const LightBounds &a, const LightBounds &b) {
+  if (a.phi == 0.f) return b;
+  if (b.phi == 0.f) return a;
+  LightBounds u;
+  u.box = a.box;
+  u.box.extend(b.box);
+  u.phi = a.phi + b.phi;
+  u.cos_theta_e = minf(a.cos_theta_e, b.cos_theta_e);
+
+  // Smallest cone around both cones
+  float theta_a = acosf(fmaxf(-1.f, fminf(1.f, a.cos_theta_o)));
+  float theta_b = acosf(fmaxf(-1.f, fminf(1.f, b.cos_theta_o)));
+  float theta_d = acosf(fmaxf(-1.f, fminf(1.f, dot(a.w, b.w))));
+  if (fminf(theta_d + theta_b, M_PI) <= theta_a) {
+    u.w = a.w;
+    u.cos_theta_o = a.cos_theta_o;
+    return u;
+  }
+  if (fminf(theta_d + theta_a, M_PI) <= theta_b) {
+    u.w = b.w;
+    u.cos_theta_o = b.cos_theta_o;
+    return u;
+  }
+  float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+  Vec3 axis = cross(a.w, b.w);
+  if (theta_o >= M_PI || axis.squared_length() == 0.f) {
+    u.cos_theta_o = -1.f;
+    return u;
+  }
+  // Rotate a's axis towards b's by theta_o - theta_a (Rodrigues)
+  float theta_r = theta_o - theta_a;
+  Vec3 k = make_unit_vector(axis);
+  u.w = a.w * cosf(theta_r) + cross(k, a.w) * sinf(theta_r)
+        + k * dot(k, a.w) * (1.f - cosf(theta_r));
+  u.cos_theta_o = cosf(theta_o);
+  return u;
+}
+
+// _____________________________________________________________________________
+// Measure of the emission directions of the bounds for the build cost
+inline float orientation_measure(const LightBounds &b) {
+  float theta_o = acosf(fmaxf(-1.f, fminf(1.f, b.cos_theta_o)));
+  float theta_e = acosf(fmaxf(-1.f, fminf(1.f, b.cos_theta_e)));
+  float theta_w = fminf(theta_o + theta_e, M_PI);
+  float sin_theta_o = sinf(theta_o);
+  return 2.f * M_PI * (1.f - cosf(theta_o))
+         + M_PI / 2.f * (2.f * theta_w * sin_theta_o
+                         - cosf(theta_o - 2.f * theta_w)
+                         - 2.f * theta_o * sin_theta_o + cosf(theta_o));
+}
+
+// _____________________________________________________________________________
+std::vector<SphereLight> sphere_lights(HitableList *list) {
+  std::vector<SphereLight> lights;
+  for (int i = 0; i < list->size(); i++) {
+    const Sphere *s = dynamic_cast<const Sphere*>((*list)[i]);
+    if (s == nullptr || s->material() == nullptr) continue;
+    Vec3 radiance = s->material()->emit(0.5f, 0.5f, s->center());
+    if (average(radiance) > 0.f) lights.push_back({s, radiance});
+  }
+  return lights;
+}
+
+// _____________________________________________________________________________
+const LightBVH*& scene_lights() {
+  static const LightBVH *lights = nullptr;
+  return lights;
+}
+
+// _____________________________________________________________________________
+LightBVH::LightBVH(std::vector<SphereLight> lights, bool uniform)
+    : _lights(std::move(lights)), _uniform(uniform) {
+  int n = light_count();
+  _trails.assign(n, 0u);
+  for (int i = 0; i < n; i++) {
+    _by_material[_lights[i].sphere->material()] = i;
+  }
+  if (n == 0) return;
+  std::vector<int> order(n);
+  for (int i = 0; i < n; i++) order[i] = i;
+  _nodes.reserve(2 * n - 1);
+  build(order, 0, n, 0, 0u);
+}
+
+// _____________________________________________________________________________
+int LightBVH::build(std::vector<int> &order, int begin, int end, int depth,
+                    uint64_t trail) {
+  int index = static_cast<int>(_nodes.size());
+  _nodes.push_back(Node());
+  LightBounds bounds;
+  AABB centroids;
+  for (int i = begin; i < end; i++) {
+    LightBounds b = _lights[order[i]].bounds();
+    bounds = union_bounds(bounds, b);
+    centroids.extend(b.box.centroid());
+  }
+  _nodes[index].bounds = bounds;
+  if (end - begin == 1 || depth + 1 >= LIGHT_BVH_MAX_DEPTH) {
+    // One light per leaf; a leaf at the maximum depth keeps the first
+    _nodes[index].leaf = true;
+    _nodes[index].offset = order[begin];
+    for (int i = begin; i < end; i++) _trails[order[i]] = trail;
+    return index;
+  }
+
+  // Binned split by the cost of the power, the box and the directions of
+  // each side, with cubes preferred over slabs
+  Vec3 extent = centroids.max() - centroids.min();
+  float max_extent = maxf(extent.x(), maxf(extent.y(), extent.z()));
+  float best_cost = maxf();
+  int best_axis = -1;
+  int best_bucket = -1;
+  for (int axis = 0; axis < 3; axis++) {
+    if (extent[axis] <= 0.f) continue;
+    LightBounds buckets[LIGHT_BVH_BUCKETS];
+    auto bucket_of = [&](int light) {
+      float c = _lights[light].sphere->center()[axis];
+      int b = static_cast<int>(LIGHT_BVH_BUCKETS
+                               * (c - centroids.min()[axis]) / extent[axis]);
+      return std::min(std::max(b, 0), LIGHT_BVH_BUCKETS - 1);
+    };
+    for (int i = begin; i < end; i++) {
+      LightBounds &b = buckets[bucket_of(order[i])];
+      b = union_bounds(b, _lights[order[i]].bounds());
+    }
+    float regularization = max_extent / extent[axis];
+    auto cost = [&](const LightBounds &b) {
+      return b.phi * orientation_measure(b) * b.box.surface_area();
+    };
+    for (int split = 0; split < LIGHT_BVH_BUCKETS - 1; split++) {
+      LightBounds below, above;
+      for (int k = 0; k <= split; k++) below = union_bounds(below, buckets[k]);
+      for (int k = split + 1; k < LIGHT_BVH_BUCKETS; k++) {
+        above = union_bounds(above, buckets[k]);
+      }
+      if (below.phi == 0.f || above.phi == 0.f) continue;
+      float c = regularization * (cost(below) + cost(above));
+      if (c < best_cost) {
+        best_cost = c;
+        best_axis = axis;
+        best_bucket = split;
+      }
+    }
+  }
+
+  int mid = (begin + end) / 2;
+  if (best_axis >= 0) {
+    auto it = std::partition(
+        order.begin() + begin, order.begin() + end, [&](int light) {
+          float c = _lights[light].sphere->center()[best_axis];
+          int b = static_cast<int>(
+              LIGHT_BVH_BUCKETS * (c - centroids.min()[best_axis])
+              / extent[best_axis]);
+          return std::min(std::max(b, 0), LIGHT_BVH_BUCKETS - 1)
+                 <= best_bucket;
+        });
+    int split = static_cast<int>(it - order.begin());
+    if (split > begin && split < end) mid = split;
+  }
+  build(order, begin, mid, depth + 1, trail);
+  int second = build(order, mid, end, depth + 1, trail | (1ull << depth));
+  _nodes[index].leaf = false;
+  _nodes[index].offset = second;
+  return index;
+}
+
+// _____________________________________________________________________________
+bool LightBVH::sample(const Vec3 &p, const Vec3 &n, float u,
+                      int &light, float &pmf) const {
+  if (_nodes.empty()) return false;
+  if (_uniform) {
+    light = std::min(static_cast<int>(u * light_count()), light_count() - 1);
+    pmf = 1.f / light_count();
+    return true;
+  }
+  int node = 0;
+  pmf = 1.f;
+  while (!_nodes[node].leaf) {
+    int first = node + 1;
+    int second = _nodes[node].offset;
+    float importance_first = _nodes[first].bounds.importance(p, n);
+    float importance_second = _nodes[second].bounds.importance(p, n);
+    float total = importance_first + importance_second;
+    if (total <= 0.f) return false;
+    float p_first = importance_first / total;
+    // Reuse the random number for the next choice
+    if (u < p_first) {
+      node = first;
+      u = minf(u / p_first, 0.99999994f);
+      pmf *= p_first;
+    } else {
+      node = second;
+      u = minf((u - p_first) / (1.f - p_first), 0.99999994f);
+      pmf *= 1.f - p_first;
+    }
+  }
+  if (_nodes[node].bounds.importance(p, n) <= 0.f) return false;
+  light = _nodes[node].offset;
+  return true;
+}
+
+// _____________________________________________________________________________
+float LightBVH::pmf(const Vec3 &p, const Vec3 &n, int light) const {
+  if (_nodes.empty()) return 0.f;
+  if (_uniform) return 1.f / light_count();
+  uint64_t trail = _trails[light];
+  int node = 0;
+  float pmf = 1.f;
+  for (int depth = 0; !_nodes[node].leaf; depth++) {
+    int first = node + 1;
+    int second = _nodes[node].offset;
+    float importance_first = _nodes[first].bounds.importance(p, n);
+    float importance_second = _nodes[second].bounds.importance(p, n);
+    float total = importance_first + importance_second;
+    if (total <= 0.f) return 0.f;
+    if (trail & (1ull << depth)) {
+      node = second;
+      pmf *= importance_second / total;
+    } else {
+      node = first;
+      pmf *= importance_first / total;
+    }
+  }
+  // A leaf at the maximum depth may hold others than the light
+  return _nodes[node].offset == light ? pmf : 0.f;
+}
+
+#endif  // SRC_LIGHTBVH_H_
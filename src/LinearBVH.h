@@ -0,0 +1,293 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_LINEARBVH_H_
+#define SRC_LINEARBVH_H_
+
+#include <algorithm>  // sort, copy, min, max
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "BVHBuilder.h"
+#include "Hitable.h"
+#include "HitableList.h"
+#include "LinearBVHNode.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+/**
+ * BVH stored as a flat array of LinearBVHNode. The node array either lives
+ * in memory, or is memory-mapped from a cache file (see BVHCache.h).
+ * The BVH takes the ownership of the list of primitives.
+ */
+class LinearBVH: public Hitable {
+ public:
+  LinearBVH() = delete;
+  LinearBVH(HitableList *l, BVHBuildResult bvh);
+  // nodes points into mapping, which is owned by the BVH afterwards
+  LinearBVH(HitableList *l,
+            const LinearBVHNode *nodes, int node_count,
+            const int32_t *indices,
+            MappedFile *mapping);
+  LinearBVH(const LinearBVH &b) = delete;
+  LinearBVH& operator=(const LinearBVH &b) = delete;
+  ~LinearBVH();
+
+  inline int node_count() const { return _node_count; }
+  // Give up the ownership of the list of primitives and return it
+  inline HitableList* release() {
+    HitableList *l = _list;
+    _list = nullptr;
+    return l;
+  }
+  inline const LinearBVHNode* nodes() const { return _nodes; }
+  // Primitives in the order, in which the leaves reference them
+  inline const std::vector<Hitable*>& primitives() const {
+    return _primitives;
+  }
+
+  /**
+   * Update the boxes of all nodes bottom-up from the current bounding boxes
+   * of the primitives, keeping the topology. Afterwards, each subtree, whose
+   * SAH cost grew by more than the factor threshold since it was built, is
+   * rebuilt in place with the binned SAH builder.
+   * Returns the number of rebuilt subtrees.
+   */
+  int refit(float threshold, ThreadPool *pool);
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const;
+
+  virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const;
+
+ private:
+  void set_primitives(HitableList *l, const int32_t *indices, int count);
+  void compute_costs(std::vector<float> &costs) const;
+  // Rebuild the subtree of node_idx at depth in place; false, if its leaves
+  // don't cover a contiguous range of primitives
+  bool rebuild_subtree(int node_idx, int depth, ThreadPool *pool);
+
+  HitableList *_list{nullptr};
+  // Primitives in the order, in which the leaves reference them
+  std::vector<Hitable*> _primitives;
+  std::vector<LinearBVHNode> _node_storage;
+  const LinearBVHNode *_nodes{nullptr};
+  int _node_count{0};
+  MappedFile *_mapping{nullptr};
+  // SAH cost of every subtree at the time it was built, used by refit
+  std::vector<float> _reference_costs;
+};
+
+// _____________________________________________________________________________
+LinearBVH::LinearBVH(HitableList *l, BVHBuildResult bvh) {
+  _list = l;
+  _node_storage = std::move(bvh.nodes);
+  _nodes = _node_storage.data();
+  _node_count = static_cast<int>(_node_storage.size());
+  set_primitives(l, bvh.indices.data(), static_cast<int>(bvh.indices.size()));
+}
+
+// _____________________________________________________________________________
+LinearBVH::LinearBVH(HitableList *l,
+                     const LinearBVHNode *nodes, int node_count,
+                     const int32_t *indices,
+                     MappedFile *mapping) {
+  _list = l;
+  _nodes = nodes;
+  _node_count = node_count;
+  _mapping = mapping;
+  set_primitives(l, indices, l->size());
+}
+
+// _____________________________________________________________________________
+LinearBVH::~LinearBVH() {
+  delete _list;
+  delete _mapping;
+}
+
+// _____________________________________________________________________________
+void LinearBVH::set_primitives(HitableList *l,
+                               const int32_t *indices,
+                               int count) {
+  // Resolve the indices once, so that the traversal doesn't have to
+  _primitives.resize(count);
+  for (int i = 0; i < count; i++) {
+    _primitives[i] = (*l)[indices[i]];
+  }
+}
+
+// _____________________________________________________________________________
+bool LinearBVH::hit(const Ray &r,
+                    float t_min,
+                    float t_max,
+                    HitRecord &rec) const {
+  if (_node_count == 0) return false;
+
+  HitRecord temp_rec;
+  float closest_hit = t_max;
+  return traverse_bvh(_nodes, r, t_min, closest_hit,
+      [&](int offset, int count, float &closest) {
+        // Intersect the primitives inside the leaf
+        bool did_hit = false;
+        for (int i = offset; i < offset + count; i++) {
+          if (_primitives[i]->hit(r, t_min, closest, temp_rec)) {
+            did_hit = true;
+            closest = temp_rec.t;
+            rec = temp_rec;
+          }
+        }
+        return did_hit;
+      });
+}
+
+// _____________________________________________________________________________
+void LinearBVH::compute_costs(std::vector<float> &costs) const {
+  // Children follow their parents, so a reverse sweep is bottom-up
+  costs.resize(_node_count);
+  for (int i = _node_count - 1; i >= 0; i--) {
+    const LinearBVHNode &node = _nodes[i];
+    float area = node.box().surface_area();
+    costs[i] = node.is_leaf() ? area * node.count
+                              : area + costs[i + 1] + costs[node.offset];
+  }
+}
+
+// _____________________________________________________________________________
+int LinearBVH::refit(float threshold, ThreadPool *pool) {
+  if (_node_count == 0) return 0;
+
+  // Mapped nodes are read-only, so work on a copy
+  if (_node_storage.empty()) {
+    _node_storage.assign(_nodes, _nodes + _node_count);
+    _nodes = _node_storage.data();
+  }
+  if (_reference_costs.empty()) compute_costs(_reference_costs);
+
+  // Refit the boxes bottom-up
+  for (int i = _node_count - 1; i >= 0; i--) {
+    LinearBVHNode &node = _node_storage[i];
+    AABB box;
+    if (node.is_leaf()) {
+      for (int p = node.offset; p < node.offset + node.count; p++) {
+        AABB prim_box;
+        if (_primitives[p]->bounding_box(prim_box)) box.extend(prim_box);
+      }
+    } else {
+      box = _node_storage[i + 1].box();
+      box.extend(_node_storage[node.offset].box());
+    }
+    node.box(box);
+  }
+
+  // Find the topmost subtrees, whose quality degraded
+  std::vector<float> costs;
+  compute_costs(costs);
+  std::vector<int> degraded;
+  // Both children are pushed, so a fixed stack of BVH_STACK_SIZE entries
+  // isn't enough for the deepest trees
+  std::vector<int> stack = {0};
+  while (!stack.empty()) {
+    int i = stack.back();
+    stack.pop_back();
+    const LinearBVHNode &node = _nodes[i];
+    if (node.is_leaf()) continue;
+    if (costs[i] > threshold * _reference_costs[i]) {
+      degraded.push_back(i);
+    } else {
+      stack.push_back(node.offset);
+      stack.push_back(i + 1);
+    }
+  }
+
+  // Rebuilding a subtree only moves the nodes after it, so go back to front
+  std::sort(degraded.begin(), degraded.end());
+  std::vector<int> depths = bvh_node_depths(_nodes, _node_count);
+  int rebuilt = 0;
+  for (int k = static_cast<int>(degraded.size()) - 1; k >= 0; k--) {
+    if (rebuild_subtree(degraded[k], depths[degraded[k]], pool)) rebuilt++;
+  }
+  return rebuilt;
+}
+
+// _____________________________________________________________________________
+bool LinearBVH::rebuild_subtree(int node_idx, int depth, ThreadPool *pool) {
+  // In depth-first order the subtree is a contiguous range of nodes, which
+  // ends after the rightmost leaf
+  int last = node_idx;
+  while (!_nodes[last].is_leaf()) last = _nodes[last].offset;
+  int node_end = last + 1;
+  // Its leaves cover a contiguous range of primitives (see BVHBuildResult),
+  // but not necessarily in the order of the leaves
+  int prim_begin = std::numeric_limits<int>::max();
+  int prim_end = 0;
+  int prim_count = 0;
+  for (int i = node_idx; i < node_end; i++) {
+    if (!_nodes[i].is_leaf()) continue;
+    prim_begin = std::min(prim_begin, static_cast<int>(_nodes[i].offset));
+    prim_end = std::max(prim_end, _nodes[i].offset + _nodes[i].count);
+    prim_count += _nodes[i].count;
+  }
+  // Trees, which break the invariant, keep the subtree
+  if (prim_end - prim_begin != prim_count) return false;
+
+  std::vector<AABB> boxes(prim_end - prim_begin);
+  for (int p = prim_begin; p < prim_end; p++) {
+    _primitives[p]->bounding_box(boxes[p - prim_begin]);
+  }
+  // The whole tree has to stay within the maximum depth
+  BVHBuildResult sub = build_binned_sah(boxes, pool, BVH_MAX_DEPTH - depth);
+
+  // Reorder the primitives of the range
+  std::vector<Hitable*> prims(boxes.size());
+  for (size_t k = 0; k < prims.size(); k++) {
+    prims[k] = _primitives[prim_begin + sub.indices[k]];
+  }
+  std::copy(prims.begin(), prims.end(), _primitives.begin() + prim_begin);
+
+  // Move the subtree to its place in the node array
+  for (LinearBVHNode &node : sub.nodes) {
+    node.offset += node.is_leaf() ? prim_begin : node_idx;
+  }
+  int delta = static_cast<int>(sub.nodes.size()) - (node_end - node_idx);
+  for (int i = 0; i < _node_count; i++) {
+    LinearBVHNode &node = _node_storage[i];
+    if (i >= node_idx && i < node_end) continue;
+    if (!node.is_leaf() && node.offset >= node_end) node.offset += delta;
+  }
+  _node_storage.erase(_node_storage.begin() + node_idx,
+                      _node_storage.begin() + node_end);
+  _node_storage.insert(_node_storage.begin() + node_idx,
+                       sub.nodes.begin(), sub.nodes.end());
+  _nodes = _node_storage.data();
+  _node_count = static_cast<int>(_node_storage.size());
+
+  // The new subtree is the reference for later refits
+  std::vector<float> costs;
+  compute_costs(costs);
+  _reference_costs.erase(_reference_costs.begin() + node_idx,
+                         _reference_costs.begin() + node_end);
+  _reference_costs.insert(_reference_costs.begin() + node_idx,
+                          costs.begin() + node_idx,
+                          costs.begin() + node_idx + sub.nodes.size());
+  return true;
+}
+
+// _____________________________________________________________________________
+bool LinearBVH::bounding_box(AABB &box) const {
+  if (_node_count == 0) return false;
+  box = _nodes[0].box();
+  return true;
+}
+
+// _____________________________________________________________________________
+unsigned LinearBVH::material_types() const {
+  unsigned types = 0u;
+  for (const Hitable *p : _primitives) types |= p->material_types();
+  return types;
+}
+
+#endif  // SRC_LINEARBVH_H_
@@ -0,0 +1,169 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_LINEARBVHNODE_H_
+#define SRC_LINEARBVHNODE_H_
+
+#include <algorithm>  // max
+#include <cstdint>
+#include <vector>
+
+#include "AABB.h"
+#include "Ray.h"
+#include "Stats.h"
+
+// Maximum depth of the traversal stack
+#define BVH_STACK_SIZE 128
+// Maximum depth of a BVH (number of interior nodes from the root to a
+// leaf). The builders keep their trees within it, so that the traversal,
+// which pushes at most one node per level, never overflows its stack
+#define BVH_MAX_DEPTH BVH_STACK_SIZE
+
+/**
+ * Node of a flattened BVH. The nodes are stored in depth-first order, so
+ * the first child of an interior node is always the next node in the array.
+ * Children and primitives are addressed by index and not by pointer, which
+ * makes the node array position-independent: it can be written to disk and
+ * mapped back at any address.
+ */
+struct LinearBVHNode {
+  float min[3];
+  float max[3];
+  // Interior node: index of the second child.
+  // Leaf node: index of the first primitive in the primitive index array.
+  int32_t offset;
+  // Number of primitives in a leaf node; 0 marks an interior node
+  uint16_t count;
+  // Split axis of an interior node, used for front-to-back traversal
+  uint16_t axis;
+
+  inline bool is_leaf() const { return count > 0; }
+  inline AABB box() const {
+    return AABB(Vec3(min[0], min[1], min[2]), Vec3(max[0], max[1], max[2]));
+  }
+  inline void box(const AABB &b) {
+    for (int a = 0; a < 3; a++) {
+      min[a] = b.min()[a];
+      max[a] = b.max()[a];
+    }
+  }
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be 32 bytes");
+
+/**
+ * Output of a BVH builder: the flattened node array and the order, in which
+ * the leaves reference the primitives. A leaf covers the entries
+ * [offset, offset + count) of indices, and each entry is an index into the
+ * primitive array, which the builder got as input. The leaves cover indices
+ * in depth-first order, so the leaves of every subtree cover one contiguous
+ * range of it.
+ */
+struct BVHBuildResult {
+  std::vector<LinearBVHNode> nodes;
+  std::vector<int32_t> indices;
+};
+
+/**
+ * Check that the flattened BVH nodes form a tree, which the traversal can
+ * walk safely: every child index lies inside the node array, every leaf
+ * references a range inside the primitives, and the tree isn't deeper than
+ * BVH_MAX_DEPTH.
+ */
+bool bvh_valid(const LinearBVHNode *nodes, int count, int primitives);
+
+/**
+ * Depth of every node of the flattened BVH nodes; the root has depth 0.
+ */
+std::vector<int> bvh_node_depths(const LinearBVHNode *nodes, int count);
+
+/**
+ * Traverse the flattened BVH nodes front-to-back with the ray r. For every
+ * leaf, whose box is hit inside [t_min, t_max], leaf(offset, count, t_max)
+ * is called; it should intersect the leaf's primitives, return if any of
+ * them is hit and narrow down t_max to the closest hit.
+ * Returns if any leaf reported a hit. The tree mustn't be deeper than
+ * BVH_MAX_DEPTH.
+ */
+template <typename LeafFunction>
+bool traverse_bvh(const LinearBVHNode *nodes,
+                  const Ray &r,
+                  float t_min,
+                  float &t_max,
+                  LeafFunction leaf) {
+  // Visit the child on the side, from which the ray comes, first
+  bool dir_neg[3] = {r.direction().x() < 0.f,
+                     r.direction().y() < 0.f,
+                     r.direction().z() < 0.f};
+
+  bool did_hit = false;
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  int node_idx = 0;
+  while (true) {
+    const LinearBVHNode &node = nodes[node_idx];
+    // The box test narrows down the interval, so work on copies
+    float box_t_min = t_min;
+    float box_t_max = t_max;
+    STATS_INC(box_tests);
+    if (node.box().hit(r, box_t_min, box_t_max)) {
+      STATS_INC(bvh_nodes_visited);
+      if (node.is_leaf()) {
+        if (leaf(node.offset, node.count, t_max)) did_hit = true;
+        if (stack_size == 0) break;
+        node_idx = stack[--stack_size];
+      } else {
+        // Push the far child, continue with the near child
+        if (dir_neg[node.axis]) {
+          stack[stack_size++] = node_idx + 1;
+          node_idx = node.offset;
+        } else {
+          stack[stack_size++] = node.offset;
+          node_idx = node_idx + 1;
+        }
+      }
+    } else {
+      if (stack_size == 0) break;
+      node_idx = stack[--stack_size];
+    }
+  }
+  return did_hit;
+}
+
+// _____________________________________________________________________________
+bool bvh_valid(const LinearBVHNode *nodes, int count, int primitives) {
+  if (count <= 0) return false;
+  // Parents come before their children, so the depth of a node is known,
+  // when it is reached
+  std::vector<int> depths(count, 0);
+  for (int i = 0; i < count; i++) {
+    const LinearBVHNode &node = nodes[i];
+    if (node.is_leaf()) {
+      if (node.offset < 0 || node.offset > primitives - node.count) {
+        return false;
+      }
+      continue;
+    }
+    if (node.offset <= i + 1 || node.offset >= count || node.axis > 2 ||
+        depths[i] >= BVH_MAX_DEPTH) {
+      return false;
+    }
+    depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+    depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+  }
+  return true;
+}
+
+// _____________________________________________________________________________
+std::vector<int> bvh_node_depths(const LinearBVHNode *nodes, int count) {
+  // Parents come before their children
+  std::vector<int> depths(count, 0);
+  for (int i = 0; i < count; i++) {
+    if (nodes[i].is_leaf()) continue;
+    depths[i + 1] = depths[i] + 1;
+    depths[nodes[i].offset] = depths[i] + 1;
+  }
+  return depths;
+}
+
+#endif  // SRC_LINEARBVHNODE_H_
@@ -7,58 +7,48 @@
 #include <cmath>    // sqrt
 #include <limits>   // maxfloat
 #include <chrono>   // clock
+#include <cstdio>   // sscanf
+#include <string>
+#include <vector>
 
 #include "Vec3.h"
 #include "Ray.h"
-#include "Sphere.h"
 #include "HitableList.h"
 #include "Camera.h"
 #include "Utils.h"
-#include "Lambertian.h"
-#include "Metal.h"
-#include "Dialectic.h"
-#include "BVH.h"
-#include "SolidTexture.h"
-#include "CheckerTexture.h"
-#include "DiffuseLight.h"
-
-// Definitions
-#define SHADOW_BIAS 0.001f
-#define RECURSION_DEPTH 50
-
-Vec3 color(const Ray &r, Hitable *world, int depth) {
-  HitRecord rec;
-  if (world->hit(r, SHADOW_BIAS, MAXFLOAT, rec)) {
-    Ray scattered_ray;
-    Vec3 attenuation;
-    Vec3 emitted = rec.mat_ptr->emit(rec.u, rec.v, rec.p);
-    // Bounce the scattered ray, until maximum recursion depth is reached,
-    // or the material on the hitpoint has decided not to scatter the ray
-    if (depth < RECURSION_DEPTH &&
-        rec.mat_ptr->scatter(r, rec, attenuation, scattered_ray)) {
-      return emitted + attenuation * color(scattered_ray, world, depth+1);
-    } else {
-      return emitted;
-    }
-  // Nothing is hit
-  } else {
-    // Black background to test lightning
-    return Vec3(0.f, 0.f, 0.f);
-    // Vec3 unit_direction = make_unit_vector(r.direction());
-    // // After making the ray's direction a unit vector, y-axis is in the range
-    // // [-1, 1]. Following transformation first adds 1 to the y-axis
-    // // and it now has the range [0, 2]. Multiplying it by 0.5 scales down the
-    // // range to [0, 1]
-    // float t = 0.5f * (unit_direction.y() + 1.f);
-    // // Linear interpolation interpolation between white (t = 0) and blue
-    // // (t = 1).
-    // return
-    // // white color
-    // (1.f - t)*Vec3(1.f, 1.f, 1.f) +
-    // // blue color
-    // t*Vec3(0.5f, 0.7f, 1.f);
-  }
-}
+#include "LinearBVH.h"
+#include "BVHBuilder.h"
+#include "ThreadPool.h"
+#include "Renderer.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Animation.h"
+#include "Distributed.h"
+#include "Scenes.h"
+
+// Options of render_scene
+struct RenderOptions {
+  // Records the cost of every pixel; only the plain render fills it
+  Heatmap *heatmap{nullptr};
+  // Trace with the kernel handling all materials instead of the one
+  // specialized on the world's materials
+  bool general_kernel{false};
+  // Render with the worker processes given by distributed
+  bool distribute{false};
+  DistributedOptions distributed;
+  // Write the tiles, while the rest of the image is rendered
+  bool stream{false};
+  ToneMap tonemap{TONEMAP_CLAMP};
+  // Render into an out-of-core TiledFramebuffer of the precision, which
+  // spills to framebuffer_dir (empty for the directory of the output file)
+  bool out_of_core{false};
+  FramebufferPrecision precision{FRAMEBUFFER_FLOAT};
+  std::string framebuffer_dir;
+  // Render only the pixels in the regions into the image in merge_file, or
+  // into a black image, if it is empty
+  std::vector<PixelRegion> regions;
+  std::string merge_file;
+};
 
 /**
  * Render with the provided camera/objects and save it to a file with
@@ -68,242 +58,455 @@ Vec3 color(const Ray &r, Hitable *world, int depth) {
  * ns provide the number of randomly shot samples per pixel (for antialiasing).
  * Box filter is applied.
  * Gamma correction is applied to the output image.
+ * The format of the output follows the extension of out_file (see
+ * image_format).
+ * The options select at most one of the distributed, streamed, out-of-core
+ * and region renders; the heatmap is only recorded without any of them:
+ * - with distribute, the image is rendered by worker processes (see
+ *   Distributed.h);
+ * - with stream, the tiles are written, while the rest of the image is
+ *   rendered, and the image is never kept in memory as a whole;
+ * - with out_of_core, the image is rendered into a TiledFramebuffer, which
+ *   keeps only a few tiles per thread in memory, and then streamed to the
+ *   file;
+ * - with regions, only the pixels in them are rendered, exactly as in a
+ *   full render.
  */
 void render_scene(Camera c,
                   Hitable* world,
                   const char *out_file,
-                  int nx, int ny, int ns) {
-  // Create file handler
-  std::ofstream image_file;
-  image_file.open(out_file);
-
-  // PPM header
-  image_file << "P3" << std::endl
-            << nx << " " << ny << std::endl
-            << "255" << std::endl;
-
-  // Iterate over the pixels
-  for (int j = ny - 1; j >= 0; j--) {
-    for (int i = 0; i < nx; i++) {
-      Vec3 col{0.f, 0.f, 0.f};
-
-      // Iterate over the samples
-      for (int s = 0; s < ns; s++) {
-        // Get the sample parameters
-        float u = static_cast<float>((i + get_random_in_range(0.f, 1.f)) / nx);
-        float v = static_cast<float>((j + get_random_in_range(0.f, 1.f)) / ny);
-
-        // Create the ray
-        Ray r = c.get_ray(u, v);
-
-        // Accumulate color
-        col += color(r, world, 0);
-      }
-
-      // Apply antialiasing using box filter
-      col /= static_cast<float>(ns);
-
-      // Gamma correction
-      col[0] = sqrt(col[0]);
-      col[1] = sqrt(col[1]);
-      col[2] = sqrt(col[2]);
-
-      // Convert floats to ints
-      int ir = static_cast<int>(255.99f * col.r());
-      int ig = static_cast<int>(255.99f * col.g());
-      int ib = static_cast<int>(255.99f * col.b());
-
-      // Print pixel
-      image_file << ir << " " << ig << " " << ib << std::endl;
+                  int nx, int ny, int ns,
+                  const RenderOptions &options) {
+  const RenderKernel &kernel = options.general_kernel
+      ? general_render_kernel()
+      : select_render_kernel(world->material_types());
+  std::cout << "Render kernel: " << kernel.name << std::endl;
+  if (!options.regions.empty()) {
+    Image image(nx, ny);
+    if (!options.merge_file.empty() &&
+        (!read_image(options.merge_file.c_str(), image, options.tonemap) ||
+         image.width != nx || image.height != ny)) {
+      std::cout << "Could not read a " << nx << "x" << ny << " PPM image from "
+                << options.merge_file << std::endl;
+      return;
     }
+    render_regions(c, world, ns, image, options.regions, &global_thread_pool(),
+                   0, &kernel);
+    if (!write_image(out_file, image, options.tonemap)) {
+      std::cout << "Could not write " << out_file << std::endl;
+    }
+    return;
+  }
+  if (options.out_of_core) {
+    ThreadPool &pool = global_thread_pool();
+    std::string spill_dir = options.framebuffer_dir.empty()
+        ? parent_directory(out_file) : options.framebuffer_dir;
+    TiledFramebuffer framebuffer(nx, ny, options.precision, 2 * pool.size(),
+                                 spill_dir.c_str());
+    if (!framebuffer.is_open()) {
+      std::cout << "Could not create the framebuffer in " << spill_dir
+                << std::endl;
+      return;
+    }
+    render_framebuffer(c, world, ns, framebuffer, &pool, 0, &kernel);
+    if (!write_framebuffer(out_file, framebuffer, options.tonemap)) {
+      std::cout << "Could not write " << out_file << std::endl;
+    }
+    return;
+  }
+  if (options.stream) {
+    ImageWriter writer(out_file, nx, ny, image_format(out_file),
+                       options.tonemap);
+    if (!render_streamed(c, world, ns, writer, &global_thread_pool(), 0,
+                         &kernel)) {
+      std::cout << "Could not write " << out_file << std::endl;
+    }
+    return;
+  }
+  Image image(nx, ny);
+  if (options.distribute) {
+    if (!render_distributed(c, world, ns, image, options.distributed, 0,
+                            &kernel)) {
+      std::cout << "Distributed rendering failed" << std::endl;
+      return;
+    }
+  } else {
+    render_image(c, world, ns, image, &global_thread_pool(), 0,
+                 options.heatmap, &kernel);
+  }
+  if (!write_image(out_file, image, options.tonemap)) {
+    std::cout << "Could not write " << out_file << std::endl;
   }
-
-  // Close file handler
-  image_file.close();
 }
 
-Hitable* cover_scene() {
-  // Number of objects
-  int n = 500;
-
-  HitableList *world = new HitableList(n+1);
-  Texture *white = new SolidTexture(Vec3(0.9f, 0.9f, 0.9f));
-  Texture *black = new SolidTexture(Vec3(0.05f, 0.05f, 0.05f));
-  Texture *chercker = new CheckerTexture(white, black, 20.f);
-  Sphere *sFloor = new Sphere(Vec3(0.f, -1000.f, 0.f),
-                              1000.f,
-                              new Lambertian(chercker));
-  world->append(sFloor);
-
-  // Add small spheres
-  for (int a = -11; a < 11; a++) {
-    for (int b = -11; b < 11; b++) {
-      float choose_material = get_random_in_range(0.f, 1.f);
-      float center_x = a+0.9f*get_random_in_range(0.f, 1.f);
-      float center_z = b+0.9f*get_random_in_range(0.f, 1.f);
-      Vec3 center(center_x, 0.2f, center_z);
-      if ((center - Vec3(4.f, 0.2f, 0.f)).length() > 0.9f) {
-        if (choose_material < 0.8f) {          // diffuse
-          float rand_r = get_random_in_range(0.f, 1.f)
-                         * get_random_in_range(0.f, 1.f);
-          float rand_g = get_random_in_range(0.f, 1.f)
-                         * get_random_in_range(0.f, 1.f);
-          float rand_b = get_random_in_range(0.f, 1.f)
-                         * get_random_in_range(0.f, 1.f);
-          Sphere *sDiffuse = new Sphere(center,
-                                        0.2f,
-                                        new Lambertian(new SolidTexture(Vec3(rand_r, rand_g, rand_b))));
-          world->append(sDiffuse);
-        } else if (choose_material < 0.95f) {  // metal
-          float rand_r = get_random_in_range(0.5f, 1.f);
-          float rand_g = get_random_in_range(0.5f, 1.f);
-          float rand_b = get_random_in_range(0.5f, 1.f);
-          float rand_fuzz = get_random_in_range(0.f, 1.f);
-          Sphere *sMetal = new Sphere(center, 0.2f,
-                                      new Metal(Vec3(rand_r, rand_g, rand_b),
-                                                rand_fuzz));
-          world->append(sMetal);
-        } else {                               // glass
-          Sphere *sGlass = new Sphere(center, 0.2, new Dialectic(1.52f));
-          world->append(sGlass);
-        }
+/**
+ * Render the particles of the chunk file at chunk_file on the stage of the
+ * particle scene, with at most about cache_mb megabytes of chunks in memory
+ * (see render_chunked), and print how much was read.
+ */
+void render_chunked_scene(Camera c,
+                          const char *chunk_file,
+                          size_t cache_mb,
+                          const char *out_file,
+                          int nx, int ny, int ns,
+                          ToneMap tonemap = TONEMAP_CLAMP) {
+  std::vector<Material*> palette = particle_palette();
+  {
+    ChunkedScene chunks(chunk_file, cache_mb << 20, palette);
+    if (!chunks.is_open()) {
+      std::cout << "Could not read chunks from " << chunk_file << std::endl;
+    } else {
+      std::cout << chunks.particle_count() << " particles in "
+                << chunks.chunk_count() << " chunks ("
+                << (chunks.data_bytes() >> 20) << " MB), cache of "
+                << cache_mb << " MB" << std::endl;
+      Hitable *world = particle_stage(nullptr);
+      Image image(nx, ny);
+      render_chunked(c, world, chunks, ns, image, &global_thread_pool());
+      delete world;
+      std::cout << chunks.chunk_batches() << " chunk batches, "
+                << chunks.cache().loads() << " chunk loads ("
+                << (chunks.cache().loaded_bytes() >> 20) << " MB read)"
+                << std::endl;
+      if (!write_image(out_file, image, tonemap)) {
+        std::cout << "Could not write " << out_file << std::endl;
       }
     }
   }
-
-  // Add 3 big spheres
-  Sphere *sBigGlass = new Sphere(Vec3(0.f, 1.f, 0.f),
-                                 1.f,
-                                 new Dialectic(1.52f));
-  Sphere *sBigDiffuse = new Sphere(Vec3(-4.f, 1.f, 0.f),
-                                   1.f,
-                                   new Lambertian(new SolidTexture(Vec3(0.4f, 0.2f, 0.1f))));
-  Sphere *sBigMetal = new Sphere(Vec3(4.f, 1.f, 0.f),
-                                 1.f,
-                                 new Metal(Vec3(0.7f, 0.6f, 0.5f), 0.f));
-  world->append(sBigGlass);
-  world->append(sBigDiffuse);
-  world->append(sBigMetal);
-
-  // Measure BVH construction time
-  auto start = std::chrono::steady_clock::now();
-
-  // Construct the BVH
-  BVH *as = new BVH(world, 0, world->size());
-
-  auto end = std::chrono::steady_clock::now();
-  auto duration =
-       std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
-  std::cout << "Constructed in " << duration << " seconds." << std::endl;
-
-  return as;
+  for (Material *m : palette) delete m;
 }
 
-Hitable* some_spheres() {
-  Sphere *sFloor = new Sphere(Vec3(3.f, 0, 0.f),
-                          0.5f,
-                          new Lambertian(new SolidTexture(Vec3(0.5f, 0.5f, 0.5f))));
-  Sphere *sPinkish = new Sphere(Vec3(0.f, 0.f, 0.f),
-                          0.5f,
-                          new Lambertian(new SolidTexture(Vec3(0.8f, 0.3f, 0.3f))));
-  Sphere *sGoldish = new Sphere(Vec3(-3.f, 0.f, 1.f),
-                              0.5f,
-                              new Metal(Vec3(1.f, 0.71f, 0.29f), 0.8f));
-  Sphere *sSilverish = new Sphere(Vec3(-6.f, 0.f, 1.f),
-                          0.5f,
-                          new Metal(Vec3(0.95f, 0.93f, 0.88f), 0.9f));
-  Sphere *sWaterish = new Sphere(Vec3(-9.f, 0.f, 1.f),
-                                0.5f,
-                                new Dialectic(1.52f));
-
-  HitableList *world = new HitableList;
-  world->append(sPinkish);
-  world->append(sFloor);
-  world->append(sGoldish);
-  world->append(sSilverish);
-  world->append(sWaterish);
-
-  // Measure BVH construction time
-  auto start = std::chrono::steady_clock::now();
-
-  // Construct the BVH
-  BVH *as = new BVH(world, 0, world->size());
-
-  auto end = std::chrono::steady_clock::now();
-  auto duration =
-       std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
-  std::cout << "Constructed in " << duration << " seconds." << std::endl;
-
-  return as;
+/**
+ * Build a BVH over the list with every builder and print the build time,
+ * the SAH cost of the tree and the tracing throughput of random rays from
+ * the camera's position.
+ */
+void compare_bvh_builders(HitableList *world, const Vec3 &lookfrom) {
+  ThreadPool &pool = global_thread_pool();
+  std::vector<AABB> boxes = primitive_boxes(world);
+  int num_rays = 200000;
+  std::cout << boxes.size() << " primitives, " << pool.size()
+            << " threads" << std::endl;
+  for (int builder : {BVH_BUILDER_MEDIAN_SPLIT, BVH_BUILDER_BINNED_SAH,
+                      BVH_BUILDER_LBVH, BVH_BUILDER_LBVH_OPTIMIZED}) {
+    auto start = std::chrono::steady_clock::now();
+    BVHBuildResult result = build_bvh_with(builder, boxes, &pool);
+    auto end = std::chrono::steady_clock::now();
+    auto build_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        end - start).count();
+    float sah = bvh_sah_cost(result.nodes);
+    size_t num_nodes = result.nodes.size();
+
+    // Trace rays from the same positions for all builders
+    LinearBVH bvh(world, std::move(result));
+    seed_random(0);
+    int hits = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_rays; i++) {
+      HitRecord rec;
+      Ray r(lookfrom, random_in_unit_sphere());
+      if (bvh.hit(r, SHADOW_BIAS, MAXFLOAT, rec)) hits++;
+    }
+    end = std::chrono::steady_clock::now();
+    bvh.release();
+    double trace_s = std::chrono::duration<double>(end - start).count();
+
+    std::cout << bvh_builder_name(builder) << ": built in " << build_us
+              << " microseconds, " << num_nodes << " nodes, SAH cost " << sah
+              << ", " << static_cast<int>(num_rays / trace_s)
+              << " rays/s (" << hits << " hits)" << std::endl;
+  }
 }
 
-Hitable* two_spheres_checker() {
-  Texture *white = new SolidTexture(Vec3(0.9f, 0.9f, 0.9f));
-  Texture *black = new SolidTexture(Vec3(0.05f, 0.05f, 0.05f));
-  Texture *chercker = new CheckerTexture(white, black, 10.f);
-  Texture *lightColor = new SolidTexture(Vec3(2.f, 2.f, 2.f));
-
-  Material *light = new DiffuseLight(lightColor);
-  Hitable *upSphere = new Sphere(Vec3(0.f, 4.f, 0.f),
-                                 3.f,
-                                 light);
-  Hitable *loSphere = new Sphere(Vec3(0.f, -10.f, 0.f),
-                                 10.f,
-                                 new Lambertian(chercker));
-
-  HitableList *world = new HitableList(2);
-  world->append(upSphere);
-  world->append(loSphere);
-  return world;
+/**
+ * Write the recorded trace to trace_file, if tracing was requested.
+ * Returns false, if the file cannot be written.
+ */
+bool write_trace(const std::string &trace_file) {
+  if (trace_file.empty()) return true;
+  if (!global_tracer().write(trace_file)) {
+    std::cout << "Could not write " << trace_file << std::endl;
+    return false;
+  }
+  return true;
 }
 
-Hitable* spheres_with_light() {
-  Sphere *sFloor = new Sphere(Vec3(0.f, -50.5f, 0.f),
-                          50.f,
-                          new Lambertian(new SolidTexture(Vec3(0.5f, 0.5f, 0.5f))));
-  Sphere *sPinkish = new Sphere(Vec3(0.f, 0.f, 0.f),
-                          0.5f,
-                          new Lambertian(new SolidTexture(Vec3(0.8f, 0.3f, 0.3f))));
-  // Sphere *sGoldish = new Sphere(Vec3(-3.f, 0.f, 0.f),
-  //                             0.5f,
-  //                             new Metal(Vec3(1.f, 0.71f, 0.29f), 0.8f));
-  // Sphere *sSilverish = new Sphere(Vec3(-6.f, 0.f, 0.f),
-  //                         0.5f,
-  //                         new Metal(Vec3(0.95f, 0.93f, 0.88f), 0.9f));
-  // Sphere *sWaterish = new Sphere(Vec3(-9.f, 0.f, 0.f),
-  //                               0.5f,
-  //                               new Dialectic(1.52f));
-  Sphere *sLight = new Sphere(Vec3(0.f, 2.f, 0.f),
-                              0.5f,
-                              new DiffuseLight(new SolidTexture(Vec3(4.f, 4.f, 4.f))));
-
-  HitableList *world = new HitableList;
-  world->append(sPinkish);
-  world->append(sFloor);
-  // world->append(sGoldish);
-  // world->append(sSilverish);
-  // world->append(sWaterish);
-  // world->append(sLight);
-
-  // Measure BVH construction time
-  auto start = std::chrono::steady_clock::now();
-
-  // Construct the BVH
-  BVH *as = new BVH(world, 0, world->size());
+int main(int argc, char *argv[]) {
+  // Command line options:
+  //   --bvh=median|sah|lbvh|lbvh-opt  select the BVH builder
+  //   --bvh-cache=<dir>               keep the BVHs of the scenes in dir and
+  //                                   map them in later runs
+  //   --accel=bvh|grid|auto           select the acceleration structure of
+  //                                   the static scenes; auto keeps the one,
+  //                                   which traces probe rays faster
+  //   --quantize-bvh=8|16             store the BVH nodes of the static
+  //                                   scenes with 8 or 16 bit boxes
+  //   --compare-bvh[=N]               compare the BVH builders on the cover
+  //                                   scene and N random spheres, and exit
+  //   --obj=<file>                    render the mesh from an OBJ file
+  //   --particles=<file>              render the spheres from a particle
+  //                                   file (see ParticleSet.h)
+  //   --save-particles=<file>         write the particles of the particles
+  //                                   scene to a particle file, and exit
+  //   --chunks=<file>                 render the particles from a chunk
+  //                                   file out-of-core (see
+  //                                   ChunkedGeometry.h)
+  //   --build-chunks=<file>           first convert the particle file to
+  //                                   the chunk file of --chunks
+  //   --chunk-cache=MB                memory for the chunks (default 256)
+  //   --scene=checker|cover|cover-lights|some|light|forest|motion|particles
+  //                                   select the built-in scene
+  //   --lights=uniform|bvh            sample one sphere light at every
+  //                                   diffuse hit, picked uniformly or by
+  //                                   its contribution with a light BVH
+  //   --env=<file>|sky                light the scene from every direction
+  //                                   with the HDR environment in a PFM
+  //                                   file (latitude-longitude layout) or a
+  //                                   procedural sky with a sun, instead of
+  //                                   a black background
+  //   --frames=N                      render N frames of the animated forest
+  //                                   at 24 frames per second
+  //   --heatmap[=time|steps]          also write the cost of every pixel as
+  //                                   heatmap.ppm (false color) and
+  //                                   heatmap.pfm (raw floats); steps needs
+  //                                   a build with -DRENDER_STATS=ON
+  //   --stats[=<file>]                print the render statistics, or write
+  //                                   them as JSON to file (needs a build
+  //                                   with -DRENDER_STATS=ON)
+  //   --general-kernel                trace with the kernel handling all
+  //                                   materials instead of the one
+  //                                   specialized on the scene's materials
+  //   --trace=<file>                  write the phases executed by every
+  //                                   thread (scene construction, BVH
+  //                                   builds, tiles, output) as a Chrome
+  //                                   trace-event JSON file
+  //   --workers=N                     render with N forked worker processes
+  //   --listen=PORT                   also accept workers over TCP on PORT
+  //   --connect=HOST:PORT             be a worker of the coordinator at
+  //                                   HOST:PORT; pass the same scene options
+  //   --output=<file>                 write the image to file; PNG for a
+  //                                   .png extension, otherwise PPM
+  //   --stream                        write the image, while rendering it
+  //   --tonemap=clamp|reinhard        map the colors to [0, 1] by clamping
+  //                                   or with x / (1 + x)
+  //   --size=WxH                      image size (default 640x480)
+  //   --framebuffer=float|half        render into an out-of-core tiled
+  //                                   framebuffer of that precision, for
+  //                                   images larger than the memory
+  //   --framebuffer-dir=<dir>         keep the spill file of the framebuffer
+  //                                   in dir (default: the directory of the
+  //                                   output file)
+  //   --region=X0,Y0,X1,Y1            render only the pixels in the
+  //                                   rectangle (X1 and Y1 exclusive, row 0
+  //                                   at the top); may be repeated
+  //   --merge-into=<file>             render the regions into the PPM image
+  //                                   from file instead of a black one
+  //   --block-samples=K               split the samples of a tile into
+  //                                   blocks of K for the workers; the image
+  //                                   depends on K, but not on the workers
+  int compare_bvh = -1;
+  int frames = 0;
+  bool stats = false;
+  bool heatmap = false;
+  HeatmapMetric heatmap_metric = HEATMAP_TIME;
+  std::string stats_file;
+  std::string trace_file;
+  std::string obj_file;
+  std::string particle_file;
+  std::string particles_out;
+  std::string chunk_file;
+  std::string chunk_source;
+  size_t chunk_cache_mb = 256;
+  std::string scene = "checker";
+  std::string environment_file;
+  std::string coordinator;
+  std::string output_file;
+  int nx = 640;
+  int ny = 480;
+  RenderOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg.rfind("--bvh=", 0) == 0) {
+      std::string name = arg.substr(6);
+      int builder = -1;
+      for (int b = BVH_BUILDER_MEDIAN_SPLIT; b <= BVH_BUILDER_LBVH_OPTIMIZED;
+           b++) {
+        if (name == bvh_builder_name(b)) builder = b;
+      }
+      if (builder < 0) {
+        std::cout << "Unknown BVH builder " << name << std::endl;
+        return 1;
+      }
+      bvh_builder = builder;
+    } else if (arg.rfind("--bvh-cache=", 0) == 0) {
+      bvh_cache_dir = arg.substr(12);
+    } else if (arg.rfind("--accel=", 0) == 0) {
+      std::string name = arg.substr(8);
+      int accel = -1;
+      for (int a = ACCEL_BVH; a <= ACCEL_AUTO; a++) {
+        if (name == accelerator_name(a)) accel = a;
+      }
+      if (accel < 0) {
+        std::cout << "Unknown acceleration structure " << name << std::endl;
+        return 1;
+      }
+      accelerator = accel;
+    } else if (arg.rfind("--quantize-bvh=", 0) == 0) {
+      if (arg != "--quantize-bvh=8" && arg != "--quantize-bvh=16") {
+        std::cout << "BVH boxes can only be quantized to 8 or 16 bits"
+                  << std::endl;
+        return 1;
+      }
+      bvh_quantization = std::stoi(arg.substr(15));
+    } else if (arg.rfind("--compare-bvh", 0) == 0) {
+      compare_bvh = arg.size() > 14 ? std::stoi(arg.substr(14)) : 100000;
+    } else if (arg.rfind("--obj=", 0) == 0) {
+      obj_file = arg.substr(6);
+    } else if (arg.rfind("--particles=", 0) == 0) {
+      particle_file = arg.substr(12);
+    } else if (arg.rfind("--save-particles=", 0) == 0) {
+      particles_out = arg.substr(17);
+    } else if (arg.rfind("--chunks=", 0) == 0) {
+      chunk_file = arg.substr(9);
+    } else if (arg.rfind("--build-chunks=", 0) == 0) {
+      chunk_source = arg.substr(15);
+    } else if (arg.rfind("--chunk-cache=", 0) == 0) {
+      chunk_cache_mb = std::stoul(arg.substr(14));
+    } else if (arg.rfind("--scene=", 0) == 0) {
+      scene = arg.substr(8);
+    } else if (arg == "--lights=uniform") {
+      light_sampling = LIGHT_SAMPLING_UNIFORM;
+    } else if (arg == "--lights=bvh") {
+      light_sampling = LIGHT_SAMPLING_BVH;
+    } else if (arg.rfind("--env=", 0) == 0) {
+      environment_file = arg.substr(6);
+    } else if (arg.rfind("--frames=", 0) == 0) {
+      frames = std::stoi(arg.substr(9));
+    } else if (arg.rfind("--heatmap", 0) == 0) {
+      heatmap = true;
+      if (arg == "--heatmap=steps") heatmap_metric = HEATMAP_STEPS;
+    } else if (arg.rfind("--stats", 0) == 0) {
+      stats = true;
+      if (arg.size() > 8) stats_file = arg.substr(8);
+    } else if (arg == "--general-kernel") {
+      options.general_kernel = true;
+    } else if (arg.rfind("--trace=", 0) == 0) {
+      trace_file = arg.substr(8);
+    } else if (arg.rfind("--workers=", 0) == 0) {
+      options.distributed.local_workers = std::stoi(arg.substr(10));
+      options.distribute = true;
+    } else if (arg.rfind("--listen=", 0) == 0) {
+      options.distributed.listen_port = std::stoi(arg.substr(9));
+      options.distribute = true;
+    } else if (arg.rfind("--connect=", 0) == 0) {
+      coordinator = arg.substr(10);
+    } else if (arg.rfind("--output=", 0) == 0) {
+      output_file = arg.substr(9);
+    } else if (arg.rfind("--size=", 0) == 0) {
+      size_t x = arg.find('x', 7);
+      if (x != std::string::npos) {
+        nx = std::stoi(arg.substr(7, x - 7));
+        ny = std::stoi(arg.substr(x + 1));
+      }
+    } else if (arg.rfind("--framebuffer-dir=", 0) == 0) {
+      options.framebuffer_dir = arg.substr(18);
+    } else if (arg.rfind("--framebuffer=", 0) == 0) {
+      options.out_of_core = true;
+      if (arg == "--framebuffer=half") options.precision = FRAMEBUFFER_HALF;
+    } else if (arg.rfind("--region=", 0) == 0) {
+      PixelRegion r;
+      if (sscanf(arg.c_str() + 9, "%d,%d,%d,%d", &r.x0, &r.y0, &r.x1,
+                 &r.y1) != 4) {
+        std::cout << "Invalid region " << arg.substr(9) << std::endl;
+        return 1;
+      }
+      options.regions.push_back(r);
+    } else if (arg.rfind("--merge-into=", 0) == 0) {
+      options.merge_file = arg.substr(13);
+    } else if (arg == "--stream") {
+      options.stream = true;
+    } else if (arg == "--tonemap=reinhard") {
+      options.tonemap = TONEMAP_REINHARD;
+    } else if (arg.rfind("--block-samples=", 0) == 0) {
+      options.distributed.block_samples = std::stoi(arg.substr(16));
+    }
+  }
+  // render_scene and render_chunked_scene render in only one of these
+  // modes, and only the plain render records a heatmap
+  int modes = options.distribute + options.out_of_core + options.stream
+      + !options.regions.empty() + !chunk_file.empty();
+  if (modes > 1) {
+    std::cout << "Only one of --workers/--listen, --framebuffer, --stream, "
+              << "--region and --chunks can be given." << std::endl;
+    return 1;
+  }
+  if (heatmap && modes > 0) {
+    std::cout << "--heatmap can't be combined with --workers/--listen, "
+              << "--framebuffer, --stream, --region or --chunks."
+              << std::endl;
+    return 1;
+  }
+  if (!chunk_source.empty() && chunk_file.empty()) {
+    std::cout << "--build-chunks needs a --chunks file." << std::endl;
+    return 1;
+  }
+  if (!options.merge_file.empty() && options.regions.empty()) {
+    std::cout << "--merge-into needs a --region." << std::endl;
+    return 1;
+  }
+  if (!trace_file.empty()) {
+    global_tracer().start();
+    trace_thread_name("main");
+  }
+  if (!environment_file.empty()) {
+    EnvironmentLight *environment = environment_file == "sky"
+        ? sky_environment()
+        : read_environment(environment_file.c_str());
+    if (environment == nullptr) {
+      std::cout << "Could not read the environment from "
+                << environment_file << std::endl;
+      return 1;
+    }
+    std::cout << "Environment: " << environment->width() << "x"
+              << environment->height() << std::endl;
+    scene_environment() = environment;
+  }
 
-  auto end = std::chrono::steady_clock::now();
-  auto duration =
-       std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
-  std::cout << "Constructed in " << duration << " seconds." << std::endl;
+  if (compare_bvh >= 0) {
+    Vec3 eye(13.f, 2.f, 3.f);
+    compare_bvh_builders(cover_scene_objects(), eye);
+    if (compare_bvh > 0) {
+      compare_bvh_builders(random_spheres_objects(compare_bvh), eye);
+    }
+    return 0;
+  }
 
-  return as;
-}
+  if (!particles_out.empty()) {
+    if (!save_particles(particles_out.c_str(), particle_cloud(1 << 20))) {
+      std::cout << "Could not write " << particles_out << std::endl;
+      return 1;
+    }
+    return 0;
+  }
 
-int main() {
-  int nx = 640;
-  int ny = 480;
   int ns = 10;  // Number of samples
 
+  if (frames > 0) {
+    float fps = 24.f;
+    Animation animation;
+    TwoLevelBVH *scenes[2];
+    {
+      TRACE_SCOPE("scene");
+      scenes[0] = animated_forest_scene(1000, frames / fps, &animation);
+      scenes[1] = animated_forest_scene(1000, frames / fps, nullptr);
+    }
+    render_sequence(animation, scenes, frames, fps, nx, ny, ns,
+                    "frame_%04d.ppm", &global_thread_pool());
+    delete scenes[0];
+    delete scenes[1];
+    return write_trace(trace_file) ? 0 : 1;
+  }
+
   Vec3 lookfrom(13.f, 2.f, 3.f);
   Vec3 lookat(0.f, 0.f, 0.f);
   // Vec3 lookfrom(0.f, 0.f, 10.f);
@@ -312,23 +515,115 @@ int main() {
   float ar = static_cast<float>(nx) / static_cast<float>(ny);
   float lens_radius = 0.f;
   float distance_to_focus = 10.f;
+  // Shutter interval; only the motion scene moves
+  float time0 = 0.f;
+  float time1 = scene == "motion" ? 1.f : 0.f;
 
   // Camera
-  Camera cam(lookfrom, lookat, up, 20.f, ar, lens_radius, distance_to_focus);
+  Camera cam(lookfrom, lookat, up, 20.f, ar, lens_radius, distance_to_focus,
+             time0, time1);
 
   // File naming
   std::ostringstream fileName;
   fileName << "spheresWithLight_5" << ".ppm";
-  std::string fileNameStr = fileName.str();
+  std::string fileNameStr = output_file.empty() ? fileName.str()
+                                                : output_file;
 
   // Measure the rendering time
   auto start = std::chrono::steady_clock::now();
 
+  if (!chunk_file.empty()) {
+    if (!chunk_source.empty()) {
+      auto convert_start = std::chrono::steady_clock::now();
+      if (!convert_particles_to_chunks(chunk_source.c_str(),
+                                       chunk_file.c_str(), CHUNK_PARTICLES,
+                                       &global_thread_pool())) {
+        std::cout << "Could not convert " << chunk_source << " to "
+                  << chunk_file << std::endl;
+        return 1;
+      }
+      std::cout << "Converted in "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - convert_start)
+                       .count()
+                << " milliseconds." << std::endl;
+      start = std::chrono::steady_clock::now();
+    }
+    render_stats_registry().reset();
+    render_chunked_scene(cam, chunk_file.c_str(), chunk_cache_mb,
+                         fileNameStr.c_str(), nx, ny, ns, options.tonemap);
+    auto duration = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << "Rendered in " << duration << " seconds." << std::endl;
+    return write_trace(trace_file) ? 0 : 1;
+  }
+
   // Render scene and output image
-  render_scene(cam, two_spheres_checker(), fileNameStr.c_str(), nx, ny, ns);
+  Hitable *world;
+  {
+    TRACE_SCOPE("scene");
+    if (!obj_file.empty()) world = mesh_scene(obj_file.c_str());
+    else if (!particle_file.empty())
+      world = particle_scene(particle_file.c_str());
+    else if (scene == "particles") world = particle_scene(nullptr);
+    else if (scene == "cover") world = cover_scene();
+    else if (scene == "cover-lights") world = cover_lights_scene();
+    else if (scene == "some") world = some_spheres();
+    else if (scene == "light") world = spheres_with_light();
+    else if (scene == "forest") world = forest_scene(5000);
+    else if (scene == "motion") world = motion_scene();
+    else
+      world = two_spheres_checker();
+  }
+  if (world == nullptr) return 1;
+  if (!coordinator.empty()) {
+    size_t colon = coordinator.rfind(':');
+    int fd = colon == std::string::npos ? -1 : connect_to_coordinator(
+        coordinator.substr(0, colon).c_str(),
+        std::stoi(coordinator.substr(colon + 1)));
+    if (fd < 0) {
+      std::cout << "Cannot connect to " << coordinator << std::endl;
+      return 1;
+    }
+    const RenderKernel *kernel =
+        options.general_kernel ? &general_render_kernel() : nullptr;
+    bool ok = serve_render_worker(fd, cam, world, nx, ny,
+                                  &global_thread_pool(), kernel);
+    close(fd);
+    return ok && write_trace(trace_file) ? 0 : 1;
+  }
+  if (heatmap && heatmap_metric == HEATMAP_STEPS && !STATS_ENABLED) {
+    std::cout << "Traversal steps are only counted with -DRENDER_STATS=ON, "
+              << "recording the time instead." << std::endl;
+    heatmap_metric = HEATMAP_TIME;
+  }
+  // Only allocated, when requested; it would be as large as the image
+  Heatmap costs(heatmap ? nx : 0, heatmap ? ny : 0, heatmap_metric);
+  render_stats_registry().reset();
+  options.heatmap = heatmap ? &costs : nullptr;
+  render_scene(cam, world, fileNameStr.c_str(), nx, ny, ns, options);
+  if (heatmap) {
+    TRACE_SCOPE("write_heatmap");
+    if (!write_heatmap_ppm("heatmap.ppm", costs) ||
+        !write_pfm("heatmap.pfm", costs)) {
+      std::cout << "Could not write the heatmap." << std::endl;
+    }
+  }
+  if (stats && !STATS_ENABLED) {
+    std::cout << "Statistics are disabled, build with -DRENDER_STATS=ON."
+              << std::endl;
+  } else if (stats) {
+    RenderStats s = render_stats_registry().collect();
+    if (stats_file.empty()) {
+      s.print(std::cout);
+    } else if (!s.write_json(stats_file)) {
+      std::cout << "Could not write " << stats_file << std::endl;
+    }
+  }
 
   auto end = std::chrono::steady_clock::now();
   auto duration =
       std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
   std::cout << "Rendered in " << duration << " seconds." << std::endl;
+  return write_trace(trace_file) ? 0 : 1;
 }
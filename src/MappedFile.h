@@ -0,0 +1,56 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_MAPPEDFILE_H_
+#define SRC_MAPPEDFILE_H_
+
+#include <fcntl.h>     // open
+#include <sys/mman.h>  // mmap
+#include <sys/stat.h>  // fstat
+#include <unistd.h>    // close
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. The mapping is released, when
+// the object is destroyed.
+class MappedFile {
+ public:
+  MappedFile() = delete;
+  explicit MappedFile(const char *path);
+  MappedFile(const MappedFile &m) = delete;
+  MappedFile& operator=(const MappedFile &m) = delete;
+  ~MappedFile();
+
+  inline bool is_open() const { return _data != nullptr; }
+  inline const char* data() const { return _data; }
+  inline size_t size() const { return _size; }
+
+ private:
+  const char *_data{nullptr};
+  size_t _size{0};
+};
+
+// _____________________________________________________________________________
+MappedFile::MappedFile(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                   MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      _data = static_cast<const char*>(p);
+      _size = static_cast<size_t>(st.st_size);
+    }
+  }
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+}
+
+// _____________________________________________________________________________
+MappedFile::~MappedFile() {
+  if (_data != nullptr) munmap(const_cast<char*>(_data), _size);
+}
+
+#endif  // SRC_MAPPEDFILE_H_
@@ -8,10 +8,46 @@
 #include "Hitable.h"
 #include "Vec3.h"
 
+// Kinds of materials, used to tell them apart in the statistics
+enum MaterialType {
+  MATERIAL_LAMBERTIAN,
+  MATERIAL_METAL,
+  MATERIAL_DIALECTIC,
+  MATERIAL_DIFFUSE_LIGHT,
+  MATERIAL_OTHER,
+  MATERIAL_TYPE_COUNT
+};
+
+// Set of material types as a bit mask
+#define MATERIAL_MASK_ALL ((1u << MATERIAL_TYPE_COUNT) - 1u)
+
+// _____________________________________________________________________________
+// Bit of the type in a set of material types
+constexpr unsigned material_bit(MaterialType type) {
+  return 1u << type;
+}
+
+// _____________________________________________________________________________
+inline const char* material_type_name(MaterialType type) {
+  switch (type) {
+    case MATERIAL_LAMBERTIAN: return "lambertian";
+    case MATERIAL_METAL: return "metal";
+    case MATERIAL_DIALECTIC: return "dialectic";
+    case MATERIAL_DIFFUSE_LIGHT: return "diffuse_light";
+    default: return "other";
+  }
+}
+
 class Material {
  public:
+  Material() = default;
+  // Materials of the types listed in MaterialType have to provide it, so
+  // the render kernels can call them without virtual dispatch
+  explicit Material(MaterialType type) : _type(type) {}
   virtual ~Material() {}
 
+  inline MaterialType type() const { return _type; }
+
   virtual bool scatter(const Ray &r,
                        const HitRecord &rec,
                        Vec3 &attenuation,
@@ -20,6 +56,9 @@ class Material {
   virtual Vec3 emit(float u, float v, const Vec3 &p) const {
     return Vec3(0.f, 0.f, 0.f);
   }
+
+ private:
+  MaterialType _type{MATERIAL_OTHER};
 };
 
 #endif  // SRC_MATERIAL_H_
@@ -13,9 +13,10 @@
 
 class Metal: public Material {
  public:
-  Metal() = default;
+  Metal() : Material(MATERIAL_METAL) {}
   Metal(const Vec3 &albedo, float fuzz);
 
+
   virtual bool scatter(const Ray &r,
                        const HitRecord &rec,
                        Vec3 &attenuation,
@@ -26,7 +27,7 @@ class Metal: public Material {
 };
 
 // _____________________________________________________________________________
-Metal::Metal(const Vec3 &albedo, float fuzz) {
+Metal::Metal(const Vec3 &albedo, float fuzz) : Material(MATERIAL_METAL) {
   _albedo = albedo;
   _fuzz = fuzz < 1.f ? fuzz : 1.f;
 }
@@ -0,0 +1,297 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_MOTIONBVH_H_
+#define SRC_MOTIONBVH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "AABB.h"
+#include "BVHBuilder.h"
+#include "Hitable.h"
+#include "HitableList.h"
+#include "LinearBVHNode.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// Maximum number of time segments, into which the shutter interval is split
+#define MOTION_BVH_MAX_SEGMENTS 4
+// Factor, by which the SAH cost of the linear bounds may exceed the cost of
+// a static snapshot, before the time segment is split in two
+#define MOTION_BVH_SPLIT_THRESHOLD 1.5f
+
+/**
+ * Node of a MotionBVH. Instead of a single box, the node stores the boxes
+ * at the start and at the end of its time segment; the box at any time in
+ * between is their linear interpolation. For primitives moving linearly,
+ * the interpolated box is conservative, and it is much tighter than the box
+ * enclosing the whole movement.
+ */
+struct MotionBVHNode {
+  float min0[3];
+  float max0[3];
+  float min1[3];
+  float max1[3];
+  // Same meaning as in LinearBVHNode
+  int32_t offset;
+  uint16_t count;
+  uint16_t axis;
+
+  inline bool is_leaf() const { return count > 0; }
+  // Box at the fraction s of the time segment
+  inline AABB box(float s) const {
+    return AABB(Vec3(min0[0] + s*(min1[0] - min0[0]),
+                     min0[1] + s*(min1[1] - min0[1]),
+                     min0[2] + s*(min1[2] - min0[2])),
+                Vec3(max0[0] + s*(max1[0] - max0[0]),
+                     max0[1] + s*(max1[1] - max0[1]),
+                     max0[2] + s*(max1[2] - max0[2])));
+  }
+  inline void boxes(const AABB &b0, const AABB &b1) {
+    for (int a = 0; a < 3; a++) {
+      min0[a] = b0.min()[a];
+      max0[a] = b0.max()[a];
+      min1[a] = b1.min()[a];
+      max1[a] = b1.max()[a];
+    }
+  }
+};
+
+/**
+ * BVH over moving primitives for the shutter interval [time0, time1].
+ * The topology of a time segment is built with the binned SAH builder over
+ * the primitives' boxes in the middle of the segment, the nodes then bound
+ * the primitives at the start and the end of the segment (see
+ * MotionBVHNode). When the primitives move in different directions, the
+ * interpolated boxes of a single topology grow, so the segment is split in
+ * two with a separate tree each (time-split nodes), up to
+ * MOTION_BVH_MAX_SEGMENTS segments.
+ * The BVH takes the ownership of the list of primitives.
+ */
+class MotionBVH: public Hitable {
+ public:
+  MotionBVH() = delete;
+  MotionBVH(HitableList *l, float time0, float time1, ThreadPool *pool,
+            int max_segments = MOTION_BVH_MAX_SEGMENTS);
+  MotionBVH(const MotionBVH &b) = delete;
+  MotionBVH& operator=(const MotionBVH &b) = delete;
+  ~MotionBVH();
+
+  inline int segment_count() const {
+    return static_cast<int>(_segments.size());
+  }
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const;
+
+  // Box over the whole shutter interval
+  virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const;
+  virtual bool bounding_box_at(float time, AABB &box) const;
+
+ private:
+  struct Segment {
+    float time0;
+    float time1;
+    std::vector<MotionBVHNode> nodes;
+    // Primitives in the order, in which the leaves reference them
+    std::vector<Hitable*> primitives;
+  };
+
+  void build_segments(float time0, float time1, int max_segments,
+                      ThreadPool *pool);
+  // Build the tree of a segment and return, by which factor its SAH cost
+  // exceeds the one of a static snapshot in the middle of the segment
+  float build_segment(Segment &segment, ThreadPool *pool) const;
+  const Segment& segment_at(float time, float &s) const;
+
+  HitableList *_list;
+  float _time0;
+  float _time1;
+  // Consecutive segments covering [_time0, _time1]
+  std::vector<Segment> _segments;
+};
+
+// _____________________________________________________________________________
+MotionBVH::MotionBVH(HitableList *l, float time0, float time1,
+                     ThreadPool *pool, int max_segments) {
+  _list = l;
+  _time0 = time0;
+  _time1 = time1;
+  TRACE_SCOPE("motion_bvh_build", "primitives", l->size());
+  build_segments(time0, time1, max_segments, pool);
+}
+
+// _____________________________________________________________________________
+MotionBVH::~MotionBVH() {
+  delete _list;
+}
+
+// _____________________________________________________________________________
+void MotionBVH::build_segments(float time0, float time1, int max_segments,
+                               ThreadPool *pool) {
+  Segment segment;
+  segment.time0 = time0;
+  segment.time1 = time1;
+  float growth = build_segment(segment, pool);
+  if (max_segments >= 2 && growth > MOTION_BVH_SPLIT_THRESHOLD) {
+    float mid = 0.5f * (time0 + time1);
+    build_segments(time0, mid, max_segments / 2, pool);
+    build_segments(mid, time1, max_segments - max_segments / 2, pool);
+  } else {
+    _segments.push_back(std::move(segment));
+  }
+}
+
+// _____________________________________________________________________________
+float MotionBVH::build_segment(Segment &segment, ThreadPool *pool) const {
+  int n = _list->size();
+  if (n == 0) return 1.f;
+  float mid = 0.5f * (segment.time0 + segment.time1);
+  std::vector<AABB> boxes(n);
+  for (int i = 0; i < n; i++) (*_list)[i]->bounding_box_at(mid, boxes[i]);
+  BVHBuildResult bvh = build_binned_sah(boxes, pool);
+
+  segment.primitives.resize(n);
+  for (int i = 0; i < n; i++) {
+    segment.primitives[i] = (*_list)[bvh.indices[i]];
+  }
+
+  // Bound the primitives at both ends of the segment. Children follow their
+  // parents, so a reverse sweep is bottom-up
+  int node_count = static_cast<int>(bvh.nodes.size());
+  segment.nodes.resize(node_count);
+  double motion_cost = 0.0;
+  double static_cost = 0.0;
+  for (int i = node_count - 1; i >= 0; i--) {
+    const LinearBVHNode &static_node = bvh.nodes[i];
+    MotionBVHNode &node = segment.nodes[i];
+    node.offset = static_node.offset;
+    node.count = static_node.count;
+    node.axis = static_node.axis;
+    AABB box0, box1;
+    if (node.is_leaf()) {
+      for (int p = node.offset; p < node.offset + node.count; p++) {
+        AABB prim_box;
+        if (segment.primitives[p]->bounding_box_at(segment.time0, prim_box)) {
+          box0.extend(prim_box);
+        }
+        if (segment.primitives[p]->bounding_box_at(segment.time1, prim_box)) {
+          box1.extend(prim_box);
+        }
+      }
+    } else {
+      box0 = segment.nodes[i + 1].box(0.f);
+      box0.extend(segment.nodes[node.offset].box(0.f));
+      box1 = segment.nodes[i + 1].box(1.f);
+      box1.extend(segment.nodes[node.offset].box(1.f));
+    }
+    node.boxes(box0, box1);
+
+    // Compare the interpolated boxes in the middle of the segment with the
+    // exact ones, which the topology was built for
+    int weight = node.is_leaf() ? node.count : 1;
+    motion_cost += weight * node.box(0.5f).surface_area();
+    static_cost += weight * static_node.box().surface_area();
+  }
+  return static_cost > 0.0 ? static_cast<float>(motion_cost / static_cost)
+                           : 1.f;
+}
+
+// _____________________________________________________________________________
+const MotionBVH::Segment& MotionBVH::segment_at(float time, float &s) const {
+  size_t k = 0;
+  while (k + 1 < _segments.size() && time >= _segments[k].time1) k++;
+  const Segment &segment = _segments[k];
+  float duration = segment.time1 - segment.time0;
+  s = duration > 0.f ? (time - segment.time0) / duration : 0.f;
+  s = minf(maxf(s, 0.f), 1.f);
+  return segment;
+}
+
+// _____________________________________________________________________________
+bool MotionBVH::hit(const Ray &r,
+                    float t_min,
+                    float t_max,
+                    HitRecord &rec) const {
+  if (_segments.empty() || _segments[0].nodes.empty()) return false;
+  float s;
+  const Segment &segment = segment_at(r.time(), s);
+  const MotionBVHNode *nodes = segment.nodes.data();
+
+  // Same front-to-back traversal as traverse_bvh, on the interpolated boxes.
+  // build_binned_sah keeps the segments within BVH_MAX_DEPTH, so the stack
+  // doesn't overflow
+  bool dir_neg[3] = {r.direction().x() < 0.f,
+                     r.direction().y() < 0.f,
+                     r.direction().z() < 0.f};
+  HitRecord temp_rec;
+  bool did_hit = false;
+  float closest = t_max;
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  int node_idx = 0;
+  while (true) {
+    const MotionBVHNode &node = nodes[node_idx];
+    float box_t_min = t_min;
+    float box_t_max = closest;
+    STATS_INC(box_tests);
+    if (node.box(s).hit(r, box_t_min, box_t_max)) {
+      STATS_INC(bvh_nodes_visited);
+      if (node.is_leaf()) {
+        for (int i = node.offset; i < node.offset + node.count; i++) {
+          if (segment.primitives[i]->hit(r, t_min, closest, temp_rec)) {
+            did_hit = true;
+            closest = temp_rec.t;
+            rec = temp_rec;
+          }
+        }
+        if (stack_size == 0) break;
+        node_idx = stack[--stack_size];
+      } else {
+        // Push the far child, continue with the near child
+        if (dir_neg[node.axis]) {
+          stack[stack_size++] = node_idx + 1;
+          node_idx = node.offset;
+        } else {
+          stack[stack_size++] = node.offset;
+          node_idx = node_idx + 1;
+        }
+      }
+    } else {
+      if (stack_size == 0) break;
+      node_idx = stack[--stack_size];
+    }
+  }
+  return did_hit;
+}
+
+// _____________________________________________________________________________
+bool MotionBVH::bounding_box(AABB &box) const {
+  if (_segments.empty() || _segments[0].nodes.empty()) return false;
+  box = AABB();
+  for (const Segment &segment : _segments) {
+    box.extend(segment.nodes[0].box(0.f));
+    box.extend(segment.nodes[0].box(1.f));
+  }
+  return true;
+}
+
+// _____________________________________________________________________________
+bool MotionBVH::bounding_box_at(float time, AABB &box) const {
+  if (_segments.empty() || _segments[0].nodes.empty()) return false;
+  float s;
+  box = segment_at(time, s).nodes[0].box(s);
+  return true;
+}
+
+// _____________________________________________________________________________
+unsigned MotionBVH::material_types() const {
+  return _list->material_types();
+}
+
+#endif  // SRC_MOTIONBVH_H_
@@ -0,0 +1,127 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_MOVINGSPHERE_H_
+#define SRC_MOVINGSPHERE_H_
+
+#include <iostream>
+#include <cmath>
+
+#include "Hitable.h"
+#include "Material.h"
+#include "AABB.h"
+#include "FastMath.h"
+#include "Stats.h"
+
+/**
+ * Sphere moving linearly from center0 at time0 to center1 at time1.
+ * The intersection uses the center at the time of the ray.
+ */
+class MovingSphere: public Hitable {
+ public:
+  MovingSphere() = delete;
+  MovingSphere(const Vec3 &center0, const Vec3 &center1,
+               float time0, float time1,
+               float radius, Material *m);
+  ~MovingSphere();
+
+  inline Vec3 center(float time) const {
+    // Without a time interval, the sphere stays at its first center
+    if (_time1 == _time0) return _center0;
+    return _center0 + ((time - _time0) / (_time1 - _time0))
+                      * (_center1 - _center0);
+  }
+  inline float radius() const { return _radius; }
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const;
+
+  // Box enclosing the sphere during the whole movement
+  virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const;
+  virtual bool bounding_box_at(float time, AABB &box) const;
+
+ private:
+  Vec3 _center0, _center1;
+  float _time0, _time1;
+  float _radius;
+  Material *_mat_ptr;
+};
+
+// _____________________________________________________________________________
+MovingSphere::MovingSphere(const Vec3 &center0, const Vec3 &center1,
+                           float time0, float time1,
+                           float radius, Material *m) {
+  _center0 = center0;
+  _center1 = center1;
+  _time0 = time0;
+  _time1 = time1;
+  _radius = radius;
+  _mat_ptr = m;
+}
+
+// _____________________________________________________________________________
+MovingSphere::~MovingSphere() {
+  delete _mat_ptr;
+}
+
+// _____________________________________________________________________________
+bool MovingSphere::hit(const Ray &r,
+                       float t_min,
+                       float t_max,
+                       HitRecord &rec) const {
+  // Same as Sphere::hit, but with the center at the ray's time
+  STATS_INC(primitive_tests);
+  Vec3 c = center(r.time());
+  Vec3 u = r.origin() - c;
+  float a = dot(r.direction(), r.direction());
+  float b = 2*dot(r.direction(), u);
+  float cc = dot(u, u) - _radius*_radius;
+
+  float discriminant = b*b - 4.f*a*cc;
+  if (discriminant < 0.f) return false;
+  float dis_sqrt = sqrt(discriminant);
+
+  float t = (-b - dis_sqrt) / (2.f*a);
+  if (!(t > t_min && t < t_max)) {
+    t = (-b + dis_sqrt) / (2.f*a);
+    if (!(t > t_min && t < t_max)) return false;
+  }
+
+  rec.t = t;
+  rec.p = r.point_at_t(t);
+  rec.normal = (rec.p - c) / _radius;
+  rec.mat_ptr = _mat_ptr;
+  // Polar coordinates relative to the center
+  Vec3 d = rec.normal;
+  float phi = static_cast<float>(math_atan2(d.z(), d.x()));
+  float theta = static_cast<float>(math_asin(d.y()));
+  rec.u = 1.f - (phi - M_PI) / (2.f * M_PI);
+  rec.v = (theta + M_PI / 2.f) / M_PI;
+  return true;
+}
+
+// _____________________________________________________________________________
+bool MovingSphere::bounding_box(AABB &box) const {
+  AABB box0, box1;
+  bounding_box_at(_time0, box0);
+  bounding_box_at(_time1, box1);
+  box = surrounding_box(box0, box1);
+  return true;
+}
+
+// _____________________________________________________________________________
+bool MovingSphere::bounding_box_at(float time, AABB &box) const {
+  Vec3 radius_vec(_radius, _radius, _radius);
+  box = AABB(center(time) - radius_vec, center(time) + radius_vec);
+  return true;
+}
+
+// _____________________________________________________________________________
+unsigned MovingSphere::material_types() const {
+  return _mat_ptr != nullptr ? material_bit(_mat_ptr->type()) : 0u;
+}
+
+#endif  // SRC_MOVINGSPHERE_H_
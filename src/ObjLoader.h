@@ -0,0 +1,160 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_OBJLOADER_H_
+#define SRC_OBJLOADER_H_
+
+#include <cstdint>
+#include <cstdlib>  // strtof, strtol
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "TriangleMesh.h"
+#include "Vec3.h"
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Load the geometry of a Wavefront OBJ file into mesh. Supported are vertex
+ * positions (v), normals (vn), texture coordinates (vt) and faces (f) in all
+ * index formats (v, v/vt, v//vn, v/vt/vn), including negative relative
+ * indices. Polygons are triangulated as fans. Normals or texture coordinates
+ * are dropped, if not all faces reference them. The file is streamed line by
+ * line, so only the mesh itself is kept in memory.
+ * Returns false, if the file cannot be read or contains no triangles.
+ */
+bool load_obj(const char *path, MeshData &mesh);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+// Convert a 1-based or negative relative OBJ index to a 0-based index
+inline bool resolve_obj_index(long idx, size_t count, uint32_t &out) {
+  if (idx > 0) idx -= 1;
+  else if (idx < 0) idx += static_cast<long>(count);
+  else
+    return false;
+  if (idx < 0 || idx >= static_cast<long>(count)) return false;
+  out = static_cast<uint32_t>(idx);
+  return true;
+}
+
+// _____________________________________________________________________________
+bool load_obj(const char *path, MeshData &mesh) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cout << "Could not open " << path << std::endl;
+    return false;
+  }
+
+  // Number of faces, which don't reference normals / texture coordinates
+  size_t faces_without_normals = 0;
+  size_t faces_without_uvs = 0;
+  std::vector<uint32_t> face_v, face_vt, face_vn;
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    const char *c = line.c_str();
+    while (*c == ' ' || *c == '\t') c++;
+    char *end;
+
+    if (c[0] == 'v' && (c[1] == ' ' || c[1] == '\t')) {
+      float x = strtof(c + 2, &end);
+      float y = strtof(end, &end);
+      float z = strtof(end, &end);
+      mesh.positions.push_back(Vec3(x, y, z));
+    } else if (c[0] == 'v' && c[1] == 'n') {
+      float x = strtof(c + 2, &end);
+      float y = strtof(end, &end);
+      float z = strtof(end, &end);
+      mesh.normals.push_back(Vec3(x, y, z));
+    } else if (c[0] == 'v' && c[1] == 't') {
+      float u = strtof(c + 2, &end);
+      float v = strtof(end, &end);
+      mesh.uvs.push_back(u);
+      mesh.uvs.push_back(v);
+    } else if (c[0] == 'f' && (c[1] == ' ' || c[1] == '\t')) {
+      // Parse the v[/vt[/vn]] tokens of the polygon
+      face_v.clear();
+      face_vt.clear();
+      face_vn.clear();
+      bool valid = true;
+      c += 2;
+      while (true) {
+        while (*c == ' ' || *c == '\t' || *c == '\r') c++;
+        if (*c == '\0') break;
+        uint32_t idx;
+        if (!resolve_obj_index(strtol(c, &end, 10), mesh.positions.size(),
+                               idx)) {
+          valid = false;
+          break;
+        }
+        face_v.push_back(idx);
+        c = end;
+        if (*c == '/') {
+          c++;
+          if (*c != '/') {
+            if (resolve_obj_index(strtol(c, &end, 10), mesh.uvs.size() / 2,
+                                  idx)) {
+              face_vt.push_back(idx);
+            }
+            c = end;
+          }
+          if (*c == '/') {
+            c++;
+            if (resolve_obj_index(strtol(c, &end, 10), mesh.normals.size(),
+                                  idx)) {
+              face_vn.push_back(idx);
+            }
+            c = end;
+          }
+        }
+        // Skip the rest of a malformed token
+        while (*c != '\0' && *c != ' ' && *c != '\t') c++;
+      }
+      if (!valid || face_v.size() < 3) {
+        std::cout << path << ":" << line_number << ": invalid face"
+                  << std::endl;
+        continue;
+      }
+
+      // Triangulate as a fan around the first vertex
+      bool has_vt = face_vt.size() == face_v.size();
+      bool has_vn = face_vn.size() == face_v.size();
+      for (size_t k = 1; k + 1 < face_v.size(); k++) {
+        size_t corners[3] = {0, k, k + 1};
+        for (size_t corner : corners) {
+          mesh.indices.push_back(face_v[corner]);
+          if (has_vt) mesh.uv_indices.push_back(face_vt[corner]);
+          if (has_vn) mesh.normal_indices.push_back(face_vn[corner]);
+        }
+        if (!has_vt) faces_without_uvs++;
+        if (!has_vn) faces_without_normals++;
+      }
+    }
+  }
+
+  // Attributes are only usable, if all triangles reference them
+  if (faces_without_normals > 0) {
+    mesh.normals = std::vector<Vec3>();
+    mesh.normal_indices = std::vector<uint32_t>();
+  }
+  if (faces_without_uvs > 0) {
+    mesh.uvs = std::vector<float>();
+    mesh.uv_indices = std::vector<uint32_t>();
+  }
+  mesh.positions.shrink_to_fit();
+  mesh.indices.shrink_to_fit();
+  mesh.normal_indices.shrink_to_fit();
+  mesh.uv_indices.shrink_to_fit();
+  return !mesh.indices.empty();
+}
+
+#endif  // SRC_OBJLOADER_H_
@@ -0,0 +1,432 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_PARTICLESET_H_
+#define SRC_PARTICLESET_H_
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "AABB.h"
+#include "BVHBuilder.h"
+#include "FastMath.h"
+#include "Half.h"
+#include "Hitable.h"
+#include "LBVHBuilder.h"
+#include "LinearBVHNode.h"
+#include "Material.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "Vec3.h"
+
+// Definitions
+// Number of neighboring particles bound by one box for the BVH, which are
+// also intersected at once
+#define PARTICLE_CLUSTER_SIZE 16
+// "MWRP" in little endian
+#define PARTICLE_FILE_MAGIC 0x5052574du
+#define PARTICLE_FILE_VERSION 1u
+
+/**
+ * Sphere of a particle set in 16 bytes: the center, the radius as a half
+ * and the index of its material in the palette of the set.
+ */
+struct Particle {
+  float center[3];
+  uint16_t radius;
+  uint16_t material;
+};
+
+static_assert(sizeof(Particle) == 16, "Particle should be 16 bytes");
+
+/**
+ * Header of a particle file. It is followed by count Particle records in
+ * the byte order of the machine (little endian on x86).
+ */
+struct ParticleFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t count;
+};
+
+/**
+ * Spheres of particle or point cloud data as a single Hitable. A Sphere
+ * object per particle would cost a heap block, a vtable pointer and a
+ * material of its own; here a particle is a 16 byte record in one array,
+ * which refers to a material of the shared palette.
+ * The particles are sorted along a Morton curve and grouped into clusters
+ * of PARTICLE_CLUSTER_SIZE neighbors. The BVH is built over the boxes of the
+ * clusters instead of the particles, so its nodes add about 4 bytes per
+ * particle, and the particles of a cluster are intersected together with a
+ * branch-free test, which the compiler can vectorize.
+ * Unless the palette is shared, the set takes the ownership of its
+ * materials. The palette must not be empty; particles with an index out of
+ * the palette get the first material.
+ */
+class ParticleSet: public Hitable {
+ public:
+  ParticleSet() = delete;
+  ParticleSet(std::vector<Particle> particles,
+              std::vector<Material*> palette,
+              ThreadPool *pool);
+  /**
+   * Set of count particles from the clusters and the BVH of another set
+   * (see clusters and nodes), e.g. stored in a file. The palette is shared;
+   * it stays owned by the caller and has to outlive the set.
+   */
+  ParticleSet(std::vector<Particle> clusters,
+              std::vector<LinearBVHNode> nodes,
+              int count,
+              const std::vector<Material*> &palette);
+  ParticleSet(const ParticleSet &s) = delete;
+  ParticleSet& operator=(const ParticleSet &s) = delete;
+  ~ParticleSet();
+
+  inline int particle_count() const { return _count; }
+  // Particles in the order of the clusters, padded to whole clusters
+  inline const std::vector<Particle>& clusters() const { return _particles; }
+  // BVH over the clusters
+  inline const std::vector<LinearBVHNode>& nodes() const { return _nodes; }
+  // Bytes of the particles and the BVH
+  inline size_t memory_bytes() const {
+    return _particles.capacity() * sizeof(Particle)
+           + _nodes.capacity() * sizeof(LinearBVHNode);
+  }
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const;
+
+  virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const;
+
+ private:
+  bool intersect_leaf(const Ray &r, int offset, int count,
+                      float t_min, float &t_max, int &hit_particle) const;
+  void set_hit_record(int particle, float t, const Ray &r,
+                      HitRecord &rec) const;
+
+  // Padded to whole clusters by repeating the last particle
+  std::vector<Particle> _particles;
+  int _count{0};
+  // BVH over the clusters
+  std::vector<LinearBVHNode> _nodes;
+  std::vector<Material*> _palette;
+  bool _owns_palette{true};
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+inline Particle make_particle(const Vec3 &center, float radius, int material);
+
+/**
+ * Indices of the particles in the order along a Morton curve through their
+ * centers, in which consecutive particles are close to each other.
+ */
+std::vector<int32_t> morton_order(const std::vector<Particle> &particles,
+                                  ThreadPool *pool);
+
+/**
+ * Sort the particles along a Morton curve, group them into clusters of
+ * PARTICLE_CLUSTER_SIZE and build a BVH over the clusters, like a
+ * ParticleSet does. The clusters are stored in the order of the leaves of
+ * nodes, padded by repeating the last particle.
+ */
+void build_particle_clusters(std::vector<Particle> particles,
+                             ThreadPool *pool,
+                             std::vector<Particle> &clusters,
+                             std::vector<LinearBVHNode> &nodes);
+
+// Box around the sphere of the particle
+AABB particle_box(const Particle &p);
+
+/**
+ * Move and scale the particle, so that the particles within bounds fit into
+ * [-1, 1] x [0, 2] x [-1, 1], standing on the origin.
+ */
+void fit_particle(Particle &p, const AABB &bounds);
+
+/**
+ * Read the particles from a particle file at path into particles. Returns
+ * false, if the file can't be read or isn't a particle file.
+ */
+bool load_particles(const char *path, std::vector<Particle> &particles);
+
+// Write the particles as a particle file to path
+bool save_particles(const char *path, const std::vector<Particle> &particles);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+Particle make_particle(const Vec3 &center, float radius, int material) {
+  Particle p;
+  for (int a = 0; a < 3; a++) p.center[a] = center[a];
+  p.radius = float_to_half(radius);
+  p.material = static_cast<uint16_t>(material);
+  return p;
+}
+
+// _____________________________________________________________________________
+std::vector<int32_t> morton_order(const std::vector<Particle> &particles,
+                                  ThreadPool *pool) {
+  int n = static_cast<int>(particles.size());
+  AABB centers;
+  for (const Particle &p : particles) {
+    centers.extend(Vec3(p.center[0], p.center[1], p.center[2]));
+  }
+  float cells = static_cast<float>((1 << 21) - 1);
+  Vec3 extent = centers.max() - centers.min();
+  Vec3 scale(extent.x() > 0.f ? cells / extent.x() : 0.f,
+             extent.y() > 0.f ? cells / extent.y() : 0.f,
+             extent.z() > 0.f ? cells / extent.z() : 0.f);
+  std::vector<uint64_t> codes(n);
+  std::vector<int32_t> order(n);
+  for (int i = 0; i < n; i++) {
+    const float *c = particles[i].center;
+    Vec3 q = (Vec3(c[0], c[1], c[2]) - centers.min()) * scale;
+    codes[i] = (expand_bits_21(static_cast<uint64_t>(q.x())) << 2)
+               | (expand_bits_21(static_cast<uint64_t>(q.y())) << 1)
+               | expand_bits_21(static_cast<uint64_t>(q.z()));
+    order[i] = i;
+  }
+  radix_sort(codes, order, 63, pool);
+  return order;
+}
+
+// _____________________________________________________________________________
+void build_particle_clusters(std::vector<Particle> particles,
+                             ThreadPool *pool,
+                             std::vector<Particle> &clusters,
+                             std::vector<LinearBVHNode> &nodes) {
+  int n = static_cast<int>(particles.size());
+  clusters.clear();
+  nodes.clear();
+  if (n == 0) return;
+
+  // Sort the particles along a Morton curve, so that consecutive particles
+  // are close to each other
+  std::vector<int32_t> order = morton_order(particles, pool);
+
+  // Bound each cluster of consecutive particles by a box
+  int count = (n + PARTICLE_CLUSTER_SIZE - 1) / PARTICLE_CLUSTER_SIZE;
+  std::vector<AABB> boxes(count);
+  for (int i = 0; i < count * PARTICLE_CLUSTER_SIZE; i++) {
+    boxes[i / PARTICLE_CLUSTER_SIZE].extend(
+        particle_box(particles[order[i < n ? i : n - 1]]));
+  }
+  BVHBuildResult bvh = build_binned_sah(boxes, pool);
+  boxes = std::vector<AABB>();
+  nodes = std::move(bvh.nodes);
+
+  // Store the clusters in the order of the leaves, so that each leaf
+  // references a contiguous range of clusters
+  clusters.resize(static_cast<size_t>(count) * PARTICLE_CLUSTER_SIZE);
+  for (int k = 0; k < count; k++) {
+    int first = bvh.indices[k] * PARTICLE_CLUSTER_SIZE;
+    for (int l = 0; l < PARTICLE_CLUSTER_SIZE; l++) {
+      int i = first + l < n ? first + l : n - 1;
+      clusters[k * PARTICLE_CLUSTER_SIZE + l] = particles[order[i]];
+    }
+  }
+}
+
+// _____________________________________________________________________________
+AABB particle_box(const Particle &p) {
+  Vec3 c(p.center[0], p.center[1], p.center[2]);
+  float r = half_to_float(p.radius);
+  return AABB(c - Vec3(r, r, r), c + Vec3(r, r, r));
+}
+
+// _____________________________________________________________________________
+void fit_particle(Particle &p, const AABB &bounds) {
+  Vec3 size = bounds.max() - bounds.min();
+  float scale = 2.f / maxf(size.x(), maxf(size.y(), size.z()));
+  Vec3 base(bounds.centroid().x(), bounds.min().y(), bounds.centroid().z());
+  for (int a = 0; a < 3; a++) p.center[a] = (p.center[a] - base[a]) * scale;
+  p.radius = float_to_half(half_to_float(p.radius) * scale);
+}
+
+// _____________________________________________________________________________
+bool load_particles(const char *path, std::vector<Particle> &particles) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) return false;
+  ParticleFileHeader header;
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      header.magic != PARTICLE_FILE_MAGIC ||
+      header.version != PARTICLE_FILE_VERSION) {
+    return false;
+  }
+  // Check the size first, so that a broken header can't allocate too much
+  std::streamoff begin = in.tellg();
+  in.seekg(0, std::ios::end);
+  std::streamoff size = in.tellg() - begin;
+  if (size < 0 || static_cast<uint64_t>(size) / sizeof(Particle)
+                  < header.count) {
+    return false;
+  }
+  in.seekg(begin);
+  particles.resize(header.count);
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(particles.data()),
+                                   header.count * sizeof(Particle)));
+}
+
+// _____________________________________________________________________________
+bool save_particles(const char *path, const std::vector<Particle> &particles) {
+  std::ofstream out(path, std::ios::binary);
+  if (!out) return false;
+  ParticleFileHeader header{PARTICLE_FILE_MAGIC, PARTICLE_FILE_VERSION,
+                            particles.size()};
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(particles.data()),
+            particles.size() * sizeof(Particle));
+  out.close();
+  return static_cast<bool>(out);
+}
+
+// _____________________________________________________________________________
+ParticleSet::ParticleSet(std::vector<Particle> particles,
+                         std::vector<Material*> palette,
+                         ThreadPool *pool) {
+  _palette = std::move(palette);
+  int n = static_cast<int>(particles.size());
+  _count = n;
+  if (n == 0) return;
+  TRACE_SCOPE("particle_bvh_build", "particles", n);
+  for (Particle &p : particles) {
+    if (p.material >= _palette.size()) p.material = 0;
+  }
+  build_particle_clusters(std::move(particles), pool, _particles, _nodes);
+}
+
+// _____________________________________________________________________________
+ParticleSet::ParticleSet(std::vector<Particle> clusters,
+                         std::vector<LinearBVHNode> nodes,
+                         int count,
+                         const std::vector<Material*> &palette)
+    : _particles(std::move(clusters)), _count(count),
+      _nodes(std::move(nodes)), _palette(palette), _owns_palette(false) {
+  for (Particle &p : _particles) {
+    if (p.material >= _palette.size()) p.material = 0;
+  }
+}
+
+// _____________________________________________________________________________
+ParticleSet::~ParticleSet() {
+  if (!_owns_palette) return;
+  for (Material *m : _palette) delete m;
+}
+
+// _____________________________________________________________________________
+bool ParticleSet::intersect_leaf(const Ray &r, int offset, int count,
+                                 float t_min, float &t_max,
+                                 int &hit_particle) const {
+  const float o[3] = {r.origin().x(), r.origin().y(), r.origin().z()};
+  const float d[3] = {r.direction().x(), r.direction().y(),
+                      r.direction().z()};
+  const float a = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+  const float inv_a = 1.f / a;
+  bool did_hit = false;
+  STATS_ADD(primitive_tests, count * PARTICLE_CLUSTER_SIZE);
+
+  for (int cluster = offset; cluster < offset + count; cluster++) {
+    const Particle *p = &_particles[cluster * PARTICLE_CLUSTER_SIZE];
+    uint16_t radius_bits[PARTICLE_CLUSTER_SIZE];
+    float radius[PARTICLE_CLUSTER_SIZE];
+    for (int l = 0; l < PARTICLE_CLUSTER_SIZE; l++) {
+      radius_bits[l] = p[l].radius;
+    }
+    halves_to_floats(radius_bits, PARTICLE_CLUSTER_SIZE, radius);
+
+    // Same quadratic as in Sphere::hit with b halved, on all lanes without
+    // branches. Lanes without a hit get infinity
+    float t[PARTICLE_CLUSTER_SIZE];
+    for (int l = 0; l < PARTICLE_CLUSTER_SIZE; l++) {
+      float ux = o[0] - p[l].center[0];
+      float uy = o[1] - p[l].center[1];
+      float uz = o[2] - p[l].center[2];
+      float b = d[0]*ux + d[1]*uy + d[2]*uz;
+      float c = ux*ux + uy*uy + uz*uz - radius[l]*radius[l];
+      float discriminant = b*b - a*c;
+      float root = sqrtf(discriminant > 0.f ? discriminant : 0.f);
+      float near = (-b - root) * inv_a;
+      float far = (-b + root) * inv_a;
+      float tl = near > t_min ? near : far;
+      bool valid = discriminant >= 0.f && tl > t_min && tl < t_max;
+      t[l] = valid ? tl : maxf();
+    }
+
+    // Closest hit among the lanes; repeated padding particles hit at the
+    // same distance as the original and don't change the result
+    for (int l = 0; l < PARTICLE_CLUSTER_SIZE; l++) {
+      if (t[l] < t_max) {
+        t_max = t[l];
+        hit_particle = cluster * PARTICLE_CLUSTER_SIZE + l;
+        did_hit = true;
+      }
+    }
+  }
+  return did_hit;
+}
+
+// _____________________________________________________________________________
+void ParticleSet::set_hit_record(int particle, float t, const Ray &r,
+                                 HitRecord &rec) const {
+  const Particle &p = _particles[particle];
+  Vec3 center(p.center[0], p.center[1], p.center[2]);
+  rec.t = t;
+  rec.p = r.point_at_t(t);
+  // Outwards, like the normal of Sphere
+  rec.normal = (rec.p - center) / half_to_float(p.radius);
+  rec.mat_ptr = _palette[p.material];
+  // Polar coordinates on the particle
+  float phi = static_cast<float>(math_atan2(rec.normal.z(), rec.normal.x()));
+  float theta = static_cast<float>(
+      math_asin(fmaxf(-1.f, fminf(1.f, rec.normal.y()))));
+  rec.u = 1.f - (phi - M_PI) / (2.f * M_PI);
+  rec.v = (theta + M_PI / 2.f) / M_PI;
+}
+
+// _____________________________________________________________________________
+bool ParticleSet::hit(const Ray &r,
+                      float t_min,
+                      float t_max,
+                      HitRecord &rec) const {
+  if (_nodes.empty()) return false;
+
+  // The hit record is only filled in for the closest particle
+  int hit_particle = -1;
+  float closest_hit = t_max;
+  bool did_hit = traverse_bvh(_nodes.data(), r, t_min, closest_hit,
+      [&](int offset, int count, float &closest) {
+        return intersect_leaf(r, offset, count, t_min, closest, hit_particle);
+      });
+  if (!did_hit) return false;
+  set_hit_record(hit_particle, closest_hit, r, rec);
+  return true;
+}
+
+// _____________________________________________________________________________
+bool ParticleSet::bounding_box(AABB &box) const {
+  if (_nodes.empty()) return false;
+  box = _nodes[0].box();
+  return true;
+}
+
+// _____________________________________________________________________________
+unsigned ParticleSet::material_types() const {
+  unsigned types = 0u;
+  for (const Material *m : _palette) {
+    if (m != nullptr) types |= material_bit(m->type());
+  }
+  return types;
+}
+
+#endif  // SRC_PARTICLESET_H_
@@ -0,0 +1,345 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_QUANTIZEDBVH_H_
+#define SRC_QUANTIZEDBVH_H_
+
+#include <cstdint>
+#include <cstring>  // memcpy
+#include <limits>
+#include <vector>
+
+#include "AABB.h"
+#include "Hitable.h"
+#include "HitableList.h"
+#include "LinearBVH.h"
+#include "LinearBVHNode.h"
+#include "Ray.h"
+#include "Stats.h"
+#include "Vec3.h"
+
+// Definitions
+// Layout of QuantizedBVHNode::bits: the index (second child of an interior
+// node, first primitive of a leaf) in the low bits, the kind of the node in
+// the highest bit and the axis of an interior node or the number of
+// primitives of a leaf minus 1 in the bits between
+#define QBVH_INDEX_BITS 28
+#define QBVH_INDEX_MASK ((1u << QBVH_INDEX_BITS) - 1u)
+#define QBVH_LEAF_BIT (1u << 31)
+#define QBVH_MAX_LEAF_SIZE 8
+
+/**
+ * Frame, in which the boxes of the children of a node are quantized: the
+ * minimum of the node's box and, per axis, the size of a step. The step is
+ * rounded up to a power of two, so that q * step is exact, and the decoded
+ * coordinates are the same, whether the compiler contracts the
+ * multiply-add or not.
+ */
+struct QuantizedFrame {
+  Vec3 base;
+  Vec3 step;
+  Vec3 max;
+
+  QuantizedFrame() = default;
+  QuantizedFrame(const AABB &box, float steps);
+};
+
+/**
+ * Node of a quantized BVH. The box of the node is stored in the frame of
+ * its parent's box: each coordinate is one of the 2^bits - 1 steps from the
+ * parent's minimum; the last one is the parent's maximum. The coordinates
+ * are rounded outwards, so that the box still contains the primitives.
+ * With Q = uint8_t a node takes 12 bytes, with Q = uint16_t 16 bytes,
+ * instead of the 32 bytes of a LinearBVHNode.
+ */
+template <typename Q>
+struct QuantizedBVHNode {
+  Q qmin[3];
+  Q qmax[3];
+  uint32_t bits;
+
+  static constexpr float steps() {
+    return static_cast<float>(std::numeric_limits<Q>::max());
+  }
+
+  inline bool is_leaf() const { return (bits & QBVH_LEAF_BIT) != 0u; }
+  inline int index() const { return static_cast<int>(bits & QBVH_INDEX_MASK); }
+  inline int count() const {
+    return static_cast<int>((bits >> QBVH_INDEX_BITS) & 7u) + 1;
+  }
+  inline int axis() const {
+    return static_cast<int>((bits >> QBVH_INDEX_BITS) & 3u);
+  }
+
+  // Box of the node in the frame of its parent
+  inline AABB decode(const QuantizedFrame &parent) const;
+};
+
+static_assert(sizeof(QuantizedBVHNode<uint8_t>) == 12,
+              "8-bit QuantizedBVHNode should be 12 bytes");
+static_assert(sizeof(QuantizedBVHNode<uint16_t>) == 16,
+              "16-bit QuantizedBVHNode should be 16 bytes");
+
+/**
+ * BVH with quantized nodes for large scenes, where the nodes are a large
+ * share of the memory and of the memory bandwidth of the traversal. It is
+ * made from a LinearBVH with the same topology and primitive order; the
+ * traversal decodes the box of every node in the frame of its parent, which
+ * it keeps on the stack. The decoded boxes contain the original ones, so
+ * the closest hits are the same, only a few more nodes may be visited.
+ * Only BVHs with leaves of at most QBVH_MAX_LEAF_SIZE primitives, less than
+ * 2^28 nodes and primitives, and at most BVH_MAX_DEPTH levels, for which
+ * the stacks of the traversal are sized, can be quantized (see quantizable).
+ */
+template <typename Q>
+class QuantizedBVH: public Hitable {
+ public:
+  QuantizedBVH() = delete;
+  // Takes the ownership of the list of primitives of bvh, which can be
+  // deleted afterwards
+  explicit QuantizedBVH(LinearBVH *bvh);
+  QuantizedBVH(const QuantizedBVH &b) = delete;
+  QuantizedBVH& operator=(const QuantizedBVH &b) = delete;
+  ~QuantizedBVH();
+
+  static bool quantizable(const LinearBVH &bvh);
+
+  inline int node_count() const { return static_cast<int>(_nodes.size()); }
+  inline size_t node_bytes() const {
+    return _nodes.size() * sizeof(QuantizedBVHNode<Q>);
+  }
+  // Give up the ownership of the list of primitives and return it
+  inline HitableList* release() {
+    HitableList *l = _list;
+    _list = nullptr;
+    return l;
+  }
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const;
+
+  virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const { return _materials; }
+
+ private:
+  // Coordinates of child in the frame of its parent, rounded outwards
+  void quantize(const AABB &child, const QuantizedFrame &parent,
+                QuantizedBVHNode<Q> &node) const;
+
+  HitableList *_list{nullptr};
+  std::vector<Hitable*> _primitives;
+  std::vector<QuantizedBVHNode<Q>> _nodes;
+  // Box of the root in full precision and the frame, in which the root
+  // node is quantized
+  AABB _root;
+  QuantizedFrame _root_frame;
+  unsigned _materials{0u};
+};
+
+// _____________________________________________________________________________
+QuantizedFrame::QuantizedFrame(const AABB &box, float steps)
+    : base(box.min()), max(box.max()) {
+  for (int a = 0; a < 3; a++) {
+    // Round the step up to a power of two (or keep 0) by carrying a
+    // non-zero mantissa into the exponent
+    float s = (box.max()[a] - box.min()[a]) * (1.f / steps);
+    uint32_t bits;
+    memcpy(&bits, &s, sizeof(bits));
+    bits = (bits + 0x7fffffu) & 0xff800000u;
+    memcpy(&step[a], &bits, sizeof(bits));
+  }
+}
+
+// _____________________________________________________________________________
+template <typename Q>
+AABB QuantizedBVHNode<Q>::decode(const QuantizedFrame &parent) const {
+  Vec3 lo, hi;
+  for (int a = 0; a < 3; a++) {
+    lo[a] = parent.base[a] + qmin[a] * parent.step[a];
+    hi[a] = qmax[a] == std::numeric_limits<Q>::max()
+            ? parent.max[a] : parent.base[a] + qmax[a] * parent.step[a];
+  }
+  return AABB(lo, hi);
+}
+
+// _____________________________________________________________________________
+template <typename Q>
+bool QuantizedBVH<Q>::quantizable(const LinearBVH &bvh) {
+  const LinearBVHNode *nodes = bvh.nodes();
+  if (static_cast<uint32_t>(bvh.node_count()) > QBVH_INDEX_MASK) return false;
+  std::vector<int> depths = bvh_node_depths(nodes, bvh.node_count());
+  for (int i = 0; i < bvh.node_count(); i++) {
+    if (nodes[i].is_leaf() && (nodes[i].count > QBVH_MAX_LEAF_SIZE ||
+        static_cast<uint32_t>(nodes[i].offset) > QBVH_INDEX_MASK)) {
+      return false;
+    }
+    if (!nodes[i].is_leaf() && depths[i] >= BVH_MAX_DEPTH) return false;
+  }
+  return true;
+}
+
+// _____________________________________________________________________________
+template <typename Q>
+QuantizedBVH<Q>::QuantizedBVH(LinearBVH *bvh) {
+  _primitives = bvh->primitives();
+  _materials = bvh->material_types();
+  _list = bvh->release();
+  int n = bvh->node_count();
+  if (n == 0) return;
+  const LinearBVHNode *nodes = bvh->nodes();
+  _root = nodes[0].box();
+  _nodes.resize(n);
+
+  // Quantize every node in the frame of the decoded box of its parent,
+  // exactly the box, which the traversal computes; parents come before
+  // their children. The root is quantized in the frame of its own box
+  const float steps = QuantizedBVHNode<Q>::steps();
+  std::vector<QuantizedFrame> frames(n);
+  std::vector<int> parent(n, -1);
+  _root_frame = QuantizedFrame(_root, steps);
+  for (int i = 0; i < n; i++) {
+    const LinearBVHNode &node = nodes[i];
+    QuantizedBVHNode<Q> &q = _nodes[i];
+    const QuantizedFrame &frame = i == 0 ? _root_frame : frames[parent[i]];
+    quantize(node.box(), frame, q);
+    frames[i] = QuantizedFrame(q.decode(frame), steps);
+    if (node.is_leaf()) {
+      q.bits = QBVH_LEAF_BIT
+               | (static_cast<uint32_t>(node.count - 1) << QBVH_INDEX_BITS)
+               | static_cast<uint32_t>(node.offset);
+    } else {
+      q.bits = (static_cast<uint32_t>(node.axis) << QBVH_INDEX_BITS)
+               | static_cast<uint32_t>(node.offset);
+      parent[i + 1] = i;
+      parent[node.offset] = i;
+    }
+  }
+}
+
+// _____________________________________________________________________________
+template <typename Q>
+QuantizedBVH<Q>::~QuantizedBVH() {
+  delete _list;
+}
+
+// _____________________________________________________________________________
+template <typename Q>
+void QuantizedBVH<Q>::quantize(const AABB &child, const QuantizedFrame &parent,
+                               QuantizedBVHNode<Q> &node) const {
+  const int max_q = std::numeric_limits<Q>::max();
+  for (int a = 0; a < 3; a++) {
+    int lo = 0;
+    int hi = max_q;
+    if (parent.step[a] > 0.f) {
+      float scale = 1.f / parent.step[a];
+      lo = static_cast<int>((child.min()[a] - parent.base[a]) * scale);
+      hi = static_cast<int>((child.max()[a] - parent.base[a]) * scale) + 1;
+      lo = lo < 0 ? 0 : (lo > max_q ? max_q : lo);
+      hi = hi < lo ? lo : (hi > max_q ? max_q : hi);
+    }
+    node.qmin[a] = static_cast<Q>(lo);
+    node.qmax[a] = static_cast<Q>(hi);
+    // The estimates may be off by the rounding of the floats; step outwards,
+    // until the decoded box contains the child. The parent's box contains
+    // the child, so this ends at the latest at 0 and max_q, which decode to
+    // the parent's minimum and maximum
+    AABB box = node.decode(parent);
+    while (node.qmin[a] > 0 && box.min()[a] > child.min()[a]) {
+      node.qmin[a]--;
+      box = node.decode(parent);
+    }
+    while (node.qmax[a] < max_q && box.max()[a] < child.max()[a]) {
+      node.qmax[a]++;
+      box = node.decode(parent);
+    }
+  }
+}
+
+// _____________________________________________________________________________
+template <typename Q>
+bool QuantizedBVH<Q>::hit(const Ray &r,
+                          float t_min,
+                          float t_max,
+                          HitRecord &rec) const {
+  if (_nodes.empty()) return false;
+
+  // Visit the child on the side, from which the ray comes, first
+  bool dir_neg[3] = {r.direction().x() < 0.f,
+                     r.direction().y() < 0.f,
+                     r.direction().z() < 0.f};
+  const Vec3 origin = r.origin();
+  const Vec3 inv_dir(1.f / r.direction().x(), 1.f / r.direction().y(),
+                     1.f / r.direction().z());
+
+  // Nodes to visit with their depths. The frame of a node at depth k is in
+  // frames[k]; it stays there, until the traversal leaves the node's
+  // subtree, so the frame of a popped node's parent is still there
+  struct Entry {
+    int node;
+    int depth;
+  };
+  Entry stack[BVH_STACK_SIZE];
+  QuantizedFrame frames[BVH_STACK_SIZE + 1];
+  frames[0] = _root_frame;
+  int stack_size = 0;
+  HitRecord temp_rec;
+  bool did_hit = false;
+  float closest = t_max;
+  int node_idx = 0;
+  int depth = 0;
+  while (true) {
+    const QuantizedBVHNode<Q> &node = _nodes[node_idx];
+    AABB box = node.decode(frames[depth]);
+    // The box test narrows down the interval, so work on copies
+    float box_t_min = t_min;
+    float box_t_max = closest;
+    STATS_INC(box_tests);
+    if (box.hit(origin, inv_dir, box_t_min, box_t_max)) {
+      STATS_INC(bvh_nodes_visited);
+      if (node.is_leaf()) {
+        int offset = node.index();
+        for (int i = offset; i < offset + node.count(); i++) {
+          if (_primitives[i]->hit(r, t_min, closest, temp_rec)) {
+            did_hit = true;
+            closest = temp_rec.t;
+            rec = temp_rec;
+          }
+        }
+        if (stack_size == 0) break;
+        --stack_size;
+        node_idx = stack[stack_size].node;
+        depth = stack[stack_size].depth;
+      } else {
+        // Push the far child, continue with the near child
+        int second = node.index();
+        depth++;
+        frames[depth] = QuantizedFrame(box, QuantizedBVHNode<Q>::steps());
+        if (dir_neg[node.axis()]) {
+          stack[stack_size++] = {node_idx + 1, depth};
+          node_idx = second;
+        } else {
+          stack[stack_size++] = {second, depth};
+          node_idx = node_idx + 1;
+        }
+      }
+    } else {
+      if (stack_size == 0) break;
+      --stack_size;
+      node_idx = stack[stack_size].node;
+      depth = stack[stack_size].depth;
+    }
+  }
+  return did_hit;
+}
+
+// _____________________________________________________________________________
+template <typename Q>
+bool QuantizedBVH<Q>::bounding_box(AABB &box) const {
+  if (_nodes.empty()) return false;
+  box = _root;
+  return true;
+}
+
+#endif  // SRC_QUANTIZEDBVH_H_
@@ -9,18 +9,26 @@
 class Ray {
  public:
   Ray() {}
-  Ray(const Vec3 &o, const Vec3 &d) { _origin = o; _direction = d; }
+  Ray(const Vec3 &o, const Vec3 &d, float time = 0.f) {
+    _origin = o;
+    _direction = d;
+    _time = time;
+  }
 
   inline Vec3 origin() const { return _origin; }
   inline Vec3 direction() const { return _direction; }
+  inline float time() const { return _time; }
   inline Vec3 point_at_t(float t) const { return _origin + t*_direction; }
 
   inline void origin(const Vec3 &origin) { _origin = origin; }
   inline void direction(const Vec3 &direction) { _direction = direction; }
+  inline void time(float time) { _time = time; }
 
  private:
   Vec3 _origin;
   Vec3 _direction;
+  // Point in time inside the camera's shutter interval
+  float _time{0.f};
 };
 
 #endif  // SRC_RAY_H_
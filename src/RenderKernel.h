@@ -0,0 +1,401 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_RENDERKERNEL_H_
+#define SRC_RENDERKERNEL_H_
+
+#include <limits>   // maxfloat
+
+#include "Dialectic.h"
+#include "DiffuseLight.h"
+#include "EnvironmentLight.h"
+#include "Hitable.h"
+#include "Lambertian.h"
+#include "LightBVH.h"
+#include "Material.h"
+#include "Metal.h"
+#include "Ray.h"
+#include "Stats.h"
+#include "Vec3.h"
+
+// Definitions
+#define SHADOW_BIAS 0.001f
+#define RECURSION_DEPTH 50
+
+/**
+ * Path tracing kernels specialized at compile time on the maximum depth of
+ * the paths and on the set of material types, which can appear in the
+ * scene. Materials in the set are called directly (and inlined) instead of
+ * through their virtual functions, emission is only evaluated, when the set
+ * contains emissive materials, and a set with a single material type needs
+ * no dispatch at all.
+ * The renderer asks the world for its material types (see
+ * Hitable::material_types) and picks the first pre-instantiated kernel in
+ * render_kernels, which covers them; the last one handles every scene.
+ */
+
+// Radiance arriving along a camera ray from the world
+typedef Vec3 (*PathKernel)(const Ray &r, Hitable *world);
+
+struct RenderKernel {
+  const char *name;
+  // Set of material types (see material_bit), which the kernel handles
+  unsigned materials;
+  PathKernel trace;
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Follow the path starting with the camera ray r, until it leaves the
+ * scene, hits a material, which doesn't scatter, or MaxDepth bounces are
+ * reached. Materials has to contain the types of all materials in world.
+ */
+template <int MaxDepth, unsigned Materials>
+Vec3 trace_path(const Ray &r, Hitable *world);
+
+/**
+ * The first of the pre-instantiated kernels, which handles all the
+ * material types in the set, or the direct lighting kernel, if
+ * scene_lights() or scene_environment() is set.
+ */
+const RenderKernel& select_render_kernel(unsigned material_types);
+
+// Kernel handling any scene, as a reference for the specialized ones
+const RenderKernel& general_render_kernel();
+
+/**
+ * Like trace_path, but at every diffuse hit one light of scene_lights() and
+ * a direction of scene_environment() are sampled directly, and combined
+ * with the light, which the path finds by itself, by multiple importance
+ * sampling (power heuristic). Lambertian surfaces are sampled by the cosine
+ * here, as ideal diffuse reflectors.
+ */
+template <int MaxDepth, unsigned Materials>
+Vec3 trace_path_direct(const Ray &r, Hitable *world);
+
+// Kernel handling any scene with the direct sampling of scene_lights() and
+// scene_environment()
+const RenderKernel& direct_lighting_kernel();
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+// True, if every material of the set is of the type
+constexpr bool only_material(unsigned materials, MaterialType type) {
+  return materials == material_bit(type);
+}
+
+// _____________________________________________________________________________
+// True, if a material of the set may be of the type
+constexpr bool may_be_material(unsigned materials, MaterialType type) {
+  return (materials & material_bit(type)) != 0u;
+}
+
+// _____________________________________________________________________________
+template <unsigned Materials>
+inline bool scatter_material(const Material *m,
+                             const Ray &r,
+                             const HitRecord &rec,
+                             Vec3 &attenuation,
+                             Ray &scattered) {
+  // The qualified calls bypass the virtual dispatch
+  if (may_be_material(Materials, MATERIAL_LAMBERTIAN) &&
+      (only_material(Materials, MATERIAL_LAMBERTIAN) ||
+       m->type() == MATERIAL_LAMBERTIAN)) {
+    return static_cast<const Lambertian*>(m)->Lambertian::scatter(
+        r, rec, attenuation, scattered);
+  }
+  if (may_be_material(Materials, MATERIAL_METAL) &&
+      (only_material(Materials, MATERIAL_METAL) ||
+       m->type() == MATERIAL_METAL)) {
+    return static_cast<const Metal*>(m)->Metal::scatter(
+        r, rec, attenuation, scattered);
+  }
+  if (may_be_material(Materials, MATERIAL_DIALECTIC) &&
+      (only_material(Materials, MATERIAL_DIALECTIC) ||
+       m->type() == MATERIAL_DIALECTIC)) {
+    return static_cast<const Dialectic*>(m)->Dialectic::scatter(
+        r, rec, attenuation, scattered);
+  }
+  // Lights don't scatter
+  if (may_be_material(Materials, MATERIAL_DIFFUSE_LIGHT) &&
+      (only_material(Materials, MATERIAL_DIFFUSE_LIGHT) ||
+       m->type() == MATERIAL_DIFFUSE_LIGHT)) {
+    return false;
+  }
+  return m->scatter(r, rec, attenuation, scattered);
+}
+
+// _____________________________________________________________________________
+template <unsigned Materials>
+inline Vec3 emit_material(const Material *m, const HitRecord &rec) {
+  if (may_be_material(Materials, MATERIAL_DIFFUSE_LIGHT) &&
+      m->type() == MATERIAL_DIFFUSE_LIGHT) {
+    return static_cast<const DiffuseLight*>(m)->DiffuseLight::emit(
+        rec.u, rec.v, rec.p);
+  }
+  if (may_be_material(Materials, MATERIAL_OTHER) &&
+      m->type() == MATERIAL_OTHER) {
+    return m->emit(rec.u, rec.v, rec.p);
+  }
+  return Vec3(0.f, 0.f, 0.f);
+}
+
+// _____________________________________________________________________________
+template <int MaxDepth, unsigned Materials>
+Vec3 trace_path(const Ray &r, Hitable *world) {
+  // Only lights and unknown materials emit
+  constexpr bool emission =
+      may_be_material(Materials, MATERIAL_DIFFUSE_LIGHT) ||
+      may_be_material(Materials, MATERIAL_OTHER);
+  STATS_INC(primary_rays);
+  Vec3 radiance(0.f, 0.f, 0.f);
+  // Product of the attenuations along the path so far
+  Vec3 throughput(1.f, 1.f, 1.f);
+  Ray ray = r;
+  for (int depth = 0; ; depth++) {
+    HitRecord rec;
+    // The environment, black by default, is the background
+    if (!world->hit(ray, SHADOW_BIAS, MAXFLOAT, rec)) {
+      STATS_PATH_END(depth);
+      return radiance + throughput * environment_radiance(ray.direction());
+    }
+    const Material *m = rec.mat_ptr;
+    STATS_MATERIAL_HIT(m->type());
+    if (emission) radiance += throughput * emit_material<Materials>(m, rec);
+
+    // Bounce the scattered ray, until the maximum depth is reached, or the
+    // material on the hitpoint has decided not to scatter the ray.
+    // The scattered ray happens at the same time as the incoming one
+    Ray scattered;
+    scattered.time(ray.time());
+    Vec3 attenuation;
+    if (depth >= MaxDepth ||
+        !scatter_material<Materials>(m, ray, rec, attenuation, scattered)) {
+      STATS_PATH_END(depth);
+      return radiance;
+    }
+    throughput *= attenuation;
+    ray = scattered;
+    STATS_INC(secondary_rays);
+  }
+}
+
+// _____________________________________________________________________________
+// Power heuristic weight of a sample with the density pdf_a against pdf_b
+inline float power_heuristic(float pdf_a, float pdf_b) {
+  float a2 = pdf_a * pdf_a;
+  float b2 = pdf_b * pdf_b;
+  return a2 + b2 > 0.f ? a2 / (a2 + b2) : 0.f;
+}
+
+// _____________________________________________________________________________
+/**
+ * Light of one light of scene_lights() arriving at the diffuse hit rec
+ * with the normal n, facing the incoming ray, after it's reflected with
+ * the albedo; zero, if the light is blocked.
+ */
+inline Vec3 sample_direct_light(const LightBVH &lights,
+                                Hitable *world,
+                                const HitRecord &rec,
+                                const Vec3 &n,
+                                const Vec3 &albedo,
+                                float time) {
+  int light;
+  float pmf;
+  if (!lights.sample(rec.p, n, get_random_in_range(0.f, 1.f), light, pmf)) {
+    return Vec3(0.f, 0.f, 0.f);
+  }
+  const SphereLight &l = lights.light(light);
+  Vec3 direction;
+  float cone_pdf;
+  if (!l.sample(rec.p, direction, cone_pdf)) return Vec3(0.f, 0.f, 0.f);
+  float cos_theta = dot(n, direction);
+  if (cos_theta <= 0.f) return Vec3(0.f, 0.f, 0.f);
+
+  // The light is visible, if the shadow ray hits it first
+  Ray shadow(rec.p, direction, time);
+  HitRecord light_rec;
+  STATS_INC(secondary_rays);
+  if (!world->hit(shadow, SHADOW_BIAS, MAXFLOAT, light_rec) ||
+      light_rec.mat_ptr != l.sphere->material()) {
+    return Vec3(0.f, 0.f, 0.f);
+  }
+  Vec3 emitted = light_rec.mat_ptr->emit(light_rec.u, light_rec.v,
+                                         light_rec.p);
+  float light_pdf = pmf * cone_pdf;
+  float bsdf_pdf = cos_theta / M_PI;
+  return albedo * emitted * (cos_theta / M_PI / light_pdf
+                             * power_heuristic(light_pdf, bsdf_pdf));
+}
+
+// _____________________________________________________________________________
+/**
+ * Light of the environment arriving at the diffuse hit rec from a sampled
+ * direction, like sample_direct_light.
+ */
+inline Vec3 sample_environment_light(const EnvironmentLight &environment,
+                                     Hitable *world,
+                                     const HitRecord &rec,
+                                     const Vec3 &n,
+                                     const Vec3 &albedo,
+                                     float time) {
+  Vec3 direction;
+  float light_pdf;
+  if (!environment.sample(direction, light_pdf)) return Vec3(0.f, 0.f, 0.f);
+  float cos_theta = dot(n, direction);
+  if (cos_theta <= 0.f) return Vec3(0.f, 0.f, 0.f);
+  // The environment is visible, if the shadow ray leaves the scene
+  Ray shadow(rec.p, direction, time);
+  HitRecord blocker;
+  STATS_INC(secondary_rays);
+  if (world->hit(shadow, SHADOW_BIAS, MAXFLOAT, blocker)) {
+    return Vec3(0.f, 0.f, 0.f);
+  }
+  float bsdf_pdf = cos_theta / M_PI;
+  return albedo * environment.radiance(direction)
+         * (cos_theta / M_PI / light_pdf
+            * power_heuristic(light_pdf, bsdf_pdf));
+}
+
+// _____________________________________________________________________________
+template <int MaxDepth, unsigned Materials>
+Vec3 trace_path_direct(const Ray &r, Hitable *world) {
+  const LightBVH *lights = scene_lights();
+  const EnvironmentLight *environment = scene_environment();
+  STATS_INC(primary_rays);
+  Vec3 radiance(0.f, 0.f, 0.f);
+  Vec3 throughput(1.f, 1.f, 1.f);
+  Ray ray = r;
+  // Point, normal and density of the last diffuse bounce, so that hitting
+  // a light afterwards can be weighted against sampling it there
+  bool after_diffuse = false;
+  Vec3 last_p;
+  Vec3 last_n;
+  float last_pdf = 0.f;
+  for (int depth = 0; ; depth++) {
+    HitRecord rec;
+    if (!world->hit(ray, SHADOW_BIAS, MAXFLOAT, rec)) {
+      if (environment != nullptr) {
+        float weight = after_diffuse
+            ? power_heuristic(last_pdf, environment->pdf(ray.direction()))
+            : 1.f;
+        radiance += throughput * environment->radiance(ray.direction())
+                    * weight;
+      }
+      STATS_PATH_END(depth);
+      return radiance;
+    }
+    const Material *m = rec.mat_ptr;
+    STATS_MATERIAL_HIT(m->type());
+    Vec3 emitted = emit_material<Materials>(m, rec);
+    if (emitted.squared_length() > 0.f) {
+      int light = lights != nullptr ? lights->light_of(m) : -1;
+      float weight = 1.f;
+      if (after_diffuse && light >= 0) {
+        float light_pdf = lights->pmf(last_p, last_n, light)
+                          * lights->light(light).pdf(last_p);
+        weight = power_heuristic(last_pdf, light_pdf);
+      }
+      radiance += throughput * emitted * weight;
+    }
+    if (depth >= MaxDepth) {
+      STATS_PATH_END(depth);
+      return radiance;
+    }
+
+    Ray scattered;
+    scattered.time(ray.time());
+    if (m->type() == MATERIAL_LAMBERTIAN) {
+      const Lambertian *lambertian = static_cast<const Lambertian*>(m);
+      Vec3 albedo = lambertian->albedo(rec);
+      // Normal on the side of the incoming ray
+      Vec3 n = dot(rec.normal, ray.direction()) > 0.f ? -rec.normal
+                                                        : rec.normal;
+      if (lights != nullptr) {
+        radiance += throughput * sample_direct_light(*lights, world, rec, n,
+                                                     albedo, ray.time());
+      }
+      if (environment != nullptr) {
+        radiance += throughput * sample_environment_light(
+            *environment, world, rec, n, albedo, ray.time());
+      }
+      // Cosine weighted direction, for which albedo is the whole weight
+      Vec3 direction = n + make_unit_vector(random_in_unit_sphere());
+      float length = direction.length();
+      if (length < 1e-6f) direction = n;
+      else direction /= length;
+      scattered.origin(rec.p);
+      scattered.direction(direction);
+      throughput *= albedo;
+      after_diffuse = true;
+      last_p = rec.p;
+      last_n = n;
+      last_pdf = maxf(dot(n, direction), 0.f) / M_PI;
+    } else {
+      Vec3 attenuation;
+      if (!scatter_material<Materials>(m, ray, rec, attenuation, scattered)) {
+        STATS_PATH_END(depth);
+        return radiance;
+      }
+      throughput *= attenuation;
+      after_diffuse = false;
+    }
+    ray = scattered;
+    STATS_INC(secondary_rays);
+  }
+}
+
+// _____________________________________________________________________________
+// Kernels for the feature sets of the built-in scenes, most specialized first
+static const RenderKernel render_kernels[] = {
+  {"lambertian", material_bit(MATERIAL_LAMBERTIAN),
+   trace_path<RECURSION_DEPTH, material_bit(MATERIAL_LAMBERTIAN)>},
+  {"lambertian+light",
+   material_bit(MATERIAL_LAMBERTIAN) | material_bit(MATERIAL_DIFFUSE_LIGHT),
+   trace_path<RECURSION_DEPTH, material_bit(MATERIAL_LAMBERTIAN) |
+                               material_bit(MATERIAL_DIFFUSE_LIGHT)>},
+  {"lambertian+metal+dialectic",
+   material_bit(MATERIAL_LAMBERTIAN) | material_bit(MATERIAL_METAL) |
+   material_bit(MATERIAL_DIALECTIC),
+   trace_path<RECURSION_DEPTH, material_bit(MATERIAL_LAMBERTIAN) |
+                               material_bit(MATERIAL_METAL) |
+                               material_bit(MATERIAL_DIALECTIC)>},
+  {"general", MATERIAL_MASK_ALL,
+   trace_path<RECURSION_DEPTH, MATERIAL_MASK_ALL>}
+};
+
+// _____________________________________________________________________________
+const RenderKernel& select_render_kernel(unsigned material_types) {
+  if (scene_lights() != nullptr || scene_environment() != nullptr) {
+    return direct_lighting_kernel();
+  }
+  int count = sizeof(render_kernels) / sizeof(render_kernels[0]);
+  for (int k = 0; k < count - 1; k++) {
+    if ((material_types & ~render_kernels[k].materials) == 0u) {
+      return render_kernels[k];
+    }
+  }
+  return general_render_kernel();
+}
+
+// _____________________________________________________________________________
+const RenderKernel& general_render_kernel() {
+  return render_kernels[sizeof(render_kernels) / sizeof(render_kernels[0]) - 1];
+}
+
+// _____________________________________________________________________________
+const RenderKernel& direct_lighting_kernel() {
+  static const RenderKernel kernel = {
+    "general+direct", MATERIAL_MASK_ALL,
+    trace_path_direct<RECURSION_DEPTH, MATERIAL_MASK_ALL>
+  };
+  return kernel;
+}
+
+#endif  // SRC_RENDERKERNEL_H_
@@ -0,0 +1,647 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_RENDERER_H_
+#define SRC_RENDERER_H_
+
+#include <algorithm>  // min
+#include <cstdint>
+#include <fstream>  // input from a file
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Camera.h"
+#include "ChunkedGeometry.h"
+#include "Heatmap.h"
+#include "Hitable.h"
+#include "ImageWriter.h"
+#include "Material.h"
+#include "Ray.h"
+#include "RenderKernel.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "TiledFramebuffer.h"
+#include "Trace.h"
+#include "Utils.h"
+#include "Vec3.h"
+
+// Definitions
+// Side length of the square tiles, which are rendered in parallel
+#define RENDER_TILE_SIZE 32
+// Pixels, whose paths are traced together by render_chunked
+#define CHUNKED_BATCH_PIXELS (1 << 16)
+// Paths shaded by one task of render_chunked
+#define CHUNKED_PATH_BLOCK 256
+
+/**
+ * Linear (not gamma corrected) colors of a rendered image. Row 0 is the top
+ * row of the image.
+ */
+struct Image {
+  Image() = default;
+  Image(int w, int h) : width(w), height(h), pixels(w * h, Vec3(0, 0, 0)) {}
+
+  inline Vec3& at(int x, int y) { return pixels[y * width + x]; }
+  inline const Vec3& at(int x, int y) const { return pixels[y * width + x]; }
+
+  int width{0};
+  int height{0};
+  std::vector<Vec3> pixels;
+};
+
+// Rectangle of pixels (row 0 is the top row), x1 and y1 exclusive
+struct PixelRegion {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+};
+
+// -----------------------------------------------------------------------------
+// Function definitions
+// -----------------------------------------------------------------------------
+
+/**
+ * Render the world with the camera c into image, which defines the size.
+ * ns provide the number of randomly shot samples per pixel (for
+ * antialiasing). Box filter is applied.
+ * The image is split into tiles, which are rendered on the pool (serially
+ * without a pool). Every pixel seeds the random number generator from seed
+ * and its position, so the result doesn't depend on the number of threads.
+ * When heatmap isn't nullptr, the cost of every pixel is recorded in it.
+ * The paths are traced with kernel, by default with the kernel specialized
+ * on the material types of the world (see RenderKernel.h).
+ */
+void render_image(const Camera &c,
+                  Hitable *world,
+                  int ns,
+                  Image &image,
+                  ThreadPool *pool,
+                  uint64_t seed = 0,
+                  Heatmap *heatmap = nullptr,
+                  const RenderKernel *kernel = nullptr);
+
+/**
+ * Render only the pixels of image, which lie in one of the regions (e.g. a
+ * crop window), and leave the others as they are, so the regions can be
+ * rendered into an existing image. The pixels are rendered with the same
+ * samples and random sequences as by render_image with the same seed, so
+ * they are the pixels of a full render. The work is proportional to the
+ * area of the regions; overlapping regions are rendered once.
+ */
+void render_regions(const Camera &c,
+                    Hitable *world,
+                    int ns,
+                    Image &image,
+                    const std::vector<PixelRegion> &regions,
+                    ThreadPool *pool,
+                    uint64_t seed = 0,
+                    const RenderKernel *kernel = nullptr);
+
+/**
+ * Render like render_image, but push every finished tile to writer instead
+ * of keeping the image, so the memory doesn't grow with the size of the
+ * image, which the writer defines, and the file is written meanwhile.
+ * Returns false, if the writer fails.
+ */
+bool render_streamed(const Camera &c,
+                     Hitable *world,
+                     int ns,
+                     ImageWriter &writer,
+                     ThreadPool *pool,
+                     uint64_t seed = 0,
+                     const RenderKernel *kernel = nullptr);
+
+/**
+ * Render like render_image into the tiles of the framebuffer, in the order
+ * of the tiles, so that only the tiles in flight are in memory.
+ */
+void render_framebuffer(const Camera &c,
+                        Hitable *world,
+                        int ns,
+                        TiledFramebuffer &framebuffer,
+                        ThreadPool *pool,
+                        uint64_t seed = 0,
+                        const RenderKernel *kernel = nullptr);
+
+/**
+ * Render the world together with the out-of-core particles of chunks into
+ * image, with the same samples and random sequences as render_image with
+ * the same seed, so that the image is the one of the particles in memory.
+ * The paths of batch_pixels pixels are traced together, a bounce at a time:
+ * all the rays of a bounce are intersected with the world, then with the
+ * chunks at once (see ChunkedScene::intersect), so that a chunk is read
+ * at most about once per bounce for the whole batch, and then shaded. When
+ * a pixel is done, the next pixel of the image takes its place. Larger
+ * batches read less, but cost about 150 bytes per pixel.
+ * The materials are handled by the general kernel.
+ */
+void render_chunked(const Camera &c,
+                    Hitable *world,
+                    ChunkedScene &chunks,
+                    int ns,
+                    Image &image,
+                    ThreadPool *pool,
+                    uint64_t seed = 0,
+                    int batch_pixels = CHUNKED_BATCH_PIXELS);
+
+/**
+ * Write the framebuffer in the format given by the extension of out_file
+ * (see image_format), streaming it a row of tiles at a time.
+ * Returns false, if the file cannot be written.
+ */
+bool write_framebuffer(const char *out_file, TiledFramebuffer &framebuffer,
+                       ToneMap tonemap = TONEMAP_CLAMP);
+
+/**
+ * Write the image in the format given by the extension of out_file (see
+ * image_format). Tonemapping and gamma correction are applied.
+ * Returns false, if the file cannot be written.
+ */
+bool write_image(const char *out_file, const Image &image,
+                 ToneMap tonemap = TONEMAP_CLAMP);
+
+/**
+ * Read a PPM file (P3 or P6 with 255 as the maximum value), as written by
+ * write_image with the tonemap, into image, which gets its size. The
+ * colors are the linear colors, which are written as the same bytes.
+ * Returns false, if the file cannot be read or has another format.
+ */
+bool read_image(const char *in_file, Image &image,
+                ToneMap tonemap = TONEMAP_CLAMP);
+
+/**
+ * Write the image as a PPM file. Gamma correction is applied.
+ * Returns false, if the file cannot be written.
+ */
+bool write_ppm(const char *out_file, const Image &image);
+
+// -----------------------------------------------------------------------------
+// Function declaration
+// -----------------------------------------------------------------------------
+
+// _____________________________________________________________________________
+// Ray through a random point of the pixel in column i and row j from the
+// bottom
+inline Ray sample_camera_ray(const Camera &c, int nx, int ny, int i, int j) {
+  float u = static_cast<float>((i + get_random_in_range(0.f, 1.f)) / nx);
+  float v = static_cast<float>((j + get_random_in_range(0.f, 1.f)) / ny);
+  return c.get_ray(u, v);
+}
+
+// _____________________________________________________________________________
+// Average of ns samples of the pixel in column i and row y of the image
+inline Vec3 render_pixel(const Camera &c, Hitable *world, PathKernel trace,
+                         int ns, int nx, int ny, int i, int y,
+                         uint64_t seed) {
+  // The camera's v axis points up
+  int j = ny - 1 - y;
+  seed_random(seed * static_cast<uint64_t>(nx) * ny + j * nx + i);
+  Vec3 col{0.f, 0.f, 0.f};
+
+  // Iterate over the samples
+  for (int s = 0; s < ns; s++) {
+    // Create the ray through a random point of the pixel
+    Ray r = sample_camera_ray(c, nx, ny, i, j);
+
+    // Accumulate color
+    col += trace(r, world);
+  }
+
+  // Apply antialiasing using box filter
+  col /= static_cast<float>(ns);
+  return col;
+}
+
+// _____________________________________________________________________________
+void render_image(const Camera &c,
+                  Hitable *world,
+                  int ns,
+                  Image &image,
+                  ThreadPool *pool,
+                  uint64_t seed,
+                  Heatmap *heatmap,
+                  const RenderKernel *kernel) {
+  TRACE_SCOPE("render", "width", image.width, "height", image.height);
+  int nx = image.width;
+  int ny = image.height;
+  int tiles_x = (nx + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (ny + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  if (kernel == nullptr) {
+    kernel = &select_render_kernel(world->material_types());
+  }
+  PathKernel trace = kernel->trace;
+
+  auto render_tile = [&](int tile) {
+    int x0 = (tile % tiles_x) * RENDER_TILE_SIZE;
+    int y0 = (tile / tiles_x) * RENDER_TILE_SIZE;
+    int x1 = std::min(x0 + RENDER_TILE_SIZE, nx);
+    int y1 = std::min(y0 + RENDER_TILE_SIZE, ny);
+    TRACE_SCOPE("tile", "x", x0, "y", y0);
+    for (int y = y0; y < y1; y++) {
+      for (int i = x0; i < x1; i++) {
+        uint64_t cost = heatmap ? heatmap_counter(heatmap->metric) : 0;
+        image.at(i, y) = render_pixel(c, world, trace, ns, nx, ny, i, y,
+                                      seed);
+        if (heatmap) {
+          heatmap->at(i, y) = static_cast<float>(
+              heatmap_counter(heatmap->metric) - cost);
+        }
+      }
+    }
+  };
+
+  if (pool != nullptr) {
+    pool->parallel_for(tiles_x * tiles_y, render_tile);
+  } else {
+    for (int tile = 0; tile < tiles_x * tiles_y; tile++) render_tile(tile);
+  }
+}
+
+// _____________________________________________________________________________
+void render_regions(const Camera &c,
+                    Hitable *world,
+                    int ns,
+                    Image &image,
+                    const std::vector<PixelRegion> &regions,
+                    ThreadPool *pool,
+                    uint64_t seed,
+                    const RenderKernel *kernel) {
+  int nx = image.width;
+  int ny = image.height;
+  TRACE_SCOPE("render", "width", nx, "height", ny);
+  if (kernel == nullptr) {
+    kernel = &select_render_kernel(world->material_types());
+  }
+  PathKernel trace = kernel->trace;
+
+  // The tiles of render_image, which intersect a region, with the parts
+  // of the regions in them
+  struct RegionTile {
+    PixelRegion bounds;
+    std::vector<PixelRegion> parts;
+  };
+  int tiles_x = (nx + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (ny + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  std::vector<RegionTile> tiles;
+  for (int tile = 0; tile < tiles_x * tiles_y; tile++) {
+    int x0 = (tile % tiles_x) * RENDER_TILE_SIZE;
+    int y0 = (tile / tiles_x) * RENDER_TILE_SIZE;
+    int x1 = std::min(x0 + RENDER_TILE_SIZE, nx);
+    int y1 = std::min(y0 + RENDER_TILE_SIZE, ny);
+    RegionTile t{{x1, y1, x0, y0}, {}};
+    for (const PixelRegion &r : regions) {
+      PixelRegion p{std::max(r.x0, x0), std::max(r.y0, y0),
+                    std::min(r.x1, x1), std::min(r.y1, y1)};
+      if (p.x0 >= p.x1 || p.y0 >= p.y1) continue;
+      t.parts.push_back(p);
+      t.bounds = {std::min(t.bounds.x0, p.x0), std::min(t.bounds.y0, p.y0),
+                  std::max(t.bounds.x1, p.x1), std::max(t.bounds.y1, p.y1)};
+    }
+    if (!t.parts.empty()) tiles.push_back(std::move(t));
+  }
+
+  auto render_tile = [&](int index) {
+    const RegionTile &t = tiles[index];
+    TRACE_SCOPE("tile", "x", t.bounds.x0, "y", t.bounds.y0);
+    for (int y = t.bounds.y0; y < t.bounds.y1; y++) {
+      for (int i = t.bounds.x0; i < t.bounds.x1; i++) {
+        bool inside = false;
+        for (const PixelRegion &p : t.parts) {
+          inside |= i >= p.x0 && i < p.x1 && y >= p.y0 && y < p.y1;
+        }
+        if (inside) {
+          image.at(i, y) = render_pixel(c, world, trace, ns, nx, ny, i, y,
+                                        seed);
+        }
+      }
+    }
+  };
+
+  int count = static_cast<int>(tiles.size());
+  if (pool != nullptr) {
+    pool->parallel_for(count, render_tile);
+  } else {
+    for (int index = 0; index < count; index++) render_tile(index);
+  }
+}
+
+// _____________________________________________________________________________
+bool render_streamed(const Camera &c,
+                     Hitable *world,
+                     int ns,
+                     ImageWriter &writer,
+                     ThreadPool *pool,
+                     uint64_t seed,
+                     const RenderKernel *kernel) {
+  int nx = writer.width();
+  int ny = writer.height();
+  TRACE_SCOPE("render", "width", nx, "height", ny);
+  int tiles_x = (nx + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  int tiles_y = (ny + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  if (kernel == nullptr) {
+    kernel = &select_render_kernel(world->material_types());
+  }
+  PathKernel trace = kernel->trace;
+
+  auto render_tile = [&](int tile) {
+    int x0 = (tile % tiles_x) * RENDER_TILE_SIZE;
+    int y0 = (tile / tiles_x) * RENDER_TILE_SIZE;
+    int x1 = std::min(x0 + RENDER_TILE_SIZE, nx);
+    int y1 = std::min(y0 + RENDER_TILE_SIZE, ny);
+    TRACE_SCOPE("tile", "x", x0, "y", y0);
+    Vec3 pixels[RENDER_TILE_SIZE * RENDER_TILE_SIZE];
+    Vec3 *p = pixels;
+    for (int y = y0; y < y1; y++) {
+      for (int i = x0; i < x1; i++) {
+        *p++ = render_pixel(c, world, trace, ns, nx, ny, i, y, seed);
+      }
+    }
+    writer.push(x0, y0, x1 - x0, y1 - y0, pixels);
+  };
+
+  if (pool != nullptr) {
+    pool->parallel_for(tiles_x * tiles_y, render_tile);
+  } else {
+    for (int tile = 0; tile < tiles_x * tiles_y; tile++) render_tile(tile);
+  }
+  return writer.finish();
+}
+
+// _____________________________________________________________________________
+void render_framebuffer(const Camera &c,
+                        Hitable *world,
+                        int ns,
+                        TiledFramebuffer &framebuffer,
+                        ThreadPool *pool,
+                        uint64_t seed,
+                        const RenderKernel *kernel) {
+  int nx = framebuffer.width();
+  int ny = framebuffer.height();
+  TRACE_SCOPE("render", "width", nx, "height", ny);
+  if (kernel == nullptr) {
+    kernel = &select_render_kernel(world->material_types());
+  }
+  PathKernel trace = kernel->trace;
+
+  auto render_tile = [&](int tile) {
+    int x0, y0, x1, y1;
+    framebuffer.tile_rect(tile, x0, y0, x1, y1);
+    TRACE_SCOPE("tile", "x", x0, "y", y0);
+    Vec3 *p = framebuffer.acquire(tile);
+    for (int y = y0; y < y1; y++) {
+      for (int i = x0; i < x1; i++) {
+        *p++ = render_pixel(c, world, trace, ns, nx, ny, i, y, seed);
+      }
+    }
+    framebuffer.release(tile);
+  };
+
+  if (pool != nullptr) {
+    pool->parallel_for(framebuffer.num_tiles(), render_tile);
+  } else {
+    for (int tile = 0; tile < framebuffer.num_tiles(); tile++) {
+      render_tile(tile);
+    }
+  }
+}
+
+// _____________________________________________________________________________
+void render_chunked(const Camera &c,
+                    Hitable *world,
+                    ChunkedScene &chunks,
+                    int ns,
+                    Image &image,
+                    ThreadPool *pool,
+                    uint64_t seed,
+                    int batch_pixels) {
+  TRACE_SCOPE("render", "width", image.width, "height", image.height);
+  int nx = image.width;
+  int ny = image.height;
+  int num_pixels = nx * ny;
+  int slots = std::min(std::max(batch_pixels, 1), num_pixels);
+
+  // Path of a sample of a pixel; the samples of a pixel are traced one
+  // after the other with the random sequence of the pixel, like in
+  // render_pixel
+  struct Path {
+    int pixel;
+    int sample;
+    int depth;
+    Vec3 throughput;
+    Vec3 radiance;
+    Vec3 sum;
+    unsigned short random[3];
+  };
+  auto run = [pool](int count, const std::function<void(int)> &body) {
+    if (pool != nullptr) {
+      pool->parallel_for(count, body);
+    } else {
+      for (int i = 0; i < count; i++) body(i);
+    }
+  };
+  auto blocks = [](int count) {
+    return (count + CHUNKED_PATH_BLOCK - 1) / CHUNKED_PATH_BLOCK;
+  };
+  // Set up the path for the first sample of the pixel, and return its ray
+  auto start_pixel = [&](Path &path, int pixel) {
+    path.pixel = pixel;
+    int i = pixel % nx;
+    int j = ny - 1 - pixel / nx;
+    seed_random(seed * static_cast<uint64_t>(nx) * ny + j * nx + i);
+    path.sample = 0;
+    path.depth = 0;
+    path.throughput = Vec3(1.f, 1.f, 1.f);
+    path.radiance = Vec3(0.f, 0.f, 0.f);
+    path.sum = Vec3(0.f, 0.f, 0.f);
+    Ray r = sample_camera_ray(c, nx, ny, i, j);
+    std::copy(random_state(), random_state() + 3, path.random);
+    STATS_INC(primary_rays);
+    return r;
+  };
+
+  // A slot per pixel in flight; a slot, whose pixel is done, takes the next
+  // pixel, so that there are as many rays as possible to share the reads
+  // of the chunks
+  std::vector<Path> paths(slots);
+  // Rays to submit: their slots, and their closest hits in the world
+  std::vector<int> ids(slots);
+  std::vector<Ray> rays(slots);
+  std::vector<float> t_max;
+  std::vector<HitRecord> rec;
+  std::vector<uint8_t> hit;
+  run(blocks(slots), [&](int block) {
+    int end = std::min(slots, (block + 1) * CHUNKED_PATH_BLOCK);
+    for (int k = block * CHUNKED_PATH_BLOCK; k < end; k++) {
+      rays[k] = start_pixel(paths[k], k);
+      ids[k] = k;
+    }
+  });
+  int next_pixel = slots;
+  std::vector<ChunkedScene::Result> finished;
+  std::vector<uint8_t> done;
+
+  while (!ids.empty() || chunks.pending() > 0) {
+    int n = static_cast<int>(ids.size());
+    t_max.assign(n, MAXFLOAT);
+    rec.resize(n);
+    hit.assign(n, 0);
+    run(blocks(n), [&](int block) {
+      int end = std::min(n, (block + 1) * CHUNKED_PATH_BLOCK);
+      for (int k = block * CHUNKED_PATH_BLOCK; k < end; k++) {
+        if (world->hit(rays[k], SHADOW_BIAS, MAXFLOAT, rec[k])) {
+          hit[k] = 1;
+          t_max[k] = rec[k].t;
+        }
+      }
+    });
+    chunks.submit(ids, rays, SHADOW_BIAS, t_max, rec, hit, pool);
+    finished.clear();
+    chunks.resolve(finished, pool);
+
+    // Shade the hits like trace_path, and start the next sample of the
+    // paths, which end
+    int m = static_cast<int>(finished.size());
+    TRACE_SCOPE("shade", "rays", m);
+    rays.resize(m);
+    done.assign(m, 0);
+    run(blocks(m), [&](int block) {
+      int end = std::min(m, (block + 1) * CHUNKED_PATH_BLOCK);
+      for (int k = block * CHUNKED_PATH_BLOCK; k < end; k++) {
+        const ChunkedScene::Result &result = finished[k];
+        Path &path = paths[result.id];
+        std::copy(path.random, path.random + 3, random_state());
+        const Ray &ray = chunks.ray(result.id);
+        Ray scattered;
+        scattered.time(ray.time());
+        Vec3 attenuation;
+        bool bounce = false;
+        if (result.hit) {
+          const Material *mat = result.rec.mat_ptr;
+          STATS_MATERIAL_HIT(mat->type());
+          path.radiance += path.throughput
+              * emit_material<MATERIAL_MASK_ALL>(mat, result.rec);
+          bounce = path.depth < RECURSION_DEPTH &&
+              scatter_material<MATERIAL_MASK_ALL>(mat, ray, result.rec,
+                                                  attenuation, scattered);
+        } else {
+          path.radiance += path.throughput
+              * environment_radiance(ray.direction());
+        }
+        if (bounce) {
+          path.throughput *= attenuation;
+          path.depth++;
+          rays[k] = scattered;
+          STATS_INC(secondary_rays);
+        } else {
+          STATS_PATH_END(path.depth);
+          path.sum += path.radiance;
+          path.sample++;
+          int i = path.pixel % nx;
+          int y = path.pixel / nx;
+          if (path.sample < ns) {
+            path.depth = 0;
+            path.throughput = Vec3(1.f, 1.f, 1.f);
+            path.radiance = Vec3(0.f, 0.f, 0.f);
+            rays[k] = sample_camera_ray(c, nx, ny, i, ny - 1 - y);
+            STATS_INC(primary_rays);
+          } else {
+            // Apply antialiasing using box filter, as in render_pixel
+            path.sum /= static_cast<float>(ns);
+            image.at(i, y) = path.sum;
+            done[k] = 1;
+          }
+        }
+        std::copy(random_state(), random_state() + 3, path.random);
+      }
+    });
+
+    // Hand the slots of the finished pixels to the next pixels
+    ids.clear();
+    int kept = 0;
+    for (int k = 0; k < m; k++) {
+      int slot = finished[k].id;
+      if (done[k]) {
+        if (next_pixel == num_pixels) continue;
+        rays[k] = start_pixel(paths[slot], next_pixel++);
+      }
+      ids.push_back(slot);
+      rays[kept++] = rays[k];
+    }
+    rays.resize(kept);
+  }
+}
+
+// _____________________________________________________________________________
+bool write_framebuffer(const char *out_file, TiledFramebuffer &framebuffer,
+                       ToneMap tonemap) {
+  TRACE_SCOPE("write_framebuffer");
+  ImageWriter writer(out_file, framebuffer.width(), framebuffer.height(),
+                     image_format(out_file), tonemap);
+  std::vector<Vec3> pixels(FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE);
+  // In the order of the tiles, so the writer completes a row of tiles,
+  // before the next one starts
+  for (int tile = 0; tile < framebuffer.num_tiles(); tile++) {
+    int x0, y0, x1, y1;
+    framebuffer.tile_rect(tile, x0, y0, x1, y1);
+    framebuffer.read_tile(tile, pixels.data());
+    writer.push(x0, y0, x1 - x0, y1 - y0, pixels.data());
+  }
+  return writer.finish();
+}
+
+// _____________________________________________________________________________
+bool write_image(const char *out_file, const Image &image, ToneMap tonemap) {
+  TRACE_SCOPE("write_image");
+  ImageWriter writer(out_file, image.width, image.height,
+                     image_format(out_file), tonemap);
+  writer.push(0, 0, image.width, image.height, image.pixels.data());
+  return writer.finish();
+}
+
+// _____________________________________________________________________________
+bool read_image(const char *in_file, Image &image, ToneMap tonemap) {
+  std::ifstream file(in_file, std::ios::binary);
+  std::string magic;
+  int width, height, max_value;
+  if (!(file >> magic >> width >> height >> max_value) ||
+      (magic != "P3" && magic != "P6") || width <= 0 || height <= 0 ||
+      max_value != 255) {
+    return false;
+  }
+  // The value of every byte
+  float linear[256];
+  for (int q = 0; q < 256; q++) {
+    linear[q] = dequantize_channel(static_cast<uint8_t>(q), tonemap);
+  }
+  image = Image(width, height);
+  std::vector<uint8_t> bytes(3 * static_cast<size_t>(width) * height);
+  if (magic == "P6") {
+    // A single whitespace separates the header from the data
+    file.get();
+    file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+  } else {
+    for (uint8_t &b : bytes) {
+      int v;
+      file >> v;
+      b = static_cast<uint8_t>(v);
+    }
+  }
+  if (!file) return false;
+  for (size_t p = 0; p < image.pixels.size(); p++) {
+    image.pixels[p] = Vec3(linear[bytes[3 * p]], linear[bytes[3 * p + 1]],
+                           linear[bytes[3 * p + 2]]);
+  }
+  return true;
+}
+
+// _____________________________________________________________________________
+bool write_ppm(const char *out_file, const Image &image) {
+  TRACE_SCOPE("write_ppm");
+  ImageWriter writer(out_file, image.width, image.height, IMAGE_PPM);
+  writer.push(0, 0, image.width, image.height, image.pixels.data());
+  return writer.finish();
+}
+
+#endif  // SRC_RENDERER_H_
@@ -0,0 +1,754 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_SCENES_H_
+#define SRC_SCENES_H_
+
+#include <algorithm>  // max
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Animation.h"
+#include "BVHBuilder.h"
+#include "BVHCache.h"
+#include "CheckerTexture.h"
+#include "Dialectic.h"
+#include "DiffuseLight.h"
+#include "HitableList.h"
+#include "Instance.h"
+#include "LBVHBuilder.h"
+#include "Lambertian.h"
+#include "LightBVH.h"
+#include "LinearBVH.h"
+#include "Metal.h"
+#include "MotionBVH.h"
+#include "MovingSphere.h"
+#include "ObjLoader.h"
+#include "ParticleSet.h"
+#include "QuantizedBVH.h"
+#include "SolidTexture.h"
+#include "Sphere.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "Transform.h"
+#include "TriangleMesh.h"
+#include "TwoLevelBVH.h"
+#include "UniformGrid.h"
+#include "Utils.h"
+
+// Built-in scenes of the renderer and the construction of their BVHs
+
+// BVH builder used by the scenes, selected with --bvh=<name>
+static int bvh_builder = BVH_BUILDER_BINNED_SAH;
+// Directory of the BVH cache files, selected with --bvh-cache=<dir>; empty
+// disables the cache
+static std::string bvh_cache_dir;
+
+// Acceleration structures of the static scenes, selected with --accel=<name>
+#define ACCEL_BVH 0
+#define ACCEL_GRID 1
+// Build both and keep the one, which traces a set of probe rays faster
+#define ACCEL_AUTO 2
+// Number of probe rays of ACCEL_AUTO
+#define ACCEL_PROBE_RAYS 4096
+static int accelerator = ACCEL_BVH;
+// Bits of the quantized BVH nodes, selected with --quantize-bvh=8|16; 0
+// keeps the full precision nodes
+static int bvh_quantization = 0;
+// Sampling of the lights at the diffuse hits, selected with
+// --lights=uniform|bvh (see LightSampling)
+static int light_sampling = LIGHT_SAMPLING_NONE;
+
+// _____________________________________________________________________________
+const char* accelerator_name(int accel) {
+  switch (accel) {
+    case ACCEL_BVH: return "bvh";
+    case ACCEL_GRID: return "grid";
+    case ACCEL_AUTO: return "auto";
+    default: return "unknown";
+  }
+}
+
+// _____________________________________________________________________________
+const char* bvh_builder_name(int builder) {
+  switch (builder) {
+    case BVH_BUILDER_MEDIAN_SPLIT: return "median";
+    case BVH_BUILDER_BINNED_SAH: return "sah";
+    case BVH_BUILDER_LBVH: return "lbvh";
+    case BVH_BUILDER_LBVH_OPTIMIZED: return "lbvh-opt";
+    default: return "unknown";
+  }
+}
+
+// _____________________________________________________________________________
+BVHBuildResult build_bvh_with(int builder,
+                              const std::vector<AABB> &boxes,
+                              ThreadPool *pool) {
+  switch (builder) {
+    case BVH_BUILDER_MEDIAN_SPLIT: return build_median_split(boxes);
+    case BVH_BUILDER_LBVH: return build_lbvh(boxes, pool, 30, false);
+    case BVH_BUILDER_LBVH_OPTIMIZED: return build_lbvh(boxes, pool, 30, true);
+    default: return build_binned_sah(boxes, pool);
+  }
+}
+
+/**
+ * Create the acceleration structure over the provided list of objects.
+ * If bvh_cache_dir is set, the built BVH is cached in it, keyed by a hash of
+ * the objects' bounding boxes. Later runs with the same scene memory-map the
+ * cached BVH instead of building it again.
+ */
+LinearBVH* build_bvh(HitableList *world) {
+  // Measure BVH construction time
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<AABB> boxes = primitive_boxes(world);
+  bool cached = !bvh_cache_dir.empty();
+  uint64_t hash = 0;
+  std::string cache_path;
+  if (cached) {
+    hash = scene_hash(boxes, bvh_builder);
+    cache_path = bvh_cache_path(bvh_cache_dir, hash);
+  }
+
+  // Try to map a BVH built by a previous run
+  LinearBVH *as = nullptr;
+  if (cached) {
+    TRACE_SCOPE("bvh_cache_load");
+    as = load_bvh_cache(cache_path, hash, world);
+  }
+  if (as != nullptr) {
+    auto end = std::chrono::steady_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        end - start).count();
+    std::cout << "Loaded BVH from " << cache_path << " in " << duration
+              << " microseconds." << std::endl;
+    return as;
+  }
+
+  // Construct the BVH on all hardware threads
+  ThreadPool &pool = global_thread_pool();
+  auto build_start = std::chrono::steady_clock::now();
+  BVHBuildResult bvh;
+  {
+    TRACE_SCOPE("bvh_build", "primitives", static_cast<int>(boxes.size()));
+    bvh = build_bvh_with(bvh_builder, boxes, &pool);
+  }
+  auto build_end = std::chrono::steady_clock::now();
+  if (cached) {
+    TRACE_SCOPE("bvh_cache_save");
+    if (!save_bvh_cache(cache_path, hash, bvh)) {
+      std::cout << "Could not write BVH cache " << cache_path << std::endl;
+    }
+  }
+  as = new LinearBVH(world, std::move(bvh));
+
+  auto end = std::chrono::steady_clock::now();
+  auto duration =
+       std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
+  auto build_duration = std::chrono::duration_cast<std::chrono::microseconds>(
+      build_end - build_start).count();
+  std::cout << "Constructed in " << duration << " seconds "
+            << "(" << bvh_builder_name(bvh_builder) << " build of "
+            << boxes.size() << " primitives: "
+            << build_duration << " microseconds on " << pool.size()
+            << " threads)." << std::endl;
+
+  return as;
+}
+
+/**
+ * Replace the BVH by one with quantized nodes, if bvh_quantization is set
+ * and the BVH can be quantized.
+ */
+Hitable* quantize_bvh(LinearBVH *bvh) {
+  if (bvh_quantization == 0) return bvh;
+  if (!QuantizedBVH<uint8_t>::quantizable(*bvh)) {
+    std::cout << "The BVH can't be quantized, keeping full precision."
+              << std::endl;
+    return bvh;
+  }
+  size_t bytes = bvh->node_count() * sizeof(LinearBVHNode);
+  size_t quantized_bytes;
+  Hitable *as;
+  if (bvh_quantization == 8) {
+    QuantizedBVH<uint8_t> *q = new QuantizedBVH<uint8_t>(bvh);
+    quantized_bytes = q->node_bytes();
+    as = q;
+  } else {
+    QuantizedBVH<uint16_t> *q = new QuantizedBVH<uint16_t>(bvh);
+    quantized_bytes = q->node_bytes();
+    as = q;
+  }
+  delete bvh;
+  std::cout << "Quantized BVH nodes to " << bvh_quantization << " bits: "
+            << quantized_bytes << " instead of " << bytes << " bytes."
+            << std::endl;
+  return as;
+}
+
+/**
+ * Create the uniform grid over the provided list of objects.
+ */
+UniformGrid* build_grid(HitableList *world) {
+  auto start = std::chrono::steady_clock::now();
+  UniformGrid *grid;
+  {
+    TRACE_SCOPE("grid_build", "primitives", world->size());
+    grid = new UniformGrid(world);
+  }
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "Constructed " << grid->resolution(0) << "x"
+            << grid->resolution(1) << "x" << grid->resolution(2)
+            << " grid with " << grid->reference_count() << " references ("
+            << grid->large_count() << " large objects) in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                   end - start).count()
+            << " microseconds." << std::endl;
+  return grid;
+}
+
+/**
+ * Time tracing the probe rays through the acceleration structure in
+ * microseconds. The rays run between random points of the bounding box, like
+ * the secondary rays of a path, so both structures see the same workload.
+ */
+int64_t time_probe_rays(const Hitable *as, const std::vector<Ray> &rays) {
+  auto start = std::chrono::steady_clock::now();
+  HitRecord rec;
+  int hits = 0;
+  for (const Ray &r : rays) hits += as->hit(r, 0.001f, MAXFLOAT, rec);
+  auto end = std::chrono::steady_clock::now();
+  // Keep the loop from being optimized away
+  if (hits < 0) std::cout << hits;
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      end - start).count();
+}
+
+/**
+ * Set scene_lights() to the sphere lights of the list, as selected by
+ * light_sampling. Scenes without such lights are rendered without.
+ */
+void collect_scene_lights(HitableList *world) {
+  if (light_sampling == LIGHT_SAMPLING_NONE) return;
+  std::vector<SphereLight> lights = sphere_lights(world);
+  if (lights.empty()) return;
+  auto start = std::chrono::steady_clock::now();
+  LightBVH *bvh = new LightBVH(std::move(lights),
+                               light_sampling == LIGHT_SAMPLING_UNIFORM);
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "Constructed light BVH over " << bvh->light_count()
+            << " lights with " << bvh->node_count() << " nodes in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                   end - start).count()
+            << " microseconds." << std::endl;
+  delete scene_lights();
+  scene_lights() = bvh;
+}
+
+/**
+ * Create the acceleration structure selected by accelerator over the
+ * provided list of objects. With ACCEL_AUTO, both the BVH and the grid are
+ * built and the one, which traces the probe rays faster, is returned.
+ * The lights of the list are collected for light_sampling first.
+ */
+Hitable* build_accelerator(HitableList *world) {
+  collect_scene_lights(world);
+  if (accelerator == ACCEL_BVH) return quantize_bvh(build_bvh(world));
+  if (accelerator == ACCEL_GRID) return build_grid(world);
+
+  LinearBVH *bvh = build_bvh(world);
+  UniformGrid *grid = build_grid(world);
+  AABB bounds;
+  if (!grid->bounding_box(bounds)) {
+    grid->release();
+    delete grid;
+    return quantize_bvh(bvh);
+  }
+  // Own generator, so that the random numbers of the scene are unchanged
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  auto random_point = [&]() {
+    Vec3 p;
+    for (int a = 0; a < 3; a++) {
+      p[a] = bounds.min()[a]
+             + uniform(generator) * (bounds.max()[a] - bounds.min()[a]);
+    }
+    return p;
+  };
+  std::vector<Ray> rays;
+  rays.reserve(ACCEL_PROBE_RAYS);
+  for (int i = 0; i < ACCEL_PROBE_RAYS; i++) {
+    Vec3 origin = random_point();
+    rays.push_back(Ray(origin, random_point() - origin));
+  }
+
+  int64_t bvh_us;
+  int64_t grid_us;
+  {
+    TRACE_SCOPE("accel_probe", "rays", ACCEL_PROBE_RAYS);
+    bvh_us = time_probe_rays(bvh, rays);
+    grid_us = time_probe_rays(grid, rays);
+  }
+  bool use_grid = grid_us < bvh_us;
+  std::cout << "Probe rays: bvh " << bvh_us << " microseconds, grid "
+            << grid_us << " microseconds; using the "
+            << (use_grid ? "grid" : "bvh") << "." << std::endl;
+  // Both own the list of objects, so the discarded one gives it up first
+  if (use_grid) {
+    bvh->release();
+    delete bvh;
+    return grid;
+  }
+  grid->release();
+  delete grid;
+  return quantize_bvh(bvh);
+}
+
+/**
+ * Objects of the book's cover scene. With moving set, the small diffuse
+ * spheres bounce up during the shutter interval [0, 1]. With emissive set,
+ * the diffuse spheres drawn below 0.5 glow in their color instead, which
+ * makes about 240 lights, while the rest of the scene stays the same.
+ */
+HitableList* cover_scene_objects(bool moving = false, bool emissive = false) {
+  // Number of objects
+  int n = 500;
+
+  HitableList *world = new HitableList(n+1);
+  Texture *white = new SolidTexture(Vec3(0.9f, 0.9f, 0.9f));
+  Texture *black = new SolidTexture(Vec3(0.05f, 0.05f, 0.05f));
+  Texture *chercker = new CheckerTexture(white, black, 20.f);
+  Sphere *sFloor = new Sphere(Vec3(0.f, -1000.f, 0.f),
+                              1000.f,
+                              new Lambertian(chercker));
+  world->append(sFloor);
+
+  // Add small spheres
+  for (int a = -11; a < 11; a++) {
+    for (int b = -11; b < 11; b++) {
+      float choose_material = get_random_in_range(0.f, 1.f);
+      float center_x = a+0.9f*get_random_in_range(0.f, 1.f);
+      float center_z = b+0.9f*get_random_in_range(0.f, 1.f);
+      Vec3 center(center_x, 0.2f, center_z);
+      if ((center - Vec3(4.f, 0.2f, 0.f)).length() > 0.9f) {
+        if (choose_material < 0.8f) {          // diffuse
+          float rand_r = get_random_in_range(0.f, 1.f)
+                         * get_random_in_range(0.f, 1.f);
+          float rand_g = get_random_in_range(0.f, 1.f)
+                         * get_random_in_range(0.f, 1.f);
+          float rand_b = get_random_in_range(0.f, 1.f)
+                         * get_random_in_range(0.f, 1.f);
+          Material *diffuse;
+          if (emissive && choose_material < 0.5f) {
+            diffuse = new DiffuseLight(new SolidTexture(
+                4.f * Vec3(rand_r, rand_g, rand_b)));
+          } else {
+            diffuse = new Lambertian(new SolidTexture(Vec3(rand_r, rand_g, rand_b)));
+          }
+          if (moving) {
+            Vec3 center1 = center
+                           + Vec3(0.f, get_random_in_range(0.f, 0.5f), 0.f);
+            world->append(new MovingSphere(center, center1, 0.f, 1.f,
+                                           0.2f, diffuse));
+          } else {
+            world->append(new Sphere(center, 0.2f, diffuse));
+          }
+        } else if (choose_material < 0.95f) {  // metal
+          float rand_r = get_random_in_range(0.5f, 1.f);
+          float rand_g = get_random_in_range(0.5f, 1.f);
+          float rand_b = get_random_in_range(0.5f, 1.f);
+          float rand_fuzz = get_random_in_range(0.f, 1.f);
+          Sphere *sMetal = new Sphere(center, 0.2f,
+                                      new Metal(Vec3(rand_r, rand_g, rand_b),
+                                                rand_fuzz));
+          world->append(sMetal);
+        } else {                               // glass
+          Sphere *sGlass = new Sphere(center, 0.2, new Dialectic(1.52f));
+          world->append(sGlass);
+        }
+      }
+    }
+  }
+
+  // Add 3 big spheres
+  Sphere *sBigGlass = new Sphere(Vec3(0.f, 1.f, 0.f),
+                                 1.f,
+                                 new Dialectic(1.52f));
+  Sphere *sBigDiffuse = new Sphere(Vec3(-4.f, 1.f, 0.f),
+                                   1.f,
+                                   new Lambertian(new SolidTexture(Vec3(0.4f, 0.2f, 0.1f))));
+  Sphere *sBigMetal = new Sphere(Vec3(4.f, 1.f, 0.f),
+                                 1.f,
+                                 new Metal(Vec3(0.7f, 0.6f, 0.5f), 0.f));
+  world->append(sBigGlass);
+  world->append(sBigDiffuse);
+  world->append(sBigMetal);
+
+  return world;
+}
+
+Hitable* cover_scene() {
+  return build_accelerator(cover_scene_objects());
+}
+
+// Cover scene lit only by hundreds of its small spheres
+Hitable* cover_lights_scene() {
+  return build_accelerator(cover_scene_objects(false, true));
+}
+
+/**
+ * Cover scene with bouncing spheres for motion blur. The spheres are bound
+ * by a MotionBVH over the shutter interval [0, 1].
+ */
+Hitable* motion_scene() {
+  auto start = std::chrono::steady_clock::now();
+  MotionBVH *as = new MotionBVH(cover_scene_objects(true), 0.f, 1.f,
+                                &global_thread_pool());
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "Constructed motion BVH with " << as->segment_count()
+            << " time segments in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(
+                   end - start).count()
+            << " microseconds." << std::endl;
+  return as;
+}
+
+/**
+ * n small diffuse spheres uniformly distributed inside a cube. Used to
+ * compare the BVH builders on scenes of arbitrary size.
+ */
+HitableList* random_spheres_objects(int n) {
+  HitableList *world = new HitableList(n);
+  float side = 2.f * static_cast<float>(cbrt(static_cast<double>(n)));
+  for (int i = 0; i < n; i++) {
+    Vec3 center(get_random_in_range(-side, side),
+                get_random_in_range(-side, side),
+                get_random_in_range(-side, side));
+    world->append(new Sphere(center, 0.2f,
+        new Lambertian(new SolidTexture(Vec3(0.5f, 0.5f, 0.5f)))));
+  }
+  return world;
+}
+
+/**
+ * Triangle mesh loaded from the OBJ file with the provided path on a checker
+ * floor. The mesh is scaled and moved to fit into a box of size 2 standing
+ * on the floor at the origin.
+ */
+Hitable* mesh_scene(const char *path) {
+  MeshData data;
+  if (!load_obj(path, data)) return nullptr;
+
+  // Fit the mesh into [-1, 1] x [0, 2] x [-1, 1]
+  AABB bounds;
+  for (const Vec3 &p : data.positions) bounds.extend(p);
+  Vec3 size = bounds.max() - bounds.min();
+  float scale = 2.f / maxf(size.x(), maxf(size.y(), size.z()));
+  Vec3 base(bounds.centroid().x(), bounds.min().y(), bounds.centroid().z());
+  for (Vec3 &p : data.positions) p = (p - base) * scale;
+
+  auto start = std::chrono::steady_clock::now();
+  TriangleMesh *mesh = new TriangleMesh(std::move(data),
+      new Lambertian(new SolidTexture(Vec3(0.8f, 0.3f, 0.3f))),
+      &global_thread_pool());
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "Loaded mesh with " << mesh->triangle_count()
+            << " triangles, BVH built in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   end - start).count()
+            << " milliseconds." << std::endl;
+
+  Texture *white = new SolidTexture(Vec3(0.9f, 0.9f, 0.9f));
+  Texture *black = new SolidTexture(Vec3(0.05f, 0.05f, 0.05f));
+  Sphere *sFloor = new Sphere(Vec3(0.f, -1000.f, 0.f),
+                              1000.f,
+                              new Lambertian(new CheckerTexture(white, black,
+                                                                10.f)));
+  Sphere *sLight = new Sphere(Vec3(0.f, 7.f, 3.f),
+                              3.f,
+                              new DiffuseLight(new SolidTexture(
+                                  Vec3(4.f, 4.f, 4.f))));
+
+  HitableList *world = new HitableList(3);
+  world->append(sFloor);
+  world->append(mesh);
+  world->append(sLight);
+  return world;
+}
+
+/**
+ * Procedural cloud of n particles: a swirling disc with a denser core, with
+ * materials 0 to 3 from the center outwards.
+ */
+std::vector<Particle> particle_cloud(int n) {
+  std::vector<Particle> particles;
+  particles.reserve(n);
+  for (int i = 0; i < n; i++) {
+    float radius = powf(get_random_in_range(0.f, 1.f), 2.f);
+    float angle = get_random_in_range(0.f, 2.f * M_PI) + 6.f * radius;
+    float height = (1.f - radius) * get_random_in_range(-0.3f, 0.3f);
+    Vec3 center(radius * cosf(angle), height, radius * sinf(angle));
+    particles.push_back(make_particle(center,
+                                      get_random_in_range(0.002f, 0.006f),
+                                      static_cast<int>(4.f * radius) % 4));
+  }
+  return particles;
+}
+
+// Palette of the particle scenes, four materials
+std::vector<Material*> particle_palette() {
+  return {new Lambertian(new SolidTexture(Vec3(0.9f, 0.8f, 0.5f))),
+          new Lambertian(new SolidTexture(Vec3(0.8f, 0.4f, 0.2f))),
+          new Metal(Vec3(0.7f, 0.7f, 0.8f), 0.1f),
+          new Lambertian(new SolidTexture(Vec3(0.2f, 0.3f, 0.7f)))};
+}
+
+/**
+ * Checker floor and light of the particle scenes, with the particles, if
+ * they aren't nullptr (e.g. when they are out-of-core, see
+ * ChunkedGeometry.h).
+ */
+HitableList* particle_stage(Hitable *particles) {
+  Texture *white = new SolidTexture(Vec3(0.9f, 0.9f, 0.9f));
+  Texture *black = new SolidTexture(Vec3(0.05f, 0.05f, 0.05f));
+  Sphere *sFloor = new Sphere(Vec3(0.f, -1000.f, 0.f),
+                              1000.f,
+                              new Lambertian(new CheckerTexture(white, black,
+                                                                10.f)));
+  Sphere *sLight = new Sphere(Vec3(0.f, 7.f, 3.f),
+                              3.f,
+                              new DiffuseLight(new SolidTexture(
+                                  Vec3(4.f, 4.f, 4.f))));
+
+  HitableList *world = new HitableList(3);
+  world->append(sFloor);
+  if (particles != nullptr) world->append(particles);
+  world->append(sLight);
+  return world;
+}
+
+/**
+ * Particles from the particle file with the provided path, or, without a
+ * path, the particle_cloud of n particles, on a checker floor. The particles
+ * are scaled and moved to fit into a box of size 2 standing on the floor at
+ * the origin. The palette has four materials.
+ */
+Hitable* particle_scene(const char *path, int n = 1 << 20) {
+  std::vector<Particle> particles;
+  if (path != nullptr) {
+    if (!load_particles(path, particles)) {
+      std::cout << "Could not read particles from " << path << std::endl;
+      return nullptr;
+    }
+  } else {
+    particles = particle_cloud(n);
+  }
+
+  // Fit the particles into [-1, 1] x [0, 2] x [-1, 1]
+  AABB bounds;
+  for (const Particle &p : particles) bounds.extend(particle_box(p));
+  for (Particle &p : particles) fit_particle(p, bounds);
+
+  auto start = std::chrono::steady_clock::now();
+  ParticleSet *set = new ParticleSet(std::move(particles), particle_palette(),
+                                     &global_thread_pool());
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "Loaded " << set->particle_count() << " particles ("
+            << set->memory_bytes() / std::max(set->particle_count(), 1)
+            << " bytes each), BVH built in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   end - start).count()
+            << " milliseconds." << std::endl;
+  return particle_stage(set);
+}
+
+// Tree made of a few spheres, used by the forest scenes
+LinearBVH* tree_object() {
+  // The tree: a trunk of three spheres and a crown of three spheres
+  HitableList *tree_parts = new HitableList(6);
+  for (int i = 0; i < 3; i++) {
+    tree_parts->append(new Sphere(Vec3(0.f, 0.1f + 0.2f*i, 0.f), 0.1f,
+        new Lambertian(new SolidTexture(Vec3(0.4f, 0.25f, 0.1f)))));
+  }
+  tree_parts->append(new Sphere(Vec3(0.f, 0.8f, 0.f), 0.35f,
+      new Lambertian(new SolidTexture(Vec3(0.1f, 0.5f, 0.1f)))));
+  tree_parts->append(new Sphere(Vec3(0.15f, 1.05f, 0.05f), 0.25f,
+      new Lambertian(new SolidTexture(Vec3(0.15f, 0.55f, 0.1f)))));
+  tree_parts->append(new Sphere(Vec3(-0.1f, 1.25f, -0.05f), 0.18f,
+      new Lambertian(new SolidTexture(Vec3(0.2f, 0.6f, 0.15f)))));
+  return new LinearBVH(tree_parts,
+                       build_binned_sah(primitive_boxes(tree_parts), nullptr));
+}
+
+/**
+ * Forest of n trees on a checker floor. All trees are instances of a single
+ * tree made of a few spheres, placed with a random position, rotation and
+ * scale. Some of the trees override the crown's material.
+ */
+Hitable* forest_scene(int n) {
+  Hitable *tree = tree_object();
+  Material *autumn = new Lambertian(new SolidTexture(Vec3(0.8f, 0.4f, 0.1f)));
+
+  HitableList *world = new HitableList(n + 2);
+  Texture *white = new SolidTexture(Vec3(0.9f, 0.9f, 0.9f));
+  Texture *black = new SolidTexture(Vec3(0.05f, 0.05f, 0.05f));
+  world->append(new Sphere(Vec3(0.f, -1000.f, 0.f), 1000.f,
+      new Lambertian(new CheckerTexture(white, black, 20.f))));
+  world->append(new Sphere(Vec3(0.f, 30.f, 0.f), 10.f,
+      new DiffuseLight(new SolidTexture(Vec3(6.f, 6.f, 6.f)))));
+
+  float side = 2.f * static_cast<float>(sqrt(static_cast<double>(n)));
+  for (int i = 0; i < n; i++) {
+    Vec3 position(get_random_in_range(-side, side), 0.f,
+                  get_random_in_range(-side, side));
+    float s = get_random_in_range(0.7f, 1.3f);
+    Transform t = Transform::translate(position)
+                  * Transform::rotate(Vec3(0.f, 1.f, 0.f),
+                                      get_random_in_range(0.f, 360.f))
+                  * Transform::scale(Vec3(s, s, s));
+    Material *m = get_random_in_range(0.f, 1.f) < 0.1f ? autumn : nullptr;
+    world->append(new Instance(tree, t, m));
+  }
+  return build_accelerator(world);
+}
+
+/**
+ * Animated forest for the frame sequence mode: n trees on a checker floor,
+ * which turn and walk in random directions while the camera circles around
+ * them. Both calls create the same scene, the animation is added to
+ * animation, when it isn't nullptr.
+ */
+TwoLevelBVH* animated_forest_scene(int n, float duration,
+                                   Animation *animation) {
+  seed_random(1);
+  TwoLevelBVH *scene = new TwoLevelBVH(&global_thread_pool());
+  HitableList *ground_parts = new HitableList(2);
+  Texture *white = new SolidTexture(Vec3(0.9f, 0.9f, 0.9f));
+  Texture *black = new SolidTexture(Vec3(0.05f, 0.05f, 0.05f));
+  ground_parts->append(new Sphere(Vec3(0.f, -1000.f, 0.f), 1000.f,
+      new Lambertian(new CheckerTexture(white, black, 20.f))));
+  ground_parts->append(new Sphere(Vec3(0.f, 30.f, 0.f), 10.f,
+      new DiffuseLight(new SolidTexture(Vec3(6.f, 6.f, 6.f)))));
+  int ground = scene->add_object(new LinearBVH(ground_parts,
+      build_binned_sah(primitive_boxes(ground_parts), nullptr)));
+  int tree = scene->add_object(tree_object());
+  scene->add_instance(ground, Transform());
+
+  float side = 2.f * static_cast<float>(sqrt(static_cast<double>(n)));
+  for (int i = 0; i < n; i++) {
+    TransformKey start;
+    start.translation = Vec3(get_random_in_range(-side, side), 0.f,
+                             get_random_in_range(-side, side));
+    start.angle = get_random_in_range(0.f, 360.f);
+    float s = get_random_in_range(0.7f, 1.3f);
+    start.scale = Vec3(s, s, s);
+    TransformKey end = start;
+    end.translation += Vec3(get_random_in_range(-2.f, 2.f), 0.f,
+                            get_random_in_range(-2.f, 2.f));
+    end.angle += get_random_in_range(-180.f, 180.f);
+    int id = scene->add_instance(tree, start.matrix());
+    if (animation != nullptr) {
+      animation->instance(id).add(0.f, start);
+      animation->instance(id).add(duration, end);
+    }
+  }
+
+  if (animation != nullptr) {
+    float radius = side + 10.f;
+    for (int k = 0; k <= 4; k++) {
+      float angle = static_cast<float>(k * M_PI / 4.);
+      CameraKey key;
+      key.lookfrom = Vec3(radius * static_cast<float>(cos(angle)), 4.f,
+                          radius * static_cast<float>(sin(angle)));
+      key.lookat = Vec3(0.f, 0.5f, 0.f);
+      key.vertical_fov = 40.f;
+      animation->camera().add(k * duration / 4.f, key);
+    }
+  }
+  return scene;
+}
+
+Hitable* some_spheres() {
+  Sphere *sFloor = new Sphere(Vec3(3.f, 0, 0.f),
+                          0.5f,
+                          new Lambertian(new SolidTexture(Vec3(0.5f, 0.5f, 0.5f))));
+  Sphere *sPinkish = new Sphere(Vec3(0.f, 0.f, 0.f),
+                          0.5f,
+                          new Lambertian(new SolidTexture(Vec3(0.8f, 0.3f, 0.3f))));
+  Sphere *sGoldish = new Sphere(Vec3(-3.f, 0.f, 1.f),
+                              0.5f,
+                              new Metal(Vec3(1.f, 0.71f, 0.29f), 0.8f));
+  Sphere *sSilverish = new Sphere(Vec3(-6.f, 0.f, 1.f),
+                          0.5f,
+                          new Metal(Vec3(0.95f, 0.93f, 0.88f), 0.9f));
+  Sphere *sWaterish = new Sphere(Vec3(-9.f, 0.f, 1.f),
+                                0.5f,
+                                new Dialectic(1.52f));
+
+  HitableList *world = new HitableList;
+  world->append(sPinkish);
+  world->append(sFloor);
+  world->append(sGoldish);
+  world->append(sSilverish);
+  world->append(sWaterish);
+
+  return build_accelerator(world);
+}
+
+Hitable* two_spheres_checker() {
+  Texture *white = new SolidTexture(Vec3(0.9f, 0.9f, 0.9f));
+  Texture *black = new SolidTexture(Vec3(0.05f, 0.05f, 0.05f));
+  Texture *chercker = new CheckerTexture(white, black, 10.f);
+  Texture *lightColor = new SolidTexture(Vec3(2.f, 2.f, 2.f));
+
+  Material *light = new DiffuseLight(lightColor);
+  Hitable *upSphere = new Sphere(Vec3(0.f, 4.f, 0.f),
+                                 3.f,
+                                 light);
+  Hitable *loSphere = new Sphere(Vec3(0.f, -10.f, 0.f),
+                                 10.f,
+                                 new Lambertian(chercker));
+
+  HitableList *world = new HitableList(2);
+  world->append(upSphere);
+  world->append(loSphere);
+  return world;
+}
+
+Hitable* spheres_with_light() {
+  Sphere *sFloor = new Sphere(Vec3(0.f, -50.5f, 0.f),
+                          50.f,
+                          new Lambertian(new SolidTexture(Vec3(0.5f, 0.5f, 0.5f))));
+  Sphere *sPinkish = new Sphere(Vec3(0.f, 0.f, 0.f),
+                          0.5f,
+                          new Lambertian(new SolidTexture(Vec3(0.8f, 0.3f, 0.3f))));
+  // Sphere *sGoldish = new Sphere(Vec3(-3.f, 0.f, 0.f),
+  //                             0.5f,
+  //                             new Metal(Vec3(1.f, 0.71f, 0.29f), 0.8f));
+  // Sphere *sSilverish = new Sphere(Vec3(-6.f, 0.f, 0.f),
+  //                         0.5f,
+  //                         new Metal(Vec3(0.95f, 0.93f, 0.88f), 0.9f));
+  // Sphere *sWaterish = new Sphere(Vec3(-9.f, 0.f, 0.f),
+  //                               0.5f,
+  //                               new Dialectic(1.52f));
+  Sphere *sLight = new Sphere(Vec3(0.f, 2.f, 0.f),
+                              0.5f,
+                              new DiffuseLight(new SolidTexture(Vec3(4.f, 4.f, 4.f))));
+
+  HitableList *world = new HitableList;
+  world->append(sPinkish);
+  world->append(sFloor);
+  // world->append(sGoldish);
+  // world->append(sSilverish);
+  // world->append(sWaterish);
+  // world->append(sLight);
+
+  return build_accelerator(world);
+}
+
+#endif  // SRC_SCENES_H_
@@ -0,0 +1,311 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_SIMD_H_
+#define SRC_SIMD_H_
+
+#include <math.h>
+#include <cstdint>
+#include <cstring>  // memcpy
+
+/**
+ * Thin layer over the SIMD instruction sets, on which the vector types
+ * Vec3A and Vec3x8 are built:
+ *   Float4  4 floats; SSE on x86, NEON on AArch64
+ *   Float8  8 floats; AVX, when the compiler targets it (e.g. with cmake
+ *           -DNATIVE_ARCH=ON), otherwise two Float4
+ * Without SSE or NEON, or when SIMD_SCALAR is defined, Float4 is a plain
+ * array of floats, which works everywhere.
+ * Comparisons return masks of the same type, whose lanes have all bits set
+ * where the comparison holds; select and movemask consume them.
+ */
+
+#if !defined(SIMD_SCALAR) && defined(__SSE__)
+#define SIMD_SSE
+#include <xmmintrin.h>
+#if defined(__FMA__)
+#include <immintrin.h>
+#endif
+#elif !defined(SIMD_SCALAR) && defined(__ARM_NEON) && defined(__aarch64__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#if !defined(SIMD_SCALAR) && defined(__AVX__)
+#define SIMD_AVX
+#include <immintrin.h>
+#endif
+
+// _____________________________________________________________________________
+// Float4
+// _____________________________________________________________________________
+
+#if defined(SIMD_SSE)
+typedef __m128 Float4;
+
+inline Float4 float4(float x, float y, float z, float w) {
+  return _mm_setr_ps(x, y, z, w);
+}
+inline Float4 float4(float a) { return _mm_set1_ps(a); }
+inline Float4 float4_load(const float *p) { return _mm_loadu_ps(p); }
+inline void float4_store(float *p, Float4 a) { _mm_storeu_ps(p, a); }
+inline float float4_x(Float4 a) { return _mm_cvtss_f32(a); }
+inline Float4 float4_add(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+inline Float4 float4_sub(Float4 a, Float4 b) { return _mm_sub_ps(a, b); }
+inline Float4 float4_mul(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+inline Float4 float4_div(Float4 a, Float4 b) { return _mm_div_ps(a, b); }
+inline Float4 float4_fmadd(Float4 a, Float4 b, Float4 c) {
+#if defined(__FMA__)
+  return _mm_fmadd_ps(a, b, c);
+#else
+  return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+inline Float4 float4_sqrt(Float4 a) { return _mm_sqrt_ps(a); }
+inline Float4 float4_min(Float4 a, Float4 b) { return _mm_min_ps(a, b); }
+inline Float4 float4_max(Float4 a, Float4 b) { return _mm_max_ps(a, b); }
+inline Float4 float4_lt(Float4 a, Float4 b) { return _mm_cmplt_ps(a, b); }
+inline Float4 float4_gt(Float4 a, Float4 b) { return _mm_cmpgt_ps(a, b); }
+inline Float4 float4_and(Float4 a, Float4 b) { return _mm_and_ps(a, b); }
+inline Float4 float4_or(Float4 a, Float4 b) { return _mm_or_ps(a, b); }
+// Lanes of a, where mask is set, otherwise of b
+inline Float4 float4_select(Float4 mask, Float4 a, Float4 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+// Bit i is set, if lane i of the mask is set
+inline int float4_movemask(Float4 mask) { return _mm_movemask_ps(mask); }
+// (y, z, x, w)
+inline Float4 float4_yzxw(Float4 a) {
+  return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+}
+inline float float4_y(Float4 a) {
+  return _mm_cvtss_f32(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)));
+}
+inline float float4_z(Float4 a) {
+  return _mm_cvtss_f32(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 2, 2)));
+}
+
+#elif defined(SIMD_NEON)
+typedef float32x4_t Float4;
+
+inline Float4 float4(float x, float y, float z, float w) {
+  const float e[4] = {x, y, z, w};
+  return vld1q_f32(e);
+}
+inline Float4 float4(float a) { return vdupq_n_f32(a); }
+inline Float4 float4_load(const float *p) { return vld1q_f32(p); }
+inline void float4_store(float *p, Float4 a) { vst1q_f32(p, a); }
+inline float float4_x(Float4 a) { return vgetq_lane_f32(a, 0); }
+inline Float4 float4_add(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+inline Float4 float4_sub(Float4 a, Float4 b) { return vsubq_f32(a, b); }
+inline Float4 float4_mul(Float4 a, Float4 b) { return vmulq_f32(a, b); }
+inline Float4 float4_div(Float4 a, Float4 b) { return vdivq_f32(a, b); }
+inline Float4 float4_fmadd(Float4 a, Float4 b, Float4 c) {
+  return vfmaq_f32(c, a, b);
+}
+inline Float4 float4_sqrt(Float4 a) { return vsqrtq_f32(a); }
+inline Float4 float4_min(Float4 a, Float4 b) { return vminq_f32(a, b); }
+inline Float4 float4_max(Float4 a, Float4 b) { return vmaxq_f32(a, b); }
+inline Float4 float4_lt(Float4 a, Float4 b) {
+  return vreinterpretq_f32_u32(vcltq_f32(a, b));
+}
+inline Float4 float4_gt(Float4 a, Float4 b) {
+  return vreinterpretq_f32_u32(vcgtq_f32(a, b));
+}
+inline Float4 float4_and(Float4 a, Float4 b) {
+  return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a),
+                                         vreinterpretq_u32_f32(b)));
+}
+inline Float4 float4_or(Float4 a, Float4 b) {
+  return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a),
+                                         vreinterpretq_u32_f32(b)));
+}
+inline Float4 float4_select(Float4 mask, Float4 a, Float4 b) {
+  return vbslq_f32(vreinterpretq_u32_f32(mask), a, b);
+}
+inline int float4_movemask(Float4 mask) {
+  static const int32_t shifts[4] = {0, 1, 2, 3};
+  uint32x4_t bits = vshrq_n_u32(vreinterpretq_u32_f32(mask), 31);
+  return static_cast<int>(vaddvq_u32(vshlq_u32(bits, vld1q_s32(shifts))));
+}
+inline Float4 float4_yzxw(Float4 a) {
+  float e[4];
+  vst1q_f32(e, a);
+  return float4(e[1], e[2], e[0], e[3]);
+}
+inline float float4_y(Float4 a) { return vgetq_lane_f32(a, 1); }
+inline float float4_z(Float4 a) { return vgetq_lane_f32(a, 2); }
+
+#else
+// Portable fallback; compilers vectorize the loops themselves, where they can
+struct Float4 {
+  float e[4];
+};
+
+// _____________________________________________________________________________
+// Lane with all bits set, if b holds, otherwise 0
+inline float simd_mask_lane(bool b) {
+  uint32_t bits = b ? 0xffffffffu : 0u;
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// _____________________________________________________________________________
+inline uint32_t simd_lane_bits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+#define FLOAT4_LANEWISE(expr) \
+  Float4 r; \
+  for (int i = 0; i < 4; i++) r.e[i] = (expr); \
+  return r
+
+inline Float4 float4(float x, float y, float z, float w) {
+  return Float4{{x, y, z, w}};
+}
+inline Float4 float4(float a) { return Float4{{a, a, a, a}}; }
+inline Float4 float4_load(const float *p) {
+  return Float4{{p[0], p[1], p[2], p[3]}};
+}
+inline void float4_store(float *p, Float4 a) {
+  for (int i = 0; i < 4; i++) p[i] = a.e[i];
+}
+inline float float4_x(Float4 a) { return a.e[0]; }
+inline Float4 float4_add(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(a.e[i] + b.e[i]);
+}
+inline Float4 float4_sub(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(a.e[i] - b.e[i]);
+}
+inline Float4 float4_mul(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(a.e[i] * b.e[i]);
+}
+inline Float4 float4_div(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(a.e[i] / b.e[i]);
+}
+inline Float4 float4_fmadd(Float4 a, Float4 b, Float4 c) {
+  FLOAT4_LANEWISE(a.e[i] * b.e[i] + c.e[i]);
+}
+inline Float4 float4_sqrt(Float4 a) { FLOAT4_LANEWISE(sqrtf(a.e[i])); }
+inline Float4 float4_min(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(a.e[i] < b.e[i] ? a.e[i] : b.e[i]);
+}
+inline Float4 float4_max(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(a.e[i] > b.e[i] ? a.e[i] : b.e[i]);
+}
+inline Float4 float4_lt(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(simd_mask_lane(a.e[i] < b.e[i]));
+}
+inline Float4 float4_gt(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(simd_mask_lane(a.e[i] > b.e[i]));
+}
+inline Float4 float4_and(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(simd_mask_lane(simd_lane_bits(a.e[i]) &&
+                                 simd_lane_bits(b.e[i])));
+}
+inline Float4 float4_or(Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(simd_mask_lane(simd_lane_bits(a.e[i]) ||
+                                 simd_lane_bits(b.e[i])));
+}
+inline Float4 float4_select(Float4 mask, Float4 a, Float4 b) {
+  FLOAT4_LANEWISE(simd_lane_bits(mask.e[i]) ? a.e[i] : b.e[i]);
+}
+inline int float4_movemask(Float4 mask) {
+  int bits = 0;
+  for (int i = 0; i < 4; i++) bits |= (simd_lane_bits(mask.e[i]) >> 31) << i;
+  return bits;
+}
+inline Float4 float4_yzxw(Float4 a) {
+  return Float4{{a.e[1], a.e[2], a.e[0], a.e[3]}};
+}
+inline float float4_y(Float4 a) { return a.e[1]; }
+inline float float4_z(Float4 a) { return a.e[2]; }
+
+#undef FLOAT4_LANEWISE
+#endif
+
+// _____________________________________________________________________________
+// Float8
+// _____________________________________________________________________________
+
+#if defined(SIMD_AVX)
+typedef __m256 Float8;
+
+inline Float8 float8(float a) { return _mm256_set1_ps(a); }
+inline Float8 float8_load(const float *p) { return _mm256_loadu_ps(p); }
+inline void float8_store(float *p, Float8 a) { _mm256_storeu_ps(p, a); }
+inline Float8 float8_add(Float8 a, Float8 b) { return _mm256_add_ps(a, b); }
+inline Float8 float8_sub(Float8 a, Float8 b) { return _mm256_sub_ps(a, b); }
+inline Float8 float8_mul(Float8 a, Float8 b) { return _mm256_mul_ps(a, b); }
+inline Float8 float8_div(Float8 a, Float8 b) { return _mm256_div_ps(a, b); }
+inline Float8 float8_fmadd(Float8 a, Float8 b, Float8 c) {
+#if defined(__FMA__)
+  return _mm256_fmadd_ps(a, b, c);
+#else
+  return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+inline Float8 float8_sqrt(Float8 a) { return _mm256_sqrt_ps(a); }
+inline Float8 float8_min(Float8 a, Float8 b) { return _mm256_min_ps(a, b); }
+inline Float8 float8_max(Float8 a, Float8 b) { return _mm256_max_ps(a, b); }
+inline Float8 float8_lt(Float8 a, Float8 b) {
+  return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+inline Float8 float8_gt(Float8 a, Float8 b) {
+  return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+inline Float8 float8_and(Float8 a, Float8 b) { return _mm256_and_ps(a, b); }
+inline Float8 float8_or(Float8 a, Float8 b) { return _mm256_or_ps(a, b); }
+inline Float8 float8_select(Float8 mask, Float8 a, Float8 b) {
+  return _mm256_blendv_ps(b, a, mask);
+}
+inline int float8_movemask(Float8 mask) { return _mm256_movemask_ps(mask); }
+
+#else
+struct Float8 {
+  Float4 lo;
+  Float4 hi;
+};
+
+#define FLOAT8_HALVES(f) return Float8{f(a.lo), f(a.hi)}
+#define FLOAT8_HALVES2(f) return Float8{f(a.lo, b.lo), f(a.hi, b.hi)}
+
+inline Float8 float8(float a) { return Float8{float4(a), float4(a)}; }
+inline Float8 float8_load(const float *p) {
+  return Float8{float4_load(p), float4_load(p + 4)};
+}
+inline void float8_store(float *p, Float8 a) {
+  float4_store(p, a.lo);
+  float4_store(p + 4, a.hi);
+}
+inline Float8 float8_add(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_add); }
+inline Float8 float8_sub(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_sub); }
+inline Float8 float8_mul(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_mul); }
+inline Float8 float8_div(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_div); }
+inline Float8 float8_fmadd(Float8 a, Float8 b, Float8 c) {
+  return Float8{float4_fmadd(a.lo, b.lo, c.lo),
+                float4_fmadd(a.hi, b.hi, c.hi)};
+}
+inline Float8 float8_sqrt(Float8 a) { FLOAT8_HALVES(float4_sqrt); }
+inline Float8 float8_min(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_min); }
+inline Float8 float8_max(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_max); }
+inline Float8 float8_lt(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_lt); }
+inline Float8 float8_gt(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_gt); }
+inline Float8 float8_and(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_and); }
+inline Float8 float8_or(Float8 a, Float8 b) { FLOAT8_HALVES2(float4_or); }
+inline Float8 float8_select(Float8 mask, Float8 a, Float8 b) {
+  return Float8{float4_select(mask.lo, a.lo, b.lo),
+                float4_select(mask.hi, a.hi, b.hi)};
+}
+inline int float8_movemask(Float8 mask) {
+  return float4_movemask(mask.lo) | (float4_movemask(mask.hi) << 4);
+}
+
+#undef FLOAT8_HALVES
+#undef FLOAT8_HALVES2
+#endif
+
+#endif  // SRC_SIMD_H_
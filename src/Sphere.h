@@ -10,6 +10,9 @@
 #include "Hitable.h"
 #include "Material.h"
 #include "AABB.h"
+#include "FastMath.h"
+#include "Stats.h"
+#include "Vec3x8.h"
 
 class Sphere: public Hitable {
  public:
@@ -19,6 +22,8 @@ class Sphere: public Hitable {
 
   inline Vec3 center() const { return _center; }
   inline float radius() const { return _radius; }
+  inline const Material* material() const { return _mat_ptr; }
+  inline void center(const Vec3 &c) { _center = c; }
 
   virtual bool hit(const Ray &r,
                    float t_min,
@@ -26,6 +31,15 @@ class Sphere: public Hitable {
                    HitRecord &rec) const;
 
   virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const;
+
+  /**
+   * Intersect eight rays with the origins o and the directions d at once.
+   * Every lane, whose ray hits the sphere in (t_min, t_max), gets the
+   * distance of the hit as its new t_max. Returns the mask of these lanes
+   * (bit i for lane i).
+   */
+  int hit8(const Vec3x8 &o, const Vec3x8 &d, float t_min, Float8 &t_max) const;
 
   inline void set_hit_record(const float t,
                              const Ray &r,
@@ -37,8 +51,8 @@ class Sphere: public Hitable {
     rec.normal = (rec.p - _center) / _radius;
     rec.mat_ptr = _mat_ptr;
     // Compute sphere's polar coordinates
-    float phi = static_cast<float>(atan2(rec.p.z(), rec.p.x()));
-    float theta = static_cast<float>(asin(rec.p.y()));
+    float phi = static_cast<float>(math_atan2(rec.p.z(), rec.p.x()));
+    float theta = static_cast<float>(math_asin(rec.p.y()));
     rec.u = 1.f - (phi - M_PI) / (2.f * M_PI);
     rec.v = (theta + M_PI / 2.f) / M_PI;
   }
@@ -72,6 +86,7 @@ bool Sphere::hit(const Ray &r,
   // b = 2*dot(ray.dir, ray.orig-center)
   // c = dot(ray.orig-center, ray.orig-center)
   // u = ray.orig-center
+  STATS_INC(primitive_tests);
   Vec3 u = r.origin() - _center;
   float a = dot(r.direction(), r.direction());
   float b = 2*dot(r.direction(), u);
@@ -101,6 +116,34 @@ bool Sphere::hit(const Ray &r,
   return false;
 }
 
+// _____________________________________________________________________________
+int Sphere::hit8(const Vec3x8 &o,
+                 const Vec3x8 &d,
+                 float t_min,
+                 Float8 &t_max) const {
+  STATS_ADD(primitive_tests, 8);
+  // Same quadratic as in hit, with b halved. Lanes with a negative
+  // discriminant get NaNs, which fail all comparisons below
+  Vec3x8 u = o - Vec3x8(_center);
+  Float8 a = dot(d, d);
+  Float8 half_b = dot(d, u);
+  Float8 c = float8_sub(dot(u, u), float8(_radius * _radius));
+  Float8 dis_sqrt = float8_sqrt(float8_sub(float8_mul(half_b, half_b),
+                                           float8_mul(a, c)));
+  Float8 t_near = float8_div(float8_sub(float8_sub(float8(0.f), half_b),
+                                        dis_sqrt), a);
+  Float8 t_far = float8_div(float8_add(float8_sub(float8(0.f), half_b),
+                                       dis_sqrt), a);
+  Float8 low = float8(t_min);
+  Float8 near_hit = float8_and(float8_gt(t_near, low),
+                               float8_lt(t_near, t_max));
+  Float8 far_hit = float8_and(float8_gt(t_far, low),
+                              float8_lt(t_far, t_max));
+  Float8 hit = float8_or(near_hit, far_hit);
+  t_max = float8_select(hit, float8_select(near_hit, t_near, t_far), t_max);
+  return float8_movemask(hit);
+}
+
 // _____________________________________________________________________________
 bool Sphere::bounding_box(AABB &box) const {
   Vec3 radius_vec(_radius, _radius, _radius);
@@ -116,4 +159,9 @@ inline std::ostream& operator<<(std::ostream &os, const Sphere &s) {
   return os;
 }
 
+// _____________________________________________________________________________
+unsigned Sphere::material_types() const {
+  return _mat_ptr != nullptr ? material_bit(_mat_ptr->type()) : 0u;
+}
+
 #endif  // SRC_SPHERE_H_
@@ -0,0 +1,172 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_STATS_H_
+#define SRC_STATS_H_
+
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include "Material.h"
+
+// Paths, which are longer, are counted in the last bucket of the histogram
+#define STATS_MAX_PATH_DEPTH 64
+
+/**
+ * Counters of the work done during a render. Every thread counts into its
+ * own instance, and they are merged after the render.
+ * The counters are only compiled in, when RENDER_STATS is defined (cmake
+ * -DRENDER_STATS=ON); otherwise the STATS_* macros expand to nothing.
+ */
+struct RenderStats {
+  uint64_t primary_rays{0};
+  uint64_t secondary_rays{0};
+  // BVH nodes, whose box was hit by the ray
+  uint64_t bvh_nodes_visited{0};
+  uint64_t box_tests{0};
+  uint64_t primitive_tests{0};
+  uint64_t material_hits[MATERIAL_TYPE_COUNT]{};
+  // Number of paths, which ended after the provided number of bounces
+  uint64_t path_depths[STATS_MAX_PATH_DEPTH + 1]{};
+
+  void merge(const RenderStats &s);
+  void print(std::ostream &out) const;
+  bool write_json(const std::string &path) const;
+};
+
+/**
+ * Owner of the counters of all threads. The counters of a thread are kept
+ * after the thread has ended, so their counts are not lost.
+ */
+class RenderStatsRegistry {
+ public:
+  RenderStats* add();
+  // Sum of the counters of all threads
+  RenderStats collect();
+  // Reset the counters of all threads. Only call it, while no thread counts
+  void reset();
+
+ private:
+  std::mutex _mutex;
+  std::deque<RenderStats> _stats;
+};
+
+// _____________________________________________________________________________
+inline RenderStatsRegistry& render_stats_registry() {
+  static RenderStatsRegistry registry;
+  return registry;
+}
+
+// _____________________________________________________________________________
+// Counters of the calling thread
+inline RenderStats& thread_render_stats() {
+  thread_local RenderStats *stats = render_stats_registry().add();
+  return *stats;
+}
+
+#ifdef RENDER_STATS
+#define STATS_ENABLED true
+#define STATS_ADD(counter, n) (thread_render_stats().counter += (n))
+#define STATS_INC(counter) STATS_ADD(counter, 1)
+#define STATS_MATERIAL_HIT(type) STATS_INC(material_hits[type])
+#define STATS_PATH_END(depth) \
+  STATS_INC(path_depths[(depth) < STATS_MAX_PATH_DEPTH ? (depth) \
+                                                       : STATS_MAX_PATH_DEPTH])
+#else
+#define STATS_ENABLED false
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_INC(counter) ((void)0)
+#define STATS_MATERIAL_HIT(type) ((void)0)
+#define STATS_PATH_END(depth) ((void)0)
+#endif
+
+// _____________________________________________________________________________
+void RenderStats::merge(const RenderStats &s) {
+  primary_rays += s.primary_rays;
+  secondary_rays += s.secondary_rays;
+  bvh_nodes_visited += s.bvh_nodes_visited;
+  box_tests += s.box_tests;
+  primitive_tests += s.primitive_tests;
+  for (int m = 0; m < MATERIAL_TYPE_COUNT; m++) {
+    material_hits[m] += s.material_hits[m];
+  }
+  for (int d = 0; d <= STATS_MAX_PATH_DEPTH; d++) {
+    path_depths[d] += s.path_depths[d];
+  }
+}
+
+// _____________________________________________________________________________
+void RenderStats::print(std::ostream &out) const {
+  uint64_t rays = primary_rays + secondary_rays;
+  double per_ray = rays > 0 ? 1.0 / rays : 0.0;
+  out << "Primary rays:      " << primary_rays << "\n"
+      << "Secondary rays:    " << secondary_rays << "\n"
+      << "BVH nodes visited: " << bvh_nodes_visited << " ("
+      << bvh_nodes_visited * per_ray << " per ray)\n"
+      << "Box tests:         " << box_tests << " ("
+      << box_tests * per_ray << " per ray)\n"
+      << "Primitive tests:   " << primitive_tests << " ("
+      << primitive_tests * per_ray << " per ray)\n"
+      << "Hits per material:";
+  for (int m = 0; m < MATERIAL_TYPE_COUNT; m++) {
+    out << " " << material_type_name(static_cast<MaterialType>(m)) << "="
+        << material_hits[m];
+  }
+  out << "\nPath depths:";
+  for (int d = 0; d <= STATS_MAX_PATH_DEPTH; d++) {
+    if (path_depths[d] > 0) out << " " << d << ":" << path_depths[d];
+  }
+  out << std::endl;
+}
+
+// _____________________________________________________________________________
+bool RenderStats::write_json(const std::string &path) const {
+  std::ofstream file(path);
+  if (!file) return false;
+  file << "{\n  \"primary_rays\": " << primary_rays
+       << ",\n  \"secondary_rays\": " << secondary_rays
+       << ",\n  \"bvh_nodes_visited\": " << bvh_nodes_visited
+       << ",\n  \"box_tests\": " << box_tests
+       << ",\n  \"primitive_tests\": " << primitive_tests
+       << ",\n  \"material_hits\": {";
+  for (int m = 0; m < MATERIAL_TYPE_COUNT; m++) {
+    file << (m == 0 ? "" : ", ") << "\""
+         << material_type_name(static_cast<MaterialType>(m)) << "\": "
+         << material_hits[m];
+  }
+  // Index is the number of bounces
+  file << "},\n  \"path_depths\": [";
+  for (int d = 0; d <= STATS_MAX_PATH_DEPTH; d++) {
+    file << (d == 0 ? "" : ", ") << path_depths[d];
+  }
+  file << "]\n}\n";
+  return static_cast<bool>(file);
+}
+
+// _____________________________________________________________________________
+RenderStats* RenderStatsRegistry::add() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  // Elements of a deque don't move, when it grows
+  _stats.emplace_back();
+  return &_stats.back();
+}
+
+// _____________________________________________________________________________
+RenderStats RenderStatsRegistry::collect() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  RenderStats sum;
+  for (const RenderStats &s : _stats) sum.merge(s);
+  return sum;
+}
+
+// _____________________________________________________________________________
+void RenderStatsRegistry::reset() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (RenderStats &s : _stats) s = RenderStats();
+}
+
+#endif  // SRC_STATS_H_
@@ -0,0 +1,147 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_THREADPOOL_H_
+#define SRC_THREADPOOL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Trace.h"
+
+/**
+ * Fixed-size pool of worker threads executing tasks from a shared queue.
+ * Tasks may submit further tasks and wait for them: a waiting thread
+ * executes queued tasks instead of blocking, so nested fork-join parallelism
+ * (e.g. recursive BVH construction) doesn't deadlock.
+ */
+class ThreadPool {
+ public:
+  ThreadPool() = delete;
+  // num_threads <= 0 uses the number of hardware threads
+  explicit ThreadPool(int num_threads);
+  ThreadPool(const ThreadPool &p) = delete;
+  ThreadPool& operator=(const ThreadPool &p) = delete;
+  ~ThreadPool();
+
+  inline int size() const { return static_cast<int>(_workers.size()); }
+
+  // Queue a task for execution
+  std::future<void> submit(std::function<void()> task);
+
+  // Wait for the task to finish, executing other queued tasks meanwhile
+  void wait(std::future<void> &f);
+
+  // Execute body(i) for all i in [0, n) and return, after all are done
+  void parallel_for(int n, const std::function<void(int)> &body);
+
+ private:
+  bool run_pending_task();
+  void worker_loop();
+
+  std::vector<std::thread> _workers;
+  std::deque<std::packaged_task<void()>> _tasks;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stop{false};
+};
+
+// _____________________________________________________________________________
+ThreadPool::ThreadPool(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = static_cast<int>(std::thread::hardware_concurrency());
+  }
+  if (num_threads <= 0) num_threads = 1;
+  for (int i = 0; i < num_threads; i++) {
+    _workers.emplace_back(&ThreadPool::worker_loop, this);
+  }
+}
+
+// _____________________________________________________________________________
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _cv.notify_all();
+  for (std::thread &w : _workers) w.join();
+}
+
+// _____________________________________________________________________________
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+  std::packaged_task<void()> packaged(std::move(task));
+  std::future<void> f = packaged.get_future();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tasks.push_back(std::move(packaged));
+  }
+  _cv.notify_one();
+  return f;
+}
+
+// _____________________________________________________________________________
+bool ThreadPool::run_pending_task() {
+  std::packaged_task<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_tasks.empty()) return false;
+    // Take the most recently queued task, it is the most likely to be needed
+    // by the waiting thread
+    task = std::move(_tasks.back());
+    _tasks.pop_back();
+  }
+  task();
+  return true;
+}
+
+// _____________________________________________________________________________
+void ThreadPool::wait(std::future<void> &f) {
+  while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    if (!run_pending_task()) std::this_thread::yield();
+  }
+  // Rethrow exceptions of the task
+  f.get();
+}
+
+// _____________________________________________________________________________
+void ThreadPool::parallel_for(int n, const std::function<void(int)> &body) {
+  std::vector<std::future<void>> futures;
+  futures.reserve(n);
+  for (int i = 0; i < n; i++) {
+    futures.push_back(submit([&body, i]() { body(i); }));
+  }
+  for (std::future<void> &f : futures) wait(f);
+}
+
+// _____________________________________________________________________________
+void ThreadPool::worker_loop() {
+  trace_thread_name("worker");
+  while (true) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+      if (_stop && _tasks.empty()) return;
+      // Workers take the oldest tasks, which are the largest ones
+      task = std::move(_tasks.front());
+      _tasks.pop_front();
+    }
+    task();
+  }
+}
+
+// _____________________________________________________________________________
+// Pool shared by the whole renderer, created on first use
+ThreadPool& global_thread_pool() {
+  static ThreadPool pool(0);
+  return pool;
+}
+
+#endif  // SRC_THREADPOOL_H_
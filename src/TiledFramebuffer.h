@@ -0,0 +1,274 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_TILEDFRAMEBUFFER_H_
+#define SRC_TILEDFRAMEBUFFER_H_
+
+#include <fcntl.h>     // open
+#include <sys/mman.h>  // mmap
+#include <unistd.h>    // ftruncate, close
+
+#include <algorithm>  // min
+#include <cstdint>
+#include <cstdlib>    // getenv, mkstemp
+#include <cstring>    // memcpy
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Half.h"
+#include "Vec3.h"
+
+// Definitions
+// Side length of the square tiles of the framebuffer
+#define FRAMEBUFFER_TILE_SIZE 64
+
+enum FramebufferPrecision {
+  // 32-bit floats, 12 bytes per pixel
+  FRAMEBUFFER_FLOAT,
+  // 16-bit floats (IEEE half precision), 6 bytes per pixel
+  FRAMEBUFFER_HALF
+};
+
+/**
+ * RGB framebuffer for images larger than the memory, stored tile by tile
+ * in a memory mapped spill file. Tiles, which are worked on, are acquired:
+ * they are loaded into float buffers, which stay in memory until at most
+ * max_resident tiles are there; then the least recently released tile is
+ * written back to the file, and its pages are dropped from the mapping.
+ * The kernel writes the dropped pages to the file in the background, so the
+ * memory of the framebuffer stays at about max_resident tiles, whatever the
+ * size of the image is.
+ * With half precision, the file takes half the space; a half has 11
+ * significant bits, which is more than the 8 bits of the output.
+ * The spill file is removed, as soon as it is mapped, so it disappears
+ * with the framebuffer (or the process).
+ */
+class TiledFramebuffer {
+ public:
+  TiledFramebuffer() = delete;
+  // The spill file is created in spill_dir, by default in $TMPDIR or /tmp
+  TiledFramebuffer(int width, int height, FramebufferPrecision precision,
+                   int max_resident, const char *spill_dir = nullptr);
+  TiledFramebuffer(const TiledFramebuffer &f) = delete;
+  TiledFramebuffer& operator=(const TiledFramebuffer &f) = delete;
+  ~TiledFramebuffer();
+
+  inline bool is_open() const { return _data != nullptr; }
+  inline int width() const { return _width; }
+  inline int height() const { return _height; }
+  inline int tiles_x() const { return _tiles_x; }
+  inline int num_tiles() const { return _tiles_x * _tiles_y; }
+  inline FramebufferPrecision precision() const { return _precision; }
+
+  // Rectangle of the tile in image coordinates (row 0 is the top row),
+  // x1 and y1 exclusive
+  void tile_rect(int tile, int &x0, int &y0, int &x1, int &y1) const;
+
+  /**
+   * Pixels of the tile, row by row with the width of the tile. They are
+   * loaded from the file, if the tile isn't in memory, and stay valid until
+   * the matching release. A tile may be acquired by one thread at a time.
+   * Thread-safe.
+   */
+  Vec3* acquire(int tile);
+
+  // The tile may be written back to the file from now on. Thread-safe
+  void release(int tile);
+
+  /**
+   * Copy the pixels of the tile row by row into out, without keeping the
+   * tile in memory (e.g. to stream the image to a file). Thread-safe.
+   */
+  void read_tile(int tile, Vec3 *out);
+
+  // Number of tiles in memory
+  int resident_tiles();
+
+ private:
+  struct Resident {
+    int tile;
+    std::vector<Vec3> pixels;
+    bool pinned;
+  };
+
+  inline size_t tile_pixels(int tile) const;
+  inline char* tile_data(int tile) const;
+  void load(int tile, Vec3 *out) const;
+  void store(int tile, const Vec3 *pixels);
+  void evict();
+
+  int _width;
+  int _height;
+  int _tiles_x;
+  int _tiles_y;
+  FramebufferPrecision _precision;
+  int _max_resident;
+  // Bytes of a tile in the file, rounded up to whole pages, so that the
+  // pages of a tile can be dropped without touching its neighbors
+  size_t _tile_stride;
+  size_t _size{0};
+  char *_data{nullptr};
+
+  // Tiles in memory, the least recently released first, and where to find
+  // them; guarded by _mutex
+  std::list<Resident> _resident;
+  std::vector<std::list<Resident>::iterator> _where;
+  std::mutex _mutex;
+};
+
+// _____________________________________________________________________________
+TiledFramebuffer::TiledFramebuffer(int width, int height,
+                                   FramebufferPrecision precision,
+                                   int max_resident, const char *spill_dir)
+    : _width(width), _height(height),
+      _tiles_x((width + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE),
+      _tiles_y((height + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE),
+      _precision(precision), _max_resident(std::max(max_resident, 1)) {
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t bytes = FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE * 3
+                 * (precision == FRAMEBUFFER_HALF ? sizeof(uint16_t)
+                                                  : sizeof(float));
+  _tile_stride = (bytes + page - 1) / page * page;
+  _where.assign(num_tiles(), _resident.end());
+
+  if (spill_dir == nullptr) spill_dir = getenv("TMPDIR");
+  std::string path = std::string(spill_dir ? spill_dir : "/tmp")
+                     + "/framebuffer-XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) return;
+  unlink(path.c_str());
+  // The file is sparse, so untouched tiles take no space and read as 0
+  size_t size = _tile_stride * num_tiles();
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED) {
+      _data = static_cast<char*>(p);
+      _size = size;
+    }
+  }
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+}
+
+// _____________________________________________________________________________
+TiledFramebuffer::~TiledFramebuffer() {
+  if (_data != nullptr) munmap(_data, _size);
+}
+
+// _____________________________________________________________________________
+void TiledFramebuffer::tile_rect(int tile, int &x0, int &y0,
+                                 int &x1, int &y1) const {
+  x0 = (tile % _tiles_x) * FRAMEBUFFER_TILE_SIZE;
+  y0 = (tile / _tiles_x) * FRAMEBUFFER_TILE_SIZE;
+  x1 = std::min(x0 + FRAMEBUFFER_TILE_SIZE, _width);
+  y1 = std::min(y0 + FRAMEBUFFER_TILE_SIZE, _height);
+}
+
+// _____________________________________________________________________________
+size_t TiledFramebuffer::tile_pixels(int tile) const {
+  int x0, y0, x1, y1;
+  tile_rect(tile, x0, y0, x1, y1);
+  return static_cast<size_t>(x1 - x0) * (y1 - y0);
+}
+
+// _____________________________________________________________________________
+char* TiledFramebuffer::tile_data(int tile) const {
+  return _data + _tile_stride * tile;
+}
+
+// _____________________________________________________________________________
+void TiledFramebuffer::load(int tile, Vec3 *out) const {
+  static_assert(sizeof(Vec3) == 3 * sizeof(float),
+                "the pixels are copied as arrays of floats");
+  int n = 3 * static_cast<int>(tile_pixels(tile));
+  float *floats = reinterpret_cast<float*>(out);
+  if (_precision == FRAMEBUFFER_HALF) {
+    halves_to_floats(reinterpret_cast<const uint16_t*>(tile_data(tile)), n,
+                     floats);
+  } else {
+    memcpy(floats, tile_data(tile), n * sizeof(float));
+  }
+}
+
+// _____________________________________________________________________________
+void TiledFramebuffer::store(int tile, const Vec3 *pixels) {
+  int n = 3 * static_cast<int>(tile_pixels(tile));
+  const float *floats = reinterpret_cast<const float*>(pixels);
+  if (_precision == FRAMEBUFFER_HALF) {
+    floats_to_halves(floats, n, reinterpret_cast<uint16_t*>(tile_data(tile)));
+  } else {
+    memcpy(tile_data(tile), floats, n * sizeof(float));
+  }
+  // Start the write back and drop the pages; the data stays in the file
+  msync(tile_data(tile), _tile_stride, MS_ASYNC);
+  madvise(tile_data(tile), _tile_stride, MADV_DONTNEED);
+}
+
+// _____________________________________________________________________________
+void TiledFramebuffer::evict() {
+  // The list is ordered by the last release, so the first unpinned tile is
+  // the least recently used one
+  int count = static_cast<int>(_resident.size());
+  for (auto it = _resident.begin();
+       it != _resident.end() && count > _max_resident;) {
+    if (it->pinned) {
+      ++it;
+      continue;
+    }
+    store(it->tile, it->pixels.data());
+    _where[it->tile] = _resident.end();
+    it = _resident.erase(it);
+    count--;
+  }
+}
+
+// _____________________________________________________________________________
+Vec3* TiledFramebuffer::acquire(int tile) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _where[tile];
+  if (it == _resident.end()) {
+    Resident r;
+    r.tile = tile;
+    r.pixels.resize(tile_pixels(tile));
+    load(tile, r.pixels.data());
+    r.pinned = true;
+    it = _resident.insert(_resident.end(), std::move(r));
+    _where[tile] = it;
+    evict();
+  }
+  it->pinned = true;
+  return it->pixels.data();
+}
+
+// _____________________________________________________________________________
+void TiledFramebuffer::release(int tile) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _where[tile];
+  if (it == _resident.end()) return;
+  it->pinned = false;
+  // Most recently used now
+  _resident.splice(_resident.end(), _resident, it);
+  evict();
+}
+
+// _____________________________________________________________________________
+void TiledFramebuffer::read_tile(int tile, Vec3 *out) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _where[tile];
+  if (it != _resident.end()) {
+    std::copy(it->pixels.begin(), it->pixels.end(), out);
+    return;
+  }
+  load(tile, out);
+  madvise(tile_data(tile), _tile_stride, MADV_DONTNEED);
+}
+
+// _____________________________________________________________________________
+int TiledFramebuffer::resident_tiles() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return static_cast<int>(_resident.size());
+}
+
+#endif  // SRC_TILEDFRAMEBUFFER_H_
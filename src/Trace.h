@@ -0,0 +1,180 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_TRACE_H_
+#define SRC_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>  // snprintf
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Scoped phase tracing in the Chrome trace-event format, which can be loaded
+ * in chrome://tracing or https://ui.perfetto.dev. Every thread records the
+ * phases it executes with microsecond timestamps into its own buffer, so
+ * recording doesn't synchronize threads. Tracing is off, until
+ * global_tracer().start() is called; until then TRACE_SCOPE only costs the
+ * check of a flag.
+ *
+ *   {
+ *     TRACE_SCOPE("bvh_build");
+ *     ...
+ *   }
+ */
+
+// Phase executed by a thread
+struct TraceEvent {
+  const char *name;
+  // Nanoseconds since the start of tracing
+  int64_t start;
+  int64_t duration;
+  // Optional integer arguments, shown with the event; unused, if nullptr
+  const char *arg_names[2];
+  int args[2];
+};
+
+// Events of a single thread
+struct ThreadTrace {
+  int id;
+  std::string name;
+  std::vector<TraceEvent> events;
+};
+
+/**
+ * Owner of the buffers of all threads. The buffers are kept after their
+ * thread has ended, so their events are not lost.
+ */
+class Tracer {
+ public:
+  inline bool enabled() const {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+  void start();
+  // Write all recorded events to a JSON trace file. Only call it, while no
+  // thread records events
+  bool write(const std::string &path);
+
+  ThreadTrace* add_thread();
+  inline int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - _start).count();
+  }
+
+ private:
+  std::atomic<bool> _enabled{false};
+  std::chrono::steady_clock::time_point _start;
+  std::mutex _mutex;
+  // Elements of a deque don't move, when it grows
+  std::deque<ThreadTrace> _threads;
+};
+
+// _____________________________________________________________________________
+inline Tracer& global_tracer() {
+  static Tracer tracer;
+  return tracer;
+}
+
+// _____________________________________________________________________________
+// Buffer of the calling thread
+inline ThreadTrace& thread_trace() {
+  thread_local ThreadTrace *trace = global_tracer().add_thread();
+  return *trace;
+}
+
+// _____________________________________________________________________________
+// Name the calling thread in the trace
+inline void trace_thread_name(const std::string &name) {
+  thread_trace().name = name;
+}
+
+/**
+ * Records the lifetime of the object as an event, if tracing is enabled.
+ * name has to be a string literal (or outlive the trace).
+ */
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(const char *name,
+                       const char *arg0 = nullptr, int value0 = 0,
+                       const char *arg1 = nullptr, int value1 = 0) {
+    if (!global_tracer().enabled()) return;
+    _event = {name, global_tracer().now(), 0, {arg0, arg1}, {value0, value1}};
+    _active = true;
+  }
+  ScopedTrace(const ScopedTrace &t) = delete;
+  ScopedTrace& operator=(const ScopedTrace &t) = delete;
+  ~ScopedTrace() {
+    if (!_active) return;
+    _event.duration = global_tracer().now() - _event.start;
+    thread_trace().events.push_back(_event);
+  }
+
+ private:
+  TraceEvent _event;
+  bool _active{false};
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Trace the rest of the enclosing scope; optionally with up to two integer
+// arguments as name/value pairs
+#define TRACE_SCOPE(...) \
+  ScopedTrace TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+// _____________________________________________________________________________
+void Tracer::start() {
+  _start = std::chrono::steady_clock::now();
+  _enabled.store(true);
+}
+
+// _____________________________________________________________________________
+ThreadTrace* Tracer::add_thread() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  int id = static_cast<int>(_threads.size());
+  _threads.push_back({id, "thread " + std::to_string(id), {}});
+  return &_threads.back();
+}
+
+// _____________________________________________________________________________
+bool Tracer::write(const std::string &path) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::ofstream file(path);
+  if (!file) return false;
+  file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  bool first = true;
+  char number[32];
+  for (const ThreadTrace &t : _threads) {
+    // Metadata event naming the thread
+    file << (first ? "" : ",\n")
+         << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+         << "\"tid\": " << t.id << ", \"args\": {\"name\": \"" << t.name
+         << "\"}}";
+    first = false;
+    for (const TraceEvent &e : t.events) {
+      // Complete events with microsecond timestamps
+      file << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", "
+           << "\"pid\": 1, \"tid\": " << t.id;
+      snprintf(number, sizeof(number), "%.3f", e.start / 1000.0);
+      file << ", \"ts\": " << number;
+      snprintf(number, sizeof(number), "%.3f", e.duration / 1000.0);
+      file << ", \"dur\": " << number;
+      if (e.arg_names[0] != nullptr) {
+        file << ", \"args\": {\"" << e.arg_names[0] << "\": " << e.args[0];
+        if (e.arg_names[1] != nullptr) {
+          file << ", \"" << e.arg_names[1] << "\": " << e.args[1];
+        }
+        file << "}";
+      }
+      file << "}";
+    }
+  }
+  file << "\n]}\n";
+  return static_cast<bool>(file);
+}
+
+#endif  // SRC_TRACE_H_
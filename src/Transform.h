@@ -0,0 +1,166 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_TRANSFORM_H_
+#define SRC_TRANSFORM_H_
+
+#include <cmath>
+
+#include "AABB.h"
+#include "Vec3.h"
+
+/**
+ * Affine transformation stored as the upper 3x4 part of a 4x4 matrix:
+ * a 3x3 linear part and a translation in the last column.
+ */
+class Transform {
+ public:
+  // Identity
+  Transform();
+
+  static Transform translate(const Vec3 &t);
+  static Transform scale(const Vec3 &s);
+  // Rotation around axis by angle degrees
+  static Transform rotate(const Vec3 &axis, float angle);
+
+  // Composition: (a * b) applies b first
+  Transform operator*(const Transform &t) const;
+  Transform inverse() const;
+
+  inline Vec3 point(const Vec3 &p) const;
+  inline Vec3 vector(const Vec3 &v) const;
+  // Multiply the vector with the transposed linear part. Normals are
+  // transformed with the transposed inverse, i.e. inverse.transposed(n)
+  inline Vec3 transposed(const Vec3 &v) const;
+  // Bounding box of the transformed box
+  AABB box(const AABB &b) const;
+
+  inline float operator()(int row, int col) const { return _m[row][col]; }
+
+ private:
+  float _m[3][4];
+};
+
+// _____________________________________________________________________________
+Transform::Transform() {
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) _m[r][c] = r == c ? 1.f : 0.f;
+  }
+}
+
+// _____________________________________________________________________________
+Transform Transform::translate(const Vec3 &t) {
+  Transform m;
+  m._m[0][3] = t.x();
+  m._m[1][3] = t.y();
+  m._m[2][3] = t.z();
+  return m;
+}
+
+// _____________________________________________________________________________
+Transform Transform::scale(const Vec3 &s) {
+  Transform m;
+  m._m[0][0] = s.x();
+  m._m[1][1] = s.y();
+  m._m[2][2] = s.z();
+  return m;
+}
+
+// _____________________________________________________________________________
+Transform Transform::rotate(const Vec3 &axis, float angle) {
+  // Rodrigues' rotation formula
+  Vec3 a = make_unit_vector(axis);
+  float theta = angle * static_cast<float>(M_PI / 180.);
+  float s = static_cast<float>(sin(theta));
+  float c = static_cast<float>(cos(theta));
+  Transform m;
+  m._m[0][0] = a.x()*a.x() + (1.f - a.x()*a.x())*c;
+  m._m[0][1] = a.x()*a.y()*(1.f - c) - a.z()*s;
+  m._m[0][2] = a.x()*a.z()*(1.f - c) + a.y()*s;
+  m._m[1][0] = a.x()*a.y()*(1.f - c) + a.z()*s;
+  m._m[1][1] = a.y()*a.y() + (1.f - a.y()*a.y())*c;
+  m._m[1][2] = a.y()*a.z()*(1.f - c) - a.x()*s;
+  m._m[2][0] = a.x()*a.z()*(1.f - c) - a.y()*s;
+  m._m[2][1] = a.y()*a.z()*(1.f - c) + a.x()*s;
+  m._m[2][2] = a.z()*a.z() + (1.f - a.z()*a.z())*c;
+  return m;
+}
+
+// _____________________________________________________________________________
+Transform Transform::operator*(const Transform &t) const {
+  Transform m;
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      m._m[r][c] = _m[r][0]*t._m[0][c] + _m[r][1]*t._m[1][c]
+                   + _m[r][2]*t._m[2][c];
+    }
+    m._m[r][3] += _m[r][3];
+  }
+  return m;
+}
+
+// _____________________________________________________________________________
+Transform Transform::inverse() const {
+  // Inverse of the linear part via the adjugate
+  const float (&a)[3][4] = _m;
+  float det = a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1])
+              - a[0][1]*(a[1][0]*a[2][2] - a[1][2]*a[2][0])
+              + a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+  float id = 1.f / det;
+  Transform m;
+  m._m[0][0] = (a[1][1]*a[2][2] - a[1][2]*a[2][1]) * id;
+  m._m[0][1] = (a[0][2]*a[2][1] - a[0][1]*a[2][2]) * id;
+  m._m[0][2] = (a[0][1]*a[1][2] - a[0][2]*a[1][1]) * id;
+  m._m[1][0] = (a[1][2]*a[2][0] - a[1][0]*a[2][2]) * id;
+  m._m[1][1] = (a[0][0]*a[2][2] - a[0][2]*a[2][0]) * id;
+  m._m[1][2] = (a[0][2]*a[1][0] - a[0][0]*a[1][2]) * id;
+  m._m[2][0] = (a[1][0]*a[2][1] - a[1][1]*a[2][0]) * id;
+  m._m[2][1] = (a[0][1]*a[2][0] - a[0][0]*a[2][1]) * id;
+  m._m[2][2] = (a[0][0]*a[1][1] - a[0][1]*a[1][0]) * id;
+  // Inverse translation: -A^-1 * t
+  for (int r = 0; r < 3; r++) {
+    m._m[r][3] = -(m._m[r][0]*a[0][3] + m._m[r][1]*a[1][3]
+                   + m._m[r][2]*a[2][3]);
+  }
+  return m;
+}
+
+// _____________________________________________________________________________
+Vec3 Transform::point(const Vec3 &p) const {
+  return Vec3(_m[0][0]*p.x() + _m[0][1]*p.y() + _m[0][2]*p.z() + _m[0][3],
+              _m[1][0]*p.x() + _m[1][1]*p.y() + _m[1][2]*p.z() + _m[1][3],
+              _m[2][0]*p.x() + _m[2][1]*p.y() + _m[2][2]*p.z() + _m[2][3]);
+}
+
+// _____________________________________________________________________________
+Vec3 Transform::vector(const Vec3 &v) const {
+  return Vec3(_m[0][0]*v.x() + _m[0][1]*v.y() + _m[0][2]*v.z(),
+              _m[1][0]*v.x() + _m[1][1]*v.y() + _m[1][2]*v.z(),
+              _m[2][0]*v.x() + _m[2][1]*v.y() + _m[2][2]*v.z());
+}
+
+// _____________________________________________________________________________
+Vec3 Transform::transposed(const Vec3 &v) const {
+  return Vec3(_m[0][0]*v.x() + _m[1][0]*v.y() + _m[2][0]*v.z(),
+              _m[0][1]*v.x() + _m[1][1]*v.y() + _m[2][1]*v.z(),
+              _m[0][2]*v.x() + _m[1][2]*v.y() + _m[2][2]*v.z());
+}
+
+// _____________________________________________________________________________
+AABB Transform::box(const AABB &b) const {
+  // Arvo's method: per axis, the extremes come from the min/max of each
+  // product of a matrix entry with the box's extent
+  Vec3 small(_m[0][3], _m[1][3], _m[2][3]);
+  Vec3 big = small;
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      float e = _m[r][c] * b.min()[c];
+      float f = _m[r][c] * b.max()[c];
+      small[r] += minf(e, f);
+      big[r] += maxf(e, f);
+    }
+  }
+  return AABB(small, big);
+}
+
+#endif  // SRC_TRANSFORM_H_
@@ -0,0 +1,254 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_TRIANGLEMESH_H_
+#define SRC_TRIANGLEMESH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "AABB.h"
+#include "BVHBuilder.h"
+#include "Hitable.h"
+#include "LinearBVHNode.h"
+#include "Material.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "Vec3.h"
+
+// Number of triangles intersected at once inside a BVH leaf
+#define MESH_LANES BVH_MAX_LEAF_SIZE
+
+/**
+ * Indexed vertex layout of a triangle mesh. Triangle i is made of the
+ * positions indices[3i], indices[3i+1], indices[3i+2]. Normals and texture
+ * coordinates are optional and have their own index arrays, which are either
+ * empty or as long as indices.
+ */
+struct MeshData {
+  std::vector<Vec3> positions;
+  std::vector<Vec3> normals;
+  // Two floats (u, v) per texture coordinate
+  std::vector<float> uvs;
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> normal_indices;
+  std::vector<uint32_t> uv_indices;
+
+  inline int triangle_count() const {
+    return static_cast<int>(indices.size() / 3);
+  }
+};
+
+/**
+ * Triangle mesh with shared vertex buffers and its own BVH over the
+ * triangles. The whole mesh is one Hitable, so it costs a few bytes per
+ * triangle, instead of a heap allocated object per triangle.
+ * The triangles of each BVH leaf are intersected together with a
+ * branch-free Möller–Trumbore test, which the compiler can vectorize.
+ * The mesh takes the ownership of the material.
+ */
+class TriangleMesh: public Hitable {
+ public:
+  TriangleMesh() = delete;
+  TriangleMesh(MeshData data, Material *m, ThreadPool *pool);
+  TriangleMesh(const TriangleMesh &m) = delete;
+  TriangleMesh& operator=(const TriangleMesh &m) = delete;
+  ~TriangleMesh();
+
+  inline int triangle_count() const { return _data.triangle_count(); }
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const;
+
+  virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const;
+
+ private:
+  bool intersect_leaf(const Ray &r, int offset, int count,
+                      float t_min, float &t_max,
+                      int &hit_triangle, float &hit_u, float &hit_v) const;
+  void set_hit_record(int triangle, float b1, float b2, float t,
+                      const Ray &r, HitRecord &rec) const;
+
+  MeshData _data;
+  std::vector<LinearBVHNode> _nodes;
+  Material *_mat_ptr;
+};
+
+// _____________________________________________________________________________
+TriangleMesh::TriangleMesh(MeshData data, Material *m, ThreadPool *pool) {
+  _data = std::move(data);
+  _mat_ptr = m;
+  int n = _data.triangle_count();
+  if (n == 0) return;
+  TRACE_SCOPE("mesh_bvh_build", "triangles", n);
+
+  // Build the BVH over the triangles' bounding boxes
+  std::vector<AABB> boxes(n);
+  for (int i = 0; i < n; i++) {
+    for (int k = 0; k < 3; k++) {
+      boxes[i].extend(_data.positions[_data.indices[3*i + k]]);
+    }
+  }
+  BVHBuildResult bvh = build_binned_sah(boxes, pool);
+  boxes = std::vector<AABB>();
+  _nodes = std::move(bvh.nodes);
+
+  // Reorder the triangles to the order of the leaves, so that each leaf
+  // references a contiguous range of triangles
+  auto reorder = [&bvh, n](std::vector<uint32_t> &indices) {
+    if (indices.empty()) return;
+    std::vector<uint32_t> sorted(indices.size());
+    for (int i = 0; i < n; i++) {
+      for (int k = 0; k < 3; k++) {
+        sorted[3*i + k] = indices[3*bvh.indices[i] + k];
+      }
+    }
+    indices.swap(sorted);
+  };
+  reorder(_data.indices);
+  reorder(_data.normal_indices);
+  reorder(_data.uv_indices);
+}
+
+// _____________________________________________________________________________
+TriangleMesh::~TriangleMesh() {
+  delete _mat_ptr;
+}
+
+// _____________________________________________________________________________
+bool TriangleMesh::intersect_leaf(const Ray &r, int offset, int count,
+                                  float t_min, float &t_max,
+                                  int &hit_triangle,
+                                  float &hit_u, float &hit_v) const {
+  const float o[3] = {r.origin().x(), r.origin().y(), r.origin().z()};
+  const float d[3] = {r.direction().x(), r.direction().y(),
+                      r.direction().z()};
+  bool did_hit = false;
+  STATS_ADD(primitive_tests, count);
+
+  for (int first = offset; first < offset + count; first += MESH_LANES) {
+    int lanes = offset + count - first;
+    if (lanes > MESH_LANES) lanes = MESH_LANES;
+
+    // Gather the triangles into structure-of-arrays form. Unused lanes
+    // repeat the first triangle and are masked out afterwards
+    float v0[3][MESH_LANES], e1[3][MESH_LANES], e2[3][MESH_LANES];
+    for (int l = 0; l < MESH_LANES; l++) {
+      int tri = first + (l < lanes ? l : 0);
+      const Vec3 &p0 = _data.positions[_data.indices[3*tri]];
+      const Vec3 &p1 = _data.positions[_data.indices[3*tri + 1]];
+      const Vec3 &p2 = _data.positions[_data.indices[3*tri + 2]];
+      for (int a = 0; a < 3; a++) {
+        v0[a][l] = p0[a];
+        e1[a][l] = p1[a] - p0[a];
+        e2[a][l] = p2[a] - p0[a];
+      }
+    }
+
+    // Möller–Trumbore on all lanes without branches
+    float t[MESH_LANES], u[MESH_LANES], v[MESH_LANES];
+    for (int l = 0; l < MESH_LANES; l++) {
+      float px = d[1]*e2[2][l] - d[2]*e2[1][l];
+      float py = d[2]*e2[0][l] - d[0]*e2[2][l];
+      float pz = d[0]*e2[1][l] - d[1]*e2[0][l];
+      float det = e1[0][l]*px + e1[1][l]*py + e1[2][l]*pz;
+      float inv_det = det != 0.f ? 1.f / det : 0.f;
+      float sx = o[0] - v0[0][l];
+      float sy = o[1] - v0[1][l];
+      float sz = o[2] - v0[2][l];
+      u[l] = (sx*px + sy*py + sz*pz) * inv_det;
+      float qx = sy*e1[2][l] - sz*e1[1][l];
+      float qy = sz*e1[0][l] - sx*e1[2][l];
+      float qz = sx*e1[1][l] - sy*e1[0][l];
+      v[l] = (d[0]*qx + d[1]*qy + d[2]*qz) * inv_det;
+      float tl = (e2[0][l]*qx + e2[1][l]*qy + e2[2][l]*qz) * inv_det;
+      bool valid = det != 0.f && u[l] >= 0.f && v[l] >= 0.f &&
+                   u[l] + v[l] <= 1.f && tl > t_min && tl < t_max && l < lanes;
+      t[l] = valid ? tl : maxf();
+    }
+
+    // Closest hit among the lanes
+    for (int l = 0; l < lanes; l++) {
+      if (t[l] < t_max) {
+        t_max = t[l];
+        hit_triangle = first + l;
+        hit_u = u[l];
+        hit_v = v[l];
+        did_hit = true;
+      }
+    }
+  }
+  return did_hit;
+}
+
+// _____________________________________________________________________________
+void TriangleMesh::set_hit_record(int triangle, float b1, float b2, float t,
+                                  const Ray &r, HitRecord &rec) const {
+  float b0 = 1.f - b1 - b2;
+  rec.t = t;
+  rec.p = r.point_at_t(t);
+  rec.mat_ptr = _mat_ptr;
+
+  // Interpolate the vertex normals, or use the geometric normal
+  if (!_data.normal_indices.empty()) {
+    const uint32_t *ni = &_data.normal_indices[3*triangle];
+    rec.normal = make_unit_vector(b0*_data.normals[ni[0]]
+                                  + b1*_data.normals[ni[1]]
+                                  + b2*_data.normals[ni[2]]);
+  } else {
+    const uint32_t *vi = &_data.indices[3*triangle];
+    const Vec3 &p0 = _data.positions[vi[0]];
+    rec.normal = make_unit_vector(cross(_data.positions[vi[1]] - p0,
+                                        _data.positions[vi[2]] - p0));
+  }
+
+  // Interpolate the texture coordinates, or use the barycentrics
+  if (!_data.uv_indices.empty()) {
+    const uint32_t *ti = &_data.uv_indices[3*triangle];
+    const float *uvs = _data.uvs.data();
+    rec.u = b0*uvs[2*ti[0]] + b1*uvs[2*ti[1]] + b2*uvs[2*ti[2]];
+    rec.v = b0*uvs[2*ti[0] + 1] + b1*uvs[2*ti[1] + 1] + b2*uvs[2*ti[2] + 1];
+  } else {
+    rec.u = b1;
+    rec.v = b2;
+  }
+}
+
+// _____________________________________________________________________________
+bool TriangleMesh::hit(const Ray &r,
+                       float t_min,
+                       float t_max,
+                       HitRecord &rec) const {
+  if (_nodes.empty()) return false;
+
+  // The hit record is only filled in for the closest triangle
+  int hit_triangle = -1;
+  float hit_u = 0.f, hit_v = 0.f;
+  float closest_hit = t_max;
+  bool did_hit = traverse_bvh(_nodes.data(), r, t_min, closest_hit,
+      [&](int offset, int count, float &closest) {
+        return intersect_leaf(r, offset, count, t_min, closest,
+                              hit_triangle, hit_u, hit_v);
+      });
+  if (!did_hit) return false;
+  set_hit_record(hit_triangle, hit_u, hit_v, closest_hit, r, rec);
+  return true;
+}
+
+// _____________________________________________________________________________
+bool TriangleMesh::bounding_box(AABB &box) const {
+  if (_nodes.empty()) return false;
+  box = _nodes[0].box();
+  return true;
+}
+
+// _____________________________________________________________________________
+unsigned TriangleMesh::material_types() const {
+  return _mat_ptr != nullptr ? material_bit(_mat_ptr->type()) : 0u;
+}
+
+#endif  // SRC_TRIANGLEMESH_H_
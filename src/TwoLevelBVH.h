@@ -0,0 +1,205 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_TWOLEVELBVH_H_
+#define SRC_TWOLEVELBVH_H_
+
+#include <chrono>
+#include <vector>
+
+#include "BVHBuilder.h"
+#include "Hitable.h"
+#include "HitableList.h"
+#include "Instance.h"
+#include "LinearBVH.h"
+#include "Material.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "Transform.h"
+
+// Factor, by which the SAH cost of a subtree may grow through refitting,
+// before the subtree is rebuilt
+#define BVH_REBUILD_THRESHOLD 1.5f
+
+// What an update of a TwoLevelBVH had to do
+struct BVHUpdateStats {
+  int refit_objects{0};
+  int rebuilt_object_subtrees{0};
+  bool refit_top{false};
+  int rebuilt_top_subtrees{0};
+  double seconds{0.0};
+};
+
+/**
+ * Two-level acceleration structure for animated scenes: a top-level BVH over
+ * instances and one bottom-level BVH per object, shared by its instances.
+ * Moving an instance only changes its transform; moving the primitives of an
+ * object only requires to mark the object as changed. update() then refits
+ * the changed bottom-level BVHs and the top level in place and only rebuilds
+ * subtrees, whose SAH cost degraded past the threshold.
+ * The two-level BVH owns the objects and the instances.
+ */
+class TwoLevelBVH: public Hitable {
+ public:
+  TwoLevelBVH() = delete;
+  explicit TwoLevelBVH(ThreadPool *pool,
+                       float threshold = BVH_REBUILD_THRESHOLD);
+  TwoLevelBVH(const TwoLevelBVH &b) = delete;
+  TwoLevelBVH& operator=(const TwoLevelBVH &b) = delete;
+  ~TwoLevelBVH();
+
+  // Add a bottom-level BVH and return its id
+  int add_object(LinearBVH *object);
+  // Add an instance of the object with the provided id and return its id
+  int add_instance(int object, const Transform &t, Material *m = nullptr);
+  // Build the top level over all instances
+  void build();
+
+  inline int object_count() const {
+    return static_cast<int>(_objects.size());
+  }
+  inline int instance_count() const {
+    return static_cast<int>(_instances.size());
+  }
+  inline LinearBVH* object(int id) { return _objects[id]; }
+  inline Instance* instance(int id) { return _instances[id]; }
+
+  void set_transform(int instance, const Transform &t);
+  // The primitives of the object with the provided id have moved
+  void mark_changed(int object);
+  // Bring the BVHs up to date with all changes since the last update
+  BVHUpdateStats update();
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const;
+
+  virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const;
+
+ private:
+  ThreadPool *_pool;
+  float _threshold;
+  std::vector<LinearBVH*> _objects;
+  std::vector<bool> _changed_objects;
+  // Ids of the instances of every object
+  std::vector<std::vector<int>> _object_instances;
+  std::vector<Instance*> _instances;
+  // Owns the list of instances
+  LinearBVH *_top{nullptr};
+  bool _top_changed{false};
+};
+
+// _____________________________________________________________________________
+TwoLevelBVH::TwoLevelBVH(ThreadPool *pool, float threshold) {
+  _pool = pool;
+  _threshold = threshold;
+}
+
+// _____________________________________________________________________________
+TwoLevelBVH::~TwoLevelBVH() {
+  // Instances are deleted with the top level's list
+  if (_top != nullptr) {
+    delete _top;
+  } else {
+    for (Instance *i : _instances) delete i;
+  }
+  for (LinearBVH *o : _objects) delete o;
+}
+
+// _____________________________________________________________________________
+int TwoLevelBVH::add_object(LinearBVH *object) {
+  _objects.push_back(object);
+  _changed_objects.push_back(false);
+  _object_instances.emplace_back();
+  return static_cast<int>(_objects.size()) - 1;
+}
+
+// _____________________________________________________________________________
+int TwoLevelBVH::add_instance(int object, const Transform &t, Material *m) {
+  int id = static_cast<int>(_instances.size());
+  _instances.push_back(new Instance(_objects[object], t, m));
+  _object_instances[object].push_back(id);
+  return id;
+}
+
+// _____________________________________________________________________________
+void TwoLevelBVH::build() {
+  HitableList *list;
+  if (_top != nullptr) {
+    // Keep the instances, which are already in the list
+    list = _top->release();
+    delete _top;
+  } else {
+    list = new HitableList(static_cast<int>(_instances.size()));
+  }
+  for (int i = list->size(); i < static_cast<int>(_instances.size()); i++) {
+    list->append(_instances[i]);
+  }
+  _top = new LinearBVH(list, build_binned_sah(primitive_boxes(list), _pool));
+  _top_changed = false;
+}
+
+// _____________________________________________________________________________
+void TwoLevelBVH::set_transform(int instance, const Transform &t) {
+  _instances[instance]->to_world(t);
+  _top_changed = true;
+}
+
+// _____________________________________________________________________________
+void TwoLevelBVH::mark_changed(int object) {
+  _changed_objects[object] = true;
+}
+
+// _____________________________________________________________________________
+BVHUpdateStats TwoLevelBVH::update() {
+  TRACE_SCOPE("bvh_update");
+  auto start = std::chrono::steady_clock::now();
+  BVHUpdateStats stats;
+
+  // Bottom level: refit the changed objects and their instances' boxes
+  for (size_t o = 0; o < _objects.size(); o++) {
+    if (!_changed_objects[o]) continue;
+    stats.refit_objects++;
+    stats.rebuilt_object_subtrees += _objects[o]->refit(_threshold, _pool);
+    for (int i : _object_instances[o]) _instances[i]->refit();
+    _changed_objects[o] = false;
+    _top_changed = true;
+  }
+
+  // Top level
+  if (_top == nullptr) {
+    build();
+  } else if (_top_changed) {
+    stats.refit_top = true;
+    stats.rebuilt_top_subtrees = _top->refit(_threshold, _pool);
+    _top_changed = false;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  stats.seconds = std::chrono::duration<double>(end - start).count();
+  return stats;
+}
+
+// _____________________________________________________________________________
+bool TwoLevelBVH::hit(const Ray &r,
+                      float t_min,
+                      float t_max,
+                      HitRecord &rec) const {
+  return _top != nullptr && _top->hit(r, t_min, t_max, rec);
+}
+
+// _____________________________________________________________________________
+bool TwoLevelBVH::bounding_box(AABB &box) const {
+  return _top != nullptr && _top->bounding_box(box);
+}
+
+// _____________________________________________________________________________
+unsigned TwoLevelBVH::material_types() const {
+  unsigned types = 0u;
+  for (const Instance *i : _instances) types |= i->material_types();
+  return types;
+}
+
+#endif  // SRC_TWOLEVELBVH_H_
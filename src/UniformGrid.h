@@ -0,0 +1,296 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_UNIFORMGRID_H_
+#define SRC_UNIFORMGRID_H_
+
+#include <algorithm>  // nth_element, min, max
+#include <cmath>      // cbrt
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "AABB.h"
+#include "Hitable.h"
+#include "HitableList.h"
+#include "Ray.h"
+#include "Vec3.h"
+
+// Definitions
+// Cells per primitive, which the automatic resolution aims at
+#define GRID_DENSITY 4.f
+#define GRID_MAX_RESOLUTION 256
+// Primitives, whose box diagonal is larger than this factor times the
+// median diagonal, are kept out of the grid (e.g. a ground sphere)
+#define GRID_LARGE_FACTOR 16.f
+// Entries of the per-ray mailbox, a power of two
+#define GRID_MAILBOX_SIZE 16
+
+/**
+ * Uniform grid over the bounding boxes of the primitives of a list, as an
+ * alternative to a BVH for scenes with primitives of similar size, which
+ * are spread evenly (e.g. the lattice of the cover scene). It is built in
+ * two linear passes over the primitives, and traversed with a 3D-DDA, cell
+ * by cell along the ray, until a hit lies in the current cell.
+ * The resolution is chosen from the number of primitives and the shape of
+ * the bounds, so that there are about density cells per primitive, with
+ * cubic cells. Primitives much larger than the typical one would cover
+ * many cells and blow up the bounds, so they are tested separately with
+ * every ray.
+ * A primitive overlapping several cells is only tested once per ray: the
+ * traversal remembers the recently tested primitives in a small mailbox on
+ * the stack, which keeps the grid free of per-ray state, so it can be
+ * shared by the threads.
+ * The primitives have to be static. The grid takes the ownership of the
+ * list of primitives.
+ */
+class UniformGrid: public Hitable {
+ public:
+  UniformGrid() = delete;
+  explicit UniformGrid(HitableList *l, float density = GRID_DENSITY);
+  UniformGrid(const UniformGrid &g) = delete;
+  UniformGrid& operator=(const UniformGrid &g) = delete;
+  ~UniformGrid();
+
+  inline int resolution(int axis) const { return _resolution[axis]; }
+  inline int cell_count() const {
+    return _resolution[0] * _resolution[1] * _resolution[2];
+  }
+  // Number of primitive references in the cells
+  inline size_t reference_count() const { return _cell_items.size(); }
+  inline int large_count() const { return static_cast<int>(_large.size()); }
+  // Give up the ownership of the list of primitives and return it
+  inline HitableList* release() {
+    HitableList *l = _list;
+    _list = nullptr;
+    return l;
+  }
+
+  virtual bool hit(const Ray &r,
+                   float t_min,
+                   float t_max,
+                   HitRecord &rec) const;
+
+  virtual bool bounding_box(AABB &box) const;
+  virtual unsigned material_types() const { return _materials; }
+
+ private:
+  inline int cell_index(int x, int y, int z) const {
+    return x + _resolution[0] * (y + _resolution[1] * z);
+  }
+  // Cell of the coordinate p on the axis, clamped to the grid
+  inline int cell_of(float p, int axis) const;
+
+  HitableList *_list{nullptr};
+  // Primitives in the cells, referenced by their index
+  std::vector<Hitable*> _primitives;
+  // Primitives outside of the grid, tested with every ray
+  std::vector<Hitable*> _large;
+  AABB _bounds;
+  AABB _world_box;
+  int _resolution[3]{1, 1, 1};
+  Vec3 _cell_size;
+  Vec3 _inv_cell_size;
+  // The primitives of cell c are _cell_items[_cell_start[c]] up to
+  // _cell_items[_cell_start[c + 1]]
+  std::vector<uint32_t> _cell_start;
+  std::vector<uint32_t> _cell_items;
+  unsigned _materials{0u};
+};
+
+// _____________________________________________________________________________
+UniformGrid::UniformGrid(HitableList *l, float density) : _list(l) {
+  int n = l->size();
+  std::vector<AABB> boxes;
+  std::vector<Hitable*> primitives;
+  std::vector<float> diagonals;
+  for (int i = 0; i < n; i++) {
+    Hitable *h = (*l)[i];
+    _materials |= h->material_types();
+    AABB box;
+    if (!h->bounding_box(box)) {
+      // Unbounded; can't be put into cells
+      _large.push_back(h);
+      continue;
+    }
+    _world_box.extend(box);
+    primitives.push_back(h);
+    boxes.push_back(box);
+    diagonals.push_back((box.max() - box.min()).length());
+  }
+  if (primitives.empty()) return;
+
+  // Separate the primitives, which are much larger than the median one
+  std::vector<float> sorted = diagonals;
+  std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2,
+                   sorted.end());
+  float large = GRID_LARGE_FACTOR * sorted[sorted.size() / 2];
+  std::vector<AABB> cell_boxes;
+  for (size_t i = 0; i < primitives.size(); i++) {
+    if (diagonals[i] > large) {
+      _large.push_back(primitives[i]);
+      continue;
+    }
+    _primitives.push_back(primitives[i]);
+    cell_boxes.push_back(boxes[i]);
+    _bounds.extend(boxes[i]);
+  }
+
+  // Cubic cells, about density per primitive; flat bounds get a minimal
+  // thickness, so that the volume isn't 0
+  Vec3 extent = _bounds.max() - _bounds.min();
+  float thickness = 1e-3f * std::max(extent.x(),
+                                     std::max(extent.y(), extent.z()));
+  thickness = std::max(thickness, 1e-6f);
+  Vec3 pad(0.f, 0.f, 0.f);
+  for (int a = 0; a < 3; a++) pad[a] = extent[a] < thickness ? thickness : 0.f;
+  _bounds = AABB(_bounds.min() - 0.5f * pad, _bounds.max() + 0.5f * pad);
+  extent = _bounds.max() - _bounds.min();
+  float volume = extent.x() * extent.y() * extent.z();
+  float cells_per_length = static_cast<float>(
+      cbrt(density * _primitives.size() / volume));
+  for (int a = 0; a < 3; a++) {
+    int r = static_cast<int>(extent[a] * cells_per_length + 0.5f);
+    _resolution[a] = std::min(std::max(r, 1), GRID_MAX_RESOLUTION);
+    _cell_size[a] = extent[a] / _resolution[a];
+    _inv_cell_size[a] = 1.f / _cell_size[a];
+  }
+
+  // Count the references of every cell, then place them (counting sort)
+  auto cell_range = [this](const AABB &box, int lo[3], int hi[3]) {
+    for (int a = 0; a < 3; a++) {
+      lo[a] = cell_of(box.min()[a], a);
+      hi[a] = cell_of(box.max()[a], a);
+    }
+  };
+  _cell_start.assign(cell_count() + 1, 0u);
+  int lo[3], hi[3];
+  for (const AABB &box : cell_boxes) {
+    cell_range(box, lo, hi);
+    for (int z = lo[2]; z <= hi[2]; z++) {
+      for (int y = lo[1]; y <= hi[1]; y++) {
+        for (int x = lo[0]; x <= hi[0]; x++) _cell_start[cell_index(x, y, z)]++;
+      }
+    }
+  }
+  uint32_t sum = 0;
+  for (size_t c = 0; c < _cell_start.size(); c++) {
+    uint32_t count = _cell_start[c];
+    _cell_start[c] = sum;
+    sum += count;
+  }
+  _cell_items.resize(sum);
+  std::vector<uint32_t> fill(_cell_start.begin(), _cell_start.end() - 1);
+  for (size_t i = 0; i < cell_boxes.size(); i++) {
+    cell_range(cell_boxes[i], lo, hi);
+    for (int z = lo[2]; z <= hi[2]; z++) {
+      for (int y = lo[1]; y <= hi[1]; y++) {
+        for (int x = lo[0]; x <= hi[0]; x++) {
+          _cell_items[fill[cell_index(x, y, z)]++] = static_cast<uint32_t>(i);
+        }
+      }
+    }
+  }
+}
+
+// _____________________________________________________________________________
+UniformGrid::~UniformGrid() {
+  delete _list;
+}
+
+// _____________________________________________________________________________
+int UniformGrid::cell_of(float p, int axis) const {
+  int c = static_cast<int>((p - _bounds.min()[axis]) * _inv_cell_size[axis]);
+  return std::min(std::max(c, 0), _resolution[axis] - 1);
+}
+
+// _____________________________________________________________________________
+bool UniformGrid::bounding_box(AABB &box) const {
+  box = _world_box;
+  return !_world_box.is_empty();
+}
+
+// _____________________________________________________________________________
+bool UniformGrid::hit(const Ray &r,
+                      float t_min,
+                      float t_max,
+                      HitRecord &rec) const {
+  HitRecord temp_rec;
+  bool did_hit = false;
+  float closest = t_max;
+  // A hit on a large primitive shortens the walk through the grid
+  for (Hitable *h : _large) {
+    if (h->hit(r, t_min, closest, temp_rec)) {
+      did_hit = true;
+      closest = temp_rec.t;
+      rec = temp_rec;
+    }
+  }
+  if (_cell_items.empty()) return did_hit;
+
+  float t_enter = t_min;
+  float t_exit = closest;
+  if (!_bounds.hit(r, t_enter, t_exit)) return did_hit;
+
+  // Set up the DDA in the cell, where the ray enters the grid
+  Vec3 o = r.origin();
+  Vec3 d = r.direction();
+  Vec3 entry = r.point_at_t(t_enter);
+  int cell[3];
+  int step[3];
+  int out[3];
+  float t_next[3];
+  float t_delta[3];
+  const float infinity = std::numeric_limits<float>::infinity();
+  for (int a = 0; a < 3; a++) {
+    cell[a] = cell_of(entry[a], a);
+    if (d[a] > 0.f) {
+      step[a] = 1;
+      out[a] = _resolution[a];
+      t_next[a] = (_bounds.min()[a] + (cell[a] + 1) * _cell_size[a] - o[a])
+                  / d[a];
+      t_delta[a] = _cell_size[a] / d[a];
+    } else if (d[a] < 0.f) {
+      step[a] = -1;
+      out[a] = -1;
+      t_next[a] = (_bounds.min()[a] + cell[a] * _cell_size[a] - o[a]) / d[a];
+      t_delta[a] = -_cell_size[a] / d[a];
+    } else {
+      step[a] = 0;
+      out[a] = -1;
+      t_next[a] = infinity;
+      t_delta[a] = infinity;
+    }
+  }
+
+  // Recently tested primitives; a collision only costs a repeated test
+  int32_t mailbox[GRID_MAILBOX_SIZE];
+  for (int k = 0; k < GRID_MAILBOX_SIZE; k++) mailbox[k] = -1;
+
+  while (true) {
+    int c = cell_index(cell[0], cell[1], cell[2]);
+    for (uint32_t k = _cell_start[c]; k < _cell_start[c + 1]; k++) {
+      int32_t id = static_cast<int32_t>(_cell_items[k]);
+      int32_t &slot = mailbox[id & (GRID_MAILBOX_SIZE - 1)];
+      if (slot == id) continue;
+      slot = id;
+      if (_primitives[id]->hit(r, t_min, closest, temp_rec)) {
+        did_hit = true;
+        closest = temp_rec.t;
+        rec = temp_rec;
+      }
+    }
+
+    // Step into the neighbor across the nearest cell boundary
+    int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2)
+                                     : (t_next[1] < t_next[2] ? 1 : 2);
+    // Hits behind the boundary may still be beaten in the next cells
+    if (closest <= t_next[axis] || t_next[axis] > t_exit) break;
+    cell[axis] += step[axis];
+    if (cell[axis] == out[axis]) break;
+    t_next[axis] += t_delta[axis];
+  }
+  return did_hit;
+}
+
+#endif  // SRC_UNIFORMGRID_H_
@@ -4,9 +4,12 @@
 #ifndef SRC_UTILS_H_
 #define SRC_UTILS_H_
 
-#include <stdlib.h>  // drand48
-#include <cmath>  // sqrt, pow
+#include <stdlib.h>  // erand48
+#include <cmath>  // sqrt
+#include <cstdint>
+#include <string>
 
+#include "FastMath.h"
 #include "Vec3.h"
 
 // -----------------------------------------------------------------------------
@@ -33,9 +36,17 @@ void random_in_unit_disc(float &x, float &y);
 
 /**
  * Generate a random number in the range [min, max)
+ * Every thread has its own generator, so threads don't share state.
  */
 float get_random_in_range(float min, float max);
 
+/**
+ * Seed the random number generator of the calling thread. The renderer
+ * seeds it per pixel, so an image doesn't depend on the thread, which
+ * rendered a pixel.
+ */
+void seed_random(uint64_t seed);
+
 /**
  * Reflect an incoming ray i, which is not normalized. n is the normal at
  * the hitpoint.
@@ -65,6 +76,13 @@ bool refract(const Vec3 &i, const Vec3 &n, float n_it, Vec3 &t);
  */
 float schlick(const Vec3 &i, const Vec3 &n, float n1, float n2, bool in);
 
+/**
+ * Directory part of the file path, "." for a file in the working
+ * directory. Temporary files of an output go there, since $TMPDIR or /tmp
+ * is often a small in-memory file system.
+ */
+std::string parent_directory(const std::string &path);
+
 // -----------------------------------------------------------------------------
 // Function declaration
 // -----------------------------------------------------------------------------
@@ -87,10 +105,31 @@ void random_in_unit_disc(float &x, float &y) {
   } while (x*x + y*y >= 1.f);
 }
 
+// _____________________________________________________________________________
+// 48-bit state of the calling thread's generator. It starts like the one of
+// drand48, so unseeded single-threaded code gets the same sequence
+inline unsigned short* random_state() {
+  thread_local unsigned short state[3] = {0, 0, 0};
+  return state;
+}
+
 // _____________________________________________________________________________
 float get_random_in_range(float min, float max) {
   float diff = max - min;
-  return static_cast<float>(drand48()*diff + min);
+  return static_cast<float>(erand48(random_state())*diff + min);
+}
+
+// _____________________________________________________________________________
+void seed_random(uint64_t seed) {
+  // splitmix64, so that consecutive seeds give unrelated sequences
+  uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  z = z ^ (z >> 31);
+  unsigned short *state = random_state();
+  state[0] = static_cast<unsigned short>(z);
+  state[1] = static_cast<unsigned short>(z >> 16);
+  state[2] = static_cast<unsigned short>(z >> 32);
 }
 
 // _____________________________________________________________________________
@@ -124,7 +163,15 @@ float schlick(const Vec3 &i, const Vec3 &n, float ri, bool in) {
   }
 
   // Compute reflection coefficient
-  return r0 + (1.f - r0)*pow((1.f - cosine), 5);
+  return r0 + (1.f - r0)*math_pow5(1.f - cosine);
+}
+
+// _____________________________________________________________________________
+std::string parent_directory(const std::string &path) {
+  size_t slash = path.rfind('/');
+  if (slash == std::string::npos) return ".";
+  if (slash == 0) return "/";
+  return path.substr(0, slash);
 }
 
 #endif  // SRC_UTILS_H_
@@ -5,13 +5,16 @@
 #define SRC_VEC3_H_
 
 #include <math.h>
+#include <iostream>
 
-// Vector3 class is used to represent colors, locations, directions, etc
+#include "FastMath.h"
+
+// Vector3 class is used to represent colors, locations, directions, etc.
+// It is trivially copyable; Vec3A (Vec3A.h) is its SIMD counterpart
 class Vec3 {
  public:
   Vec3() = default;
   Vec3(float e0, float e1, float e2) { _e[0] = e0; _e[1] = e1; _e[2] = e2; }
-  Vec3(const Vec3 &v2) { _e[0] = v2.x(); _e[1] = v2.y(); _e[2] = v2.z(); }
 
   // Location / Direction
   inline float x() const { return _e[0]; }
@@ -24,7 +27,7 @@ class Vec3 {
   inline float b() const { return _e[2]; }
 
   inline const Vec3& operator+() const { return *this; }
-  inline Vec3 operator-() const { return Vec3(-_e[0], -_e[2], -_e[2]); }
+  inline Vec3 operator-() const { return Vec3(-_e[0], -_e[1], -_e[2]); }
   inline float operator[](int i) const { return _e[i]; }
   inline float& operator[](int i) { return _e[i]; }
 
@@ -106,7 +109,7 @@ float Vec3::squared_length() const {
 
 // _____________________________________________________________________________
 void Vec3::make_unit_vector() {
-  float il = 1.f / sqrt(_e[0]*_e[0] + _e[1]*_e[1] + _e[2]*_e[2]);
+  float il = math_rsqrt(_e[0]*_e[0] + _e[1]*_e[1] + _e[2]*_e[2]);
   _e[0] *= il;
   _e[1] *= il;
   _e[2] *= il;
@@ -171,7 +174,11 @@ inline Vec3 cross(const Vec3 &v1, const Vec3 &v2) {
 
 // _____________________________________________________________________________
 inline Vec3 make_unit_vector(const Vec3 v) {
+#ifdef FAST_MATH
+  return v * fast_rsqrt(v.squared_length());
+#else
   return v / v.length();
+#endif
 }
 
 
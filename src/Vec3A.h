@@ -0,0 +1,170 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_VEC3A_H_
+#define SRC_VEC3A_H_
+
+#include <iostream>
+
+#include "Simd.h"
+#include "Vec3.h"
+
+/**
+ * 16-byte aligned vector of three floats in a SIMD register (see Simd.h),
+ * for the hot paths, which do a lot of vector math. It offers the same
+ * operations as Vec3 and converts from and to it, so code can adopt it one
+ * function at a time. The fourth lane is padding; the operations ignore
+ * its value.
+ */
+class alignas(16) Vec3A {
+ public:
+  Vec3A() : _v(float4(0.f)) {}
+  Vec3A(float e0, float e1, float e2) : _v(float4(e0, e1, e2, 0.f)) {}
+  explicit Vec3A(const Vec3 &v) : _v(float4(v.x(), v.y(), v.z(), 0.f)) {}
+  explicit Vec3A(Float4 v) : _v(v) {}
+
+  inline float x() const { return float4_x(_v); }
+  inline float y() const { return float4_y(_v); }
+  inline float z() const { return float4_z(_v); }
+  inline Float4 simd() const { return _v; }
+  inline Vec3 vec3() const { return Vec3(x(), y(), z()); }
+
+  inline Vec3A operator-() const {
+    return Vec3A(float4_sub(float4(0.f), _v));
+  }
+  inline float operator[](int i) const {
+    alignas(16) float e[4];
+    float4_store(e, _v);
+    return e[i];
+  }
+
+  inline Vec3A& operator+=(const Vec3A &v2) {
+    _v = float4_add(_v, v2._v);
+    return *this;
+  }
+  inline Vec3A& operator-=(const Vec3A &v2) {
+    _v = float4_sub(_v, v2._v);
+    return *this;
+  }
+  inline Vec3A& operator*=(const Vec3A &v2) {
+    _v = float4_mul(_v, v2._v);
+    return *this;
+  }
+  inline Vec3A& operator*=(float t) {
+    _v = float4_mul(_v, float4(t));
+    return *this;
+  }
+  inline Vec3A& operator/=(float t) {
+    _v = float4_mul(_v, float4(1.f / t));
+    return *this;
+  }
+
+  inline float length() const;
+  inline float squared_length() const;
+  inline void make_unit_vector();
+
+ private:
+  Float4 _v;
+};
+
+// _____________________________________________________________________________
+// Non-member functions
+// _____________________________________________________________________________
+
+// _____________________________________________________________________________
+inline Vec3A operator+(const Vec3A &v1, const Vec3A &v2) {
+  return Vec3A(float4_add(v1.simd(), v2.simd()));
+}
+
+// _____________________________________________________________________________
+inline Vec3A operator-(const Vec3A &v1, const Vec3A &v2) {
+  return Vec3A(float4_sub(v1.simd(), v2.simd()));
+}
+
+// _____________________________________________________________________________
+inline Vec3A operator*(const Vec3A &v1, const Vec3A &v2) {
+  return Vec3A(float4_mul(v1.simd(), v2.simd()));
+}
+
+// _____________________________________________________________________________
+inline Vec3A operator/(const Vec3A &v1, const Vec3A &v2) {
+  return Vec3A(float4_div(v1.simd(), v2.simd()));
+}
+
+// _____________________________________________________________________________
+inline Vec3A operator*(const Vec3A &v, float t) {
+  return Vec3A(float4_mul(v.simd(), float4(t)));
+}
+
+// _____________________________________________________________________________
+inline Vec3A operator*(float t, const Vec3A &v) {
+  return Vec3A(float4_mul(v.simd(), float4(t)));
+}
+
+// _____________________________________________________________________________
+inline Vec3A operator/(const Vec3A &v, float t) {
+  return Vec3A(float4_div(v.simd(), float4(t)));
+}
+
+// _____________________________________________________________________________
+inline std::ostream& operator<<(std::ostream &os, const Vec3A &v) {
+  os << "[" << v.x() << ", " << v.y() << ", " << v.z() << "]";
+  return os;
+}
+
+// _____________________________________________________________________________
+// a * b + c, fused, where the instruction set has it
+inline Vec3A fmadd(const Vec3A &a, const Vec3A &b, const Vec3A &c) {
+  return Vec3A(float4_fmadd(a.simd(), b.simd(), c.simd()));
+}
+
+// _____________________________________________________________________________
+inline Vec3A min(const Vec3A &v1, const Vec3A &v2) {
+  return Vec3A(float4_min(v1.simd(), v2.simd()));
+}
+
+// _____________________________________________________________________________
+inline Vec3A max(const Vec3A &v1, const Vec3A &v2) {
+  return Vec3A(float4_max(v1.simd(), v2.simd()));
+}
+
+// _____________________________________________________________________________
+inline float dot(const Vec3A &v1, const Vec3A &v2) {
+  Float4 m = float4_mul(v1.simd(), v2.simd());
+  // x + y + z in the first lane, without leaving the register; the padding
+  // is left out
+  Float4 yzx = float4_yzxw(m);
+  return float4_x(float4_add(float4_add(m, yzx), float4_yzxw(yzx)));
+}
+
+// _____________________________________________________________________________
+inline Vec3A cross(const Vec3A &v1, const Vec3A &v2) {
+  // (v1 * v2.yzx - v1.yzx * v2).yzx
+  Float4 a = v1.simd();
+  Float4 b = v2.simd();
+  Float4 c = float4_sub(float4_mul(a, float4_yzxw(b)),
+                        float4_mul(float4_yzxw(a), b));
+  return Vec3A(float4_yzxw(c));
+}
+
+// _____________________________________________________________________________
+float Vec3A::length() const {
+  return sqrtf(dot(*this, *this));
+}
+
+// _____________________________________________________________________________
+float Vec3A::squared_length() const {
+  return dot(*this, *this);
+}
+
+// _____________________________________________________________________________
+void Vec3A::make_unit_vector() {
+  _v = float4_mul(_v, float4(1.f / length()));
+}
+
+// _____________________________________________________________________________
+inline Vec3A make_unit_vector(const Vec3A &v) {
+  return v * (1.f / v.length());
+}
+
+#endif  // SRC_VEC3A_H_
@@ -0,0 +1,109 @@
+// Copyright (c) 2019, University of Freiburg.
+// Author: Haralambi Todorov <harrytodorov@gmail.com>
+
+#ifndef SRC_VEC3X8_H_
+#define SRC_VEC3X8_H_
+
+#include "Simd.h"
+#include "Vec3.h"
+
+/**
+ * Eight vectors in structure-of-arrays layout: one Float8 per component,
+ * so that batch kernels (e.g. packets of rays) process a vector operation
+ * for all eight lanes with a few instructions.
+ */
+struct Vec3x8 {
+  Vec3x8() : x(float8(0.f)), y(float8(0.f)), z(float8(0.f)) {}
+  Vec3x8(Float8 x8, Float8 y8, Float8 z8) : x(x8), y(y8), z(z8) {}
+  // The vector in all lanes
+  explicit Vec3x8(const Vec3 &v)
+      : x(float8(v.x())), y(float8(v.y())), z(float8(v.z())) {}
+
+  // Transpose eight vectors into the lanes
+  static Vec3x8 load(const Vec3 *v);
+  // Transpose the lanes back into eight vectors
+  void store(Vec3 *v) const;
+
+  Float8 x;
+  Float8 y;
+  Float8 z;
+};
+
+// _____________________________________________________________________________
+Vec3x8 Vec3x8::load(const Vec3 *v) {
+  alignas(32) float e[3][8];
+  for (int i = 0; i < 8; i++) {
+    e[0][i] = v[i].x();
+    e[1][i] = v[i].y();
+    e[2][i] = v[i].z();
+  }
+  return Vec3x8(float8_load(e[0]), float8_load(e[1]), float8_load(e[2]));
+}
+
+// _____________________________________________________________________________
+void Vec3x8::store(Vec3 *v) const {
+  alignas(32) float e[3][8];
+  float8_store(e[0], x);
+  float8_store(e[1], y);
+  float8_store(e[2], z);
+  for (int i = 0; i < 8; i++) v[i] = Vec3(e[0][i], e[1][i], e[2][i]);
+}
+
+// _____________________________________________________________________________
+// Non-member functions
+// _____________________________________________________________________________
+
+// _____________________________________________________________________________
+inline Vec3x8 operator+(const Vec3x8 &v1, const Vec3x8 &v2) {
+  return Vec3x8(float8_add(v1.x, v2.x), float8_add(v1.y, v2.y),
+                float8_add(v1.z, v2.z));
+}
+
+// _____________________________________________________________________________
+inline Vec3x8 operator-(const Vec3x8 &v1, const Vec3x8 &v2) {
+  return Vec3x8(float8_sub(v1.x, v2.x), float8_sub(v1.y, v2.y),
+                float8_sub(v1.z, v2.z));
+}
+
+// _____________________________________________________________________________
+inline Vec3x8 operator*(const Vec3x8 &v1, const Vec3x8 &v2) {
+  return Vec3x8(float8_mul(v1.x, v2.x), float8_mul(v1.y, v2.y),
+                float8_mul(v1.z, v2.z));
+}
+
+// _____________________________________________________________________________
+inline Vec3x8 operator*(const Vec3x8 &v, Float8 t) {
+  return Vec3x8(float8_mul(v.x, t), float8_mul(v.y, t), float8_mul(v.z, t));
+}
+
+// _____________________________________________________________________________
+// a * b + c per lane, fused, where the instruction set has it
+inline Vec3x8 fmadd(const Vec3x8 &a, Float8 b, const Vec3x8 &c) {
+  return Vec3x8(float8_fmadd(a.x, b, c.x), float8_fmadd(a.y, b, c.y),
+                float8_fmadd(a.z, b, c.z));
+}
+
+// _____________________________________________________________________________
+inline Float8 dot(const Vec3x8 &v1, const Vec3x8 &v2) {
+  return float8_fmadd(v1.x, v2.x,
+                      float8_fmadd(v1.y, v2.y, float8_mul(v1.z, v2.z)));
+}
+
+// _____________________________________________________________________________
+inline Vec3x8 cross(const Vec3x8 &v1, const Vec3x8 &v2) {
+  return Vec3x8(float8_sub(float8_mul(v1.y, v2.z), float8_mul(v1.z, v2.y)),
+                float8_sub(float8_mul(v1.z, v2.x), float8_mul(v1.x, v2.z)),
+                float8_sub(float8_mul(v1.x, v2.y), float8_mul(v1.y, v2.x)));
+}
+
+// _____________________________________________________________________________
+inline Float8 length(const Vec3x8 &v) {
+  return float8_sqrt(dot(v, v));
+}
+
+// _____________________________________________________________________________
+inline Vec3x8 make_unit_vector(const Vec3x8 &v) {
+  return v * float8_div(float8(1.f), length(v));
+}
+
+#endif  // SRC_VEC3X8_H_